@@ -9,6 +9,7 @@ static const uint PIN_DATA  = 22;
 // --- Internal State ---
 static volatile uint8_t current_button_states = 0;
 static uint8_t last_button_states = 0; // Used for edge detection
+static volatile uint32_t button_events = 0; // scans that saw a change, for idle waits
 
 // --- Timer Interrupt Callback ---
 static bool reading_timer_callback(struct repeating_timer *t) {
@@ -33,6 +34,10 @@ static bool reading_timer_callback(struct repeating_timer *t) {
         gpio_put(PIN_CLOCK, 0);
     }
 
+    if (reading != current_button_states) {
+        button_events++;
+        __sev(); // wake a core sleeping in idle_wait_input()
+    }
     current_button_states = reading;
     return true;
 }
@@ -52,6 +57,10 @@ void buttons_init(int32_t scan_time) {
     add_repeating_timer_ms(scan_time, reading_timer_callback, NULL, &timer);
 }
 
+uint32_t buttons_get_events(void) {
+    return button_events;
+}
+
 uint8_t buttons_get_raw_state(void) {
     return current_button_states;
 }
@@ -28,6 +28,12 @@ void buttons_init(int32_t scan_time);
  */
 uint8_t buttons_get_raw_state(void);
 
+/**
+ * Counts scans that saw any button change. Each change also raises an
+ * event (SEV) so a core waiting on WFE wakes up.
+ */
+uint32_t buttons_get_events(void);
+
 /**
  * Returns ONLY the buttons that were pressed since the last call.
  * Useful for triggering single events (like toggling a menu).
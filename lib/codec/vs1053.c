@@ -1,5 +1,11 @@
 #include "vs1053.h"
+#include "vs1053_feed.h"
+#include "vs1053_transport.h"
+#include "vs1053_stats.h"
+#include "vs1053_plugin.h"
+#include "lib/spi_bus/spi_bus.h"
 #include <stdio.h>
+#include <string.h>
 
 #define VS_WRITE 0x02
 #define VS_READ  0x03
@@ -8,41 +14,91 @@
 #define SCI_CLOCKF  0x03
 #define SCI_VOL     0x0B
 #define SCI_AUDATA  0x05
+#define SCI_HDAT1   0x09
 
 #define SCI_WRAM      0x06
 #define SCI_WRAMADDR  0x07
 
+#define SM_RESET    0x0004
+#define SM_CANCEL   0x0008
+#define SM_SDINEW   0x0800
+
 #define VS1053_PARA_PLAYSPEED 0x1E04
+#define VS1053_PARA_ENDFILLBYTE 0x1E06
+
+#define VS1053_CANCEL_LIMIT 2048 // datasheet: reset if SM_CANCEL is still set after this many bytes
+#define VS1053_END_FILL_LEN 2052 // end fill bytes that flush the last frame out of the decoder
+
+#define TAPE_STOP_US 1500000
 
 static inline void cs_low(uint pin)  { gpio_put(pin, 0); }
 static inline void cs_high(uint pin) { gpio_put(pin, 1); }
 
 static void wait_dreq(vs1053_t *v) {
+    if (gpio_get(v->dreq))
+        return;
+    uint32_t t0 = time_us_32();
     while (!gpio_get(v->dreq)) tight_loop_contents();
+    vs1053_stats_dreq_wait(time_us_32() - t0);
 }
 
 void sci_write(vs1053_t *v, uint8_t addr, uint16_t data) {
+    spi_bus_acquire(SPI_BUS_SCI); // SDI feeder must not touch the bus mid-transaction
     wait_dreq(v);
 
     uint8_t buf[4] = {VS_WRITE, addr, data >> 8, data & 0xFF};
     cs_low(v->cs);
     spi_write_blocking(v->spi, buf, 4);
     cs_high(v->cs);
+    vs1053_stats.sci_writes++; // while we hold the bus, the feeder IRQ counts posted writes only with it
+    spi_bus_release();
 }
 
-uint16_t sci_read(vs1053_t *v, uint8_t addr) {
+// SCI multiple write: n words into one register under a single xCS assertion.
+// DREQ dips briefly after every word and has to be back up before the next.
+// copy walks data, otherwise data[0] is repeated (RLE runs of a plugin).
+void sci_write_multi(vs1053_t *v, uint8_t addr, const uint16_t *data, size_t n, bool copy) {
+    uint8_t hdr[2] = {VS_WRITE, addr};
+
+    spi_bus_acquire(SPI_BUS_SCI);
     wait_dreq(v);
+    cs_low(v->cs);
+    spi_write_blocking(v->spi, hdr, 2);
+    for (size_t i = 0; i < n; i++) {
+        uint16_t w = copy ? data[i] : data[0];
+        uint8_t buf[2] = {w >> 8, w & 0xFF};
+        if (i > 0) {
+            busy_wait_us_32(1); // let DREQ drop before we look at it
+            wait_dreq(v);
+        }
+        spi_write_blocking(v->spi, buf, 2);
+    }
+    cs_high(v->cs);
+    vs1053_stats.sci_writes += n;
+    spi_bus_release();
+}
 
+uint16_t sci_read(vs1053_t *v, uint8_t addr) {
     uint8_t tx[4] = {VS_READ, addr, 0xFF, 0xFF};
     uint8_t rx[4];
 
+    spi_bus_acquire(SPI_BUS_SCI);
+    wait_dreq(v);
     cs_low(v->cs);
     spi_write_read_blocking(v->spi, tx, rx, 4);
     cs_high(v->cs);
+    spi_bus_release();
 
     return (rx[2] << 8) | rx[3];
 }
 
+// Raises the SCI/SDI clocks to what the boosted CLKI allows
+static void vs1053_spi_fast(vs1053_t *v) {
+    uint sci = spi_bus_set_baudrate(SPI_BUS_SCI, SPI_BUS_SCI_FAST_HZ);
+    uint sdi = spi_bus_set_baudrate(SPI_BUS_SDI, SPI_BUS_SDI_FAST_HZ);
+    printf("VS1053 SPI: SCI %u Hz, SDI %u Hz\r\n", sci, sdi);
+}
+
 bool vs1053_ready(vs1053_t *v) {
     return gpio_get(v->dreq);
 }
@@ -54,8 +110,7 @@ void vs1053_init(vs1053_t *v) {
     gpio_init(v->rst);  gpio_set_dir(v->rst, GPIO_OUT); gpio_put(v->rst, 1);
     gpio_init(v->dreq); gpio_set_dir(v->dreq, GPIO_IN);
     printf("test point 3");
-    spi_init(v->spi, 1 * 1000 * 1000);
-    spi_set_format(v->spi, 8, SPI_CPOL_0, SPI_CPHA_0, SPI_MSB_FIRST);
+    spi_bus_init(v->spi); // SPI1 is shared with the SD card from here on
     
 
     printf("test point 4");
@@ -64,6 +119,7 @@ void vs1053_init(vs1053_t *v) {
     // Boost clock (datasheet recommended)
     sci_write(v, SCI_CLOCKF, 0xB000);
     sleep_ms(10);
+    vs1053_spi_fast(v);
 }
 
 void vs1053_soft_reset(vs1053_t *v) {
@@ -89,7 +145,16 @@ void vs1053_set_dac_gain(vs1053_t *v, uint8_t gain) {
 void vs1053_play_data(vs1053_t *v, const uint8_t *data, size_t len) {
     size_t i = 0;
 
+    // once the SDI feeder runs, everything has to go through its ring to keep ordering
+    if (vs1053_feed_active()) {
+        while (i < len) {
+            i += vs1053_feed_submit(data + i, len - i);
+        }
+        return;
+    }
+
     while (i < len) {
+        spi_bus_acquire(SPI_BUS_SDI);
         wait_dreq(v);
 
         size_t chunk = (len - i > 32) ? 32 : len - i;
@@ -97,13 +162,77 @@ void vs1053_play_data(vs1053_t *v, const uint8_t *data, size_t len) {
         cs_low(v->dcs);
         spi_write_blocking(v->spi, data + i, chunk);
         cs_high(v->dcs);
+        spi_bus_release();
 
+        vs1053_stats.bytes_fed += chunk;
         i += chunk;
     }
 }
 
-void vs1053_stop(vs1053_t *v) {
-    sci_write(v, SCI_MODE, 0x0808); // SM_CANCEL | SM_SDINEW
+// Byte the decoder wants as padding after the end of a stream (extra parameter endFillByte)
+uint8_t vs1053_end_fill_byte(vs1053_t *v) {
+    sci_write(v, SCI_WRAMADDR, VS1053_PARA_ENDFILLBYTE);
+    return sci_read(v, SCI_WRAM) & 0xFF;
+}
+
+// Sends len end fill bytes over SDI, through the feeder once it runs
+static void send_fill(vs1053_t *v, uint8_t fill, size_t len) {
+    uint8_t buf[32];
+    memset(buf, fill, sizeof(buf));
+    while (len > 0) {
+        size_t n = len > sizeof(buf) ? sizeof(buf) : len;
+        vs1053_play_data(v, buf, n);
+        len -= n;
+    }
+}
+
+// Normal end of a file: pushes the last frame through the decoder
+void vs1053_end_fill(vs1053_t *v) {
+    send_fill(v, vs1053_end_fill_byte(v), VS1053_END_FILL_LEN);
+    vs1053_feed_drain();
+}
+
+// Soft reset (SM_RESET) for when a cancel doesn't go through. Puts back what
+// sb_hw_init set up: clock, volume, I2S output and plugins.
+static void vs1053_mode_reset(vs1053_t *v) {
+    uint16_t vol = sci_read(v, SCI_VOL);
+    sci_write(v, SCI_MODE, SM_SDINEW | SM_RESET);
+    spi_bus_set_baudrate(SPI_BUS_SCI, SPI_BUS_VS1053_SLOW_HZ); // CLKI is back to XTALI
+    spi_bus_set_baudrate(SPI_BUS_SDI, SPI_BUS_VS1053_SLOW_HZ);
+    sleep_us(2); // datasheet: DREQ drops within 2 us of the reset
+    sci_write(v, SCI_CLOCKF, 0xB000); // sci_write waits for DREQ to come back
+    vs1053_spi_fast(v);
+    sci_write(v, SCI_VOL, vol);
+    vs1053_plugins_reload(v); // SM_RESET threw them away, I2S output included
+}
+
+// Datasheet cancel sequence: set SM_CANCEL, keep the decoder fed with
+// endFillByte and poll SCI_MODE every 32 bytes until it clears. Falls back
+// to a soft reset if it's still set after 2048 bytes. Whatever the caller
+// still had queued should be flushed first, it would only be thrown away.
+// Returns false when the reset was needed.
+bool vs1053_stop(vs1053_t *v) {
+    vs1053_feed_set_paused(false);
+    vs1053_set_play_speed(v, 1); // a hard-paused decoder never takes the fill bytes
+
+    uint8_t fill = vs1053_end_fill_byte(v);
+    sci_write(v, SCI_MODE, SM_SDINEW | SM_CANCEL);
+
+    for (int sent = 0; sent < VS1053_CANCEL_LIMIT; sent += 32) {
+        send_fill(v, fill, 32);
+        vs1053_feed_drain();
+        if (!(sci_read(v, SCI_MODE) & SM_CANCEL))
+            return true;
+    }
+
+    printf("VS1053 cancel timed out, resetting\r\n");
+    vs1053_mode_reset(v);
+    return false;
+}
+
+// True once the decoder has locked onto a stream (HDAT1 holds the frame sync)
+bool vs1053_decoding(vs1053_t *v) {
+    return sci_read(v, SCI_HDAT1) != 0;
 }
 
 void vs1053_set_play_speed(vs1053_t *player, uint16_t playspeed) {
@@ -122,73 +251,38 @@ uint16_t vs1053_get_play_speed(vs1053_t *player) {
     return ((uint16_t)resp[0] << 8) | resp[1];
 }
 
+// I2S output as a plugin image, so sb_hw_init() registers it with the rest
+// and the reset fallback reloads it with them: GPIO4-7 as outputs
+// (GPIO_DDR), then I2S + MCLK on (I2S_CONFIG bits 2 and 3)
+const uint16_t vs1053_i2s_patch[VS1053_I2S_PATCH_SIZE] = {
+    SCI_WRAMADDR, 1, 0xC017, SCI_WRAM, 1, 0x00F0,
+    SCI_WRAMADDR, 1, 0xC040, SCI_WRAM, 1, 0x000C,
+};
+
 void vs1053_enable_i2s(vs1053_t *v) {
-    // Set GPIO4–GPIO7 as outputs
-    sci_write(v, SCI_WRAMADDR, 0xC017);  // GPIO_DDR
-    sci_write(v, SCI_WRAM,     0x00F0);  // bits 4–7 = outputs
-    
-    // Select I2S_CONFIG address
-    sci_write(v, SCI_WRAMADDR, 0xC040);
-
-    // Enable I2S + MCLK (bits 6 and 7)
-    sci_write(v, SCI_WRAM, 0x000C);
-}
-
-void vs1053_load_patch(vs1053_t *v, const unsigned short* plugin, unsigned short plugin_size) {
-    int i = 0;
-    while (i<plugin_size) {
-        unsigned short addr, n, val;
-        addr = plugin[i++];
-        n = plugin[i++];
-        if (n & 0x8000U) { /* RLE run, replicate n samples */
-            n &= 0x7FFF;
-            val = plugin[i++];
-            while (n--) {
-                sci_write(v, addr, val);
-            }
-        } else {           /* Copy run, copy n samples */
-            while (n--) {
-                val = plugin[i++];
-                sci_write(v, addr, val);
-            }
-        }
-    }
+    vs1053_load_patch(v, vs1053_i2s_patch, VS1053_I2S_PATCH_SIZE);
 }
 
+// Lets go of the DAC's serial port so the RP2350 can drive it: I2S off,
+// GPIO4-7 back to inputs
+void vs1053_disable_i2s(vs1053_t *v) {
+    sci_write(v, SCI_WRAMADDR, 0xC040); // I2S_CONFIG
+    sci_write(v, SCI_WRAM,     0x0000);
+    sci_write(v, SCI_WRAMADDR, 0xC017); // GPIO_DDR
+    sci_write(v, SCI_WRAM,     0x0000);
+}
+
+// Blocking tape stop: spins the rate down on the transport engine, then
+// cancels playback and puts the rate back for the next song. The caller's
+// data keeps flowing through the feeder meanwhile.
 void vs1053_tape_stop(vs1053_t *v) {
-    // 1. Read current rate and preserve the stereo bit (Bit 0)
-    uint16_t current_reg = sci_read(v, SCI_AUDATA);
-    uint16_t stereo_bit = current_reg & 0x0001;
-    uint16_t base_rate = current_reg & 0xFFFE;
-
-    // 2. Prepare "End Fill" bytes (silence)
-    // VS1053 needs these to keep the decoder running when no more file data exists
-    uint8_t dummy[32] = {0}; 
-    float factor = 1.0f;
-    float factorfactor = 0.96f;
-
-    // 3. The Slowdown Loop
-    while (factor > 0.005f) {
-        uint16_t new_rate = (uint16_t)(base_rate * factor) & 0xFFFE;
-        factor *= factorfactor;
-        
-        if (new_rate < 500) break; // Don't go below 2000 (4kHz total)
-
-        // Write the new rate
-        sci_write(v, SCI_AUDATA, new_rate | stereo_bit);
-
-        // FEED THE CHIP: This is the missing link. 
-        // We must send data so the decoder has something to play at the new speed.
-        for(int i = 0; i < 1; i++) {
-            vs1053_play_data(v, dummy, 32);
-        }
-    }
+    vs1053_transport_warp(0.0f, TAPE_STOP_US, TRANSPORT_EXP);
+    while (vs1053_transport_busy())
+        tight_loop_contents();
 
-    // 4. Clean exit
     vs1053_set_volume(v, 0xFE, 0xFE); // Mute
+    vs1053_feed_flush();
     vs1053_stop(v);
-    
-    // Optional: Reset rate to 44.1k for the next song
-    sci_write(v, SCI_AUDATA, 0xAC45); 
+    vs1053_transport_start(0xAC44, 1); // back to 44.1k stereo for the next song
     vs1053_set_volume(v, 0x00, 0x00); // Unmute
 }
\ No newline at end of file
@@ -10,7 +10,13 @@
 #define PIN_CS 32
 
 #define MAX_TRACKS 128
+
+// Fastest PlaySpeed the decoder keeps up with on high bitrate Layer III at CLKI = 55.3 MHz
+#define VS1053_MAX_PLAY_SPEED 4
 #define MAX_FILENAME_LEN 256
+// I2S_CONFIG rate bits are left at 0: the codec resamples everything to 48 kHz
+#define VS1053_I2S_RATE 48000
+#define VS1053_I2S_PATCH_SIZE 12 // words in vs1053_i2s_patch
 
 void sci_write(vs1053_t *v, uint8_t addr, uint16_t data);
 uint16_t sci_read(vs1053_t *v, uint8_t addr);
@@ -19,10 +25,15 @@ void vs1053_soft_reset(vs1053_t *v);
 void vs1053_set_volume(vs1053_t *v, uint8_t left, uint8_t right);
 void vs1053_play_data(vs1053_t *v, const uint8_t *data, size_t len);
 bool vs1053_ready(vs1053_t *v);
-void vs1053_stop(vs1053_t *v);
+bool vs1053_stop(vs1053_t *v);
+uint8_t vs1053_end_fill_byte(vs1053_t *v);
+void vs1053_end_fill(vs1053_t *v);
+bool vs1053_decoding(vs1053_t *v);
 void vs1053_set_play_speed(vs1053_t *player, uint16_t speed);
 uint16_t vs1053_get_play_speed(vs1053_t *player);
+extern const uint16_t vs1053_i2s_patch[VS1053_I2S_PATCH_SIZE];
 void vs1053_enable_i2s(vs1053_t *v);
+void vs1053_disable_i2s(vs1053_t *v);
 void vs1053_set_samplerate(vs1053_t *player, uint16_t samplerate);
 void vs1053_load_patch(vs1053_t *v, const unsigned short* plugin, unsigned short plugin_size);
 void vs1053_tape_stop(vs1053_t *v);
@@ -0,0 +1,251 @@
+#include "vs1053_feed.h"
+#include "vs1053_stats.h"
+#include "lib/spi_bus/spi_bus.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+
+/* ##########################################################
+VS1053 SDI FEEDER
+Streams audio from a byte ring into the codec without the CPU
+polling DREQ. A DREQ rising edge (or a finished burst while DREQ
+is still high) starts a 32-byte DMA burst into SPI1 with xDCS held
+low. The main loop only has to keep the ring topped up.
+Each burst borrows the bus from the SPI1 arbiter; if someone else has
+it the burst waits for the arbiter's release callback.
+########################################################## */
+
+#define FEED_DMA_IRQ_INDEX 1
+#define FEED_DMA_IRQ DMA_IRQ_1
+
+static struct {
+    vs1053_t *v;
+    int dma_chan;
+    volatile uint32_t head;  // producer index (main loop)
+    volatile uint32_t tail;  // consumer index (DMA IRQ)
+    volatile uint32_t burst; // bytes in the running burst
+    volatile bool busy;      // DMA burst in flight
+    volatile bool paused;    // playback paused, keep queued data for resume
+    volatile bool sci_pending; // register write waiting for DREQ
+    volatile bool starved;     // DREQ found the ring empty, counted once until data comes
+    volatile bool ending;      // stream is draining out, an empty ring isn't an underrun
+    uint8_t sci_addr;
+    uint16_t sci_data;
+} feed;
+
+static uint8_t feed_buf[VS1053_FEED_BUF_SIZE] __attribute__((aligned(4)));
+
+// Start a DMA burst if the codec has room, we have data and the bus is free.
+// Must run with interrupts disabled or from IRQ context.
+static void feed_kick(void)
+{
+    if (feed.v == NULL || feed.busy)
+        return;
+    if (!gpio_get(feed.v->dreq))
+        return;
+
+    // a posted register write goes first, it's only a few microseconds
+    if (feed.sci_pending && spi_bus_try_acquire_dma(SPI_BUS_SCI))
+    {
+        uint8_t buf[4] = {0x02, feed.sci_addr, feed.sci_data >> 8, feed.sci_data & 0xFF};
+        feed.sci_pending = false;
+        gpio_put(feed.v->cs, 0);
+        spi_write_blocking(feed.v->spi, buf, 4);
+        gpio_put(feed.v->cs, 1);
+        vs1053_stats.sci_writes++;
+        spi_bus_release(); // kicks us again for the data burst
+        return;
+    }
+
+    if (feed.paused)
+        return;
+
+    uint32_t avail = feed.head - feed.tail;
+    if (avail == 0)
+    {
+        // codec asked for data and the main loop hasn't got any queued
+        if (!feed.starved && !feed.ending)
+            vs1053_stats.underruns++;
+        feed.starved = true;
+        return;
+    }
+    feed.starved = false;
+    if (!spi_bus_try_acquire_dma(SPI_BUS_SDI))
+        return; // the release callback kicks us again
+
+    uint32_t off = feed.tail & (VS1053_FEED_BUF_SIZE - 1);
+    uint32_t n = avail;
+    if (n > VS1053_SDI_BURST)
+        n = VS1053_SDI_BURST;
+    if (n > VS1053_FEED_BUF_SIZE - off)
+        n = VS1053_FEED_BUF_SIZE - off; // don't run off the end of the ring
+
+    feed.busy = true;
+    feed.burst = n;
+    gpio_put(feed.v->dcs, 0);
+    dma_channel_transfer_from_buffer_now(feed.dma_chan, &feed_buf[off], n);
+}
+
+static void feed_dma_irq(void)
+{
+    if (!dma_irqn_get_channel_status(FEED_DMA_IRQ_INDEX, feed.dma_chan))
+        return;
+    dma_irqn_acknowledge_channel(FEED_DMA_IRQ_INDEX, feed.dma_chan);
+
+    spi_inst_t *spi = feed.v->spi;
+
+    // DMA finishing only means the TX FIFO took the last byte; wait for it to
+    // leave the shifter, then throw away what was clocked back in
+    while (spi_is_busy(spi))
+        tight_loop_contents();
+    while (spi_is_readable(spi))
+        (void)spi_get_hw(spi)->dr;
+    spi_get_hw(spi)->icr = SPI_SSPICR_RORIC_BITS;
+
+    gpio_put(feed.v->dcs, 1);
+
+    feed.tail += feed.burst;
+    vs1053_stats.bytes_fed += feed.burst;
+    feed.busy = false;
+    spi_bus_release(); // runs feed_bus_free(), which starts the next burst
+}
+
+// Arbiter release callback: DREQ edges that came in while the bus was taken were dropped
+static void feed_bus_free(void)
+{
+    uint32_t irq = save_and_disable_interrupts();
+    feed_kick();
+    restore_interrupts(irq);
+}
+
+static void feed_dreq_irq(void)
+{
+    if (gpio_get_irq_event_mask(feed.v->dreq) & GPIO_IRQ_EDGE_RISE)
+    {
+        gpio_acknowledge_irq(feed.v->dreq, GPIO_IRQ_EDGE_RISE);
+        feed_kick();
+    }
+}
+
+void vs1053_feed_init(vs1053_t *v)
+{
+    feed.head = 0;
+    feed.tail = 0;
+    feed.busy = false;
+    feed.paused = false;
+    feed.sci_pending = false;
+    feed.starved = true; // nothing has played yet
+    feed.ending = false;
+
+    feed.dma_chan = dma_claim_unused_channel(true);
+    dma_channel_config c = dma_channel_get_default_config(feed.dma_chan);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, spi_get_dreq(v->spi, true));
+    dma_channel_configure(feed.dma_chan, &c, &spi_get_hw(v->spi)->dr, feed_buf, 0, false);
+
+    dma_irqn_set_channel_enabled(FEED_DMA_IRQ_INDEX, feed.dma_chan, true);
+    irq_add_shared_handler(FEED_DMA_IRQ, feed_dma_irq, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    irq_set_enabled(FEED_DMA_IRQ, true);
+
+    // raw handler so we don't steal the shared GPIO callback from the DAC interrupt
+    gpio_add_raw_irq_handler(v->dreq, feed_dreq_irq);
+    gpio_set_irq_enabled(v->dreq, GPIO_IRQ_EDGE_RISE, true);
+    irq_set_enabled(IO_IRQ_BANK0, true);
+
+    spi_bus_set_release_callback(feed_bus_free);
+    feed.v = v;
+}
+
+// Copies as much of data as fits into the ring, returns the number of bytes taken.
+// Never blocks.
+size_t vs1053_feed_submit(const uint8_t *data, size_t len)
+{
+    uint32_t head = feed.head;
+    uint32_t space = VS1053_FEED_BUF_SIZE - (head - feed.tail);
+    if (len > space)
+        len = space;
+
+    size_t done = 0;
+    while (done < len)
+    {
+        uint32_t off = head & (VS1053_FEED_BUF_SIZE - 1);
+        size_t n = len - done;
+        if (n > VS1053_FEED_BUF_SIZE - off)
+            n = VS1053_FEED_BUF_SIZE - off;
+        memcpy(&feed_buf[off], data + done, n);
+        head += n;
+        done += n;
+    }
+    feed.head = head;
+    if (done)
+        feed.ending = false;
+
+    uint32_t irq = save_and_disable_interrupts();
+    feed_kick();
+    restore_interrupts(irq);
+
+    return done;
+}
+
+size_t vs1053_feed_space(void)
+{
+    return VS1053_FEED_BUF_SIZE - (feed.head - feed.tail);
+}
+
+size_t vs1053_feed_level(void)
+{
+    return feed.head - feed.tail;
+}
+
+// Drops everything still queued in the ring (e.g. on song change)
+void vs1053_feed_flush(void)
+{
+    spi_bus_acquire(SPI_BUS_SDI); // waits out a running burst
+    feed.tail = feed.head;
+    feed.starved = true; // emptied on purpose, not an underrun
+    spi_bus_release();
+}
+
+// Blocks until every queued byte has been handed to the codec
+void vs1053_feed_drain(void)
+{
+    feed.ending = true; // running dry from here on is expected
+    while (feed.v != NULL && !feed.paused && (feed.head != feed.tail || feed.busy))
+    {
+        uint32_t irq = save_and_disable_interrupts();
+        feed_kick(); // in case DREQ rose while someone else had the bus
+        restore_interrupts(irq);
+        tight_loop_contents();
+    }
+}
+
+// Freezes the ring without dropping it, so a paused song resumes where it stopped
+void vs1053_feed_set_paused(bool pause)
+{
+    uint32_t irq = save_and_disable_interrupts();
+    feed.paused = pause;
+    feed_kick();
+    restore_interrupts(irq);
+    while (pause && feed.busy)
+        tight_loop_contents();
+}
+
+// Queues an SCI register write for the next moment DREQ is high and the bus
+// is free, without waiting for either. A newer post replaces one still
+// pending. Safe from IRQs (the transport timer uses it for SCI_AUDATA).
+void vs1053_feed_post_sci(uint8_t addr, uint16_t data)
+{
+    uint32_t irq = save_and_disable_interrupts();
+    feed.sci_addr = addr;
+    feed.sci_data = data;
+    feed.sci_pending = true;
+    feed_kick();
+    restore_interrupts(irq);
+}
+
+bool vs1053_feed_active(void)
+{
+    return feed.v != NULL;
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include "vs1053.h"
+
+// Size of the SDI ring buffer in bytes (must be a power of two)
+#define VS1053_FEED_BUF_SIZE 4096
+// VS1053 guarantees room for at least 32 bytes whenever DREQ is high
+#define VS1053_SDI_BURST 32
+
+void vs1053_feed_init(vs1053_t *v);
+size_t vs1053_feed_submit(const uint8_t *data, size_t len);
+size_t vs1053_feed_space(void);
+size_t vs1053_feed_level(void);
+void vs1053_feed_flush(void);
+void vs1053_feed_drain(void);
+void vs1053_feed_set_paused(bool pause);
+void vs1053_feed_post_sci(uint8_t addr, uint16_t data);
+bool vs1053_feed_active(void);
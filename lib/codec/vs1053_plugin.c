@@ -0,0 +1,135 @@
+#include "vs1053_plugin.h"
+#include <stdio.h>
+
+/* ##########################################################
+VS1053 PLUGIN LOADER
+Uploads VLSI plugin images without expanding them: RLE runs and
+copy runs go out as SCI multiple writes, one xCS assertion per
+VS1053_PLUGIN_BURST words, and SCI_WRAM auto-increments SCI_WRAMADDR
+as it goes. Registered plugins load either at boot or in slices from
+the play loop once audio is running. An SM_RESET wipes them, so the
+reset fallback in vs1053_stop() reloads them all.
+########################################################## */
+
+#define SCI_WRAM 0x06
+
+// Resumable position in a plugin image
+typedef struct {
+    const uint16_t *image;
+    uint16_t size;
+    uint16_t pos;
+} plugin_cursor_t;
+
+static vs1053_plugin_t registry[VS1053_MAX_PLUGINS];
+static int num_plugins;
+static int bg_next = -1;     // background plugin being loaded, -1 when none
+static plugin_cursor_t bg_cursor;
+
+// Writes whole records until at least budget words went out, returns the words
+// written. Stops only in front of a record that sets up its own address, never
+// between an SCI_WRAMADDR record and the SCI_WRAM data that depends on it (the
+// play loop may move WRAMADDR between slices).
+static uint32_t plugin_step(vs1053_t *v, plugin_cursor_t *c, uint32_t budget)
+{
+    uint32_t done = 0;
+    while (c->pos + 2 <= c->size)
+    {
+        uint8_t addr = c->image[c->pos];
+        if (done >= budget && addr != SCI_WRAM)
+            break;
+
+        uint16_t n = c->image[c->pos + 1];
+        bool rle = n & 0x8000;
+        n &= 0x7FFF;
+        c->pos += 2;
+        const uint16_t *data = &c->image[c->pos];
+        c->pos += rle ? 1 : n;
+
+        while (n > 0)
+        {
+            uint16_t burst = n > VS1053_PLUGIN_BURST ? VS1053_PLUGIN_BURST : n;
+            sci_write_multi(v, addr, data, burst, !rle);
+            if (!rle)
+                data += burst;
+            n -= burst;
+            done += burst;
+        }
+    }
+    return done;
+}
+
+static bool plugin_done(plugin_cursor_t *c)
+{
+    return c->pos + 2 > c->size;
+}
+
+void vs1053_load_patch(vs1053_t *v, const unsigned short *plugin, unsigned short plugin_size)
+{
+    plugin_cursor_t c = {plugin, plugin_size, 0};
+    plugin_step(v, &c, UINT32_MAX);
+}
+
+// Adds a plugin to the registry (flash image, nothing is copied). False when full.
+bool vs1053_plugin_register(const char *name, const uint16_t *image, uint16_t size, bool background)
+{
+    if (num_plugins >= VS1053_MAX_PLUGINS)
+        return false;
+    registry[num_plugins++] = (vs1053_plugin_t){name, image, size, background, false};
+    return true;
+}
+
+// Blocking load of everything registered for boot, queues the rest
+void vs1053_plugins_load_boot(vs1053_t *v)
+{
+    for (int i = 0; i < num_plugins; i++)
+    {
+        vs1053_plugin_t *p = &registry[i];
+        if (p->background || p->loaded)
+            continue;
+        uint32_t t0 = time_us_32();
+        vs1053_load_patch(v, p->image, p->size);
+        p->loaded = true;
+        printf("VS1053 plugin %s: %u words in %lu us\r\n", p->name, p->size,
+               (unsigned long)(time_us_32() - t0));
+    }
+    bg_next = -1;
+}
+
+// True while a background plugin still has to go in
+bool vs1053_plugins_pending(void)
+{
+    for (int i = 0; i < num_plugins; i++)
+        if (!registry[i].loaded)
+            return true;
+    return false;
+}
+
+// One slice of background loading, call from the play loop once audio runs
+void vs1053_plugins_service(vs1053_t *v)
+{
+    if (bg_next < 0)
+    {
+        for (int i = 0; i < num_plugins && bg_next < 0; i++)
+            if (!registry[i].loaded)
+                bg_next = i;
+        if (bg_next < 0)
+            return;
+        bg_cursor = (plugin_cursor_t){registry[bg_next].image, registry[bg_next].size, 0};
+    }
+
+    plugin_step(v, &bg_cursor, VS1053_PLUGIN_SLICE);
+    if (plugin_done(&bg_cursor))
+    {
+        registry[bg_next].loaded = true;
+        printf("\r\nVS1053 plugin %s loaded\r\n", registry[bg_next].name);
+        bg_next = -1;
+    }
+}
+
+// After a reset: boot plugins go back in now, background ones start over
+void vs1053_plugins_reload(vs1053_t *v)
+{
+    for (int i = 0; i < num_plugins; i++)
+        registry[i].loaded = false;
+    vs1053_plugins_load_boot(v);
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include "vs1053.h"
+
+#define VS1053_MAX_PLUGINS 8
+// Words per xCS assertion; between bursts the SD card and the SDI feeder get the bus
+#define VS1053_PLUGIN_BURST 64
+// Words a background load writes per vs1053_plugins_service() call
+#define VS1053_PLUGIN_SLICE 512
+
+// A plugin image in VLSI's compressed format (the arrays in .plg files), read
+// straight from flash: records of {register, count, words...}, count bit 15
+// set means one word repeated count & 0x7FFF times.
+typedef struct {
+    const char *name;
+    const uint16_t *image;
+    uint16_t size;   // in words
+    bool background; // load once playback has started instead of at boot
+    bool loaded;
+} vs1053_plugin_t;
+
+void sci_write_multi(vs1053_t *v, uint8_t addr, const uint16_t *data, size_t n, bool copy);
+bool vs1053_plugin_register(const char *name, const uint16_t *image, uint16_t size, bool background);
+void vs1053_plugins_load_boot(vs1053_t *v);
+bool vs1053_plugins_pending(void);
+void vs1053_plugins_service(vs1053_t *v);
+void vs1053_plugins_reload(vs1053_t *v);
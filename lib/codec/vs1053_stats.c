@@ -0,0 +1,104 @@
+#include "vs1053_stats.h"
+#include "hardware/sync.h"
+#include <stdio.h>
+#include <string.h>
+
+/* ##########################################################
+PLAYBACK HEALTH COUNTERS
+Fixed-cost totals kept by the feed path: time blocked on DREQ, SCI
+traffic, SDI bytes, feeder underruns and a log2 histogram of the
+read-ahead's f_read latency. Nothing here prints from the feed path;
+vs1053_stats_poll() turns the totals into per-second rates once per
+VS1053_STATS_DUMP_MS from the main loop, and only while the dump is on.
+########################################################## */
+
+vs1053_stats_t vs1053_stats;
+
+static struct {
+    bool dump;
+    uint32_t last_us;
+    vs1053_stats_t last; // totals at the previous dump
+} stats_dump;
+
+// Consistent copy of the totals (the IRQ side can't bump them mid-copy)
+void vs1053_stats_get(vs1053_stats_t *out)
+{
+    uint32_t irq = save_and_disable_interrupts();
+    memcpy(out, (const void *)&vs1053_stats, sizeof(*out));
+    restore_interrupts(irq);
+}
+
+void vs1053_stats_clear(void)
+{
+    uint32_t irq = save_and_disable_interrupts();
+    memset((void *)&vs1053_stats, 0, sizeof(vs1053_stats));
+    restore_interrupts(irq);
+    memset(&stats_dump.last, 0, sizeof(stats_dump.last));
+    stats_dump.last_us = time_us_32();
+}
+
+// Totals and the read latency histogram, for the 'i' style one-off report
+void vs1053_stats_print(void)
+{
+    vs1053_stats_t s;
+    vs1053_stats_get(&s);
+
+    printf("  DREQ waits: %lu (%lu us, max %lu us)\r\n", (unsigned long)s.dreq_waits,
+           (unsigned long)s.dreq_wait_us, (unsigned long)s.dreq_wait_max_us);
+    printf("  SCI writes: %lu, SDI bytes: %lu, feeder underruns: %lu\r\n", (unsigned long)s.sci_writes,
+           (unsigned long)s.bytes_fed, (unsigned long)s.underruns);
+    printf("  f_read: %lu reads, max %lu us\r\n", (unsigned long)s.reads, (unsigned long)s.read_max_us);
+    for (int b = 0; b < VS1053_STATS_READ_BUCKETS; b++)
+    {
+        if (s.read_hist[b] == 0)
+            continue;
+        if (b == VS1053_STATS_READ_BUCKETS - 1)
+            printf("    >= %6lu us: %lu\r\n", 1ul << b, (unsigned long)s.read_hist[b]);
+        else
+            printf("    %6lu-%6lu us: %lu\r\n", 1ul << b, (2ul << b) - 1, (unsigned long)s.read_hist[b]);
+    }
+}
+
+void vs1053_stats_set_dump(bool on)
+{
+    stats_dump.dump = on;
+    stats_dump.last_us = time_us_32();
+    vs1053_stats_get(&stats_dump.last);
+}
+
+bool vs1053_stats_dump_enabled(void)
+{
+    return stats_dump.dump;
+}
+
+// Call from the main loop. Returns at once unless a dump line is due.
+void vs1053_stats_poll(void)
+{
+    if (!stats_dump.dump)
+        return;
+    uint32_t now = time_us_32();
+    uint32_t dt = now - stats_dump.last_us;
+    if (dt < VS1053_STATS_DUMP_MS * 1000u)
+        return;
+
+    vs1053_stats_t s;
+    vs1053_stats_get(&s);
+    vs1053_stats_t *p = &stats_dump.last;
+
+    // slowest bucket that saw a read this period
+    int worst = -1;
+    for (int b = 0; b < VS1053_STATS_READ_BUCKETS; b++)
+        if (s.read_hist[b] != p->read_hist[b])
+            worst = b;
+
+    printf("[health] %lu B/s, SCI %lu/s, DREQ wait %lu us/s, underruns %lu, reads %lu (worst < %lu us)\r\n",
+           (unsigned long)((uint64_t)(s.bytes_fed - p->bytes_fed) * 1000000 / dt),
+           (unsigned long)((uint64_t)(s.sci_writes - p->sci_writes) * 1000000 / dt),
+           (unsigned long)((uint64_t)(s.dreq_wait_us - p->dreq_wait_us) * 1000000 / dt),
+           (unsigned long)(s.underruns - p->underruns),
+           (unsigned long)(s.reads - p->reads),
+           worst < 0 ? 0ul : 2ul << worst);
+
+    *p = s;
+    stats_dump.last_us = now;
+}
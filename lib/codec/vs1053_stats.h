@@ -0,0 +1,50 @@
+#pragma once
+#include "pico/stdlib.h"
+
+// f_read latency buckets, bucket n counts reads of [2^n, 2^(n+1)) us, the last one everything slower
+#define VS1053_STATS_READ_BUCKETS 16
+// Period of the USB dump while it's switched on
+#define VS1053_STATS_DUMP_MS 1000
+
+// Running totals since boot (or the last vs1053_stats_clear()), they wrap
+typedef struct {
+    volatile uint32_t dreq_wait_us;     // blocked in wait_dreq() with DREQ low
+    volatile uint32_t dreq_waits;       // wait_dreq() calls that had to block
+    volatile uint32_t dreq_wait_max_us; // longest single block
+    volatile uint32_t sci_writes;       // direct and posted register writes
+    volatile uint32_t bytes_fed;        // SDI bytes clocked into the codec
+    volatile uint32_t underruns;        // DREQ high but nothing queued to send
+    volatile uint32_t reads;            // read-ahead refills
+    volatile uint32_t read_max_us;
+    volatile uint32_t read_hist[VS1053_STATS_READ_BUCKETS];
+} vs1053_stats_t;
+
+extern vs1053_stats_t vs1053_stats;
+
+// Recorders, cheap enough for the feed path and the DMA IRQ
+
+static inline void vs1053_stats_dreq_wait(uint32_t us)
+{
+    vs1053_stats.dreq_wait_us += us;
+    vs1053_stats.dreq_waits++;
+    if (us > vs1053_stats.dreq_wait_max_us)
+        vs1053_stats.dreq_wait_max_us = us;
+}
+
+static inline void vs1053_stats_read(uint32_t us)
+{
+    uint32_t b = us ? 31 - __builtin_clz(us) : 0;
+    if (b >= VS1053_STATS_READ_BUCKETS)
+        b = VS1053_STATS_READ_BUCKETS - 1;
+    vs1053_stats.read_hist[b]++;
+    vs1053_stats.reads++;
+    if (us > vs1053_stats.read_max_us)
+        vs1053_stats.read_max_us = us;
+}
+
+void vs1053_stats_get(vs1053_stats_t *out);
+void vs1053_stats_clear(void);
+void vs1053_stats_print(void);
+void vs1053_stats_set_dump(bool on);
+bool vs1053_stats_dump_enabled(void);
+void vs1053_stats_poll(void);
@@ -0,0 +1,158 @@
+#include "vs1053_transport.h"
+#include "vs1053_feed.h"
+#include "hardware/sync.h"
+#include <math.h>
+
+/* ##########################################################
+VS1053 TRANSPORT ENGINE
+Tape warp effects (pause, resume, stop) bend the sample rate in
+SCI_AUDATA. A repeating timer walks an easing curve from a precomputed
+table in 16.16 fixed point and only posts a new AUDATA value to the
+SDI feeder when the rate it quantizes to actually changes. The feeder
+writes it the next time DREQ is high, so nobody waits on the codec.
+########################################################## */
+
+#define SCI_AUDATA 0x05
+#define Q16_ONE 65536
+
+static uint16_t lut[TRANSPORT_NUM_CURVES][TRANSPORT_LUT_SIZE]; // ease(x) * 65535
+
+static struct {
+    repeating_timer_t timer;
+    volatile bool busy;
+    uint16_t base_rate;
+    uint16_t stereo_bit;
+    uint16_t last_rate;   // last rate posted to SCI_AUDATA
+    int32_t speed;        // current speed, Q16 (65536 = normal)
+    int32_t from;         // warp start speed, Q16
+    int32_t to;           // warp target speed, Q16
+    uint64_t start_us;
+    uint32_t duration_us;
+    transport_curve_t curve;
+} tp;
+
+static void post_rate(void)
+{
+    uint32_t rate = ((uint32_t)tp.base_rate * tp.speed >> 16) & 0xFFFE;
+    if (rate < TRANSPORT_MIN_RATE)
+        rate = TRANSPORT_MIN_RATE;
+    if (rate == tp.last_rate)
+        return;
+    tp.last_rate = rate;
+    vs1053_feed_post_sci(SCI_AUDATA, rate | tp.stereo_bit);
+}
+
+// Linear interpolation between table entries, x in Q16 (0..65536)
+static int32_t ease(transport_curve_t curve, uint32_t x)
+{
+    uint32_t pos = x * (TRANSPORT_LUT_SIZE - 1); // Q16 index
+    uint32_t i = pos >> 16;
+    if (i >= TRANSPORT_LUT_SIZE - 1)
+        return lut[curve][TRANSPORT_LUT_SIZE - 1];
+    uint32_t frac = pos & 0xFFFF;
+    int32_t a = lut[curve][i];
+    int32_t b = lut[curve][i + 1];
+    return a + (int32_t)(((b - a) * (int64_t)frac) >> 16);
+}
+
+static bool transport_tick(repeating_timer_t *t)
+{
+    uint64_t elapsed = time_us_64() - tp.start_us;
+    bool done = elapsed >= tp.duration_us;
+
+    if (done)
+        tp.speed = tp.to;
+    else
+    {
+        uint32_t x = (uint32_t)((elapsed << 16) / tp.duration_us);
+        int32_t e = ease(tp.curve, x);
+        tp.speed = tp.from + (int32_t)(((int64_t)(tp.to - tp.from) * e) / 65535);
+    }
+    post_rate();
+
+    if (done)
+        tp.busy = false;
+    return !done;
+}
+
+void vs1053_transport_init(vs1053_t *v)
+{
+    for (int i = 0; i < TRANSPORT_LUT_SIZE; i++)
+    {
+        float x = (float)i / (TRANSPORT_LUT_SIZE - 1);
+        float e[TRANSPORT_NUM_CURVES];
+        e[TRANSPORT_LINEAR] = x;
+        e[TRANSPORT_EXP] = (1.0f - expf(-5.0f * x)) / (1.0f - expf(-5.0f));
+        e[TRANSPORT_SCURVE] = x * x * (3.0f - 2.0f * x);
+        for (int c = 0; c < TRANSPORT_NUM_CURVES; c++)
+            lut[c][i] = (uint16_t)(e[c] * 65535.0f + 0.5f);
+    }
+    tp.busy = false;
+    tp.speed = Q16_ONE;
+}
+
+// New track at normal speed: writes its rate to SCI_AUDATA (through the
+// feeder, so it can't be overtaken by a write still pending from a warp)
+void vs1053_transport_start(uint16_t base_rate, uint16_t stereo_bit)
+{
+    vs1053_transport_cancel();
+    uint32_t irq = save_and_disable_interrupts();
+    tp.base_rate = base_rate;
+    tp.stereo_bit = stereo_bit;
+    tp.speed = Q16_ONE;
+    tp.last_rate = 0; // always write
+    post_rate();
+    restore_interrupts(irq);
+}
+
+// Spliced track at the rate of the one before: the state carries over and
+// SCI_AUDATA is only written if the rate really differs, so nothing gets
+// posted into the middle of a gapless stream
+void vs1053_transport_resume(uint16_t base_rate, uint16_t stereo_bit)
+{
+    vs1053_transport_cancel();
+    uint32_t irq = save_and_disable_interrupts();
+    tp.base_rate = base_rate;
+    tp.stereo_bit = stereo_bit;
+    tp.speed = Q16_ONE;
+    post_rate();
+    restore_interrupts(irq);
+}
+
+// Glides from the current speed to target (1.0 = normal) over duration_us.
+// A warp already running is picked up from where it is.
+void vs1053_transport_warp(float target, uint32_t duration_us, transport_curve_t curve)
+{
+    uint32_t irq = save_and_disable_interrupts();
+    tp.from = tp.speed;
+    tp.to = (int32_t)(target * Q16_ONE);
+    tp.start_us = time_us_64();
+    tp.duration_us = duration_us ? duration_us : 1;
+    tp.curve = curve;
+    bool running = tp.busy;
+    tp.busy = true;
+    restore_interrupts(irq);
+
+    if (!running)
+        add_repeating_timer_us(-TRANSPORT_TICK_US, transport_tick, NULL, &tp.timer);
+}
+
+// Stops a warp where it is
+void vs1053_transport_cancel(void)
+{
+    if (tp.busy)
+    {
+        cancel_repeating_timer(&tp.timer);
+        tp.busy = false;
+    }
+}
+
+bool vs1053_transport_busy(void)
+{
+    return tp.busy;
+}
+
+float vs1053_transport_speed(void)
+{
+    return (float)tp.speed / Q16_ONE;
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include "vs1053.h"
+
+// Easing curves for tape warp effects
+typedef enum {
+    TRANSPORT_LINEAR,
+    TRANSPORT_EXP,    // fast start, long tail, like a motor spinning down
+    TRANSPORT_SCURVE, // smoothstep, eases in and out
+    TRANSPORT_NUM_CURVES
+} transport_curve_t;
+
+#define TRANSPORT_LUT_SIZE 65   // entries per curve (64 segments)
+#define TRANSPORT_TICK_US 2000  // rate update period while warping
+#define TRANSPORT_MIN_RATE 9000 // lowest SCI_AUDATA rate we write
+
+void vs1053_transport_init(vs1053_t *v);
+void vs1053_transport_start(uint16_t base_rate, uint16_t stereo_bit);
+void vs1053_transport_resume(uint16_t base_rate, uint16_t stereo_bit);
+void vs1053_transport_warp(float target, uint32_t duration_us, transport_curve_t curve);
+void vs1053_transport_cancel(void);
+bool vs1053_transport_busy(void);
+float vs1053_transport_speed(void);
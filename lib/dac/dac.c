@@ -388,4 +388,73 @@ void dac_init() {
     }
     printf("---------------------------\r\n");
     // --- END PASTE BLOCK ---
-}
\ No newline at end of file
+}
+
+// DAC clock tree with PLL_CLKIN = BCLK (P = 1, D = 0, MDAC = 2, DOSR = 128):
+// PLL = BCLK * R * J = 256 * NDAC * fs, and PLL has to sit in 80-110 MHz
+#define DAC_PLL_MIN_HZ 80000000u
+#define DAC_PLL_MAX_HZ 110000000u
+
+typedef struct {
+    uint8_t r, j, ndac;
+} dac_pll_t;
+
+static bool dac_pll_for(uint32_t rate, uint8_t slot_bits, dac_pll_t *pll) {
+    uint32_t bclk_ratio = 2 * slot_bits; // BCLK periods per frame
+    if (rate == 0 || rate > 52000)       // DAC_MOD_CLK (128 * fs) tops out at 6.758 MHz
+        return false;
+
+    // highest NDAC that keeps the PLL in range, that's what dac_init uses for 48 kHz
+    for (int ndac = 128; ndac >= 1; ndac--) {
+        uint64_t pll_hz = (uint64_t)256 * ndac * rate;
+        if (pll_hz < DAC_PLL_MIN_HZ || pll_hz > DAC_PLL_MAX_HZ)
+            continue;
+        uint32_t rj = 256 * ndac / bclk_ratio;
+        for (int r = 1; r <= 4; r++) {
+            if (rj % r == 0 && rj / r >= 4 && rj / r <= 63) {
+                pll->r = r;
+                pll->j = rj / r;
+                pll->ndac = ndac;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool dac_clock_supported(uint32_t rate, uint8_t slot_bits) {
+    dac_pll_t pll;
+    return dac_pll_for(rate, slot_bits, &pll);
+}
+
+void dac_set_mute(bool mute) {
+    dac_write(0, DAC_REG_DAC_VOL_CTRL, mute ? 0x0C : 0x00); // bits 3:2 mute L/R
+}
+
+// PLL and dividers off before BCLK goes away or changes
+void dac_clock_off(void) {
+    dac_write(0, DAC_REG_NDAC, dac_read(0, DAC_REG_NDAC) & 0x7F);
+    dac_write(0, DAC_REG_MDAC, dac_read(0, DAC_REG_MDAC) & 0x7F);
+    dac_write(0, DAC_REG_PLL_P_R, dac_read(0, DAC_REG_PLL_P_R) & 0x7F);
+}
+
+// Locks the DAC onto a BCLK of 2 * slot_bits * rate. Word length follows the
+// slot, 32-bit slots carry 24-bit samples left justified.
+bool dac_clock_on(uint32_t rate, uint8_t slot_bits) {
+    dac_pll_t pll;
+    if (!dac_pll_for(rate, slot_bits, &pll))
+        return false;
+
+    dac_write(0, DAC_REG_CODEC_IF_CTRL1, slot_bits == 16 ? 0x00 : 0x30); // I2S, 16/32 bit
+    dac_write(0, DAC_REG_CLOCK_MUX1, 0x07);                              // PLL_CLKIN = BCLK
+    dac_write(0, DAC_REG_PLL_J, pll.j);
+    dac_write(0, DAC_REG_PLL_D_MSB, 0);
+    dac_write(0, DAC_REG_PLL_D_LSB, 0);
+    dac_write(0, DAC_REG_PLL_P_R, 0x90 | pll.r); // PLL on, P = 1
+    sleep_ms(10);                                // PLL lock
+    dac_write(0, DAC_REG_NDAC, 0x80 | (pll.ndac & 0x7F)); // 128 is written as 0
+    dac_write(0, DAC_REG_MDAC, 0x82);
+    dac_write(0, DAC_REG_DOSR_MSB, 0x00);
+    dac_write(0, DAC_REG_DOSR_LSB, 0x80);
+    return true;
+}
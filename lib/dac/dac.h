@@ -61,7 +61,13 @@ void dac_eq_init(float sampleRate);
 void dac_eq_adjust(int band, float step_db, float sampleRate); 
 float dac_eq_get_gain(int band);   
 int dac_eq_get_freq(int band);    
-static void dac_apply_eq(float sampleRate);
+
+
+// Clock handoff between I2S sources
+bool dac_clock_supported(uint32_t rate, uint8_t slot_bits);
+void dac_set_mute(bool mute);
+void dac_clock_off(void);
+bool dac_clock_on(uint32_t rate, uint8_t slot_bits);
 
 
 void dac_int_callback(uint gpio, uint32_t events);
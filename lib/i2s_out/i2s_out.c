@@ -0,0 +1,259 @@
+#include "i2s_out.h"
+#include "i2s_out.pio.h"
+#include "lib/dac/dac.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+
+/* ##########################################################
+I2S OUT: PIO TRANSMITTER FOR THE TLV320
+Second way into the DAC next to the VS1053. Two DMA channels
+chained into each other play ring blocks into the PIO TX FIFO back
+to back. When one finishes the other is already running, and the
+IRQ points the finished one at the next committed block, or at a
+block of silence when the card fell behind or playback is paused,
+so BCLK (which the DAC's PLL runs off) never stops.
+########################################################## */
+
+#define I2S_DMA_IRQ_INDEX 0
+#define I2S_DMA_IRQ DMA_IRQ_0
+#define DAC_PLL_LOCK_MS 10
+
+static struct {
+    PIO pio;
+    uint sm;
+    uint offset;
+    int dma[2];
+    dma_channel_config cfg[2];
+    i2s_route_t route;
+    pcm_ring_t ring;
+    uint16_t len[I2S_OUT_NUM_BLOCKS]; // PCM bytes in each block, the rest is padding
+    volatile int8_t slot[2];          // ring slot each channel is on, -1 for silence
+    volatile uint16_t counts[2];      // bytes of that block that count as played
+    volatile uint32_t played;         // bytes played since the route came up or the last flush
+    volatile uint32_t underruns;
+    volatile bool paused;
+    volatile bool feeding;            // the producer has more coming
+    volatile bool starved;
+} out;
+
+static uint8_t blocks[I2S_OUT_NUM_BLOCKS][I2S_OUT_BLOCK_SIZE] __attribute__((aligned(4)));
+static uint8_t silence[I2S_OUT_BLOCK_SIZE] __attribute__((aligned(4)));
+
+// Points a finished channel at whatever plays after the one now running
+static void queue_next(int i)
+{
+    int slot = out.paused ? -1 : pcm_ring_take(&out.ring, I2S_OUT_NUM_BLOCKS);
+
+    bool dry = slot < 0 && !out.paused && out.feeding;
+    if (dry && !out.starved)
+        out.underruns++;
+    out.starved = dry;
+
+    out.slot[i] = slot;
+    out.counts[i] = slot < 0 ? 0 : out.len[slot];
+    dma_channel_set_read_addr(out.dma[i], slot < 0 ? silence : blocks[slot], false);
+}
+
+static void i2s_out_dma_irq(void)
+{
+    for (int i = 0; i < 2; i++)
+    {
+        if (!dma_irqn_get_channel_status(I2S_DMA_IRQ_INDEX, out.dma[i]))
+            continue;
+        dma_irqn_acknowledge_channel(I2S_DMA_IRQ_INDEX, out.dma[i]);
+
+        if (out.slot[i] >= 0)
+        {
+            out.played += out.counts[i];
+            pcm_ring_release(&out.ring);
+        }
+        queue_next(i);
+    }
+}
+
+void i2s_out_init(PIO pio)
+{
+    out.pio = pio;
+    out.sm = pio_claim_unused_sm(pio, true);
+    out.offset = pio_add_program(pio, &i2s_out_program);
+    out.route = I2S_ROUTE_VS1053; // sb_audio_init gave the port to the codec
+    for (int i = 0; i < 2; i++)
+        out.dma[i] = dma_claim_unused_channel(true);
+
+    irq_add_shared_handler(I2S_DMA_IRQ, i2s_out_dma_irq, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    irq_set_enabled(I2S_DMA_IRQ, true);
+}
+
+static void out_start(uint32_t rate, uint8_t slot_bits, bool bswap)
+{
+    pcm_ring_reset(&out.ring);
+    out.played = 0;
+    out.underruns = 0;
+    out.paused = false;
+    out.feeding = false;
+    out.starved = false;
+
+    i2s_out_program_init(out.pio, out.sm, out.offset, PIN_I2S_DIN, PIN_I2S_BCLK, slot_bits);
+    i2s_out_program_set_rate(out.pio, out.sm, rate, slot_bits);
+
+    // one transfer per slot, 16-bit ones land in both halves of the FIFO word
+    enum dma_channel_transfer_size size = slot_bits == 16 ? DMA_SIZE_16 : DMA_SIZE_32;
+    for (int i = 0; i < 2; i++)
+    {
+        dma_channel_config c = dma_channel_get_default_config(out.dma[i]);
+        channel_config_set_transfer_data_size(&c, size);
+        channel_config_set_read_increment(&c, true);
+        channel_config_set_write_increment(&c, false);
+        channel_config_set_dreq(&c, pio_get_dreq(out.pio, out.sm, true));
+        channel_config_set_chain_to(&c, out.dma[i ^ 1]);
+        channel_config_set_bswap(&c, bswap); // big-endian AIFF straight from the card
+        dma_channel_configure(out.dma[i], &c, &out.pio->txf[out.sm], silence,
+                              I2S_OUT_BLOCK_SIZE >> size, false);
+        out.cfg[i] = c;
+        out.slot[i] = -1;
+        out.counts[i] = 0;
+        dma_irqn_set_channel_enabled(I2S_DMA_IRQ_INDEX, out.dma[i], true);
+    }
+
+    pio_sm_set_enabled(out.pio, out.sm, true);
+    dma_channel_start(out.dma[0]); // silence until the producer commits something
+}
+
+static void out_stop(void)
+{
+    // the channels restart each other, unchain them before aborting
+    for (int i = 0; i < 2; i++)
+    {
+        dma_irqn_set_channel_enabled(I2S_DMA_IRQ_INDEX, out.dma[i], false);
+        channel_config_set_chain_to(&out.cfg[i], out.dma[i]);
+        dma_channel_set_config(out.dma[i], &out.cfg[i], false);
+    }
+    for (int i = 0; i < 2; i++)
+    {
+        dma_channel_abort(out.dma[i]);
+        dma_irqn_acknowledge_channel(I2S_DMA_IRQ_INDEX, out.dma[i]);
+    }
+
+    pio_sm_set_enabled(out.pio, out.sm, false);
+    pio_sm_clear_fifos(out.pio, out.sm);
+
+    // back to inputs so the VS1053 can drive the nets
+    gpio_init(PIN_I2S_DIN);
+    gpio_init(PIN_I2S_BCLK);
+    gpio_init(PIN_I2S_LRCLK);
+}
+
+// Hands the DAC's serial port from one side to the other. The DAC's PLL runs
+// off BCLK, so its clocks go down while the drivers swap and come back up
+// locked to the new BCLK, muted throughout. rate/slot_bits/bswap are only
+// used for I2S_ROUTE_RP2350. False (and nothing touched) if the DAC can't
+// clock at rate, the caller then plays the file through the VS1053.
+bool i2s_out_route(vs1053_t *v, i2s_route_t route, uint32_t rate, uint8_t slot_bits, bool bswap)
+{
+    if (route == I2S_ROUTE_RP2350 && !dac_clock_supported(rate, slot_bits))
+        return false;
+
+    absolute_time_t t0 = get_absolute_time();
+    dac_set_mute(true);
+    dac_clock_off();
+
+    if (out.route == I2S_ROUTE_RP2350)
+        out_stop();
+    else
+        vs1053_disable_i2s(v);
+
+    if (route == I2S_ROUTE_RP2350)
+    {
+        out_start(rate, slot_bits, bswap);
+        dac_clock_on(rate, slot_bits);
+    }
+    else
+    {
+        vs1053_enable_i2s(v);
+        dac_clock_on(VS1053_I2S_RATE, 16);
+    }
+    sleep_ms(DAC_PLL_LOCK_MS);
+    dac_set_mute(false);
+
+    out.route = route;
+    printf("I2S route: %s at %lu Hz, %u-bit slots (%lld us)\r\n",
+           route == I2S_ROUTE_RP2350 ? "RP2350" : "VS1053",
+           (unsigned long)(route == I2S_ROUTE_RP2350 ? rate : VS1053_I2S_RATE),
+           route == I2S_ROUTE_RP2350 ? slot_bits : 16,
+           absolute_time_diff_us(t0, get_absolute_time()));
+    return true;
+}
+
+i2s_route_t i2s_out_get_route(void)
+{
+    return out.route;
+}
+
+// Next free ring block for the producer, NULL while the ring is full.
+// Fill it in place and hand it over with i2s_out_commit().
+uint8_t *i2s_out_claim(void)
+{
+    int slot = pcm_ring_claim(&out.ring, I2S_OUT_NUM_BLOCKS);
+    return slot < 0 ? NULL : blocks[slot];
+}
+
+// Queues the claimed block with len bytes of PCM in it, the rest is padded with silence
+void i2s_out_commit(uint32_t len)
+{
+    uint32_t slot = out.ring.head % I2S_OUT_NUM_BLOCKS;
+    if (len < I2S_OUT_BLOCK_SIZE)
+        memset(blocks[slot] + len, 0, I2S_OUT_BLOCK_SIZE - len);
+    out.len[slot] = len;
+    out.feeding = true;
+    __compiler_memory_barrier(); // block contents before the IRQ can see it
+    pcm_ring_commit(&out.ring);
+}
+
+// Drops everything queued (seek). The block or two the DMA already has
+// still play out but don't count toward i2s_out_played().
+void i2s_out_flush(void)
+{
+    uint32_t irq = save_and_disable_interrupts();
+    pcm_ring_drop(&out.ring);
+    out.counts[0] = 0;
+    out.counts[1] = 0;
+    out.played = 0;
+    out.feeding = false;
+    restore_interrupts(irq);
+}
+
+// End of the source: silence from here on is not an underrun
+void i2s_out_finish(void)
+{
+    out.feeding = false;
+}
+
+// Paused, the DMA keeps clocking silence and leaves the ring alone
+void i2s_out_set_paused(bool pause)
+{
+    out.paused = pause;
+}
+
+// Everything committed has played out
+bool i2s_out_idle(void)
+{
+    return pcm_ring_empty(&out.ring);
+}
+
+// Blocks committed but not picked up by the DMA yet
+uint32_t i2s_out_queued(void)
+{
+    return pcm_ring_queued(&out.ring);
+}
+
+// Ring bytes played since the route came up or the last flush
+uint32_t i2s_out_played(void)
+{
+    return out.played;
+}
+
+uint32_t i2s_out_underruns(void)
+{
+    return out.underruns;
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include "pico/stdlib.h"
+#include "hardware/pio.h"
+#include "lib/codec/vs1053.h"
+#include "pcm_ring.h"
+
+// RP2350 side of the DAC's audio serial port. These are meant to share the
+// nets with the VS1053's I2S pins (GPIO4-7), only one side drives them at a
+// time. LRCLK has to be BCLK + 1 (side-set pins).
+//
+// Source: none yet. The KiCad project in the repo (stereoBoy_MGB.kicad_pro)
+// has no schematic or netlist, so nothing ties GPIO12-14 to the DAC's
+// DIN/BCLK/WCLK. Until they're checked against the board the transmitter
+// and the WAV/AIFF player stay out of the firmware (CMake option
+// SB_I2S_OUT, which sets this to 1) and WAV/AIFF are left out of the library.
+#ifndef I2S_OUT_PINS_CONFIRMED
+#define I2S_OUT_PINS_CONFIRMED 0
+#endif
+#define PIN_I2S_DIN   12
+#define PIN_I2S_BCLK  13
+#define PIN_I2S_LRCLK 14
+
+// PCM ring: I2S_OUT_NUM_BLOCKS * I2S_OUT_BLOCK_SIZE bytes, ~93 ms of 16-bit 44.1 kHz stereo
+#define I2S_OUT_BLOCK_SIZE 2048 // whole stereo frames for 16 and 32-bit slots
+#define I2S_OUT_NUM_BLOCKS 8
+
+typedef enum {
+    I2S_ROUTE_VS1053, // codec drives the DAC (MP3 and everything it decodes)
+    I2S_ROUTE_RP2350  // PIO drives the DAC from the PCM ring
+} i2s_route_t;
+
+void i2s_out_init(PIO pio);
+bool i2s_out_route(vs1053_t *v, i2s_route_t route, uint32_t rate, uint8_t slot_bits, bool bswap);
+i2s_route_t i2s_out_get_route(void);
+uint8_t *i2s_out_claim(void);
+void i2s_out_commit(uint32_t len);
+void i2s_out_flush(void);
+void i2s_out_finish(void);
+void i2s_out_set_paused(bool pause);
+bool i2s_out_idle(void);
+uint32_t i2s_out_queued(void);
+uint32_t i2s_out_played(void);
+uint32_t i2s_out_underruns(void);
@@ -0,0 +1,67 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+/* ##########################################################
+PCM RING BOOKKEEPING
+Block counters shared by the producer (main loop reading the card)
+and the consumer (DMA completion IRQ). Blocks go
+claim -> commit -> take -> release, always in order, so three free
+running counters say everything. No hardware in here.
+########################################################## */
+
+typedef struct {
+    volatile uint32_t head;     // blocks committed by the producer
+    volatile uint32_t assigned; // blocks handed to a DMA channel
+    volatile uint32_t done;     // blocks played out, their slots are free again
+} pcm_ring_t;
+
+static inline void pcm_ring_reset(pcm_ring_t *r)
+{
+    r->head = 0;
+    r->assigned = 0;
+    r->done = 0;
+}
+
+// Slot the producer may fill next, -1 while all n slots are queued or playing
+static inline int pcm_ring_claim(const pcm_ring_t *r, uint32_t n)
+{
+    return r->head - r->done < n ? (int)(r->head % n) : -1;
+}
+
+static inline void pcm_ring_commit(pcm_ring_t *r)
+{
+    r->head++;
+}
+
+// Consumer: next committed slot for a DMA channel, -1 when there is none
+static inline int pcm_ring_take(pcm_ring_t *r, uint32_t n)
+{
+    if (r->assigned == r->head)
+        return -1;
+    return (int)(r->assigned++ % n);
+}
+
+// Consumer: the oldest taken slot has played out
+static inline void pcm_ring_release(pcm_ring_t *r)
+{
+    r->done++;
+}
+
+// Drops committed blocks no DMA channel has picked up yet (seek)
+static inline void pcm_ring_drop(pcm_ring_t *r)
+{
+    r->head = r->assigned;
+}
+
+// Committed blocks still waiting for the DMA
+static inline uint32_t pcm_ring_queued(const pcm_ring_t *r)
+{
+    return r->head - r->assigned;
+}
+
+// Nothing committed, nothing playing
+static inline bool pcm_ring_empty(const pcm_ring_t *r)
+{
+    return r->done == r->head;
+}
@@ -0,0 +1,228 @@
+#include <string.h>
+#include "pcm_source.h"
+
+/* ##########################################################
+PCM SOURCE: WAV / AIFF LAYOUT AND RING FORMAT
+Finds the sample data in RIFF/WAVE and FORM/AIFF(-C) files and
+decides how it reaches the I2S ring. 16-bit and 32-bit stereo go
+from the card to the DMA untouched (AIFF gets its bytes swapped by
+the DMA), everything else is read into the back of a ring block
+and widened to I2S slots in place, front to back.
+Only talks to the file through a pcm_read_t, no FatFs or SDK here.
+########################################################## */
+
+#define PCM_MAX_CHUNKS 64 // give up on files with more chunks than this before the audio
+
+static uint16_t le16(const uint8_t *b) { return b[0] | (b[1] << 8); }
+static uint32_t le32(const uint8_t *b) { return le16(b) | ((uint32_t)le16(b + 2) << 16); }
+static uint16_t be16(const uint8_t *b) { return (b[0] << 8) | b[1]; }
+static uint32_t be32(const uint8_t *b) { return ((uint32_t)be16(b) << 16) | be16(b + 2); }
+
+// 80-bit IEEE extended (AIFF sample rate) to an integer
+static uint32_t ext80_to_uint(const uint8_t *b)
+{
+    int exp = ((b[0] & 0x7F) << 8) | b[1];
+    int shift = 16383 + 31 - exp; // top 32 bits of the mantissa hold the integer part
+    if (b[0] & 0x80 || shift < 0 || shift > 31)
+        return 0;
+    return be32(b + 2) >> shift;
+}
+
+static bool parse_wav(pcm_read_t read, void *ctx, uint32_t size, pcm_format_t *f)
+{
+    bool have_fmt = false;
+    uint32_t pos = 12;
+
+    for (int i = 0; i < PCM_MAX_CHUNKS && pos + 8 <= size; i++)
+    {
+        uint8_t hdr[8];
+        if (read(ctx, pos, hdr, 8) != 8)
+            return false;
+        uint32_t len = le32(hdr + 4);
+
+        if (!memcmp(hdr, "fmt ", 4))
+        {
+            uint8_t fmt[26];
+            uint32_t n = len < sizeof(fmt) ? len : sizeof(fmt);
+            if (n < 16 || read(ctx, pos + 8, fmt, n) != n)
+                return false;
+            uint16_t tag = le16(fmt);
+            f->channels = le16(fmt + 2);
+            f->rate = le32(fmt + 4);
+            f->bits = le16(fmt + 14);
+            if (tag == 0xFFFE && n >= 26) // WAVE_FORMAT_EXTENSIBLE, subformat GUID starts with the tag
+            {
+                tag = le16(fmt + 24);
+                if (le16(fmt + 18))
+                    f->bits = le16(fmt + 18); // valid bits, left justified in the container
+            }
+            if (tag != 1 || f->channels == 0)
+                return false; // float, ADPCM, ... go to the VS1053
+            f->container = le16(fmt + 12) / f->channels;
+            f->big_endian = false;
+            f->is_unsigned = f->container == 1;
+            have_fmt = true;
+        }
+        else if (!memcmp(hdr, "data", 4))
+        {
+            f->data_start = pos + 8;
+            f->data_len = len;
+            return have_fmt; // the spec puts fmt first
+        }
+
+        pos += 8 + len + (len & 1);
+    }
+    return false;
+}
+
+static bool parse_aiff(pcm_read_t read, void *ctx, uint32_t size, bool aifc, pcm_format_t *f)
+{
+    bool have_comm = false, have_ssnd = false;
+    uint32_t pos = 12;
+
+    // COMM and SSND may come in either order
+    for (int i = 0; i < PCM_MAX_CHUNKS && pos + 8 <= size && !(have_comm && have_ssnd); i++)
+    {
+        uint8_t hdr[8];
+        if (read(ctx, pos, hdr, 8) != 8)
+            return false;
+        uint32_t len = be32(hdr + 4);
+
+        if (!memcmp(hdr, "COMM", 4))
+        {
+            uint8_t comm[22];
+            uint32_t n = aifc ? 22 : 18;
+            if (len < n || read(ctx, pos + 8, comm, n) != n)
+                return false;
+            f->channels = be16(comm);
+            f->bits = be16(comm + 6);
+            f->rate = ext80_to_uint(comm + 8);
+            f->container = (f->bits + 7) / 8;
+            f->big_endian = true;
+            f->is_unsigned = false;
+            if (aifc)
+            {
+                if (!memcmp(comm + 18, "sowt", 4))
+                    f->big_endian = false;
+                else if (memcmp(comm + 18, "NONE", 4) && memcmp(comm + 18, "twos", 4))
+                    return false; // compressed
+            }
+            have_comm = true;
+        }
+        else if (!memcmp(hdr, "SSND", 4))
+        {
+            uint8_t ssnd[4];
+            if (len < 8 || read(ctx, pos + 8, ssnd, 4) != 4)
+                return false;
+            uint32_t offset = be32(ssnd);
+            if (offset > len - 8)
+                return false;
+            f->data_start = pos + 16 + offset;
+            f->data_len = len - 8 - offset;
+            have_ssnd = true;
+        }
+
+        pos += 8 + len + (len & 1);
+    }
+    return have_comm && have_ssnd;
+}
+
+// Fills f from the file header. False for anything the I2S path can't play
+// bit for bit (compressed, float, more than two channels, odd rates are the
+// DAC's call later on).
+bool pcm_parse(pcm_read_t read, void *ctx, uint32_t size, pcm_format_t *f)
+{
+    uint8_t hdr[12];
+    memset(f, 0, sizeof(*f));
+    if (size < 12 || read(ctx, 0, hdr, 12) != 12)
+        return false;
+
+    bool ok;
+    if (!memcmp(hdr, "RIFF", 4) && !memcmp(hdr + 8, "WAVE", 4))
+        ok = parse_wav(read, ctx, size, f);
+    else if (!memcmp(hdr, "FORM", 4) && !memcmp(hdr + 8, "AIFF", 4))
+        ok = parse_aiff(read, ctx, size, false, f);
+    else if (!memcmp(hdr, "FORM", 4) && !memcmp(hdr + 8, "AIFC", 4))
+        ok = parse_aiff(read, ctx, size, true, f);
+    else
+        return false;
+
+    if (!ok || f->channels < 1 || f->channels > 2 || f->rate == 0 ||
+        f->container < 1 || f->container > 4 || f->bits > f->container * 8 ||
+        f->data_start >= size)
+        return false;
+
+    f->frame_bytes = f->channels * f->container;
+    if (f->data_len > size - f->data_start)
+        f->data_len = size - f->data_start; // truncated file or a streaming header
+    f->data_len -= f->data_len % f->frame_bytes;
+
+    f->slot_bits = f->container <= 2 ? 16 : 32;
+    f->out_frame = f->slot_bits / 4; // two slots
+    f->direct = f->channels == 2 && f->container * 8 == f->slot_bits;
+    f->bswap = f->direct && f->big_endian;
+    return true;
+}
+
+// Where in a ring block to read frames of file data so pcm_expand() can
+// widen them in place (0 for direct formats)
+uint32_t pcm_read_offset(const pcm_format_t *f, uint32_t frames)
+{
+    return frames * (f->out_frame - f->frame_bytes);
+}
+
+// One sample, left justified to 32 bits
+static inline uint32_t sample_at(const pcm_format_t *f, const uint8_t *p)
+{
+    uint32_t v = 0;
+    for (int k = 0; k < f->container; k++)
+        v = (v << 8) | (f->big_endian ? p[k] : p[f->container - 1 - k]);
+    v <<= 32 - 8 * f->container;
+    if (f->is_unsigned)
+        v ^= 0x80000000;
+    return v;
+}
+
+// Widens frames read to src (at least pcm_read_offset() past dst, a short
+// read can leave fewer frames there than the offset was made for) into I2S
+// slots starting at dst. Going front to back never overwrites input that
+// hasn't been read: output frame i ends at out * (i + 1), which is never past
+// where input frame i + 1 starts, src - dst + in * (i + 1).
+void pcm_expand(const pcm_format_t *f, uint8_t *dst, const uint8_t *src, uint32_t frames)
+{
+    if (f->direct)
+        return;
+
+    uint32_t right = f->channels > 1 ? f->container : 0; // mono goes out on both sides
+
+    for (uint32_t i = 0; i < frames; i++)
+    {
+        const uint8_t *p = src + i * f->frame_bytes;
+        uint32_t l = sample_at(f, p);
+        uint32_t r = sample_at(f, p + right);
+        if (f->slot_bits == 16)
+        {
+            uint16_t *o = (uint16_t *)(dst + i * 4);
+            o[0] = l >> 16;
+            o[1] = r >> 16;
+        }
+        else
+        {
+            uint32_t *o = (uint32_t *)(dst + i * 8);
+            o[0] = l;
+            o[1] = r;
+        }
+    }
+}
+
+uint32_t pcm_frame_at_ms(const pcm_format_t *f, uint32_t ms)
+{
+    uint32_t frames = f->data_len / f->frame_bytes;
+    uint64_t frame = (uint64_t)ms * f->rate / 1000;
+    return frame < frames ? (uint32_t)frame : frames;
+}
+
+uint32_t pcm_ms_at_frame(const pcm_format_t *f, uint32_t frame)
+{
+    return (uint64_t)frame * 1000 / f->rate;
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+// Reads len bytes at pos into buf, returns the number of bytes read
+typedef uint32_t (*pcm_read_t)(void *ctx, uint32_t pos, void *buf, uint32_t len);
+
+// Layout of the sample data in a WAV or AIFF file, and how it goes out over I2S
+typedef struct {
+    uint32_t data_start;  // file offset of the first sample frame
+    uint32_t data_len;    // bytes of sample data, whole frames
+    uint32_t rate;        // Hz
+    uint16_t channels;    // 1 or 2
+    uint16_t bits;        // valid bits per sample
+    uint8_t container;    // bytes per sample as stored
+    uint8_t frame_bytes;  // channels * container
+    bool big_endian;      // AIFF (but not AIFC 'sowt')
+    bool is_unsigned;     // 8-bit WAV
+    // output side
+    uint8_t slot_bits;    // 16 or 32 bit I2S slots
+    uint8_t out_frame;    // bytes per stereo frame in the ring
+    bool direct;          // file bytes go to the DMA untouched
+    bool bswap;           // DMA swaps bytes on the way out (direct big-endian)
+} pcm_format_t;
+
+bool pcm_parse(pcm_read_t read, void *ctx, uint32_t size, pcm_format_t *f);
+uint32_t pcm_read_offset(const pcm_format_t *f, uint32_t frames);
+void pcm_expand(const pcm_format_t *f, uint8_t *dst, const uint8_t *src, uint32_t frames);
+uint32_t pcm_frame_at_ms(const pcm_format_t *f, uint32_t ms);
+uint32_t pcm_ms_at_frame(const pcm_format_t *f, uint32_t frame);
@@ -17,6 +17,7 @@ uint8_t marquee_album_start = 0;
 void set_visualizer(int num)
 {
     visualizer = num;
+    idle_poke(); // core1 may be sleeping out an idle frame
 }
 
 void app_node(char *str)
@@ -78,13 +79,35 @@ void dprint(char *fmt, ...)
     return;
 }
 
+static void process_audio_batch(); // below
+
 // This is the main loop for Core 1
 
+#define ALBUM_ART_FRAME_MS 16 // icon/VU refresh over album art, ~60 FPS
+
+// Everything addIcons() draws from, folded into one word to spot changes
+static uint32_t overlay_key(void)
+{
+    uint32_t key = 2166136261u;
+    uint32_t parts[] = {(uint32_t)(uintptr_t)playStatus, (uint32_t)(uintptr_t)ff_rew_status,
+                        (uint32_t)progress_bar, enableIcons, (uint32_t)get_selected_band()};
+    for (int i = 0; i < count_of(parts); i++)
+        key = (key ^ parts[i]) * 16777619u;
+    for (int i = 0; i < 6; i++)
+        key = (key ^ (uint32_t)(int32_t)(dac_eq_get_gain(i) * 10.0f)) * 16777619u;
+    return key;
+}
+
 int start;
 void core1_entry()
 {
+    absolute_time_t next_frame = get_absolute_time();
     while (1)
     {
+        // paused or in the menu: one frame per IDLE_FRAME_MS unless core0 pokes
+        if (idle_active())
+            idle_pace(&next_frame, IDLE_FRAME_MS);
+
         switch (visualizer)
         {
         case 0: // Album Art
@@ -97,7 +120,8 @@ void core1_entry()
                 spi_set_format(spi0, 16, SPI_CPOL_0, SPI_CPHA_0, SPI_MSB_FIRST);
                 spi_write16_blocking(spi0, frame_buffer, 240 * 240);
 
-                // Lock into an LED-only
+                // Lock into an LED-only loop, the frame only goes out again when the overlay changed
+                uint32_t pushed = overlay_key() ^ 1;
                 while (visualizer == 0)
                 {
                     adc_select_input(ADC_CH_L);
@@ -108,12 +132,17 @@ void core1_entry()
 
                     pca9685_update_vu(&vu_meter, raw_l, raw_r);
 
-                    addIcons(frame_buffer, enableIcons);
-                    st7789_set_cursor(0, 0);
-                    st7789_ramwr();
-                    spi_set_format(spi0, 16, SPI_CPOL_0, SPI_CPHA_0, SPI_MSB_FIRST);
-                    spi_write16_blocking(spi0, frame_buffer, 240 * 240);
-                    // sleep_ms(16); // Throttle to ~60FPS
+                    addIcons(frame_buffer, enableIcons); // also samples the pot
+                    uint32_t key = overlay_key();
+                    if (key != pushed)
+                    {
+                        st7789_set_cursor(0, 0);
+                        st7789_ramwr();
+                        spi_set_format(spi0, 16, SPI_CPOL_0, SPI_CPHA_0, SPI_MSB_FIRST);
+                        spi_write16_blocking(spi0, frame_buffer, 240 * 240);
+                        pushed = key;
+                    }
+                    idle_pace(&next_frame, idle_active() ? IDLE_FRAME_MS : ALBUM_ART_FRAME_MS);
                 }
             }
             break;
@@ -180,8 +209,8 @@ void core1_entry()
         case 6:
             clear_framebuffer();
             start =  (song_choice < 6) ? 0 : song_choice - 5;
-            track_info_t *track;
-            track_info_t *selected_track;
+            static library_row_t selected_row = {.id = -1}; // library_row() copy for the marquees
+            library_row_t *selected_track = &selected_row;
             char buf[256]; // buffer for string to write to display
             char marquee_title[32]; // buffer for scrolling title marquee
             char md_artist[128]; // artist metadata of currently selected track
@@ -198,8 +227,6 @@ void core1_entry()
                 if (start + i >= count) {
                     break;
                 }
-                track = &tracks[start+i];
-                selected_track = &tracks[song_choice];
                 sprintf(buf, "%d", start+i+1); //Index at 1 for users
                 strcat(buf, " ");
                 if (start + i == song_choice) {
@@ -207,12 +234,19 @@ void core1_entry()
                     st7789_draw_string(1, 0 + i * font_height, buf, HIGHLIGHT_COLOR_SECONDARY);
                 }
                 else{
-                    strcat(buf, track->title);
+                    strcat(buf, library_title(start + i));
                     st7789_draw_string(1, 0 + i * font_height, buf, WHITE);
                 }
             }
 
-            if (song_choice != last_song_choice) {
+            // core0 loads rows into the window, take a copy once it's there or got its tags
+            const library_row_t *row = library_row(song_choice);
+            if (song_choice != last_song_choice ||
+                (row && (selected_row.id != song_choice || selected_row.flags != row->flags))) {
+                if (row)
+                    selected_row = *row;
+                else
+                    selected_row = (library_row_t){.id = -1};
                 marquee_title_start = 0;
                 marquee_artist_start = 0;
                 marquee_album_start = 0;
@@ -422,11 +456,10 @@ void core1_entry()
                 if (start + i >= count){
                     break;
                 }
-                track_info_t *track = &tracks[start+i];
                 char buf[256];
                 sprintf(buf, "%d", start+i+1); //Index at 1 for users
                 strcat(buf, " ");
-                strcat(buf, track->title);
+                strcat(buf, library_title(start + i));
                 if (start + i == song_choice){
                     st7789_draw_string(1, 5 + i * font_height, buf, HIGHLIGHT_COLOR_PRIMARY);
                 }
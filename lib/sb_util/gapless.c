@@ -0,0 +1,63 @@
+#include "lib/sb_util/sb_util.h"
+
+/* ##########################################################
+GAPLESS: OPENING THE NEXT TRACK AND SPLICING IT IN
+jukebox() plays from one of two read-aheads. Near the end of a track
+the next one is opened in the other and its blocks filled while this
+one keeps pumping; when this one is done the other is pumped straight
+into the feed, no cancel, no reset, no drain. These are the steps on
+the read-aheads, jukebox.c decides when to take them and
+scripting/library_indexer/tests/gapless_test.c drives the same ones
+through a codec FIFO model.
+########################################################## */
+
+// Opens a track into s and positions it at the first audio byte
+bool gapless_open(sd_stream_t *s, seek_index_t *idx, track_info_t *track)
+{
+    if (sd_stream_open(s, track->filename) != FR_OK)
+        return false;
+
+    spi_bus_acquire(SPI_BUS_SD);
+    seek_index_init(idx, &s->fil, track);
+    uint32_t start = find_audio_start(&s->fil);
+    spi_bus_release();
+    // frame table grows as the read-ahead pulls blocks in, other containers go by bitrate
+    s->index = track->container == CONTAINER_MP3 ? idx : NULL;
+    if (track->audio_end > start)
+        s->end = track->audio_end; // leave the ID3v1 tag out of the feed
+    sd_stream_seek(s, start);
+    return true;
+}
+
+// Whether next can go into the feed right behind track
+bool gapless_fits(const track_info_t *track, const track_info_t *next)
+{
+    if (next->format != TRACK_CODEC || next->samplespeed != track->samplespeed)
+        return false; // rate change or the I2S path needs the normal start-up path
+    // only MPEG frames splice, other decoders want their headers after a cancel
+    return next->container == CONTAINER_MP3 && track->container == CONTAINER_MP3;
+}
+
+// Opens next into s and fills its read-ahead, pumping playing (the track
+// on its way out) between the reads so it keeps flowing
+bool gapless_prefetch(sd_stream_t *s, seek_index_t *idx, track_info_t *next, sd_stream_t *playing)
+{
+    if (!gapless_open(s, idx, next))
+        return false;
+    for (int i = 0; i < SD_STREAM_NUM_BLOCKS; i++)
+    {
+        sd_stream_fill(s);
+        sd_stream_pump(playing);
+    }
+    return true;
+}
+
+// done has gone out to the feed: closes it and puts next's first bytes in
+// right behind its last. Returns what was still queued at the splice.
+size_t gapless_splice(sd_stream_t *done, sd_stream_t *next)
+{
+    sd_stream_close(done);
+    size_t queued = vs1053_feed_level();
+    sd_stream_pump(next);
+    return queued;
+}
@@ -22,6 +22,7 @@
 
 #include "lib/display/picojpeg.h"
 #include "lib/font/font.h"
+#include "lib/i2s_out/pcm_source.h"
 
 
 //LED DRIVER
@@ -37,6 +38,7 @@ extern pca9685_t vu_meter;
 //DAC
 extern bool paused;
 extern bool warping;
+extern bool gapless;
 
 //DISPLAY
 #define HISTORY_SIZE 256
@@ -71,7 +73,21 @@ typedef struct st7789_t {
 
 //SB_UTIL
 #define MAX_FILENAME_LEN 256 // max filaname character length
-#define MAX_TRACKS 128 // max number of mp3 files in sd card
+#define LIBRARY_MAX_TRACKS 65535        // track_info_t.id is 16 bits, RAM doesn't grow with it
+#define LIBRARY_PAGES 8                 // record pages cached in RAM
+#define LIBRARY_PAGE_RECS 32            // records per page, 2.5 KB
+#define LIBRARY_STR_LINES 4             // strings.dat sectors cached in RAM
+#define LIBRARY_HASH_SLOTS 1024         // shared strings remembered while writing, power of two
+#define LIBRARY_WINDOW 32               // menu rows core0 keeps loaded for core1
+#define LIBRARY_ROW_TEXT 64             // bytes of title, artist and album per row
+#define LIBRARY_MAX_DEPTH 8             // directory levels scanned
+#define LIBRARY_FILL_AHEAD 5            // rows either side of the highlight parsed first
+#define LIBRARY_SNAP_DIRS 2048          // directories the rescan snapshot covers, past that changes rebuild
+#define LIBRARY_DIRTY_DIRS 64           // changed directories a rescan takes on without a rebuild
+
+// track_rec_t.flags
+#define TRACK_PENDING 0x01              // listed, tags not parsed yet
+#define TRACK_UNPLAYABLE 0x02           // parsed, nothing we can decode
 
 extern mutex_t text_buff_mtx;
 extern semaphore_t text_sem;
@@ -82,6 +98,24 @@ extern bool album_art_ready;
 #define IMG_HEIGHT 160
 extern uint16_t img_buffer[IMG_WIDTH * IMG_HEIGHT];
 
+// How a track reaches the DAC
+typedef enum {
+    TRACK_CODEC, // SDI -> VS1053 -> I2S (MP3)
+    TRACK_PCM    // WAV/AIFF straight from the card over the RP2350's own I2S
+} track_format_t;
+
+// What the file turned out to be from its first bytes (metadata.c)
+typedef enum {
+    CONTAINER_UNKNOWN,
+    CONTAINER_MP3,
+    CONTAINER_FLAC, // needs the VS1053 FLAC plugin
+    CONTAINER_OGG,  // Vorbis only
+    CONTAINER_MP4,  // AAC in M4A/MP4, moov before mdat
+    CONTAINER_WAV,
+    CONTAINER_AIFF,
+    CONTAINER_NUM
+} track_container_t;
+
 typedef struct {
     uint32_t album_art_size;
     uint32_t album_art_offset;
@@ -93,15 +127,167 @@ typedef struct {
     uint8_t mpegID;
     uint8_t channels;
     uint8_t album_art_type;
+    uint8_t format;       // track_format_t
+    uint8_t container;    // track_container_t
+    uint32_t file_size;   // size and FAT date/time when parsed, library.c
+    uint32_t file_time;   // matches them against the card on the next boot
+    uint16_t id;          // position in the library
+    uint16_t track_no;    // on its album, 0 if the tags don't say
     char mime_type[32];
     char filename[256];
     char title[128];
     char artist[128];
     char album[128];
+    char album_artist[128]; // "" when untagged, browse falls back to artist
+    char genre[64];
 } track_info_t;
 
-extern track_info_t tracks[MAX_TRACKS];
-extern int count;
+// One library entry, strings are offsets into strings.dat (library.c)
+typedef struct {
+    uint32_t file_size;
+    uint32_t file_time;   // FAT date << 16 | time
+    uint32_t audio_start;
+    uint32_t audio_end;
+    uint32_t album_art_offset;
+    uint32_t album_art_size;
+    uint32_t header;
+    uint32_t dir;         // "" for the root, no leading or trailing '/'
+    uint32_t name;
+    uint32_t title;
+    uint32_t artist;
+    uint32_t album;
+    uint32_t mime_type;
+    uint32_t album_artist;
+    uint32_t genre;
+    uint16_t bitrate;
+    uint16_t samplespeed;
+    uint8_t mpegID;
+    uint8_t channels;
+    uint8_t album_art_type;
+    uint8_t format;
+    uint8_t container;
+    uint8_t flags;        // TRACK_PENDING, TRACK_UNPLAYABLE
+    uint16_t track_no;
+    uint32_t dir_crc;     // CRC32 of the dir string, what a rescan finds changed directories by
+    uint32_t crc;         // CRC32 of the bytes above, checked when its page is read. 80 bytes,
+                          // a page of them stays whole sectors
+} track_rec_t;
+
+extern int count; // tracks in the library
+
+// Browse orders kept next to the track table (library.c)
+typedef enum {
+    LIBRARY_BY_ARTIST, // artist, then album and track number inside one
+    LIBRARY_BY_ALBUM,  // album artist (or artist) and album, then track number
+    LIBRARY_BY_GENRE,  // genre, then artist, album and track number
+    LIBRARY_INDEX_NUM
+} library_index_t;
+
+// What the menu draws of one track, loaded by core0 so core1 never touches the card
+typedef struct {
+    volatile int32_t id;  // -1 while core0 rewrites it
+    uint8_t flags;        // of its track_rec_t
+    char title[LIBRARY_ROW_TEXT];
+    char artist[LIBRARY_ROW_TEXT];
+    char album[LIBRARY_ROW_TEXT];
+} library_row_t;
+
+// Page and string sector cache lookups since boot (library_print_stats())
+typedef struct {
+    uint32_t page_hits;
+    uint32_t page_misses;
+    uint32_t line_hits;
+    uint32_t line_misses;
+} library_cache_stats_t;
+
+// One decoded MPEG audio frame header
+typedef struct {
+    uint8_t version_bits; // 0 = MPEG 2.5, 2 = MPEG 2, 3 = MPEG 1
+    uint8_t layer_bits;   // 1 = Layer III, 2 = Layer II, 3 = Layer I
+    uint8_t channel_bits;
+    uint8_t padding;
+    uint16_t bitrate;     // kbps
+    uint16_t samplespeed; // Hz
+    uint16_t samples;     // PCM samples per channel in this frame
+    uint16_t frame_len;   // bytes including the header
+} mp3_frame_t;
+
+// MP3 seek index: Xing/Info TOC, VBRI table or a sparse frame table built while playing
+#define SEEK_INDEX_MAX_POINTS 512
+#define SEEK_INDEX_STRIDE 38 // frames per table entry to start with (~1 s of 44.1 kHz Layer III)
+#define SEEK_ALIGN_WALK_MAX (32 * 1024) // furthest seek_index_align() walks frame by frame
+
+typedef struct {
+    uint32_t frame;  // frame number from the first audio frame
+    uint32_t offset; // file offset of that frame's header
+} seek_point_t;
+
+typedef struct {
+    uint32_t base;          // file offset of the first frame (the Xing/VBRI frame when present)
+    uint32_t first_frame;   // file offset of the first audio frame
+    uint32_t audio_end;
+    uint16_t samplespeed;
+    uint16_t samples;       // samples per frame
+    uint16_t bitrate;       // kbps of the first frame, for estimates
+    uint8_t layer_bits;
+    bool has_toc;
+    uint8_t toc[100];       // Xing TOC
+    uint32_t total_frames;  // 0 if unknown
+    uint32_t total_bytes;   // 0 if unknown
+    seek_point_t points[SEEK_INDEX_MAX_POINTS];
+    uint16_t num_points;
+    uint16_t stride;        // frames between points, doubles when the table fills up
+    bool complete;          // table covers the whole file
+    // incremental frame scanner
+    uint32_t scan_frame;    // number of the next frame header to find
+    uint32_t scan_pos;      // file offset of the next frame header
+    uint8_t hdr[4];
+    uint8_t hdr_have;
+} seek_index_t;
+
+#define SD_SECTOR_SIZE 512
+
+// SD read-ahead, SD_STREAM_NUM_BLOCKS * SD_STREAM_BLOCK_SIZE bytes (8-32 KB is sensible)
+#define SD_STREAM_BLOCK_SIZE 4096 // multiple of 512 so refills are whole sectors
+#define SD_STREAM_NUM_BLOCKS 4
+// Cluster link map entries kept inline, (n - 1) / 2 fragments. Files that are
+// more fragmented than that get a heap table sized to fit.
+#define SD_STREAM_CLMT_LEN 64
+
+typedef struct {
+    FIL fil;
+    bool open;
+    bool eof;           // nothing left to read from the card
+    bool starved;
+    bool primed;        // ring has been full since the last open/seek
+    uint8_t blocks[SD_STREAM_NUM_BLOCKS][SD_STREAM_BLOCK_SIZE] __attribute__((aligned(4)));
+    uint16_t len[SD_STREAM_NUM_BLOCKS];
+    uint32_t pos[SD_STREAM_NUM_BLOCKS]; // file offset of each block
+    uint32_t head;      // blocks filled
+    uint32_t tail;      // blocks drained
+    uint32_t rd_off;    // drain offset inside the tail block
+    uint32_t fill_pos;  // file offset of the next read
+    uint32_t play_pos;  // file offset of the next byte handed to the codec
+    uint32_t end;       // stop reading here
+    uint32_t low_water; // fewest buffered bytes seen since open
+    uint32_t underruns; // times the codec ran dry before end of file
+    seek_index_t *index; // optional, gets every block read for frame scanning
+    DWORD clmt[SD_STREAM_CLMT_LEN]; // cluster link map for O(1) f_lseek
+    DWORD *clmt_heap;               // used instead when clmt is too small
+} sd_stream_t;
+
+// WAV/AIFF reader for the I2S ring, reads straight into the ring blocks
+typedef struct {
+    FIL fil;
+    bool open;
+    bool eof;
+    pcm_format_t fmt;
+    uint32_t pos;         // file offset of the next read
+    uint32_t end;         // end of the sample data
+    uint32_t start_frame; // frame playback (re)started at, for the play time
+    DWORD clmt[SD_STREAM_CLMT_LEN];
+    DWORD *clmt_heap;
+} pcm_stream_t;
 
 //CODEC
 typedef struct {
@@ -0,0 +1,75 @@
+#include "lib/sb_util/sb_util.h"
+
+/* ##########################################################
+IDLE: SLEEPING BETWEEN EVENTS
+While playback is paused or the song menu is up there is nothing to
+do until a button changes, a character comes in over USB or a timer
+runs out, so both cores wait on WFE instead of spinning. The button
+scan and the USB RX callback raise an event (SEV), interrupts (DREQ,
+DMA, timers) end a WFE by themselves, and idle_set()/idle_poke() SEV
+so core1 picks up a mode change or new menu selection at once.
+########################################################## */
+
+static volatile uint32_t usb_events;  // USB RX callbacks, ever
+static volatile uint32_t poke_events; // idle_set()/idle_poke() from core0
+static volatile bool idle_on;
+static uint32_t seen_buttons, seen_usb;
+
+static void usb_rx(void *param)
+{
+    usb_events++;
+    __sev();
+}
+
+void idle_init(void)
+{
+    stdio_set_chars_available_callback(usb_rx, NULL);
+    seen_buttons = buttons_get_events();
+    seen_usb = usb_events;
+}
+
+// Tells core1 whether the player is idle (paused, menu) so it can drop its frame rate
+void idle_set(bool on)
+{
+    if (idle_on == on)
+        return;
+    idle_on = on;
+    idle_poke();
+}
+
+bool idle_active(void)
+{
+    return idle_on;
+}
+
+// Something core1 draws changed (menu selection), wake it now
+void idle_poke(void)
+{
+    poke_events++;
+    __sev();
+}
+
+// Core0: sleeps until a button changes, USB has a character or ms have
+// passed. Input since the previous call counts too. True on input.
+bool idle_wait_input(uint32_t ms)
+{
+    absolute_time_t until = make_timeout_time_ms(ms);
+    while (buttons_get_events() == seen_buttons && usb_events == seen_usb)
+    {
+        if (best_effort_wfe_or_timeout(until))
+            return false;
+    }
+    seen_buttons = buttons_get_events();
+    seen_usb = usb_events;
+    return true;
+}
+
+// Core1: paces a redraw loop. Sleeps until *next or until core0 pokes,
+// then moves *next period_ms on from now.
+void idle_pace(absolute_time_t *next, uint32_t period_ms)
+{
+    uint32_t poke = poke_events;
+    while (poke_events == poke && !best_effort_wfe_or_timeout(*next))
+        ;
+    *next = make_timeout_time_ms(period_ms);
+}
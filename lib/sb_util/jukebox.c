@@ -18,6 +18,11 @@ volatile uint16_t potVal = 0;
 #define PAUSE_WARP_US 600000   // 0.7 seconds for pause
 #define RESUME_WARP_US 1200000 // 1.2 seconds for resume
 #define SKIP_INTERVAL_MS 100   // minimum interval between FF/RW jumps
+#define GAPLESS_PREFETCH_MS 3000 // open the next track this long before the end
+#define SCRUB_STEP_MS 1000       // hold time before scrubbing goes to the next speed
+#define SCRUB_JUMP_MS 250        // jump period for speeds past VS1053_MAX_PLAY_SPEED
+
+static const uint16_t scrub_speeds[] = {2, 4, 8};
 
 int selected_band = 0;
 uint16_t *playStatus = empty_icon;
@@ -35,20 +40,251 @@ int history_index = 0;
 int num_visualizations = 6;
 bool album_art_ready = false;
 
+bool gapless = true; // splice the next track straight into the codec feed
+
+// Two read-aheads so the next track can be opened while this one plays out
+static sd_stream_t streams[2];
+static seek_index_t seek_idxs[2];
+static int active = 0;
+static sd_stream_t *stream = &streams[0];      // read-ahead between the SD card and the codec feed
+static seek_index_t *seek_idx = &seek_idxs[0]; // time <-> offset map for the playing track
+static track_info_t next_track;                // library_get() copy of the one after this
+static track_info_t *prefetched = NULL;        // track already open in the other slot
+static bool streaming = false;                 // jukebox_service() may feed the codec
+
+// Opens a track into one of the slots and positions it at the first audio byte
+static bool open_track(int slot, track_info_t *track)
+{
+    return gapless_open(&streams[slot], &seek_idxs[slot], track);
+}
+
+static void close_streams(void)
+{
+    streaming = false;
+    sd_stream_close(&streams[0]);
+    sd_stream_close(&streams[1]);
+    prefetched = NULL;
+}
+
+// Parses the track after this one early, while the read-ahead is full and
+// the whole track is left to catch up, so prefetch_next() finds it ready
+static void resolve_next(track_info_t *track)
+{
+    if (count >= 2)
+        library_resolve((track->id + 1) % count);
+}
+
+// Opens the track after this one and fills its read-ahead so it can be
+// spliced into the feed the moment this one runs out. Nothing is parsed
+// here, a next track resolve_next() didn't get to is left to main().
+static void prefetch_next(track_info_t *track)
+{
+    if (count < 2)
+        return;
+    track_info_t *next = &next_track;
+    int id = (track->id + 1) % count;
+    if (!library_ready(id))
+        return; // main() steps over it the slow way
+    library_get(id, next);
+    if (!gapless_fits(track, next))
+        return;
+
+    absolute_time_t t0 = get_absolute_time();
+    if (!gapless_prefetch(&streams[active ^ 1], &seek_idxs[active ^ 1], next, stream))
+        return;
+    prefetched = next;
+    printf("\r\nGapless: prefetched %s (%lld us)\r\n", next->filename, absolute_time_diff_us(t0, get_absolute_time()));
+}
+
+static absolute_time_t switch_start; // button press of the last next/prev
+static bool switch_pending = false;   // waiting for the new track to reach the decoder
+
+// Fast next/prev: drop the queued data and cancel the decoder instead of
+// hard-pausing it, the new track can start as soon as SM_CANCEL clears
+static int switch_track(vs1053_t *player, int exitType)
+{
+    switch_start = get_absolute_time();
+    switch_pending = true;
+    close_streams();
+    vs1053_feed_flush();
+    bool clean = vs1053_stop(player);
+    printf("Cancel %s in %lld us\r\n", clean ? "done" : "needed a reset",
+           absolute_time_diff_us(switch_start, get_absolute_time()));
+    return exitType;
+}
+
+/* A-B loop: frames [a, b) are replayed until the loop is cleared. Loops
+   that fit in ab_cache play from RAM and leave the SD card alone, longer
+   ones stream up to b and fast-seek back to a. */
+#define AB_LOOP_CACHE_SIZE (64 * 1024)
+
+typedef enum {
+    AB_OFF,
+    AB_MARKED, // A set, waiting for B
+    AB_RAM,    // looping from ab_cache
+    AB_STREAM  // looping from the card
+} ab_mode_t;
+
+static struct {
+    ab_mode_t mode;
+    uint32_t a, b;      // frame aligned file offsets
+    uint32_t len;       // b - a
+    uint32_t off;       // next ab_cache byte for the feed ring (AB_RAM)
+    uint32_t saved_end; // stream end before AB_STREAM moved it to b
+    uint32_t passes;
+} ab;
+static uint8_t ab_cache[AB_LOOP_CACHE_SIZE];
+
+// File offset of the byte the codec is about to get
+static uint32_t play_pos(void)
+{
+    uint32_t queued = vs1053_feed_level();
+    if (ab.mode == AB_RAM)
+        return ab.a + (ab.off + ab.len - queued % ab.len) % ab.len;
+    uint32_t pos = sd_stream_tell(stream);
+    return pos > queued ? pos - queued : 0;
+}
+
+// Moves ab_cache into the feed ring, wrapping at b
+static void ab_pump(void)
+{
+    while (1)
+    {
+        ab.off += vs1053_feed_submit(&ab_cache[ab.off], ab.len - ab.off);
+        if (ab.off < ab.len)
+            break; // feed ring is full
+        ab.off = 0;
+        ab.passes++;
+    }
+}
+
+// Drops the loop without touching playback (the caller seeks)
+static void ab_cancel(void)
+{
+    if (ab.mode == AB_STREAM)
+        sd_stream_set_end(stream, ab.saved_end);
+    ab.mode = AB_OFF;
+}
+
+// 'a': mark A, mark B (starts looping), clear the loop
+static void ab_mark(void)
+{
+    uint32_t pos = seek_index_align(seek_idx, stream, play_pos());
+
+    switch (ab.mode)
+    {
+    case AB_OFF:
+        ab.a = pos;
+        ab.mode = AB_MARKED;
+        printf("\r\nA-B: A at %lu ms\r\n", (unsigned long)seek_index_time(seek_idx, pos));
+        break;
+
+    case AB_MARKED:
+        if (pos <= ab.a)
+        {
+            printf("\r\nA-B: B has to come after A\r\n");
+            break;
+        }
+        ab.b = pos;
+        ab.len = ab.b - ab.a;
+        ab.off = 0;
+        ab.passes = 0;
+        vs1053_feed_flush(); // jump straight back to A
+        if (ab.len <= sizeof(ab_cache) && sd_stream_read_at(stream, ab.a, ab_cache, ab.len) == ab.len)
+        {
+            ab.mode = AB_RAM;
+            printf("\r\nA-B: looping %lu bytes from RAM\r\n", (unsigned long)ab.len);
+        }
+        else
+        {
+            ab.mode = AB_STREAM;
+            ab.saved_end = stream->end;
+            sd_stream_set_end(stream, ab.b);
+            sd_stream_seek(stream, ab.a);
+            printf("\r\nA-B: looping %lu bytes from the card\r\n", (unsigned long)ab.len);
+        }
+        break;
+
+    default:
+    {
+        // carry on from wherever the loop is, past B this time
+        bool from_ram = ab.mode == AB_RAM;
+        pos = seek_index_align(seek_idx, stream, play_pos());
+        printf("\r\nA-B: off after %lu passes\r\n", (unsigned long)ab.passes);
+        ab_cancel();
+        if (from_ram)
+        {
+            vs1053_feed_flush();
+            sd_stream_seek(stream, pos);
+        }
+        break;
+    }
+    }
+}
+
+// Keeps the codec fed: from the A-B cache or the SD read-ahead
+static void feed_audio(void)
+{
+    if (ab.mode == AB_RAM)
+    {
+        ab_pump();
+        return;
+    }
+    sd_stream_fill(stream);
+    sd_stream_pump(stream);
+    if (ab.mode == AB_STREAM && sd_stream_done(stream))
+    {
+        sd_stream_seek(stream, ab.a); // CLMT makes this a table lookup
+        ab.passes++;
+    }
+}
+
+// Keeps the codec fed while the main loop is stuck in something slow (album art)
+void jukebox_service(void)
+{
+    if (streaming && !paused)
+        feed_audio();
+}
+
+// Jump to ms into the playing track, drops whatever is still queued
+void seek_to_ms(uint32_t ms)
+{
+    uint32_t pos = play_pos();
+    uint32_t now = seek_index_time(seek_idx, pos);
+    uint32_t off = seek_index_offset(seek_idx, ms);
+
+    // the map is coarse between index points; a forward seek must still move
+    // forward, so fall back to the bitrate from here if it landed behind us
+    if (ms > now && off <= pos)
+        off = MIN(pos + (uint64_t)(ms - now) * seek_idx->bitrate / 8, stream->end);
+
+    ab_cancel();
+    vs1053_feed_flush();
+    sd_stream_seek(stream, off);
+}
+
+// Play time of the byte the codec is about to get
+uint32_t elapsed_ms(void)
+{
+    return seek_index_time(seek_idx, play_pos());
+}
+
 int jukebox(vs1053_t *player, track_info_t *track, st7789_t *display)
 {
-    album_art_ready = false;
+#if I2S_OUT_PINS_CONFIRMED
+    if (track->format == TRACK_PCM)
+    {
+        close_streams();
+        return pcm_jukebox(player, track, display); // WAV/AIFF skip the codec
+    }
+#endif
 
-    FIL fil;             // file object
-    UINT br;             // pointer to number of bytes read
-    uint8_t buffer[512]; // buffer read from file
+    album_art_ready = false;
 
     char *filename = track->filename;
     uint16_t sampleSpeed = track->samplespeed;
-    uint16_t bitRate = track->bitrate;
-    uint32_t skip_bits = bitRate * 256; // bitrate * 1024 / 4 = approx. 2 seconds
     int exitType = 0;
-    sci_write(player, 0x05, sampleSpeed + 1); // initialize codec sampling speed (+1 at the end for stereo)
+    bool spliced = prefetched && prefetched->id == track->id; // previous call already spliced it into the feed
 
     // status bits for player state and warp effect
     paused = false;
@@ -56,43 +292,62 @@ int jukebox(vs1053_t *player, track_info_t *track, st7789_t *display)
     warping = false;
     stopped = 0;
     enableIcons = true;
+    ab.mode = AB_OFF;
 
-    // more warp effect stuff
-    float transport = 1.0f;                  // desired speed
-    float warp_start_transport = 1.0f;       // start speed for warp
-    float warp_target = 1.0f;                // target speed for warp
-    uint32_t warp_duration = RESUME_WARP_US; // warp effect duration
-    absolute_time_t warp_start_time;
-
-    // open selected MP3 file
-    if (f_open(&fil, filename, FA_READ) != FR_OK)
+    if (spliced)
+    {
+        prefetched = NULL;
+        streaming = true;
+    }
+    else
     {
-        printf("Failed to open %s\r\n", filename);
-        return exitType;
+        close_streams();
+        // open selected MP3 file
+        if (!open_track(active, track))
+        {
+            printf("Failed to open %s\r\n", filename);
+            return exitType;
+        }
     }
 
-    uint16_t stereo_bit = sampleSpeed & 1;     // LSB indicates mono or stereo (not exactly sure what but this is pretty much always 1)
+    uint16_t stereo_bit = 1;                   // SCI_AUDATA LSB: stereo (what the old sampleSpeed + 1 write meant)
     uint16_t base_rate = sampleSpeed & 0xFFFE; // sampling speed in upper 15 bits
+    if (spliced)
+        vs1053_transport_resume(base_rate, stereo_bit); // same rate, already in the codec
+    else
+        vs1053_transport_start(base_rate, stereo_bit); // initialize codec sampling speed, warps bend it from a timer
     album_art_ready = false;
     if (track->album_art_size > 0 && visualizer == 0)
     {
         process_image(track, filename, 160); // fills frame_buffer
         album_art_ready = true;
     }
-    uint32_t start = find_audio_start(&fil);
-    f_lseek(&fil, start);
+    uint32_t duration = seek_index_duration(seek_idx);
     absolute_time_t last_skip_time = get_absolute_time();
 
+    vs1053_feed_set_paused(false);
+
     selected_band = 0;
     int currEq = 0;
-    dac_eq_init(sampleSpeed); // init with default sample rate
+    if (!spliced)
+        dac_eq_init(sampleSpeed); // init with default sample rate
+    streaming = true;
+    bool prefetch_tried = false;
+    bool next_resolved = false;
+    bool scrubbing = false;
+    uint16_t scrub_speed = 0;
+    absolute_time_t scrub_start, last_jump;
     uint8_t vol_check = 10;
     uint8_t old_volume = 0;
     read_lwbt();
     while (1)
     {
-        // janky counter for volume sampling
-        if (vol_check == 10) {
+        // fully paused: nothing moves until input, so sleep between passes (see idle.c)
+        bool idle = paused && !warping;
+        idle_set(idle);
+
+        // janky counter for volume sampling (every pass while idle, passes are slow then)
+        if (vol_check == 10 || idle) {
             uint16_t vol = (uint32_t)potVal * 0x60 / 4096;
             ff_rew_status = empty_icon; //update ff/rew icon every 10 as well
             // Only update DAC if the change is larger than the noise (hysteresis)
@@ -109,6 +364,7 @@ int jukebox(vs1053_t *player, track_info_t *track, st7789_t *display)
 
         // --- 2. MUSIC FEEDING (Priority) ---
         // The rest of your jukebox logic remains here...
+        vs1053_stats_poll(); // health line once a second while 'h' has it on
         int c = getchar_timeout_us(0); // nonblocking getchar
 
         // get value from buttons
@@ -116,24 +372,27 @@ int jukebox(vs1053_t *player, track_info_t *track, st7789_t *display)
         {
             char temp_btn = buttons_map_to_char_jukebox();
             char btn_char = get_button_repeat(temp_btn);
+            if (btn_char == 'f')
+                btn_char = 0; // held Select+Right scrubs instead of jumping (see below)
             if (btn_char != 0)
                 c = (int)btn_char; // Inject the button character into the logic
         }
 
         //progress bar (should make seperate function)
-        long song_pos = f_tell(&fil);
-        float progress = (float)(song_pos - track->audio_start) / (float)(track->audio_end - track->audio_start);
-        if (progress < 0.0f)
-            progress = 0.0f;
-        if (progress > 1.0f)
-            progress = 1.0f;
-        prev_progress_bar = progress_bar;
-        progress_bar = 240 * progress;
-        bool update_bar = prev_progress_bar != progress_bar;
+        // the position only moves while playing or when a key seeks
+        if (!idle || c != PICO_ERROR_TIMEOUT)
+        {
+            if (seek_idx->complete)
+                duration = seek_index_duration(seek_idx); // exact once the whole file was scanned
+            float progress = duration ? (float)elapsed_ms() / (float)duration : 0.0f;
+            if (progress > 1.0f)
+                progress = 1.0f;
+            prev_progress_bar = progress_bar;
+            progress_bar = 240 * progress;
+        }
 
         if (c != PICO_ERROR_TIMEOUT)
         {
-            long pos = f_tell(&fil);
             // bool headphonesIn = dac_read(0, 0x43) & 0x20;
             // printf("Headphone prescence: %d\r\n", headphonesIn);
             absolute_time_t now = get_absolute_time();
@@ -161,39 +420,32 @@ int jukebox(vs1053_t *player, track_info_t *track, st7789_t *display)
             case 'n':
             case 'N':
                 exitType = 1;
-                vs1053_set_play_speed(player, 0); // hard pause
                 printf("\r\n Going to next song....\r\n");
-                f_close(&fil);
-                vs1053_stop(player);
-                return exitType;
+                return switch_track(player, exitType);
             case 'o':
             case 'O':
-                uint8_t seconds_into_song = (f_tell(&fil) - track->audio_start) / (track->bitrate * 125);
+                uint32_t seconds_into_song = elapsed_ms() / 1000;
                 if (seconds_into_song >= 5){
-                    pos = 0;
-                    f_lseek(&fil, pos);
+                    seek_to_ms(0);
                     break;
                 } else {
                     exitType = 2;
-                    vs1053_set_play_speed(player, 0); // hard pause
-                    printf("\r\n Going to next song....\r\n");
-                    f_close(&fil);
-                    vs1053_stop(player);
-                    return exitType;
+                    printf("\r\n Going to previous song....\r\n");
+                    return switch_track(player, exitType);
                 }
             case 'p':
             case 'P':
                 paused = !paused;                      // set paused flag
-                warp_start_time = get_absolute_time(); // get timestamp for warp start
-                warp_start_transport = transport;      //
-                warp_target = paused ? 0.0f : 1.0f;
+                if (!paused)
+                    vs1053_feed_set_paused(false);     // let queued data flow again
+                // tape spins down exponentially and eases back up
+                vs1053_transport_warp(paused ? 0.0f : 1.0f,
+                                      paused ? PAUSE_WARP_US : RESUME_WARP_US,
+                                      paused ? TRANSPORT_EXP : TRANSPORT_SCURVE);
                 warping = true;
                 if (paused) playStatus = pause_icon;
                 else playStatus = play_icon;
 
-                // select duration based on pause/resume
-                warp_duration = paused ? PAUSE_WARP_US : RESUME_WARP_US;
-
                 printf(paused ? "\r\nTape slowing...\r\n"
                               : "\r\nTape resuming...\r\n");
                 break;
@@ -202,11 +454,12 @@ int jukebox(vs1053_t *player, track_info_t *track, st7789_t *display)
                 if (absolute_time_diff_us(last_skip_time, now) >= SKIP_INTERVAL_MS * 1000)
                 {
                     ff_rew_status = ff_icon;
-                    pos += skip_bits;
-                    if (pos > f_size(&fil))
-                        pos = f_size(&fil) - 1;
-                    f_lseek(&fil, pos);
-                    printf("\r\nFast-forwarded ~2s\r\n");
+                    uint32_t target = elapsed_ms() + 2000;
+                    if (duration && target > duration)
+                        target = duration;
+                    absolute_time_t seek_start = get_absolute_time();
+                    seek_to_ms(target);
+                    printf("\r\nFast-forwarded to %lu ms (seek %lld us)\r\n", (unsigned long)target, absolute_time_diff_us(seek_start, get_absolute_time()));
                     last_skip_time = now;
                 }
                 break;
@@ -215,11 +468,11 @@ int jukebox(vs1053_t *player, track_info_t *track, st7789_t *display)
                 if (absolute_time_diff_us(last_skip_time, now) >= SKIP_INTERVAL_MS * 1000)
                 {
                     ff_rew_status = rew_icon;
-                    pos -= skip_bits;
-                    if (pos < 0)
-                        pos = 0;
-                    f_lseek(&fil, pos);
-                    printf("\r\nRewound ~2s\r\n");
+                    uint32_t now_ms = elapsed_ms();
+                    uint32_t target = now_ms > 2000 ? now_ms - 2000 : 0;
+                    absolute_time_t seek_start = get_absolute_time();
+                    seek_to_ms(target);
+                    printf("\r\nRewound to %lu ms (seek %lld us)\r\n", (unsigned long)target, absolute_time_diff_us(seek_start, get_absolute_time()));
                     last_skip_time = now;
                 }
                 break;
@@ -246,6 +499,7 @@ int jukebox(vs1053_t *player, track_info_t *track, st7789_t *display)
             case 'v':
             case 'V':
                 visualizer = (visualizer + 1) % (num_visualizations - 1);
+                idle_poke(); // don't leave a paused core1 on the old one for a frame
                 if (visualizer == 0 && !album_art_ready && track->album_art_size > 0)
                 {
                     process_image(track, filename, 160);
@@ -283,17 +537,55 @@ int jukebox(vs1053_t *player, track_info_t *track, st7789_t *display)
                 printf("  Title : %s\r\n", track->title);
                 printf("  Artist: %s\r\n", track->artist);
                 printf("  Album : %s\r\n", track->album);
+                printf("  Album artist: %s\r\n", track->album_artist);
+                printf("  Genre : %s\r\n", track->genre);
+                printf("  Track : %u\r\n", track->track_no);
                 printf("  Bitrate : %d Kbps\r\n", track->bitrate);
                 printf("  Sample rate : %d Hz\r\n", track->samplespeed);
                 printf("  Channels : %s\r\n", track->channels == 1 ? "Mono" : "Stereo");
                 printf("  Album Art Size: %lu\r\n", (unsigned long)track->album_art_size);
                 printf("  Mime Type: %s\r\n", track->mime_type);
                 printf("  Header: %X\r\n", track->header);
+                printf("  Container: %s\r\n", container_name(track->container));
+                printf("  Read-ahead: %lu/%u bytes (low %lu, underruns %lu)\r\n",
+                       (unsigned long)sd_stream_level(stream),
+                       SD_STREAM_NUM_BLOCKS * SD_STREAM_BLOCK_SIZE,
+                       (unsigned long)stream->low_water,
+                       (unsigned long)stream->underruns);
+                printf("  Position: %lu / %lu ms (%u seek points, %s)\r\n",
+                       (unsigned long)elapsed_ms(), (unsigned long)duration, seek_idx->num_points,
+                       seek_idx->has_toc ? "Xing TOC" : seek_idx->complete ? "full table" : "scanning");
+                printf("  SPI1 profile switches: %lu\r\n", (unsigned long)spi_bus_switches());
+                vs1053_stats_print();
+                break;
+            case 'h':
+            case 'H':
+                vs1053_stats_set_dump(!vs1053_stats_dump_enabled());
+                printf("\r\nPlayback health dump %s\r\n", vs1053_stats_dump_enabled() ? "on" : "off");
+                break;
+            case 'c':
+            case 'C':
+                library_invalidate();
+                printf("\r\nLibrary index dropped, the next boot scans every file\r\n");
                 break;
             case 'm':
             case 'M':
                 enableIcons = !enableIcons;
                 break;
+            case 'a':
+            case 'A':
+                ab_mark();
+                break;
+            case 'g':
+            case 'G':
+                gapless = !gapless;
+                printf("\r\nGapless %s\r\n", gapless ? "on" : "off");
+                break;
+            case 'b':
+            case 'B':
+                library_index_print(LIBRARY_BY_ARTIST, track->artist);
+                library_print_stats();
+                break;
             case 's':
             case 'S':
                 if (paused)
@@ -301,15 +593,13 @@ int jukebox(vs1053_t *player, track_info_t *track, st7789_t *display)
                     exitType = 0;
                     vs1053_set_play_speed(player, 0); // hard pause
                     printf("\r\nStopping....\r\n");
-                    f_close(&fil);
+                    close_streams();
+                    vs1053_feed_flush();
                     vs1053_stop(player);
                     return exitType;
                 }
                 stopped = 1;
-                warp_start_time = get_absolute_time();
-                warp_start_transport = transport;
-                warp_target = 0.0f;
-                warp_duration = PAUSE_WARP_US;
+                vs1053_transport_warp(0.0f, PAUSE_WARP_US, TRANSPORT_EXP);
                 warping = true;
                 album_art_ready = false;
                 printf("Stopping...\r\n");
@@ -319,7 +609,8 @@ int jukebox(vs1053_t *player, track_info_t *track, st7789_t *display)
                     exitType = 0;
                     vs1053_set_play_speed(player, 0); // hard pause
                     printf("\r\nStopping....\r\n");
-                    f_close(&fil);
+                    close_streams();
+                    vs1053_feed_flush();
                     vs1053_stop(player);
                     return exitType;
                 }
@@ -327,65 +618,133 @@ int jukebox(vs1053_t *player, track_info_t *track, st7789_t *display)
         }
 
         // Always feed decoder unless fully paused
+        // (the SDI feeder drains the ring from DREQ/DMA interrupts, we only keep
+        // the read-ahead full and move it across)
         if (!paused || warping)
         {
-            if (f_read(&fil, buffer, sizeof(buffer), &br) != FR_OK || br == 0)
+            feed_audio();
+            bool looping = ab.mode == AB_RAM || ab.mode == AB_STREAM;
+            if (gapless && !next_resolved && !warping &&
+                (stream->eof || sd_stream_level(stream) >= (SD_STREAM_NUM_BLOCKS - 1) * SD_STREAM_BLOCK_SIZE))
+            {
+                next_resolved = true;
+                resolve_next(track);
+            }
+            if (gapless && !prefetch_tried && !warping && !looping &&
+                (stream->eof || (duration && elapsed_ms() + GAPLESS_PREFETCH_MS >= duration)))
+            {
+                prefetch_tried = true;
+                prefetch_next(track);
+            }
+            if (!looping && sd_stream_done(stream))
             {
-                exitType = 1; // Default return when no bytes read (end of song)
+                exitType = 1; // Default return when the whole file went out (end of song)
                 break;
             }
+        }
+
+        // background plugins go in a slice at a time once the first audio came out
+        if (!idle && vs1053_plugins_pending() && vs1053_decoding(player))
+            vs1053_plugins_service(player);
+
+        if (switch_pending && vs1053_decoding(player))
+        {
+            switch_pending = false;
+            printf("\r\nTrack switch: %lld us from button to first audio\r\n",
+                   absolute_time_diff_us(switch_start, get_absolute_time()));
+        }
+
+        // --- Scrub: hold Select+Right ---
+        // PlaySpeed makes the decoder skip through the stream itself, the read-ahead just keeps
+        // streaming faster. Past what the decoder manages we add index jumps on top.
+        bool scrub_held = !paused && !warping &&
+                          (~buttons_get_raw_state() & (BTN_SELECT | BTN_R)) == (BTN_SELECT | BTN_R);
+        if (scrub_held && !scrubbing)
+        {
+            scrubbing = true;
+            scrub_speed = 0;
+            scrub_start = get_absolute_time();
+        }
+        if (scrubbing && !scrub_held)
+        {
+            scrubbing = false;
+            vs1053_set_play_speed(player, 1);
+            printf("\r\nScrub off\r\n");
+        }
+        else if (scrubbing)
+        {
+            absolute_time_t now = get_absolute_time();
+            uint32_t step = absolute_time_diff_us(scrub_start, now) / (SCRUB_STEP_MS * 1000);
+            if (step >= count_of(scrub_speeds))
+                step = count_of(scrub_speeds) - 1;
+            uint16_t speed = scrub_speeds[step];
+            uint16_t codec_speed = MIN(speed, VS1053_MAX_PLAY_SPEED);
 
-            vs1053_play_data(player, buffer, br);
+            if (speed != scrub_speed)
+            {
+                scrub_speed = speed;
+                last_jump = now;
+                vs1053_set_play_speed(player, codec_speed);
+                printf("\r\nScrub %ux\r\n", speed);
+            }
+            if (speed > codec_speed && absolute_time_diff_us(last_jump, now) >= SCRUB_JUMP_MS * 1000)
+            {
+                // cover the rest of the speed with a jump for every SCRUB_JUMP_MS of wall time
+                seek_to_ms(elapsed_ms() + SCRUB_JUMP_MS * (speed - codec_speed));
+                last_jump = now;
+            }
+            ff_rew_status = ff_icon;
         }
 
         // --- Warp logic ---
-        if (warping)
+        // (the transport engine bends the rate from its timer, we only act when it lands)
+        if (warping && !vs1053_transport_busy())
         {
-            int64_t elapsed = absolute_time_diff_us(warp_start_time, get_absolute_time());
+            warping = false;
 
-            if (elapsed >= warp_duration)
+            if (paused)
             {
-                transport = warp_target;
-                warping = false;
-
-                if (paused)
-                {
-                    vs1053_set_play_speed(player, 0); // hard pause
-                    printf("\r\nPaused.\r\n");
-                }
-                else if (stopped)
-                {
-                    vs1053_set_play_speed(player, 0); // hard pause
-                    printf("\r\nPaused.\r\n");
-                    f_close(&fil);
-                    vs1053_stop(player);
-                    return 0;
-                }
+                vs1053_set_play_speed(player, 0); // hard pause
+                vs1053_feed_set_paused(true);     // hold the rest of the ring for resume
+                printf("\r\nPaused.\r\n");
             }
-            else
+            else if (stopped)
             {
-                float t = (float)elapsed / (float)warp_duration;
-                transport = warp_start_transport +
-                            (warp_target - warp_start_transport) * t;
+                vs1053_set_play_speed(player, 0); // hard pause
+                printf("\r\nPaused.\r\n");
+                close_streams();
+                vs1053_feed_flush();
+                vs1053_stop(player);
+                return 0;
             }
         }
-
-        // --- Apply playback rate + volume ---
-        if (!paused || warping)
+        else if (!warping && vs1053_transport_busy())
         {
-            uint16_t new_rate = (uint16_t)(base_rate * transport) & 0xFFFE;
-            if (new_rate < 9000)
-                new_rate = 9000;
-            sci_write(player, 0x05, new_rate | stereo_bit);
-
-            // volume scales with transport
-            // uint8_t vol = (uint8_t)(0xFE * (1.0f - transport));
-            // if (vol > 0xFE) vol = 0xFE;
-            // vs1053_set_volume(player, vol, vol);
+            vs1053_transport_cancel(); // paused without warping (headphone interrupt)
         }
+
+        if (idle && c == PICO_ERROR_TIMEOUT && !library_fill_step(track->id))
+            idle_wait_input(IDLE_WAIT_MS); // buttons, USB or the pot check wake us
+    }
+
+    if (scrubbing)
+        vs1053_set_play_speed(player, 1); // ran off the end while scrubbing
+
+    if (prefetched != NULL)
+    {
+        // splice: the next track's first bytes go in right behind this one's last,
+        // no cancel, no reset, no drain
+        size_t queued = gapless_splice(stream, &streams[active ^ 1]);
+        active ^= 1;
+        stream = &streams[active];
+        seek_idx = &seek_idxs[active];
+        printf("\r\nGapless: spliced with %u bytes still queued\r\n", (unsigned)queued);
+        return 3;
     }
 
-    f_close(&fil);
+    close_streams();
+    vs1053_feed_drain(); // let the tail of the song play out
+    vs1053_end_fill(player); // and push the last frame out of the decoder
     // exitType = 0; //plays next song if song just ends
     return exitType;
 }
@@ -0,0 +1,2247 @@
+#include "lib/sb_util/sb_util.h"
+#include "hardware/sync.h"
+#include <stddef.h>
+
+/* ##########################################################
+LIBRARY: EVERY PLAYABLE FILE ON THE CARD, IN CONSTANT RAM
+The track table lives on the card. LIBRARY_TRACKS is one header
+sector, then fixed size track_rec_t records in id order (sorted by
+path). Their strings are offsets into LIBRARY_STRINGS. RAM holds
+LIBRARY_PAGES pages of records (LRU, written back when dirty), a few
+sectors of strings and the LIBRARY_WINDOW menu rows core0 loads for
+core1, the same whether the card has 50 tracks or 50,000.
+
+library_scan() walks the card (LIBRARY_MAX_DEPTH deep) and CRCs the
+path, size and timestamp of every audio file. If that matches the
+table, it's done. The same walk signs every directory (its audio
+files and its own timestamp) and diffs that against LIBRARY_DIRS, the
+snapshot of the last scan, which is tied to the table's epoch and the
+volume serial. If only a few directories changed, update() lists just
+those, sorted, and merges them into the table: records elsewhere are
+copied over a page at a time without their strings being read, and
+strings.dat is only appended to. Listing and parsing go with the
+changed files, only that copy goes with the library, and the fill
+steps go straight to the records it left pending. Otherwise rebuild() lists
+every file into runs sorted in RAM, merges the runs on the card and
+joins the result with the old table. Either way unchanged records keep
+their tags and new or changed files become TRACK_PENDING. A rebuild
+only copies the strings still in use, so it compacts strings.dat too,
+and one is forced every LIBRARY_MAX_UPDATES updates.
+library_fill_step() parses pending tracks when the menu or a paused
+jukebox has nothing else to do, the highlighted track and the rows
+around it first. library_resolve() parses one on the spot when it's
+about to play, library_ready() only looks.
+
+A new table is written as .tmp files and renamed over the old one.
+Both files carry the same epoch, a pair that doesn't match (card
+pulled between the renames) is rebuilt rather than misread.
+
+Every record carries a CRC32 of itself, checked whenever its page is
+read. A record that fails reads as an empty, unplayable one, and the
+next fill step rescans: the rebuild joins the rest of the old table as
+usual and lists the damaged records' files again as pending. strings.dat
+is only ever appended to, so the header keeps a running CRC32 of it,
+and once nothing is pending the fill steps read it back a few sectors
+at a time against that. If it fails, no tag can be trusted and the
+table is rebuilt from nothing. digest is a different thing, the CRC of
+the card listing, and only says whether the table is current.
+
+Once nothing is pending the tags can't change any more, and the
+fill steps go on to build the browse indices, one per step, through
+the same external sort: one file per library_index_t with a (track id, track number)
+entry per playable track in key order, then a record per distinct
+name pointing at its first entry, and a jump table to the first name
+at each letter. Opening a letter or a name is a binary search over
+the name records, O(log n) sector reads whatever the card holds.
+########################################################## */
+
+#define LIBRARY_MAGIC 0x494C4253               // "SBLI"
+#define LIBRARY_STR_MAGIC 0x53534253           // "SBSS"
+#define LIBRARY_INDEX_MAGIC 0x58494253         // "SBIX"
+#define LIBRARY_DIRS_MAGIC 0x53444253          // "SBDS"
+#define LIBRARY_DATA_OFFSET SD_SECTOR_SIZE     // records start on a sector, so every page does
+#define LIBRARY_PAGE_BYTES (LIBRARY_PAGE_RECS * sizeof(track_rec_t))
+#define LIBRARY_SAVE_EVERY 128                 // parses between writing dirty pages back
+#define LIBRARY_MERGE_WAYS 4                   // sorted runs merged in one go
+#define LIBRARY_FILL_SCAN (2 * LIBRARY_PAGE_RECS) // records a fill step looks through for pending ones
+#define LIBRARY_MAX_UPDATES 16                 // incremental updates before a rebuild compacts strings.dat
+#define LIBRARY_RESCAN LIBRARY_SORT_B          // paths of the changed directories, until update() listed them
+#define LIBRARY_CHECK_BYTES (4 * SD_SECTOR_SIZE) // of strings.dat a fill step reads back against its CRC
+#define LIBRARY_OUT_SLOT (LIBRARY_PAGES - 1)   // page a rebuild or update collects the new records in
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t rec_size;   // sizeof(track_rec_t) when it was written
+    uint32_t count;
+    uint32_t pending;    // TRACK_PENDING records as of the last write-back
+    uint32_t digest;     // CRC32 of the card listing the table was built from
+    uint32_t epoch;      // new with every change of the table
+    uint32_t cold_ms;    // listing plus parsing of every file from nothing, for the boot report
+    uint32_t strings_epoch; // strings.dat carries the same one, updates keep it
+    uint32_t updates;    // since the last rebuild
+    uint32_t strings_size; // of strings.dat as of the last write-back
+    uint32_t strings_crc;  // CRC32 of those bytes past its strings_header_t
+} library_header_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t epoch;
+} strings_header_t; // refs below sizeof() read as ""
+
+// Browse index file: this, entries from LIBRARY_DATA_OFFSET on, then the groups
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t kind;       // library_index_t
+    uint32_t epoch;      // of the table it was built from
+    uint32_t tracks;     // index_entry_t
+    uint32_t groups;     // index_group_t
+    uint32_t jump[26];   // first group whose name starts at or after 'a' + i
+} index_header_t;
+
+typedef struct {
+    uint16_t id;
+    uint16_t track_no;
+} index_entry_t;
+
+// Tracks sharing a name (case-insensitive): artist, album artist and album, genre
+typedef struct {
+    uint32_t ref[2];     // name in strings.dat, the album after its artist for LIBRARY_BY_ALBUM
+    uint32_t first;      // entry
+} index_group_t;
+
+// LIBRARY_DIRS: this, then a dir_sig_t per directory sorted by path CRC
+typedef struct {
+    uint32_t magic;
+    uint32_t epoch;      // of the table it describes
+    uint32_t serial;     // volume serial number, a reformatted card starts over
+    uint32_t count;
+} dirs_header_t;
+
+typedef struct {
+    uint32_t path;       // CRC32 of the path, "" for the root
+    uint32_t sig;        // what walk() made of its contents
+} dir_sig_t;
+
+// Index keys are the group's name, then INDEX_SUB and what orders the
+// tracks inside it. Both separators sort below any text.
+#define INDEX_SUB '\x01'
+#define INDEX_ALBUM '\x02' // between album artist and album, both part of the name
+
+// One file of the card listing, in the sort buffer and in the run files.
+// Browse index entries go through the same sort with a key in path.
+typedef struct {
+    uint32_t size;       // index: track number
+    uint32_t stamp;      // index: track id
+    uint32_t ref[2];     // index: the group's name in strings.dat
+    uint16_t len;        // of path, NUL included
+    char path[MAX_FILENAME_LEN];
+} listed_t;
+#define LISTED_HEAD offsetof(listed_t, path) // bytes before the path, on the card too
+
+typedef struct {
+    int32_t page;        // -1 if empty
+    uint32_t used;       // LRU clock
+    bool dirty;
+} page_tag_t;
+
+typedef struct {
+    FIL fil;
+    uint32_t left;       // bytes of the run still on the card
+    bool valid;          // cur holds its next entry
+    listed_t cur;
+} run_reader_t;
+
+// Shared string already written: its ref and CRC32, slot picked by FNV hash
+typedef struct {
+    uint32_t ref;
+    uint32_t crc;
+} dedup_t;
+
+// Ids [start, end)
+typedef struct {
+    uint16_t start;
+    uint16_t end;
+} id_run_t;
+
+typedef struct {
+    int hits;    // unchanged since the last table
+    int listed;  // new or changed, pending now
+    int removed;
+    int dirs;    // directories an update listed again, 0 after a rebuild
+} scan_stats_t;
+
+static FIL tracks_fil, strings_fil;
+static bool lib_open;         // both files open and belonging together
+static bool lib_readonly;     // library_invalidate() spoiled the header, stop writing back
+static bool lib_damaged;      // a CRC failed, the next fill step rescans
+static library_header_t hdr;
+static uint32_t strings_end;  // where strings.dat grows
+static uint32_t strings_crc;  // of strings.dat up to strings_end
+static uint32_t check_pos, check_crc; // how far the fill steps read strings.dat back, up to hdr.strings_size
+
+// a rebuild's sort buffer and the walk's directory snapshot are the page
+// cache's RAM, they're never needed at once
+static union {
+    track_rec_t pages[LIBRARY_PAGES][LIBRARY_PAGE_RECS];
+    uint8_t sort[LIBRARY_PAGES * LIBRARY_PAGE_BYTES];
+    struct {
+        dir_sig_t dirs[LIBRARY_SNAP_DIRS];
+        uint8_t seen[LIBRARY_SNAP_DIRS / 8]; // walked this time
+    } snap;
+} mem;
+static page_tag_t tags[LIBRARY_PAGES];
+static uint32_t use_clock;
+static uint32_t page_hits, page_misses;
+
+static uint8_t lines[LIBRARY_STR_LINES][SD_SECTOR_SIZE];
+static int32_t line_sector[LIBRARY_STR_LINES]; // -1 if empty
+static uint32_t line_used[LIBRARY_STR_LINES];
+static uint32_t line_hits, line_misses;
+
+static FIL *str_in = &strings_fil;   // what the lines cache
+static FIL *str_out = &strings_fil;  // where new strings go
+static uint32_t *str_end = &strings_end;
+static uint32_t *str_crc = &strings_crc;
+static dedup_t dedup[LIBRARY_HASH_SLOTS];
+
+static library_row_t rows[LIBRARY_WINDOW];
+
+static const char *const index_files[LIBRARY_INDEX_NUM] = {LIBRARY_BY_ARTIST_IDX, LIBRARY_BY_ALBUM_IDX,
+                                                           LIBRARY_BY_GENRE_IDX};
+static const char *const index_names[LIBRARY_INDEX_NUM] = {"artist", "album", "genre"};
+static FIL index_fil;
+static int index_open = -1;   // library_index_t index_fil has open, checked against the table
+static index_header_t index_hdr;
+static bool index_due;        // some index may not match the table, the fill steps check
+static uint32_t lookups;
+static int64_t lookup_us;
+
+// scan scratch, core0 only and too big for its stack
+static DIR walk_dir[LIBRARY_MAX_DEPTH];
+static uint16_t walk_len[LIBRARY_MAX_DEPTH];
+static uint32_t walk_sig[LIBRARY_MAX_DEPTH];   // per open directory: its audio files so far,
+static uint32_t walk_files[LIBRARY_MAX_DEPTH]; // how many,
+static uint32_t walk_stamp[LIBRARY_MAX_DEPTH]; // and its own time
+static char walk_path[MAX_FILENAME_LEN];
+static FILINFO walk_fno;
+static char file_path[MAX_FILENAME_LEN];
+static uint32_t list_digest;
+static int list_count;
+static bool list_full;
+static FIL sort_fil, new_tracks, new_strings;
+static uint32_t sort_used, sort_n; // bytes of entries from the bottom, offsets from the top
+static int sort_runs;
+static FRESULT sort_err;
+static run_reader_t readers[LIBRARY_MERGE_WAYS];
+static char old_path[MAX_FILENAME_LEN];
+static char str_buf[MAX_FILENAME_LEN];
+static char scan_path[MAX_FILENAME_LEN];
+static track_info_t scratch;
+static scan_stats_t stats;
+
+// rescan
+static uint32_t volume_serial;
+static bool snap_loaded;      // mem.snap holds the table's snapshot, otherwise the walk collects a new one
+static bool snap_changed;     // differs from LIBRARY_DIRS
+static bool snap_over;        // more directories than LIBRARY_SNAP_DIRS
+static int snap_n, snap_sorted; // entries, and how many of them LIBRARY_DIRS had (those are sorted)
+static uint32_t dirty[LIBRARY_DIRTY_DIRS]; // path CRCs of directories added, changed or gone
+static int dirty_n;
+static bool dirty_over;       // more than LIBRARY_DIRTY_DIRS, or LIBRARY_RESCAN failed
+static bool rescan_made;      // LIBRARY_RESCAN has been written to
+
+// background fill
+static int pending;           // records still TRACK_PENDING
+static int fill_cursor;       // id the next plain fill step looks at
+static id_run_t pending_runs[LIBRARY_DIRTY_DIRS]; // where this boot's update left pending records
+static int pending_run_n;     // -1 if that isn't known, the cursor looks at every record then
+static int fill_misses;       // records the cursor found done in a row
+static int fill_unsaved;      // parses since the last write-back
+static bool fill_cold;        // started without a table, for cold_ms
+static uint32_t scan_ms;      // library_scan() of this boot
+static uint32_t cold_ms;
+static int64_t fill_us;
+static int filled, fill_failed;
+
+_Static_assert(sizeof(mem.sort) <= 0x10000, "sort offsets are 16 bits");
+_Static_assert(LIBRARY_PAGE_BYTES % SD_SECTOR_SIZE == 0, "pages are read as whole sectors");
+_Static_assert(sizeof(mem.snap) <= sizeof(mem.sort), "the snapshot fits the page RAM");
+
+// Nibble table CRC32 (IEEE, reflected), small and fast enough for a few hundred KB
+uint32_t library_crc32(uint32_t crc, const void *data, size_t len)
+{
+    static const uint32_t nib[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+    };
+    const uint8_t *p = data;
+    crc = ~crc;
+    while (len--)
+    {
+        crc ^= *p++;
+        crc = (crc >> 4) ^ nib[crc & 15];
+        crc = (crc >> 4) ^ nib[crc & 15];
+    }
+    return ~crc;
+}
+
+// FILINFO date and time in one word, what a record is matched on along with the size
+uint32_t library_stamp(const FILINFO *fno)
+{
+    return (uint32_t)fno->fdate << 16 | fno->ftime;
+}
+
+static FRESULT write_all(FIL *fil, const void *data, UINT len)
+{
+    UINT bw = 0;
+    FRESULT fr = f_write(fil, data, len, &bw);
+    return fr == FR_OK && bw != len ? FR_DENIED : fr; // short write: card full
+}
+
+static FRESULT write_at(FIL *fil, uint32_t pos, const void *data, UINT len)
+{
+    FRESULT fr = f_lseek(fil, pos);
+    return fr == FR_OK ? write_all(fil, data, len) : fr;
+}
+
+/* ---------------- pages ---------------- */
+
+static void pages_drop(void)
+{
+    for (int i = 0; i < LIBRARY_PAGES; i++)
+        tags[i] = (page_tag_t){.page = -1};
+}
+
+static uint32_t rec_crc(const track_rec_t *r)
+{
+    return library_crc32(0, r, offsetof(track_rec_t, crc));
+}
+
+static FRESULT page_write(int slot)
+{
+    uint32_t first = tags[slot].page * LIBRARY_PAGE_RECS;
+    uint32_t n = count - first < LIBRARY_PAGE_RECS ? count - first : LIBRARY_PAGE_RECS;
+    for (uint32_t i = 0; i < n; i++)
+        mem.pages[slot][i].crc = rec_crc(&mem.pages[slot][i]);
+    FRESULT fr = write_at(&tracks_fil, LIBRARY_DATA_OFFSET + first * sizeof(track_rec_t), mem.pages[slot],
+                          n * sizeof(track_rec_t));
+    if (fr == FR_OK)
+        tags[slot].dirty = false;
+    return fr;
+}
+
+// A record that fails its CRC: emptied, so it can't send anyone into the
+// wrong file, and the table is rebuilt at the next fill step. Nothing is
+// written back until then, the card keeps the evidence for the next boot.
+static void rec_damaged(track_rec_t *r, int id)
+{
+    if (!lib_damaged)
+        printf("Library record %d damaged, rebuilding\r\n", id);
+    memset(r, 0, sizeof(*r));
+    r->flags = TRACK_UNPLAYABLE;
+    lib_damaged = lib_readonly = true;
+}
+
+// Record id, paging it in over the least recently used page. The pointer is
+// good until the next rec_at(). write marks the page for write-back.
+static track_rec_t *rec_at(int id, bool write)
+{
+    int page = id / LIBRARY_PAGE_RECS;
+    int slot = 0;
+    for (int i = 0; i < LIBRARY_PAGES; i++)
+    {
+        if (tags[i].page == page)
+        {
+            page_hits++;
+            slot = i;
+            goto found;
+        }
+        if (tags[i].used < tags[slot].used)
+            slot = i;
+    }
+
+    page_misses++;
+    if (tags[slot].dirty && !lib_readonly && page_write(slot) != FR_OK)
+        printf("Library page %ld not written back\r\n", (long)tags[slot].page);
+    UINT br = 0;
+    if (!lib_open || f_lseek(&tracks_fil, LIBRARY_DATA_OFFSET + page * LIBRARY_PAGE_BYTES) != FR_OK ||
+        f_read(&tracks_fil, mem.pages[slot], LIBRARY_PAGE_BYTES, &br) != FR_OK)
+        br = 0;
+    memset((uint8_t *)mem.pages[slot] + br, 0, LIBRARY_PAGE_BYTES - br); // past the end reads as empty
+    tags[slot] = (page_tag_t){.page = page};
+    for (uint32_t i = 0, first = page * LIBRARY_PAGE_RECS; i < LIBRARY_PAGE_RECS && first + i < hdr.count; i++)
+        if (mem.pages[slot][i].crc != rec_crc(&mem.pages[slot][i]))
+            rec_damaged(&mem.pages[slot][i], first + i);
+
+found:
+    tags[slot].used = ++use_clock;
+    if (write)
+        tags[slot].dirty = true;
+    return &mem.pages[slot][id % LIBRARY_PAGE_RECS];
+}
+
+/* ---------------- strings ---------------- */
+
+static uint32_t str_hash(const char *s)
+{
+    uint32_t h = 2166136261u;
+    while (*s)
+        h = (h ^ (uint8_t)*s++) * 16777619u;
+    return h;
+}
+
+static void lines_drop(void)
+{
+    for (int i = 0; i < LIBRARY_STR_LINES; i++)
+        line_sector[i] = -1;
+}
+
+// Drops cached sectors a write into str_in touched
+static void lines_forget(uint32_t pos, uint32_t len)
+{
+    for (int i = 0; i < LIBRARY_STR_LINES; i++)
+        if (line_sector[i] >= (int32_t)(pos / SD_SECTOR_SIZE) &&
+            line_sector[i] <= (int32_t)((pos + len - 1) / SD_SECTOR_SIZE))
+            line_sector[i] = -1;
+}
+
+static const uint8_t *str_line(uint32_t sector)
+{
+    int slot = 0;
+    for (int i = 0; i < LIBRARY_STR_LINES; i++)
+    {
+        if (line_sector[i] == (int32_t)sector)
+        {
+            line_hits++;
+            line_used[i] = ++use_clock;
+            return lines[i];
+        }
+        if (line_sector[slot] >= 0 && (line_sector[i] < 0 || line_used[i] < line_used[slot]))
+            slot = i;
+    }
+
+    line_misses++;
+    UINT br = 0;
+    if (f_lseek(str_in, sector * SD_SECTOR_SIZE) != FR_OK || f_read(str_in, lines[slot], SD_SECTOR_SIZE, &br) != FR_OK)
+        br = 0;
+    memset(&lines[slot][br], 0, SD_SECTOR_SIZE - br); // a string cut off by the end stops there
+    line_sector[slot] = sector;
+    line_used[slot] = ++use_clock;
+    return lines[slot];
+}
+
+// Copies the string at ref out of str_in, cut at n - 1 bytes
+static void read_str(uint32_t ref, char *out, size_t n)
+{
+    size_t k = 0;
+    while (ref >= sizeof(strings_header_t) && k + 1 < n)
+    {
+        uint8_t c = str_line(ref / SD_SECTOR_SIZE)[ref % SD_SECTOR_SIZE];
+        if (!c)
+            break;
+        out[k++] = c;
+        ref++;
+    }
+    out[k] = '\0';
+}
+
+// Appends s to str_out and returns its ref. Shared strings (directories,
+// artists, albums, MIME types) come back from dedup[] when they're already
+// there. Another string with the same slot and CRC32 is a 1 in 2^42 shot.
+static uint32_t str_put(const char *s, bool shared)
+{
+    if (!*s)
+        return 0;
+    uint32_t n = strlen(s) + 1;
+    dedup_t *d = NULL;
+    uint32_t crc = 0;
+    if (shared)
+    {
+        crc = library_crc32(0, s, n);
+        d = &dedup[str_hash(s) & (LIBRARY_HASH_SLOTS - 1)];
+        if (d->ref && d->crc == crc)
+            return d->ref;
+    }
+
+    uint32_t ref = *str_end;
+    if (write_at(str_out, ref, s, n) != FR_OK)
+        return 0; // the record loses a tag, nothing worse
+    *str_end += n;
+    *str_crc = library_crc32(*str_crc, s, n);
+    if (str_out == str_in)
+        lines_forget(ref, n);
+    if (d)
+        *d = (dedup_t){.ref = ref, .crc = crc};
+    return ref;
+}
+
+// CRC32 of strings.dat from pos to end, carried on from crc. False if the
+// card let us down.
+static bool strings_read_crc(uint32_t pos, uint32_t end, uint32_t *crc)
+{
+    UINT br = 0;
+    for (; pos < end; pos += br)
+    {
+        UINT n = end - pos < sizeof(str_buf) ? end - pos : sizeof(str_buf);
+        if (f_lseek(&strings_fil, pos) != FR_OK || f_read(&strings_fil, str_buf, n, &br) != FR_OK || br != n)
+            return false;
+        *crc = library_crc32(*crc, str_buf, n);
+    }
+    return true;
+}
+
+static uint32_t str_copy(uint32_t ref, bool shared)
+{
+    read_str(ref, str_buf, sizeof(str_buf));
+    return str_put(str_buf, shared);
+}
+
+/* ---------------- records ---------------- */
+
+// Directory and name joined into something f_open() takes
+static void rec_path(const track_rec_t *r, char *out, size_t n)
+{
+    read_str(r->dir, out, n);
+    size_t len = strlen(out);
+    if (len && len + 1 < n)
+        out[len++] = '/';
+    read_str(r->name, &out[len], n - len);
+}
+
+// A record blown back up into the track_info_t the players work with.
+// Pending tracks, and titles that couldn't be written, show the file name.
+void library_get(int id, track_info_t *t)
+{
+    spi_bus_acquire(SPI_BUS_SD);
+    track_rec_t r = *rec_at(id, false);
+    memset(t, 0, sizeof(*t));
+    rec_path(&r, t->filename, sizeof(t->filename));
+    read_str(r.title ? r.title : r.name, t->title, sizeof(t->title));
+    read_str(r.artist, t->artist, sizeof(t->artist));
+    read_str(r.album, t->album, sizeof(t->album));
+    read_str(r.mime_type, t->mime_type, sizeof(t->mime_type));
+    read_str(r.album_artist, t->album_artist, sizeof(t->album_artist));
+    read_str(r.genre, t->genre, sizeof(t->genre));
+    spi_bus_release();
+    t->album_art_size = r.album_art_size;
+    t->album_art_offset = r.album_art_offset;
+    t->audio_start = r.audio_start;
+    t->audio_end = r.audio_end;
+    t->header = r.header;
+    t->bitrate = r.bitrate;
+    t->samplespeed = r.samplespeed;
+    t->mpegID = r.mpegID;
+    t->channels = r.channels;
+    t->album_art_type = r.album_art_type;
+    t->format = r.format;
+    t->container = r.container;
+    t->file_size = r.file_size;
+    t->file_time = r.file_time;
+    t->track_no = r.track_no;
+    t->id = id;
+}
+
+// The other way round, for what get_metadata() found
+static void rec_fill(track_rec_t *r, const track_info_t *t)
+{
+    r->audio_start = t->audio_start;
+    r->audio_end = t->audio_end;
+    r->album_art_offset = t->album_art_offset;
+    r->album_art_size = t->album_art_size;
+    r->header = t->header;
+    r->title = str_put(t->title, false);
+    r->artist = str_put(t->artist, true);
+    r->album = str_put(t->album, true);
+    r->mime_type = str_put(t->mime_type, true);
+    r->album_artist = str_put(t->album_artist, true);
+    r->genre = str_put(t->genre, true);
+    r->track_no = t->track_no;
+    r->bitrate = t->bitrate;
+    r->samplespeed = t->samplespeed;
+    r->mpegID = t->mpegID;
+    r->channels = t->channels;
+    r->album_art_type = t->album_art_type;
+    r->format = t->format;
+    r->container = t->container;
+    r->flags = 0;
+}
+
+/* ---------------- menu rows ---------------- */
+
+static void rows_drop(void)
+{
+    for (int i = 0; i < LIBRARY_WINDOW; i++)
+        rows[i].id = -1;
+}
+
+static void row_load(library_row_t *row, int id)
+{
+    const track_rec_t *r = rec_at(id, false);
+    uint32_t title = r->title ? r->title : r->name;
+    uint32_t artist = r->artist, album = r->album;
+    uint8_t flags = r->flags;
+
+    row->id = -1;
+    __dmb(); // core1 sees the row go before its text changes
+    read_str(title, row->title, sizeof(row->title));
+    read_str(artist, row->artist, sizeof(row->artist));
+    read_str(album, row->album, sizeof(row->album));
+    row->flags = flags;
+    __dmb();
+    row->id = id;
+}
+
+// Core0: loads the rows around center (wrapping, like the menu does) that
+// aren't loaded yet. Rows sit by position before the wrap, so scrolling by
+// one costs one row on either side of it.
+void library_window(int center)
+{
+    if (count == 0)
+        return;
+    int n = count < LIBRARY_WINDOW ? count : LIBRARY_WINDOW;
+    spi_bus_acquire(SPI_BUS_SD);
+    for (int pos = center - n / 2; pos < center - n / 2 + n; pos++)
+    {
+        library_row_t *row = &rows[(pos % LIBRARY_WINDOW + LIBRARY_WINDOW) % LIBRARY_WINDOW];
+        int id = (pos % count + count) % count;
+        if (row->id != id)
+            row_load(row, id);
+    }
+    spi_bus_release();
+}
+
+// Core1: row id if core0 has it loaded, NULL otherwise
+const library_row_t *library_row(int id)
+{
+    for (int i = 0; i < LIBRARY_WINDOW; i++)
+        if (rows[i].id == id)
+            return &rows[i];
+    return NULL;
+}
+
+const char *library_title(int id)
+{
+    const library_row_t *row = library_row(id);
+    return row ? row->title : "";
+}
+
+int library_pending(void)
+{
+    return pending;
+}
+
+/* ---------------- table files ---------------- */
+
+static void index_close(void)
+{
+    if (index_open >= 0)
+        f_close(&index_fil);
+    index_open = -1;
+}
+
+static void library_close(void)
+{
+    index_close();
+    if (!lib_open)
+        return;
+    f_close(&tracks_fil);
+    f_close(&strings_fil);
+    lib_open = false;
+}
+
+// Opens the table and its strings, false if they're missing, stale or
+// don't belong together
+static bool library_open(void)
+{
+    strings_header_t sh;
+    UINT br = 0, br2 = 0;
+
+    library_close();
+    pages_drop();
+    lines_drop();
+    memset(dedup, 0, sizeof(dedup));
+    str_in = str_out = &strings_fil;
+    str_end = &strings_end;
+    str_crc = &strings_crc;
+
+    memset(&hdr, 0, sizeof(hdr));
+    if (f_open(&tracks_fil, LIBRARY_TRACKS, FA_READ | FA_WRITE) != FR_OK)
+        return false;
+    if (f_open(&strings_fil, LIBRARY_STRINGS, FA_READ | FA_WRITE) != FR_OK)
+    {
+        f_close(&tracks_fil);
+        return false;
+    }
+
+    bool ok = f_read(&tracks_fil, &hdr, sizeof(hdr), &br) == FR_OK && br == sizeof(hdr) &&
+              f_read(&strings_fil, &sh, sizeof(sh), &br2) == FR_OK && br2 == sizeof(sh) &&
+              hdr.magic == LIBRARY_MAGIC && hdr.version == LIBRARY_VERSION &&
+              hdr.rec_size == sizeof(track_rec_t) && hdr.count <= LIBRARY_MAX_TRACKS &&
+              f_size(&tracks_fil) >= LIBRARY_DATA_OFFSET + hdr.count * sizeof(track_rec_t) &&
+              sh.magic == LIBRARY_STR_MAGIC && sh.epoch == hdr.strings_epoch &&
+              hdr.strings_size >= sizeof(sh) && f_size(&strings_fil) >= hdr.strings_size;
+    // strings appended after the last write-back go on the running CRC as they are
+    strings_crc = hdr.strings_crc;
+    if (ok)
+        ok = strings_read_crc(hdr.strings_size, f_size(&strings_fil), &strings_crc);
+    if (!ok)
+    {
+        printf("Library index is from another firmware or incomplete, rebuilding\r\n");
+        f_close(&tracks_fil);
+        f_close(&strings_fil);
+        memset(&hdr, 0, sizeof(hdr));
+        return false;
+    }
+    strings_end = f_size(&strings_fil);
+    check_pos = sizeof(sh);
+    check_crc = 0;
+    lib_open = true;
+    return true;
+}
+
+// Dirty pages and the header back to the card. Strings go first, so no
+// record on the card ever points past the end of strings.dat.
+static void library_flush(void)
+{
+    if (!lib_open || lib_readonly)
+        return;
+    FRESULT fr = f_sync(&strings_fil);
+    for (int i = 0; i < LIBRARY_PAGES && fr == FR_OK; i++)
+        if (tags[i].dirty)
+            fr = page_write(i);
+    hdr.pending = pending;
+    hdr.cold_ms = cold_ms;
+    hdr.strings_size = strings_end;
+    hdr.strings_crc = strings_crc;
+    if (fr == FR_OK)
+        fr = write_at(&tracks_fil, 0, &hdr, sizeof(hdr));
+    if (fr == FR_OK)
+        fr = f_sync(&tracks_fil);
+    if (fr != FR_OK)
+        printf("Library index not saved (%d)\r\n", fr);
+}
+
+// Spoils the index header so the next boot starts cold, and stops writing
+// back. What's loaded keeps working until then.
+void library_invalidate(void)
+{
+    spi_bus_acquire(SPI_BUS_SD);
+    if (lib_open)
+    {
+        library_header_t h = {0};
+        write_at(&tracks_fil, 0, &h, sizeof(h));
+        f_sync(&tracks_fil);
+    }
+    lib_readonly = true;
+    spi_bus_release();
+}
+
+/* ---------------- card walk ---------------- */
+
+// Extensions worth opening, get_metadata() decides from the contents
+static bool audio_extension(const char *name)
+{
+    static const char *const exts[] = {".mp3", ".flac", ".ogg", ".oga", ".m4a", ".mp4", ".wav", ".aif", ".aiff"};
+    const char *ext = strrchr(name, '.');
+    if (!ext)
+        return false;
+    for (size_t i = 0; i < count_of(exts); i++)
+        if (!strcasecmp(ext, exts[i]))
+            return true;
+    return false;
+}
+
+static int fold_case(int c)
+{
+    return c >= 'A' && c <= 'Z' ? c + 'a' - 'A' : (uint8_t)c;
+}
+
+static int fold(int c)
+{
+    if (c == '/')
+        return 1; // a directory's files sort before "dir name with more"
+    return fold_case(c);
+}
+
+// The order ids come in: case-insensitive, directory by directory
+static int compare_paths(const char *a, const char *b)
+{
+    for (;; a++, b++)
+    {
+        int ca = fold(*a), cb = fold(*b);
+        if (ca != cb || !ca)
+            return ca - cb;
+    }
+}
+
+// Hidden and system entries, .stereoboy too
+static bool walk_skip(const FILINFO *fno)
+{
+    return fno->fname[0] == '.' || (fno->fattrib & (AM_HID | AM_SYS));
+}
+
+typedef void (*walk_fn)(const FILINFO *fno, const char *path);
+typedef void (*dir_fn)(const char *path, uint32_t sig, uint32_t files);
+
+// Depth first over the card, skipping what walk_skip() says, visit() gets
+// every audio file up to LIBRARY_MAX_TRACKS. done(), if given, gets every
+// directory once it's read through, with a signature of its audio files
+// (names, sizes and times, summed so their order in the directory doesn't
+// matter), their count and its own time.
+static void walk(walk_fn visit, dir_fn done)
+{
+    int depth = 0;
+    walk_path[0] = '\0';
+    walk_len[0] = 0;
+    walk_sig[0] = walk_files[0] = walk_stamp[0] = 0;
+    list_count = 0;
+    list_full = false;
+    if (f_opendir(&walk_dir[0], "/") != FR_OK)
+        return;
+
+    while (depth >= 0)
+    {
+        FILINFO *fno = &walk_fno;
+        if (f_readdir(&walk_dir[depth], fno) != FR_OK || !fno->fname[0])
+        {
+            f_closedir(&walk_dir[depth]);
+            if (done)
+            {
+                uint32_t tail[2] = {walk_files[depth], walk_stamp[depth]};
+                done(walk_path, library_crc32(walk_sig[depth], tail, sizeof(tail)), walk_files[depth]);
+            }
+            if (--depth >= 0)
+                walk_path[walk_len[depth]] = '\0';
+            continue;
+        }
+        if (walk_skip(fno))
+            continue;
+
+        size_t len = walk_len[depth];
+        if (!(fno->fattrib & AM_DIR))
+        {
+            if (!audio_extension(fno->fname))
+                continue;
+            uint32_t meta[2] = {fno->fsize, library_stamp(fno)};
+            walk_sig[depth] += library_crc32(library_crc32(0, fno->fname, strlen(fno->fname)), meta, sizeof(meta));
+            walk_files[depth]++;
+            if (list_count >= LIBRARY_MAX_TRACKS)
+            {
+                list_full = true;
+                continue;
+            }
+            if (snprintf(file_path, sizeof(file_path), "%s%s%s", walk_path, len ? "/" : "", fno->fname) <
+                (int)sizeof(file_path))
+                visit(fno, file_path); // longer ones couldn't be opened anyway
+            continue;
+        }
+
+        if (depth + 1 >= LIBRARY_MAX_DEPTH || len + strlen(fno->fname) + 2 >= sizeof(walk_path))
+            continue;
+        snprintf(&walk_path[len], sizeof(walk_path) - len, "%s%s", len ? "/" : "", fno->fname);
+        if (f_opendir(&walk_dir[depth + 1], walk_path) != FR_OK)
+        {
+            walk_path[len] = '\0';
+            continue;
+        }
+        depth++;
+        walk_len[depth] = strlen(walk_path);
+        walk_sig[depth] = walk_files[depth] = 0;
+        walk_stamp[depth] = library_stamp(fno);
+    }
+}
+
+static void visit_digest(const FILINFO *fno, const char *path)
+{
+    uint32_t meta[2] = {fno->fsize, library_stamp(fno)};
+    list_digest = library_crc32(list_digest, path, strlen(path) + 1);
+    list_digest = library_crc32(list_digest, meta, sizeof(meta));
+    list_count++;
+}
+
+/* ---------------- directory snapshot ---------------- */
+
+// Without the volume serial a reformatted card with the same directories
+// would be taken for the old one, so a FatFs configuration without
+// f_getlabel() doesn't build
+#if !FF_USE_LABEL
+#error "library needs FF_USE_LABEL 1 in ffconf.h"
+#endif
+
+// Volume serial number, a reformat changes it
+static uint32_t card_serial(void)
+{
+    DWORD vsn = 0;
+    if (f_getlabel("", NULL, &vsn) == FR_OK)
+        return vsn;
+    return 0;
+}
+
+static bool snap_seen(int i)
+{
+    return mem.snap.seen[i / 8] & (1u << (i % 8));
+}
+
+static void snap_see(int i)
+{
+    mem.snap.seen[i / 8] |= 1u << (i % 8);
+}
+
+static int compare_dirs(const void *a, const void *b)
+{
+    uint32_t x = ((const dir_sig_t *)a)->path, y = ((const dir_sig_t *)b)->path;
+    return x < y ? -1 : x > y;
+}
+
+// LIBRARY_DIRS into mem.snap if it belongs to the table and this card.
+// Otherwise the walk collects a new snapshot. Right after library_open(),
+// it's the pages' RAM.
+static void snapshot_load(void)
+{
+    dirs_header_t dh;
+    UINT br = 0, bd = 0;
+
+    snap_loaded = snap_changed = snap_over = dirty_over = rescan_made = false;
+    snap_n = snap_sorted = dirty_n = 0;
+    memset(mem.snap.seen, 0, sizeof(mem.snap.seen));
+    volume_serial = card_serial();
+    if (!lib_open || f_open(&new_tracks, LIBRARY_DIRS, FA_READ) != FR_OK)
+        return;
+    bool ok = f_read(&new_tracks, &dh, sizeof(dh), &br) == FR_OK && br == sizeof(dh) &&
+              dh.magic == LIBRARY_DIRS_MAGIC && dh.epoch == hdr.epoch && dh.serial == volume_serial &&
+              dh.count <= LIBRARY_SNAP_DIRS &&
+              f_read(&new_tracks, mem.snap.dirs, dh.count * sizeof(dir_sig_t), &bd) == FR_OK &&
+              bd == dh.count * sizeof(dir_sig_t);
+    f_close(&new_tracks);
+    if (!ok)
+        return;
+    snap_n = snap_sorted = dh.count;
+    snap_loaded = true;
+}
+
+// First entry LIBRARY_DIRS had with path, or where it would be
+static int snap_find(uint32_t path)
+{
+    int lo = 0, hi = snap_sorted;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (mem.snap.dirs[mid].path < path)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// A directory to list again (dir, with its path, which goes to
+// LIBRARY_RESCAN) or to drop (gone)
+static void dirty_add(uint32_t path, const char *dir)
+{
+    snap_changed = true;
+    if (!snap_loaded)
+        return;
+    if (dirty_n >= LIBRARY_DIRTY_DIRS)
+    {
+        dirty_over = true;
+        return;
+    }
+    dirty[dirty_n++] = path;
+    if (dir)
+    {
+        uint16_t len = strlen(dir) + 1;
+        if (!rescan_made)
+            rescan_made = f_open(&sort_fil, LIBRARY_RESCAN, FA_WRITE | FA_CREATE_ALWAYS) == FR_OK;
+        if (!rescan_made || write_all(&sort_fil, &len, sizeof(len)) != FR_OK || write_all(&sort_fil, dir, len) != FR_OK)
+            dirty_over = true;
+    }
+}
+
+// walk()'s done(): the directory against the snapshot. Ones without audio
+// files aren't kept, if the snapshot had it, it's gone now.
+static void dir_check(const char *path, uint32_t sig, uint32_t files)
+{
+    if (!files)
+        return;
+    uint32_t crc = library_crc32(0, path, strlen(path));
+    int i = snap_find(crc), changed = -1;
+    for (; i < snap_sorted && mem.snap.dirs[i].path == crc; i++)
+    {
+        if (snap_seen(i))
+            continue; // another directory with the same CRC
+        if (mem.snap.dirs[i].sig == sig)
+        {
+            snap_see(i);
+            return;
+        }
+        if (changed < 0)
+            changed = i;
+    }
+
+    if (changed >= 0)
+    {
+        mem.snap.dirs[changed].sig = sig;
+        snap_see(changed);
+    }
+    else if (snap_n < LIBRARY_SNAP_DIRS)
+    {
+        mem.snap.dirs[snap_n] = (dir_sig_t){.path = crc, .sig = sig}; // past snap_sorted, searches don't see it
+        snap_see(snap_n++);
+    }
+    else
+    {
+        snap_over = true;
+    }
+    dirty_add(crc, path);
+}
+
+// After the walk: what the snapshot had but the walk didn't see is gone
+static void snapshot_end(void)
+{
+    for (int i = 0; i < snap_sorted; i++)
+        if (!snap_seen(i))
+            dirty_add(mem.snap.dirs[i].path, NULL);
+    if (rescan_made && f_close(&sort_fil) != FR_OK)
+        dirty_over = true;
+}
+
+// The directories the walk saw as LIBRARY_DIRS, for the table with epoch.
+// The header goes last, a half written file never matches.
+static void snapshot_save(uint32_t epoch)
+{
+    int n = 0;
+    for (int i = 0; i < snap_n; i++)
+        if (snap_seen(i))
+            mem.snap.dirs[n++] = mem.snap.dirs[i];
+    qsort(mem.snap.dirs, n, sizeof(dir_sig_t), compare_dirs);
+
+    dirs_header_t dh = {.magic = LIBRARY_DIRS_MAGIC, .epoch = epoch, .serial = volume_serial, .count = n};
+    dirs_header_t blank = {0};
+    FRESULT fr = f_mkdir(LIBRARY_DIR);
+    if (fr == FR_EXIST)
+        fr = FR_OK;
+    if (fr == FR_OK)
+        fr = f_open(&new_tracks, LIBRARY_DIRS, FA_WRITE | FA_CREATE_ALWAYS);
+    if (fr == FR_OK)
+    {
+        fr = write_all(&new_tracks, &blank, sizeof(blank));
+        if (fr == FR_OK)
+            fr = write_all(&new_tracks, mem.snap.dirs, n * sizeof(dir_sig_t));
+        if (fr == FR_OK)
+            fr = write_at(&new_tracks, 0, &dh, sizeof(dh));
+        FRESULT fc = f_close(&new_tracks);
+        if (fr == FR_OK)
+            fr = fc;
+    }
+    if (fr != FR_OK)
+        printf("Directory snapshot not saved (%d)\r\n", fr);
+}
+
+/* ---------------- external sort ---------------- */
+
+static uint16_t *sort_index(void)
+{
+    return (uint16_t *)&mem.sort[sizeof(mem.sort)] - sort_n;
+}
+
+// compare_paths() for the listing, compare_keys() for the browse indices
+static int (*sort_compare)(const char *a, const char *b) = compare_paths;
+
+// Paths are unique, index keys tie break on track number, then id
+static int compare_listed(const listed_t *a, const listed_t *b)
+{
+    int c = sort_compare(a->path, b->path);
+    if (c)
+        return c;
+    if (a->size != b->size)
+        return a->size < b->size ? -1 : 1;
+    return a->stamp < b->stamp ? -1 : a->stamp > b->stamp;
+}
+
+static int compare_sorted(const void *a, const void *b)
+{
+    return compare_listed((const listed_t *)&mem.sort[*(const uint16_t *)a],
+                          (const listed_t *)&mem.sort[*(const uint16_t *)b]);
+}
+
+// Sorts what's in the buffer and appends it to sort_fil as one run:
+// its length in bytes, then the entries
+static void run_flush(void)
+{
+    if (!sort_n)
+        return;
+    uint16_t *idx = sort_index();
+    qsort(idx, sort_n, sizeof(idx[0]), compare_sorted);
+
+    uint32_t bytes = 0;
+    for (uint32_t i = 0; i < sort_n; i++)
+        bytes += LISTED_HEAD + ((const listed_t *)&mem.sort[idx[i]])->len;
+    FRESULT fr = write_all(&sort_fil, &bytes, sizeof(bytes));
+    for (uint32_t i = 0; i < sort_n && fr == FR_OK; i++)
+    {
+        const listed_t *e = (const listed_t *)&mem.sort[idx[i]];
+        fr = write_all(&sort_fil, e, LISTED_HEAD + e->len);
+    }
+    if (fr != FR_OK)
+        sort_err = fr;
+    sort_runs++;
+    sort_used = sort_n = 0;
+}
+
+// Room in the buffer for an entry with len bytes of path, full buffers
+// go to the card as a run first
+static listed_t *sort_slot(uint16_t len)
+{
+    uint32_t need = (LISTED_HEAD + len + 3) & ~3u;
+    if (sort_used + need + (sort_n + 1) * sizeof(uint16_t) > sizeof(mem.sort))
+        run_flush();
+
+    listed_t *e = (listed_t *)&mem.sort[sort_used];
+    e->len = len;
+    e->ref[0] = e->ref[1] = 0;
+    sort_n++;
+    sort_index()[0] = sort_used;
+    sort_used += need;
+    return e;
+}
+
+static void visit_list(const FILINFO *fno, const char *path)
+{
+    uint16_t len = strlen(path) + 1;
+    listed_t *e = sort_slot(len);
+    e->size = fno->fsize;
+    e->stamp = library_stamp(fno);
+    memcpy(e->path, path, len);
+    list_count++;
+}
+
+static bool reader_next(run_reader_t *r)
+{
+    UINT br = 0;
+    r->valid = false;
+    if (r->left == 0)
+        return false;
+    if (r->left < LISTED_HEAD || f_read(&r->fil, &r->cur, LISTED_HEAD, &br) != FR_OK || br != LISTED_HEAD ||
+        r->cur.len == 0 || r->cur.len > MAX_FILENAME_LEN || r->left < LISTED_HEAD + r->cur.len ||
+        f_read(&r->fil, r->cur.path, r->cur.len, &br) != FR_OK || br != r->cur.len)
+    {
+        sort_err = FR_INT_ERR;
+        return false;
+    }
+    r->cur.path[r->cur.len - 1] = '\0';
+    r->left -= LISTED_HEAD + r->cur.len;
+    r->valid = true;
+    return true;
+}
+
+// Opens up to LIBRARY_MERGE_WAYS runs of path from *pos on, returns how many
+static int readers_open(const char *path, uint32_t *pos, int runs, uint32_t *bytes)
+{
+    int k = 0;
+    *bytes = 0;
+    for (; k < runs && k < LIBRARY_MERGE_WAYS; k++)
+    {
+        run_reader_t *r = &readers[k];
+        uint32_t len = 0;
+        UINT br = 0;
+        if (f_open(&r->fil, path, FA_READ) != FR_OK)
+            break;
+        if (f_lseek(&r->fil, *pos) != FR_OK || f_read(&r->fil, &len, sizeof(len), &br) != FR_OK || br != sizeof(len))
+        {
+            f_close(&r->fil);
+            break;
+        }
+        r->left = len;
+        *pos += sizeof(len) + len;
+        *bytes += len;
+        reader_next(r);
+    }
+    if (k < runs && k < LIBRARY_MERGE_WAYS)
+        sort_err = FR_INT_ERR;
+    return k;
+}
+
+static void readers_close(int k)
+{
+    for (int i = 0; i < k; i++)
+        f_close(&readers[i].fil);
+}
+
+// Reader with the smallest entry, NULL once all k ran dry
+static run_reader_t *readers_min(int k)
+{
+    run_reader_t *m = NULL;
+    for (int i = 0; i < k; i++)
+        if (readers[i].valid && (!m || compare_listed(&readers[i].cur, &m->cur) < 0))
+            m = &readers[i];
+    return m;
+}
+
+// Merges the runs of in, LIBRARY_MERGE_WAYS at a time, into out. Returns
+// the number of runs out ends up with.
+static int merge_pass(const char *in, const char *out, int runs)
+{
+    int out_runs = 0;
+    uint32_t pos = 0;
+    FRESULT fr = f_open(&sort_fil, out, FA_WRITE | FA_CREATE_ALWAYS);
+    if (fr != FR_OK)
+    {
+        sort_err = fr;
+        return 0;
+    }
+    while (fr == FR_OK && runs > 0 && sort_err == FR_OK)
+    {
+        uint32_t bytes;
+        int k = readers_open(in, &pos, runs, &bytes);
+        runs -= k;
+        fr = write_all(&sort_fil, &bytes, sizeof(bytes));
+        for (run_reader_t *m; fr == FR_OK && (m = readers_min(k)); reader_next(m))
+            fr = write_all(&sort_fil, &m->cur, LISTED_HEAD + m->cur.len);
+        readers_close(k);
+        out_runs++;
+    }
+    FRESULT fc = f_close(&sort_fil);
+    if (fr == FR_OK)
+        fr = fc;
+    if (fr != FR_OK)
+        sort_err = fr;
+    return out_runs;
+}
+
+// Starts a listing into LIBRARY_SORT_A, in cmp's order. The sort buffer is
+// the pages' RAM, they go.
+static FRESULT sort_begin(int (*cmp)(const char *a, const char *b))
+{
+    pages_drop();
+    sort_compare = cmp;
+    sort_err = FR_OK;
+    sort_used = sort_n = 0;
+    sort_runs = 0;
+    return f_open(&sort_fil, LIBRARY_SORT_A, FA_WRITE | FA_CREATE_ALWAYS);
+}
+
+// Ends the listing and merges until readers_open() takes the runs left in
+// one go. Returns how many, *in is the file they're in, *out the other one.
+static int sort_end(const char **in, const char **out)
+{
+    run_flush();
+    FRESULT fr = f_close(&sort_fil);
+    if (fr != FR_OK)
+        sort_err = fr;
+
+    int runs = sort_runs;
+    *in = LIBRARY_SORT_A;
+    *out = LIBRARY_SORT_B;
+    while (runs > LIBRARY_MERGE_WAYS && sort_err == FR_OK)
+    {
+        runs = merge_pass(*in, *out, runs);
+        const char *t = *in;
+        *in = *out;
+        *out = t;
+    }
+    return runs;
+}
+
+/* ---------------- rebuild ---------------- */
+
+// Old record i, and its path if it's going to be compared. False past the end.
+static bool old_at(int i, int old_count, track_rec_t *old, bool path)
+{
+    if (i >= old_count)
+        return false;
+    *old = *rec_at(i, false);
+    if (path)
+        rec_path(old, old_path, sizeof(old_path));
+    return true;
+}
+
+// Pending record for a file the old table doesn't have (or had different)
+static track_rec_t rec_listed(listed_t *e)
+{
+    track_rec_t r = {
+        .file_size = e->size,
+        .file_time = e->stamp,
+        .flags = TRACK_PENDING,
+    };
+    char *slash = strrchr(e->path, '/');
+    if (slash)
+    {
+        *slash = '\0';
+        r.dir = str_put(e->path, true);
+        r.dir_crc = library_crc32(0, e->path, slash - e->path);
+        *slash = '/';
+    }
+    r.name = str_put(slash ? slash + 1 : e->path, false);
+    return r;
+}
+
+// The page slot new records collect in, out of the LRU while a new table
+// is written. rec_at() has the other pages for the old one.
+static int out_n;
+
+static void out_begin(void)
+{
+    tags[LIBRARY_OUT_SLOT] = (page_tag_t){.page = -1, .used = UINT32_MAX};
+    out_n = 0;
+}
+
+static FRESULT out_flush(FIL *fil)
+{
+    FRESULT fr = write_all(fil, mem.pages[LIBRARY_OUT_SLOT], out_n * sizeof(track_rec_t));
+    out_n = 0;
+    return fr;
+}
+
+// Appends r to the new table, a page at a time so the card sees whole
+// sectors in one go
+static FRESULT out_put(FIL *fil, track_rec_t *r)
+{
+    r->crc = rec_crc(r);
+    mem.pages[LIBRARY_OUT_SLOT][out_n++] = *r;
+    return out_n == LIBRARY_PAGE_RECS ? out_flush(fil) : FR_OK;
+}
+
+// Second walk: the sorted listing joined with the old table into the
+// .tmp pair, which then replaces it as epoch. If the card lets us down on
+// the way the old table (if any) stays in use.
+static void rebuild(uint32_t epoch)
+{
+    int old_count = lib_open ? hdr.count : 0;
+    uint32_t digest = list_digest;
+    const char *in, *out;
+    FRESULT fr;
+    pending_run_n = -1; // anything may be pending after a rebuild
+
+    // the listing, as runs sorted in RAM
+    fr = f_mkdir(LIBRARY_DIR);
+    if (fr != FR_OK && fr != FR_EXIST)
+    {
+        printf("Can't create %s (%d)\r\n", LIBRARY_DIR, fr);
+        return;
+    }
+    f_unlink(LIBRARY_DIR "/library.idx"); // the all-in-RAM index earlier firmware kept
+    if ((fr = sort_begin(compare_paths)) != FR_OK)
+    {
+        printf("Can't write %s (%d)\r\n", LIBRARY_SORT_A, fr);
+        return;
+    }
+    walk(visit_list, NULL);
+    int runs = sort_end(&in, &out);
+
+    // the join, fed by the last merge directly
+    fr = f_open(&new_tracks, LIBRARY_TRACKS_TMP, FA_WRITE | FA_CREATE_ALWAYS);
+    if (fr == FR_OK && (fr = f_open(&new_strings, LIBRARY_STRINGS_TMP, FA_READ | FA_WRITE | FA_CREATE_ALWAYS)) != FR_OK)
+        f_close(&new_tracks);
+    if (fr != FR_OK)
+    {
+        printf("Can't write the library index (%d)\r\n", fr);
+        return;
+    }
+    strings_header_t sh = {.magic = LIBRARY_STR_MAGIC, .epoch = epoch};
+    uint32_t new_end = sizeof(sh), new_crc = 0;
+    fr = write_all(&new_strings, &sh, sizeof(sh));
+    if (fr == FR_OK)
+        fr = f_lseek(&new_tracks, LIBRARY_DATA_OFFSET);
+    str_out = &new_strings;
+    str_end = &new_end;
+    str_crc = &new_crc;
+    memset(dedup, 0, sizeof(dedup));
+
+    uint32_t pos = 0, bytes;
+    int k = readers_open(in, &pos, runs, &bytes);
+    run_reader_t *m = readers_min(k);
+    track_rec_t old;
+    out_begin();
+    int i = 0, n = 0, n_pending = 0;
+    bool have_old = old_at(i, old_count, &old, m);
+    while (fr == FR_OK && (m || have_old))
+    {
+        int c = !m ? -1 : !have_old ? 1 : compare_paths(old_path, m->cur.path);
+        if (c < 0)
+        {
+            stats.removed++;
+            have_old = old_at(++i, old_count, &old, m);
+            continue;
+        }
+
+        track_rec_t r;
+        if (c == 0 && old.file_size == m->cur.size && old.file_time == m->cur.stamp)
+        {
+            r = old;
+            r.dir = str_copy(old.dir, true);
+            r.name = str_copy(old.name, false);
+            r.title = str_copy(old.title, false);
+            r.artist = str_copy(old.artist, true);
+            r.album = str_copy(old.album, true);
+            r.mime_type = str_copy(old.mime_type, true);
+            r.album_artist = str_copy(old.album_artist, true);
+            r.genre = str_copy(old.genre, true);
+            stats.hits++;
+        }
+        else
+        {
+            r = rec_listed(&m->cur);
+            stats.listed++;
+        }
+        if (r.flags & TRACK_PENDING)
+            n_pending++;
+        fr = out_put(&new_tracks, &r);
+        n++;
+
+        if (c == 0)
+            have_old = old_at(++i, old_count, &old, m);
+        reader_next(m);
+        m = readers_min(k);
+    }
+    if (fr == FR_OK)
+        fr = out_flush(&new_tracks);
+    readers_close(k);
+    f_unlink(LIBRARY_SORT_A);
+    f_unlink(LIBRARY_SORT_B);
+
+    library_header_t h = {
+        .magic = LIBRARY_MAGIC,
+        .version = LIBRARY_VERSION,
+        .rec_size = sizeof(track_rec_t),
+        .count = n,
+        .pending = n_pending,
+        .digest = digest,
+        .epoch = epoch,
+        .cold_ms = hdr.cold_ms,
+        .strings_epoch = epoch,
+        .strings_size = new_end,
+        .strings_crc = new_crc,
+    };
+    if (fr == FR_OK)
+        fr = write_at(&new_tracks, 0, &h, sizeof(h));
+    FRESULT fc = f_close(&new_tracks);
+    FRESULT fs = f_close(&new_strings);
+    if (fr == FR_OK)
+        fr = fc != FR_OK ? fc : fs != FR_OK ? fs : sort_err;
+
+    library_close();
+    if (fr == FR_OK)
+    {
+        f_unlink(LIBRARY_TRACKS);
+        f_unlink(LIBRARY_STRINGS);
+        fr = f_rename(LIBRARY_TRACKS_TMP, LIBRARY_TRACKS);
+        if (fr == FR_OK)
+            fr = f_rename(LIBRARY_STRINGS_TMP, LIBRARY_STRINGS);
+    }
+    if (fr != FR_OK)
+    {
+        printf("Library index not rebuilt (%d)\r\n", fr);
+        f_unlink(LIBRARY_TRACKS_TMP);
+        f_unlink(LIBRARY_STRINGS_TMP);
+    }
+    library_open();
+}
+
+/* ---------------- update ---------------- */
+
+// The directories in LIBRARY_RESCAN listed again, the way walk() would
+static void list_dirty(void)
+{
+    FIL *f = &new_strings;
+    uint16_t len;
+    UINT br = 0;
+
+    list_count = 0;
+    if (!rescan_made)
+        return; // only directories that are gone
+    if (f_open(f, LIBRARY_RESCAN, FA_READ) != FR_OK)
+    {
+        sort_err = FR_NO_FILE;
+        return;
+    }
+    while (sort_err == FR_OK && f_read(f, &len, sizeof(len), &br) == FR_OK && br == sizeof(len))
+    {
+        if (len == 0 || len > sizeof(walk_path) || f_read(f, walk_path, len, &br) != FR_OK || br != len)
+        {
+            sort_err = FR_INT_ERR;
+            break;
+        }
+        walk_path[len - 1] = '\0';
+        if (f_opendir(&walk_dir[0], walk_path) != FR_OK)
+        {
+            sort_err = FR_NO_PATH; // it was there during the walk
+            break;
+        }
+        FILINFO *fno = &walk_fno;
+        while (f_readdir(&walk_dir[0], fno) == FR_OK && fno->fname[0])
+        {
+            if (walk_skip(fno) || (fno->fattrib & AM_DIR) || !audio_extension(fno->fname))
+                continue;
+            if (snprintf(file_path, sizeof(file_path), "%s%s%s", walk_path, len > 1 ? "/" : "", fno->fname) <
+                (int)sizeof(file_path))
+                visit_list(fno, file_path);
+        }
+        f_closedir(&walk_dir[0]);
+    }
+    f_close(f);
+}
+
+// Whether r is in one of the dirty directories, without reading its dir
+// string: it's the records outside them that an update goes through most
+static bool rec_dirty(const track_rec_t *r)
+{
+    for (int i = 0; i < dirty_n; i++)
+        if (dirty[i] == r->dir_crc)
+            return true;
+    return false;
+}
+
+// Id n of the new table is pending, it goes on the last run or starts one
+static void pending_run_add(int n)
+{
+    if (pending_run_n > 0 && pending_runs[pending_run_n - 1].end == n)
+        pending_runs[pending_run_n - 1].end = n + 1;
+    else if (pending_run_n >= 0 && pending_run_n < LIBRARY_DIRTY_DIRS)
+        pending_runs[pending_run_n++] = (id_run_t){.start = n, .end = n + 1};
+    else
+        pending_run_n = -1;
+}
+
+// First old id from lo on whose path doesn't sort before path. It gallops
+// out from lo, then bisects, so the records between one changed directory
+// and the next go over without their strings being read.
+static int old_bound(int lo, int old_count, const char *path)
+{
+    int hi = lo, step = 1;
+    while (hi < old_count)
+    {
+        rec_path(rec_at(hi, false), old_path, sizeof(old_path));
+        if (compare_paths(old_path, path) >= 0)
+            break;
+        lo = hi + 1;
+        hi += step;
+        step *= 2;
+    }
+    hi = hi < old_count ? hi : old_count;
+    while (lo < hi)
+    {
+        int mid = lo + (hi - lo) / 2;
+        rec_path(rec_at(mid, false), old_path, sizeof(old_path));
+        if (compare_paths(old_path, path) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// Only the dirty directories listed and joined with the table as epoch.
+// Records elsewhere come over as they are, strings and all, and new
+// strings go on the end of strings.dat, so it's the changed files that
+// cost, not the library. False if the card let us down, the old table is
+// still there for rebuild() then.
+static bool update(uint32_t epoch)
+{
+    int old_count = hdr.count;
+    const char *in, *out;
+    FRESULT fr;
+
+    if ((fr = sort_begin(compare_paths)) != FR_OK)
+    {
+        printf("Can't write %s (%d)\r\n", LIBRARY_SORT_A, fr);
+        return false;
+    }
+    list_dirty();
+    int runs = sort_end(&in, &out);
+    if ((fr = f_open(&new_tracks, LIBRARY_TRACKS_TMP, FA_WRITE | FA_CREATE_ALWAYS)) != FR_OK)
+    {
+        printf("Can't write the library index (%d)\r\n", fr);
+        return false;
+    }
+    fr = f_lseek(&new_tracks, LIBRARY_DATA_OFFSET);
+    pending_run_n = 0;
+
+    uint32_t pos = 0, bytes;
+    int k = readers_open(in, &pos, runs, &bytes);
+    run_reader_t *m = readers_min(k);
+    track_rec_t old;
+    out_begin();
+    int i = 0, n = 0, n_pending = 0;
+    int stop = m ? old_bound(0, old_count, m->cur.path) : old_count; // old ids before it sort before m
+    bool have_old = old_at(i, old_count, &old, m && i >= stop);
+    while (fr == FR_OK && (m || have_old))
+    {
+        int c = !m ? -1 : !have_old ? 1 : i < stop ? -1 : compare_paths(old_path, m->cur.path);
+        if (c < 0 && rec_dirty(&old))
+        {
+            stats.removed++;
+            i++;
+            have_old = old_at(i, old_count, &old, m && i >= stop);
+            continue;
+        }
+
+        track_rec_t r;
+        if (c < 0 || (c == 0 && old.file_size == m->cur.size && old.file_time == m->cur.stamp))
+        {
+            r = old;
+            stats.hits++;
+        }
+        else
+        {
+            r = rec_listed(&m->cur);
+            stats.listed++;
+        }
+        if (r.flags & TRACK_PENDING)
+        {
+            n_pending++;
+            pending_run_add(n);
+        }
+        fr = out_put(&new_tracks, &r);
+        n++;
+
+        if (c <= 0)
+        {
+            i++;
+            have_old = old_at(i, old_count, &old, m && i >= stop);
+        }
+        if (c >= 0)
+        {
+            reader_next(m);
+            m = readers_min(k);
+            stop = m ? old_bound(i, old_count, m->cur.path) : old_count;
+            if (m && have_old && i >= stop)
+                rec_path(&old, old_path, sizeof(old_path)); // old_bound() went through old_path
+        }
+    }
+    if (fr == FR_OK)
+        fr = out_flush(&new_tracks);
+    readers_close(k);
+    f_unlink(LIBRARY_SORT_A);
+    f_unlink(LIBRARY_SORT_B);
+
+    library_header_t h = hdr;
+    h.count = n;
+    h.pending = n_pending;
+    h.digest = list_digest;
+    h.epoch = epoch;
+    h.updates++;
+    h.strings_size = strings_end;
+    h.strings_crc = strings_crc;
+    if (fr == FR_OK)
+        fr = write_at(&new_tracks, 0, &h, sizeof(h));
+    FRESULT fc = f_close(&new_tracks);
+    if (fr == FR_OK)
+        fr = fc != FR_OK ? fc : sort_err;
+    if (fr == FR_OK)
+        fr = f_sync(&strings_fil); // before anything points at the new strings
+
+    library_close();
+    if (fr == FR_OK)
+    {
+        f_unlink(LIBRARY_TRACKS);
+        fr = f_rename(LIBRARY_TRACKS_TMP, LIBRARY_TRACKS);
+    }
+    if (fr != FR_OK)
+    {
+        printf("Library index not updated (%d)\r\n", fr);
+        f_unlink(LIBRARY_TRACKS_TMP);
+    }
+    stats.dirs = dirty_n;
+    return library_open() && fr == FR_OK;
+}
+
+/* ---------------- browse indices ---------------- */
+
+// Appends the string at ref to out[at], control characters blanked so the
+// separators stay unambiguous. Returns the new length.
+static size_t key_put(char *out, size_t at, size_t n, uint32_t ref)
+{
+    if (at + 1 >= n)
+        return at;
+    read_str(ref, &out[at], n - at);
+    for (; out[at]; at++)
+        if ((uint8_t)out[at] < ' ')
+            out[at] = ' ';
+    return at;
+}
+
+// Group name as the index sorts it
+static size_t group_key(const uint32_t ref[2], char *out, size_t n)
+{
+    size_t k = key_put(out, 0, n, ref[0]);
+    if (ref[1] && k + 2 < n)
+    {
+        out[k++] = INDEX_ALBUM;
+        k = key_put(out, k, n, ref[1]);
+    }
+    return k;
+}
+
+// Index keys: case-insensitive, and unlike paths nothing special about '/'
+static int compare_keys(const char *a, const char *b)
+{
+    for (;; a++, b++)
+    {
+        int ca = fold_case(*a), cb = fold_case(*b);
+        if (ca != cb || !ca)
+            return ca - cb;
+    }
+}
+
+// Sort entry of record id for index ix
+static void index_list(library_index_t ix, int id, const track_rec_t *r)
+{
+    uint32_t ref[2] = {0, 0}, sub[2] = {0, 0};
+    if (ix == LIBRARY_BY_ARTIST)
+        ref[0] = r->artist, sub[0] = r->album;
+    else if (ix == LIBRARY_BY_ALBUM)
+        ref[0] = r->album_artist ? r->album_artist : r->artist, ref[1] = r->album;
+    else
+        ref[0] = r->genre, sub[0] = r->artist, sub[1] = r->album;
+
+    size_t k = group_key(ref, str_buf, sizeof(str_buf));
+    for (int i = 0; i < 2 && sub[i] && k + 2 < sizeof(str_buf); i++)
+    {
+        str_buf[k++] = INDEX_SUB;
+        k = key_put(str_buf, k, sizeof(str_buf), sub[i]);
+    }
+    listed_t *e = sort_slot(k + 1);
+    e->size = r->track_no;
+    e->stamp = id;
+    e->ref[0] = ref[0];
+    e->ref[1] = ref[1];
+    memcpy(e->path, str_buf, k + 1);
+}
+
+// Index ix from the table as it is now. Caller holds the SD bus and has
+// flushed the pages, their RAM is the sort buffer again.
+static FRESULT index_build(library_index_t ix, index_header_t *h)
+{
+    const char *in, *out;
+    FRESULT fr;
+    index_close();
+    if ((fr = sort_begin(compare_keys)) != FR_OK)
+        return fr;
+
+    // records straight off the card in id order, the strings through the lines
+    fr = f_lseek(&tracks_fil, LIBRARY_DATA_OFFSET);
+    for (int id = 0; id < count && fr == FR_OK; id++)
+    {
+        track_rec_t r;
+        UINT br = 0;
+        fr = f_read(&tracks_fil, &r, sizeof(r), &br);
+        if (fr == FR_OK && br != sizeof(r))
+            fr = FR_INT_ERR;
+        if (fr == FR_OK && !(r.flags & (TRACK_PENDING | TRACK_UNPLAYABLE)))
+            index_list(ix, id, &r);
+    }
+    int runs = sort_end(&in, &out);
+    if (fr == FR_OK)
+        fr = sort_err;
+
+    // entries go in place, the groups to the spare sort file until their count is known
+    *h = (index_header_t){.magic = LIBRARY_INDEX_MAGIC, .version = LIBRARY_VERSION, .kind = ix, .epoch = hdr.epoch};
+    index_header_t blank = {0};
+    if (fr == FR_OK)
+        fr = f_open(&new_tracks, index_files[ix], FA_WRITE | FA_CREATE_ALWAYS);
+    if (fr != FR_OK)
+        return fr;
+    if ((fr = f_open(&new_strings, out, FA_READ | FA_WRITE | FA_CREATE_ALWAYS)) != FR_OK)
+    {
+        f_close(&new_tracks);
+        return fr;
+    }
+    fr = write_all(&new_tracks, &blank, sizeof(blank)); // stays invalid until it's complete
+    if (fr == FR_OK)
+        fr = f_lseek(&new_tracks, LIBRARY_DATA_OFFSET);
+
+    uint32_t pos = 0, bytes;
+    int k = readers_open(in, &pos, runs, &bytes), letter = 0;
+    for (run_reader_t *m; fr == FR_OK && (m = readers_min(k)); reader_next(m))
+    {
+        char *sub = strchr(m->cur.path, INDEX_SUB);
+        if (sub)
+            *sub = '\0';
+        if (h->groups == 0 || compare_keys(m->cur.path, old_path))
+        {
+            index_group_t g = {.ref = {m->cur.ref[0], m->cur.ref[1]}, .first = h->tracks};
+            for (int c = fold_case(m->cur.path[0]); letter < 26 && c >= 'a' + letter; letter++)
+                h->jump[letter] = h->groups;
+            strcpy(old_path, m->cur.path);
+            fr = write_all(&new_strings, &g, sizeof(g));
+            h->groups++;
+        }
+        index_entry_t e = {.id = m->cur.stamp, .track_no = m->cur.size};
+        if (fr == FR_OK)
+            fr = write_all(&new_tracks, &e, sizeof(e));
+        h->tracks++;
+    }
+    readers_close(k);
+    for (; letter < 26; letter++)
+        h->jump[letter] = h->groups;
+
+    // groups behind the entries, through the sort buffer
+    uint32_t left = h->groups * sizeof(index_group_t);
+    if (fr == FR_OK)
+        fr = f_lseek(&new_strings, 0);
+    while (fr == FR_OK && left)
+    {
+        UINT n = left < sizeof(mem.sort) ? left : sizeof(mem.sort), br = 0;
+        fr = f_read(&new_strings, mem.sort, n, &br);
+        if (fr == FR_OK && br != n)
+            fr = FR_INT_ERR;
+        if (fr == FR_OK)
+            fr = write_all(&new_tracks, mem.sort, n);
+        left -= n;
+    }
+    if (fr == FR_OK)
+        fr = sort_err;
+    if (fr == FR_OK)
+        fr = write_at(&new_tracks, 0, h, sizeof(*h));
+    FRESULT fc = f_close(&new_tracks);
+    f_close(&new_strings);
+    f_unlink(LIBRARY_SORT_A);
+    f_unlink(LIBRARY_SORT_B);
+    return fr == FR_OK ? fc : fr;
+}
+
+static uint32_t group_at(uint32_t g)
+{
+    return LIBRARY_DATA_OFFSET + index_hdr.tracks * sizeof(index_entry_t) + g * sizeof(index_group_t);
+}
+
+// Opens index ix if it was built from the table as it is now
+static bool index_select(library_index_t ix)
+{
+    if (index_open == (int)ix)
+        return true;
+    index_close();
+    if (!lib_open || ix >= LIBRARY_INDEX_NUM || f_open(&index_fil, index_files[ix], FA_READ) != FR_OK)
+        return false;
+    UINT br = 0;
+    bool ok = f_read(&index_fil, &index_hdr, sizeof(index_hdr), &br) == FR_OK && br == sizeof(index_hdr) &&
+              index_hdr.magic == LIBRARY_INDEX_MAGIC && index_hdr.version == LIBRARY_VERSION &&
+              index_hdr.kind == ix && index_hdr.epoch == hdr.epoch && index_hdr.tracks <= (uint32_t)count &&
+              index_hdr.groups <= index_hdr.tracks && f_size(&index_fil) >= group_at(index_hdr.groups);
+    if (!ok)
+    {
+        f_close(&index_fil);
+        return false;
+    }
+    index_open = ix;
+    return true;
+}
+
+static bool index_read(uint32_t pos, void *out, UINT len)
+{
+    UINT br = 0;
+    return f_lseek(&index_fil, pos) == FR_OK && f_read(&index_fil, out, len, &br) == FR_OK && br == len;
+}
+
+// <0, 0 or >0 as the name of group g sorts before, starts with or sorts after prefix
+static int group_vs_prefix(uint32_t g, const char *prefix)
+{
+    index_group_t grp;
+    if (!index_read(group_at(g), &grp, sizeof(grp)))
+        return 1;
+    group_key(grp.ref, str_buf, sizeof(str_buf));
+    for (const char *k = str_buf; *prefix; k++, prefix++)
+    {
+        int ck = fold_case(*k), cp = fold_case(*prefix);
+        if (ck != cp)
+            return ck - cp;
+    }
+    return 0;
+}
+
+// First group in [lo, hi) that doesn't sort before prefix, or with past
+// the first that sorts after it
+static uint32_t group_bound(const char *prefix, bool past, uint32_t lo, uint32_t hi)
+{
+    while (lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int c = group_vs_prefix(mid, prefix);
+        if (past ? c <= 0 : c < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// Builds the first browse index the table doesn't have yet, one per call
+// so the menu doesn't stall for all of them. Clears index_due when
+// they're all there. Caller holds the SD bus, nothing is pending.
+static void index_refresh(void)
+{
+    for (int ix = 0; ix < LIBRARY_INDEX_NUM && lib_open && count; ix++)
+    {
+        if (index_select(ix))
+            continue;
+        library_flush();
+
+        index_header_t h;
+        absolute_time_t t0 = get_absolute_time();
+        FRESULT fr = index_build(ix, &h);
+        uint32_t ms = absolute_time_diff_us(t0, get_absolute_time()) / 1000;
+        if (fr != FR_OK)
+        {
+            printf("\r\nBrowse by %s not built (%d)\r\n", index_names[ix], fr);
+            f_unlink(index_files[ix]);
+            break; // the card is in trouble, try again next boot
+        }
+        printf("\r\nBrowse by %s: %lu names over %lu tracks, built in %lu ms\r\n", index_names[ix],
+               (unsigned long)h.groups, (unsigned long)h.tracks, (unsigned long)ms);
+        return;
+    }
+    index_due = false;
+}
+
+// Names in index ix, 0 while it isn't built
+int library_index_groups(library_index_t ix)
+{
+    spi_bus_acquire(SPI_BUS_SD);
+    int n = index_select(ix) ? index_hdr.groups : 0;
+    spi_bus_release();
+    return n;
+}
+
+// Groups whose name starts with prefix (case-insensitive) are [returned, *end).
+// The jump table narrows it to the first letter, a binary search does the rest.
+int library_index_find(library_index_t ix, const char *prefix, int *end)
+{
+    absolute_time_t t0 = get_absolute_time();
+    uint32_t lo = 0, hi = 0;
+    spi_bus_acquire(SPI_BUS_SD);
+    if (index_select(ix))
+    {
+        hi = index_hdr.groups;
+        int c = fold_case(prefix[0]);
+        if (c >= 'a' && c <= 'z')
+        {
+            lo = index_hdr.jump[c - 'a'];
+            if (c < 'z')
+                hi = index_hdr.jump[c - 'a' + 1];
+        }
+        if (prefix[0])
+        {
+            lo = group_bound(prefix, false, lo, hi);
+            hi = group_bound(prefix, true, lo, hi);
+        }
+    }
+    spi_bus_release();
+    lookups++;
+    lookup_us += absolute_time_diff_us(t0, get_absolute_time());
+    *end = hi;
+    return lo;
+}
+
+// First group at or after letter, for a jump-to-letter control
+int library_index_jump(library_index_t ix, char letter)
+{
+    int c = fold_case(letter), g = 0;
+    spi_bus_acquire(SPI_BUS_SD);
+    if (index_select(ix) && c >= 'a' && c <= 'z')
+        g = index_hdr.jump[c - 'a'];
+    spi_bus_release();
+    return g;
+}
+
+// Name of group g into name, its tracks are entries [returned, returned + *tracks).
+// -1 if there's no such group.
+int library_index_group(library_index_t ix, int g, char *name, size_t n, int *tracks)
+{
+    index_group_t grp[2];
+    int first = -1;
+    *tracks = 0;
+    spi_bus_acquire(SPI_BUS_SD);
+    if (index_select(ix) && g >= 0 && (uint32_t)g < index_hdr.groups &&
+        index_read(group_at(g), grp, (uint32_t)g + 1 < index_hdr.groups ? 2 * sizeof(grp[0]) : sizeof(grp[0])))
+    {
+        first = grp[0].first;
+        *tracks = ((uint32_t)g + 1 < index_hdr.groups ? grp[1].first : index_hdr.tracks) - first;
+        read_str(grp[0].ref[0], name, n);
+        size_t k = strlen(name);
+        if (grp[0].ref[1] && k + 4 < n)
+        {
+            strcpy(&name[k], " - ");
+            read_str(grp[0].ref[1], &name[k + 3], n - k - 3);
+        }
+    }
+    spi_bus_release();
+    return first;
+}
+
+// Track id at entry pos of index ix, -1 if there's none
+int library_index_track(library_index_t ix, int pos)
+{
+    index_entry_t e;
+    int id = -1;
+    spi_bus_acquire(SPI_BUS_SD);
+    if (index_select(ix) && pos >= 0 && (uint32_t)pos < index_hdr.tracks &&
+        index_read(LIBRARY_DATA_OFFSET + pos * sizeof(e), &e, sizeof(e)))
+        id = e.id;
+    spi_bus_release();
+    return id;
+}
+
+// Serial view of index ix: the names starting with prefix and their first tracks
+void library_index_print(library_index_t ix, const char *prefix)
+{
+    char name[LIBRARY_ROW_TEXT * 2];
+    int end, first = library_index_find(ix, prefix, &end);
+    printf("\r\nBy %s, \"%s\": %d of %d names\r\n", index_names[ix], prefix, end - first, library_index_groups(ix));
+    for (int g = first; g < end && g < first + 8; g++)
+    {
+        int n, pos = library_index_group(ix, g, name, sizeof(name), &n);
+        printf("  %s (%d)\r\n", name, n);
+        for (int i = 0; i < n && i < 16; i++)
+        {
+            int id = library_index_track(ix, pos + i);
+            if (id < 0)
+                break;
+            spi_bus_acquire(SPI_BUS_SD);
+            track_rec_t r = *rec_at(id, false);
+            read_str(r.title ? r.title : r.name, name, sizeof(name));
+            spi_bus_release();
+            printf("    %2u %s\r\n", r.track_no, name);
+        }
+    }
+}
+
+// Bytes of RAM the library takes, whatever is on the card
+static uint32_t library_ram(void)
+{
+    return sizeof(mem) + sizeof(tags) + sizeof(lines) + sizeof(dedup) + sizeof(rows) + sizeof(readers) +
+           sizeof(walk_dir) + sizeof(FIL) * 6 + sizeof(scratch) + sizeof(dirty) + 5 * MAX_FILENAME_LEN;
+}
+
+// The table for what's on the card now. Returns the track count, pending
+// ones included. Caller holds the SD bus.
+int library_scan(void)
+{
+    absolute_time_t t0 = get_absolute_time();
+    memset(&stats, 0, sizeof(stats));
+    rows_drop();
+    bool damaged = lib_damaged; // keep what the old table has left, but all of it goes through rebuild()
+    pending_run_n = -1;
+
+    bool have = library_open();
+    snapshot_load();
+    list_digest = 0;
+    walk(visit_digest, dir_check);
+    snapshot_end();
+    bool same = have && !damaged && list_digest == hdr.digest && list_count == (int)hdr.count;
+    uint32_t epoch = same ? hdr.epoch : library_crc32(hdr.epoch, &list_digest, sizeof(list_digest)); // new, and not some other card's
+    if (snap_changed && !snap_over)
+        snapshot_save(epoch);
+    pages_drop(); // the snapshot was in their RAM
+    bool small = snap_loaded && !dirty_over && !list_full && hdr.updates < LIBRARY_MAX_UPDATES && !damaged;
+    if (!same && !(small && update(epoch) && !lib_damaged))
+        rebuild(epoch);
+    lib_damaged = lib_readonly = false;
+    if (rescan_made)
+        f_unlink(LIBRARY_RESCAN);
+    if (list_full)
+        printf("More than %d tracks, the rest are left out\r\n", LIBRARY_MAX_TRACKS);
+
+    count = lib_open ? hdr.count : 0;
+    pending = lib_open ? hdr.pending : 0;
+    cold_ms = hdr.cold_ms;
+    scan_ms = absolute_time_diff_us(t0, get_absolute_time()) / 1000;
+    fill_cold = !have;
+    fill_cursor = fill_misses = fill_unsaved = 0;
+    fill_us = 0;
+    filled = fill_failed = 0;
+    library_window(0);
+
+    if (same)
+        printf("Library: %d tracks, card unchanged (%lu ms)", count, (unsigned long)scan_ms);
+    else
+        printf("Library: %d tracks in %lu ms, %d unchanged, %d new or changed, %d gone", count,
+               (unsigned long)scan_ms, stats.hits, stats.listed, stats.removed);
+    if (stats.dirs)
+        printf(" (%d directories rescanned)", stats.dirs);
+    if (have && cold_ms)
+        printf(", cold start took %lu ms", (unsigned long)cold_ms);
+    if (pending)
+        printf(", %d to parse", pending);
+    printf("\r\n  %lu bytes of RAM for any number of tracks\r\n", (unsigned long)library_ram());
+    index_due = true;
+    return count;
+}
+
+/* ---------------- background fill ---------------- */
+
+// Parses one pending record. Caller holds the SD bus.
+static void fill(int id)
+{
+    track_rec_t *r = rec_at(id, true); // nothing below pages anything in
+    rec_path(r, scan_path, sizeof(scan_path));
+
+    memset(&scratch, 0, sizeof(scratch));
+    absolute_time_t t0 = get_absolute_time();
+    bool ok = get_metadata(scan_path, &scratch);
+    fill_us += absolute_time_diff_us(t0, get_absolute_time());
+
+    if (ok)
+    {
+        rec_fill(r, &scratch);
+        filled++;
+    }
+    else
+    {
+        printf("\r\n%s: not something we can play\r\n", scan_path);
+        r->flags = TRACK_UNPLAYABLE; // stays listed so ids don't shift under the menu
+        fill_failed++;
+    }
+    if (pending > 0)
+        pending--;
+    fill_unsaved++;
+    for (int i = 0; i < LIBRARY_WINDOW; i++)
+        if (rows[i].id == id)
+            row_load(&rows[i], id);
+
+    if (pending == 0)
+    {
+        if (fill_cold)
+            cold_ms = scan_ms + fill_us / 1000;
+        printf("\r\nLibrary complete: %d parsed in %lld ms (%lld us each), %d unplayable\r\n",
+               filled + fill_failed, (long long)(fill_us / 1000), (long long)(fill_us / (filled + fill_failed)),
+               fill_failed);
+    }
+    if (pending == 0 || fill_unsaved >= LIBRARY_SAVE_EVERY)
+    {
+        library_flush();
+        fill_unsaved = 0;
+    }
+}
+
+// Reads the next LIBRARY_CHECK_BYTES of strings.dat back against the
+// header's CRC. A mismatch spoils the header, the rescan starts cold. A
+// read that fails gives up on the check, it's the card, not the table.
+static void strings_check(void)
+{
+    uint32_t end = hdr.strings_size - check_pos < LIBRARY_CHECK_BYTES ? hdr.strings_size
+                                                                      : check_pos + LIBRARY_CHECK_BYTES;
+    bool ok = strings_read_crc(check_pos, end, &check_crc);
+    check_pos = ok ? end : hdr.strings_size;
+    if (!ok || end < hdr.strings_size || check_crc == hdr.strings_crc)
+        return;
+    printf("Library strings damaged, rebuilding\r\n");
+    library_header_t h = {0};
+    write_at(&tracks_fil, 0, &h, sizeof(h));
+    f_sync(&tracks_fil);
+    lib_damaged = lib_readonly = true;
+}
+
+// id, or the next id an update left pending if id isn't one of them. The
+// records in between don't need paging in to find that out.
+static int cursor_skip(int id)
+{
+    if (pending_run_n <= 0)
+        return id;
+    for (int i = 0; i < pending_run_n; i++)
+        if (id < pending_runs[i].end)
+            return id > pending_runs[i].start ? id : pending_runs[i].start;
+    return pending_runs[0].start;
+}
+
+static bool is_pending(int id)
+{
+    return id >= 0 && id < count && (rec_at(id, false)->flags & TRACK_PENDING);
+}
+
+// One background parse. prefer is the highlighted id, it and the rows
+// around it go first, then the cursor works through the rest a couple of
+// pages per call. Once nothing is pending, a step builds a browse index
+// instead. Returns false when there's nothing left to do.
+bool library_fill_step(int prefer)
+{
+    if (lib_damaged)
+    {
+        spi_bus_acquire(SPI_BUS_SD);
+        library_scan();
+        spi_bus_release();
+        return true;
+    }
+    if (lib_readonly || (pending == 0 && !index_due && check_pos >= hdr.strings_size))
+        return false;
+
+    spi_bus_acquire(SPI_BUS_SD);
+    if (pending == 0 && check_pos < hdr.strings_size)
+    {
+        strings_check();
+        spi_bus_release();
+        return true;
+    }
+    if (pending == 0)
+    {
+        index_refresh();
+        spi_bus_release();
+        return index_due;
+    }
+    int id = -1;
+    for (int i = 0; id < 0 && i <= 2 * LIBRARY_FILL_AHEAD; i++)
+    {
+        int near = prefer + (i + 1) / 2 * (i % 2 ? 1 : -1); // prefer, +1, -1, +2...
+        if (is_pending(near))
+            id = near;
+    }
+    for (int i = 0; id < 0 && pending && i < LIBRARY_FILL_SCAN; i++)
+    {
+        fill_cursor = cursor_skip(fill_cursor);
+        if (is_pending(fill_cursor))
+            id = fill_cursor;
+        else if (++fill_misses >= count)
+            pending = 0; // a page went back without the header, nothing's actually left
+        fill_cursor = (fill_cursor + 1) % count;
+    }
+
+    if (id >= 0)
+    {
+        fill_misses = 0;
+        fill(id);
+    }
+    else if (pending == 0)
+        library_flush();
+    spi_bus_release();
+    return pending > 0 || index_due;
+}
+
+// Makes sure id is parsed before it plays. False if it can't be played.
+bool library_resolve(int id)
+{
+    spi_bus_acquire(SPI_BUS_SD);
+    if (is_pending(id))
+        fill(id);
+    bool ok = !(rec_at(id, false)->flags & TRACK_UNPLAYABLE);
+    spi_bus_release();
+    return ok;
+}
+
+// Whether id is parsed and playable, without parsing it (a page read at most)
+bool library_ready(int id)
+{
+    spi_bus_acquire(SPI_BUS_SD);
+    uint8_t flags = rec_at(id, false)->flags;
+    spi_bus_release();
+    return !(flags & (TRACK_PENDING | TRACK_UNPLAYABLE));
+}
+
+// Cache hit rates, what LIBRARY_PAGES and LIBRARY_STR_LINES are tuned on
+void library_cache_stats(library_cache_stats_t *s)
+{
+    s->page_hits = page_hits;
+    s->page_misses = page_misses;
+    s->line_hits = line_hits;
+    s->line_misses = line_misses;
+}
+
+void library_print_stats(void)
+{
+    uint32_t p = page_hits + page_misses, l = line_hits + line_misses;
+    printf("Library cache: %lu of %lu page lookups hit (%lu%%), %lu of %lu string sectors (%lu%%)\r\n",
+           (unsigned long)page_hits, (unsigned long)p, (unsigned long)(p ? page_hits * 100 / p : 0),
+           (unsigned long)line_hits, (unsigned long)l, (unsigned long)(l ? line_hits * 100 / l : 0));
+    if (lookups)
+        printf("Browse lookups: %lu, %lld us each\r\n", (unsigned long)lookups, (long long)(lookup_us / lookups));
+}
@@ -0,0 +1,1205 @@
+#include "lib/sb_util/sb_util.h"
+
+/* ##########################################################
+METADATA: TAGS FROM WHATEVER CONTAINER THE FILE TURNS OUT TO BE
+get_metadata() goes by the first bytes of the file, not its name, and
+hands it to the parser for that container: ID3v2 (2.2 to 2.4) plus
+the first MPEG frame, FLAC metadata blocks, the Ogg Vorbis comment
+header, MP4 atom trees and RIFF INFO / AIFF NAME+AUTH text on top of
+the WAV/AIFF format parser. All of them read through one MD_BLOCK
+buffer and step over what they don't want with seeks, so a 5 MB cover
+costs the same as a 5 byte one.
+########################################################## */
+
+#define MD_BLOCK 512
+#define MD_MP4_DEPTH 8     // deepest atom nesting followed
+#define MD_OGG_TAIL 16384  // how far back from the end to look for the last page
+#define MD_SYNC_HUNT 131072 // furthest past the tag to look for the first MPEG frame
+#define MD_TEXT_MAX 260    // ID3 text frame bytes decoded, enough for 128 chars of UTF-16
+
+#define FOURCC(a, b, c, d) ((uint32_t)(a) << 24 | (uint32_t)(b) << 16 | (uint32_t)(c) << 8 | (uint32_t)(d))
+
+typedef struct {
+    FIL *fil;
+    uint32_t base;      // file offset of buf[0]
+    uint16_t len;       // valid bytes in buf
+    uint16_t off;       // read position in buf
+    bool fail;          // a read came up short (truncated or corrupt file)
+    bool ogg;           // step over page headers, reads only see packet data
+    uint32_t page_left; // ogg: bytes left in the current page body
+    bool unsync;        // ID3 unsynchronisation: drop the 0x00 after every 0xFF
+    uint8_t last;       // unsync: previous raw byte
+    uint32_t count;     // unsync: bytes handed out, the decoded position
+    uint32_t unsync_end; // unsync: file offset the encoded bytes stop at
+    uint8_t buf[MD_BLOCK];
+} md_reader_t;
+
+static md_reader_t reader; // scanning is core0 only, keep the buffer off its small stack
+
+static const char *const container_names[CONTAINER_NUM] = {"?", "MP3", "FLAC", "Ogg", "MP4", "WAV", "AIFF"};
+
+const char *container_name(uint8_t container)
+{
+    return container < CONTAINER_NUM ? container_names[container] : container_names[0];
+}
+
+/* ---------------- block reader ---------------- */
+
+static uint32_t md_tell(md_reader_t *r)
+{
+    return r->base + r->off;
+}
+
+static void md_seek(md_reader_t *r, uint32_t pos)
+{
+    if (pos >= r->base && pos <= r->base + r->len)
+    {
+        r->off = pos - r->base;
+        return;
+    }
+    f_lseek(r->fil, pos);
+    r->base = pos;
+    r->len = 0;
+    r->off = 0;
+}
+
+static void md_open(md_reader_t *r, FIL *fil)
+{
+    r->fil = fil;
+    r->fail = false;
+    r->ogg = false;
+    r->page_left = 0;
+    r->unsync = false;
+    r->last = 0;
+    r->count = 0;
+    r->base = 0;
+    r->len = 0;
+    r->off = 0;
+    f_lseek(fil, 0);
+}
+
+// Reads the block that starts at pos, returns how much of it there is
+static uint32_t md_load(md_reader_t *r, uint32_t pos)
+{
+    UINT br = 0;
+    f_lseek(r->fil, pos);
+    r->base = pos;
+    r->off = 0;
+    r->len = 0;
+    if (f_read(r->fil, r->buf, MD_BLOCK, &br) == FR_OK)
+        r->len = br;
+    return r->len;
+}
+
+// Straight from the file, dst NULL just moves past the bytes
+static uint32_t md_raw_read(md_reader_t *r, uint8_t *dst, uint32_t n)
+{
+    uint32_t done = 0;
+    while (done < n)
+    {
+        if (r->off == r->len)
+        {
+            UINT br = 0;
+            r->base += r->len;
+            r->off = 0;
+            r->len = 0;
+            if (f_read(r->fil, r->buf, MD_BLOCK, &br) != FR_OK || br == 0)
+                break;
+            r->len = br;
+        }
+        uint32_t k = n - done;
+        if (k > (uint32_t)(r->len - r->off))
+            k = r->len - r->off;
+        if (dst)
+            memcpy(dst + done, r->buf + r->off, k);
+        r->off += k;
+        done += k;
+    }
+    if (done < n)
+        r->fail = true;
+    return done;
+}
+
+// Loads the next page header, leaves the reader at its body
+static bool ogg_next_page(md_reader_t *r)
+{
+    uint8_t h[27], lacing[255];
+    if (md_raw_read(r, h, 27) != 27 || memcmp(h, "OggS", 4))
+        return false;
+    if (md_raw_read(r, lacing, h[26]) != h[26])
+        return false;
+    r->page_left = 0;
+    for (int i = 0; i < h[26]; i++)
+        r->page_left += lacing[i];
+    return true;
+}
+
+// Undoes ID3 unsynchronisation byte by byte, only tags that use it pay for that
+static uint32_t unsync_read(md_reader_t *r, uint8_t *dst, uint32_t n)
+{
+    uint32_t done = 0;
+    while (done < n && md_tell(r) < r->unsync_end)
+    {
+        uint8_t b;
+        if (md_raw_read(r, &b, 1) != 1)
+            break;
+        bool stuffed = r->last == 0xFF && b == 0x00;
+        r->last = b;
+        if (stuffed)
+            continue;
+        if (dst)
+            dst[done] = b;
+        done++;
+    }
+    r->count += done;
+    return done;
+}
+
+static uint32_t md_read(md_reader_t *r, void *dst, uint32_t n)
+{
+    if (r->unsync)
+        return unsync_read(r, dst, n);
+    if (!r->ogg)
+        return md_raw_read(r, dst, n);
+
+    uint8_t *d = dst;
+    uint32_t done = 0;
+    while (done < n)
+    {
+        if (r->page_left == 0 && !ogg_next_page(r))
+        {
+            r->fail = true;
+            break;
+        }
+        uint32_t k = n - done;
+        if (k > r->page_left)
+            k = r->page_left;
+        if (d)
+            md_raw_read(r, d + done, k);
+        else
+            md_seek(r, md_tell(r) + k);
+        r->page_left -= k;
+        done += k;
+    }
+    return done;
+}
+
+static void md_skip(md_reader_t *r, uint32_t n)
+{
+    if (r->ogg || r->unsync)
+        md_read(r, NULL, n);
+    else
+        md_seek(r, md_tell(r) + n);
+}
+
+static uint32_t md_be32(md_reader_t *r)
+{
+    uint8_t b[4] = {0};
+    md_read(r, b, 4);
+    return (uint32_t)b[0] << 24 | (uint32_t)b[1] << 16 | (uint32_t)b[2] << 8 | b[3];
+}
+
+static uint32_t md_le32(md_reader_t *r)
+{
+    uint8_t b[4] = {0};
+    md_read(r, b, 4);
+    return (uint32_t)b[3] << 24 | (uint32_t)b[2] << 16 | (uint32_t)b[1] << 8 | b[0];
+}
+
+// Up to out_size - 1 bytes of text into out, the rest of the n is skipped
+static void md_text(md_reader_t *r, uint32_t n, char *out, size_t out_size)
+{
+    uint32_t k = n < out_size - 1 ? n : out_size - 1;
+    k = md_read(r, out, k);
+    out[k] = '\0';
+    md_skip(r, n - k);
+}
+
+/* ---------------- shared pieces ---------------- */
+
+static void md_defaults(const char *filename, track_info_t *track)
+{
+    strcpy(track->filename, filename);
+    strcpy(track->title, "(unknown)");
+    strcpy(track->artist, "(unknown)");
+    strcpy(track->album, "(unknown)");
+    strcpy(track->mime_type, "unknown");
+    track->album_artist[0] = '\0';
+    track->genre[0] = '\0';
+    track->track_no = 0;
+    track->album_art_size = 0;
+    track->album_art_offset = 0;
+    track->album_art_type = 0;
+    track->header = 0;
+    track->mpegID = 0;
+    track->bitrate = 0;
+    track->samplespeed = 0;
+    track->channels = 2;
+    track->format = TRACK_CODEC;
+}
+
+// ID3v1 genre numbers, which TCON "(n)" and MP4 gnre refer to as well
+static const char *const id3_genres[] = {
+    "Blues", "Classic Rock", "Country", "Dance", "Disco", "Funk", "Grunge", "Hip-Hop",
+    "Jazz", "Metal", "New Age", "Oldies", "Other", "Pop", "R&B", "Rap",
+    "Reggae", "Rock", "Techno", "Industrial", "Alternative", "Ska", "Death Metal", "Pranks",
+    "Soundtrack", "Euro-Techno", "Ambient", "Trip-Hop", "Vocal", "Jazz+Funk", "Fusion", "Trance",
+    "Classical", "Instrumental", "Acid", "House", "Game", "Sound Clip", "Gospel", "Noise",
+    "Alternative Rock", "Bass", "Soul", "Punk", "Space", "Meditative", "Instrumental Pop", "Instrumental Rock",
+    "Ethnic", "Gothic", "Darkwave", "Techno-Industrial", "Electronic", "Pop-Folk", "Eurodance", "Dream",
+    "Southern Rock", "Comedy", "Cult", "Gangsta", "Top 40", "Christian Rap", "Pop/Funk", "Jungle",
+    "Native American", "Cabaret", "New Wave", "Psychedelic", "Rave", "Showtunes", "Trailer", "Lo-Fi",
+    "Tribal", "Acid Punk", "Acid Jazz", "Polka", "Retro", "Musical", "Rock & Roll", "Hard Rock",
+};
+
+static void genre_number(track_info_t *track, unsigned n)
+{
+    if (n < count_of(id3_genres))
+        strcpy(track->genre, id3_genres[n]);
+}
+
+// "(17)", "(17)Rock" (the text refines the number and wins) or, from v2.4
+// on, a bare "17". Names are left as they are.
+static void genre_fix(track_info_t *track)
+{
+    const char *p = track->genre;
+    bool paren = *p == '(';
+    p += paren;
+    if (*p < '0' || *p > '9')
+        return;
+    unsigned n = 0;
+    while (*p >= '0' && *p <= '9' && n < 1000)
+        n = n * 10 + *p++ - '0';
+    if (paren && *p++ != ')')
+        return;
+    if (*p && paren)
+        memmove(track->genre, p, strlen(p) + 1);
+    else if (!*p)
+    {
+        track->genre[0] = '\0';
+        genre_number(track, n);
+    }
+}
+
+// "3" or "3/12"
+static uint16_t track_number(const char *s)
+{
+    uint32_t n = 0;
+    while (*s >= '0' && *s <= '9' && n < 0xFFFF)
+        n = n * 10 + *s++ - '0';
+    return n > 0xFFFF ? 0xFFFF : n;
+}
+
+// Same rule as APIC: the front cover wins, otherwise the first picture found
+static void take_art(md_reader_t *r, track_info_t *track, uint8_t type, const char *mime,
+                     uint32_t offset, uint32_t size)
+{
+    uint32_t file_size = f_size(r->fil);
+    if (size == 0 || offset > file_size || size > file_size - offset)
+        return;
+    if (type != 0x03 && track->album_art_offset != 0)
+        return;
+    track->album_art_type = type;
+    strncpy(track->mime_type, mime, sizeof(track->mime_type) - 1);
+    track->mime_type[sizeof(track->mime_type) - 1] = '\0';
+    track->album_art_offset = offset;
+    track->album_art_size = size;
+}
+
+// Average kbps from the audio payload and the play time
+static uint16_t avg_kbps(uint32_t bytes, uint64_t duration_ms)
+{
+    if (duration_ms == 0)
+        return 0;
+    uint64_t kbps = (uint64_t)bytes * 8 / duration_ms;
+    return kbps > 0xFFFF ? 0xFFFF : kbps;
+}
+
+// key=value list with little endian lengths (FLAC VORBIS_COMMENT, Ogg comment header)
+static void parse_vorbis_comments(md_reader_t *r, track_info_t *track)
+{
+    md_skip(r, md_le32(r)); // vendor string
+    uint32_t count = md_le32(r);
+
+    for (uint32_t i = 0; i < count && !r->fail; i++)
+    {
+        uint32_t len = md_le32(r);
+        char key[16];
+        uint32_t k = 0, klen = 0;
+        bool long_key = false;
+
+        // key runs up to '=', only the short ones matter
+        while (k < len)
+        {
+            char c = 0;
+            if (md_read(r, &c, 1) != 1)
+                return;
+            k++;
+            if (c == '=')
+                break;
+            if (klen < sizeof(key) - 1)
+                key[klen++] = c;
+            else
+                long_key = true;
+        }
+        key[klen] = '\0';
+
+        char *dst = NULL;
+        size_t size = 0;
+        if (!long_key && !strcasecmp(key, "TITLE"))
+            dst = track->title, size = sizeof(track->title);
+        else if (!long_key && !strcasecmp(key, "ARTIST"))
+            dst = track->artist, size = sizeof(track->artist);
+        else if (!long_key && !strcasecmp(key, "ALBUM"))
+            dst = track->album, size = sizeof(track->album);
+        else if (!long_key && !strcasecmp(key, "ALBUMARTIST"))
+            dst = track->album_artist, size = sizeof(track->album_artist);
+        else if (!long_key && !strcasecmp(key, "GENRE"))
+            dst = track->genre, size = sizeof(track->genre);
+
+        if (dst)
+            md_text(r, len - k, dst, size);
+        else if (!long_key && !strcasecmp(key, "TRACKNUMBER"))
+        {
+            char num[8];
+            md_text(r, len - k, num, sizeof(num));
+            track->track_no = track_number(num);
+        }
+        else
+            md_skip(r, len - k);
+    }
+}
+
+/* ---------------- ID3v2 / MPEG ---------------- */
+
+// Appends one code point as UTF-8, false when it doesn't fit
+static bool utf8_put(char *out, size_t *oi, size_t out_size, uint32_t cp)
+{
+    uint8_t b[4];
+    size_t n;
+    if (cp < 0x80)
+        b[0] = cp, n = 1;
+    else if (cp < 0x800)
+        b[0] = 0xC0 | cp >> 6, b[1] = 0x80 | (cp & 0x3F), n = 2;
+    else if (cp < 0x10000)
+        b[0] = 0xE0 | cp >> 12, b[1] = 0x80 | ((cp >> 6) & 0x3F), b[2] = 0x80 | (cp & 0x3F), n = 3;
+    else
+        b[0] = 0xF0 | cp >> 18, b[1] = 0x80 | ((cp >> 12) & 0x3F), b[2] = 0x80 | ((cp >> 6) & 0x3F),
+        b[3] = 0x80 | (cp & 0x3F), n = 4;
+    if (*oi + n >= out_size)
+        return false;
+    memcpy(out + *oi, b, n);
+    *oi += n;
+    return true;
+}
+
+// Text in any of the four ID3 encodings to UTF-8, up to the first terminator
+// (v2.4 separates multiple values with one). Returns the length.
+static size_t id3_decode(uint8_t enc, const uint8_t *src, uint32_t len, char *out, size_t out_size)
+{
+    size_t oi = 0;
+    uint32_t i = 0;
+
+    if (enc == 1 || enc == 2)
+    {
+        bool little_endian = false; // encoding 2 is big endian without a BOM
+        if (enc == 1 && len >= 2 && ((src[0] == 0xFF && src[1] == 0xFE) || (src[0] == 0xFE && src[1] == 0xFF)))
+        {
+            little_endian = src[0] == 0xFF;
+            i = 2;
+        }
+        while (i + 1 < len)
+        {
+            uint32_t ch = little_endian ? src[i] | src[i + 1] << 8 : src[i] << 8 | src[i + 1];
+            i += 2;
+            if (ch == 0)
+                break;
+            if (ch >= 0xD800 && ch < 0xDC00 && i + 1 < len) // surrogate pair
+            {
+                uint32_t lo = little_endian ? src[i] | src[i + 1] << 8 : src[i] << 8 | src[i + 1];
+                if (lo >= 0xDC00 && lo < 0xE000)
+                {
+                    ch = 0x10000 + ((ch - 0xD800) << 10) + (lo - 0xDC00);
+                    i += 2;
+                }
+            }
+            if (!utf8_put(out, &oi, out_size, ch))
+                break;
+        }
+    }
+    else
+    {
+        for (; i < len && src[i]; i++)
+        {
+            if (enc == 3 || src[i] < 0x80)
+            {
+                if (oi + 1 >= out_size)
+                    break;
+                out[oi++] = src[i];
+            }
+            else if (!utf8_put(out, &oi, out_size, src[i])) // ISO-8859-1
+                break;
+        }
+        if (enc == 3 && i < len && src[i])
+            while (oi && (out[oi - 1] & 0xC0) == 0x80)
+                oi--; // cut at a character boundary
+        if (enc == 3 && oi && (out[oi - 1] & 0xC0) == 0xC0)
+            oi--;
+    }
+    out[oi] = '\0';
+    return oi;
+}
+
+// Text frame body (encoding byte first). Empty frames leave the default alone.
+static void id3_text(md_reader_t *r, uint32_t size, char *out, size_t out_size)
+{
+    static uint8_t raw[MD_TEXT_MAX];
+    char text[sizeof(((track_info_t *)0)->title)];
+    uint32_t n = md_read(r, raw, size < sizeof(raw) ? size : sizeof(raw));
+    if (n < 2)
+        return;
+    if (id3_decode(raw[0], raw + 1, n - 1, text, out_size < sizeof(text) ? out_size : sizeof(text)))
+        strcpy(out, text);
+}
+
+// Steps over a terminated string in the given encoding, false if the frame ends first
+static bool id3_skip_string(md_reader_t *r, uint8_t enc, uint32_t *left)
+{
+    uint32_t unit = (enc == 1 || enc == 2) ? 2 : 1;
+    while (*left >= unit)
+    {
+        uint8_t c[2] = {0};
+        md_read(r, c, unit);
+        *left -= unit;
+        if (r->fail)
+            return false;
+        if (c[0] == 0 && (unit == 1 || c[1] == 0))
+            return true;
+    }
+    return false;
+}
+
+// APIC (v2.3/2.4) or PIC (v2.2). The image is only usable when it sits
+// on the card as is, not through unsynchronisation.
+static void id3_picture(md_reader_t *r, uint8_t ver, uint32_t size, track_info_t *track)
+{
+    char mime[32] = "";
+    uint8_t enc, type;
+    uint32_t left = size;
+
+    if (left < 2 || md_read(r, &enc, 1) != 1)
+        return;
+    left--;
+    if (ver == 2)
+    {
+        uint8_t fmt[3];
+        if (left < 4 || md_read(r, fmt, 3) != 3)
+            return;
+        left -= 3;
+        strcpy(mime, !memcmp(fmt, "PNG", 3) ? "image/png" : "image/jpeg");
+    }
+    else
+    {
+        size_t i = 0;
+        for (;;)
+        {
+            char c = 0;
+            if (left == 0 || md_read(r, &c, 1) != 1)
+                return;
+            left--;
+            if (c == '\0')
+                break;
+            if (i < sizeof(mime) - 1)
+                mime[i++] = c;
+        }
+        mime[i] = '\0';
+    }
+    if (left == 0 || md_read(r, &type, 1) != 1)
+        return;
+    left--;
+    if (!id3_skip_string(r, enc, &left) || r->unsync)
+        return;
+    take_art(r, track, type, mime, md_tell(r), left);
+}
+
+static bool id3_frame_id_ok(const uint8_t *id, int n)
+{
+    for (int i = 0; i < n; i++)
+        if (!((id[i] >= 'A' && id[i] <= 'Z') || (id[i] >= '0' && id[i] <= '9')))
+            return false;
+    return true;
+}
+
+// v2.4 frame sizes are syncsafe, but some taggers wrote plain ones. When the
+// two readings differ, take the one that lands on the next frame, padding or
+// the end of the tag.
+static uint32_t id3v24_frame_size(md_reader_t *r, const uint8_t *b, uint32_t tag_end)
+{
+    uint32_t plain = (uint32_t)b[0] << 24 | (uint32_t)b[1] << 16 | (uint32_t)b[2] << 8 | b[3];
+    if ((b[0] | b[1] | b[2] | b[3]) & 0x80)
+        return plain; // can't be syncsafe
+    uint32_t safe = syncsafe_to_uint(b);
+    if (safe == plain)
+        return safe;
+
+    uint32_t here = md_tell(r);
+    uint32_t pick = safe;
+    for (int i = 0; i < 2; i++)
+    {
+        uint32_t at = here + (i ? plain : safe);
+        uint8_t id[4] = {0};
+        bool ok = at == tag_end;
+        if (!ok && at + 4 <= tag_end)
+        {
+            md_seek(r, at);
+            ok = md_raw_read(r, id, 4) == 4 && (id[0] == 0 || id3_frame_id_ok(id, 4));
+        }
+        if (ok)
+        {
+            pick = i ? plain : safe;
+            break;
+        }
+    }
+    r->fail = false;
+    md_seek(r, here);
+    return pick;
+}
+
+// ID3v2.2 to 2.4 at the start of the file. Returns the tag end (0 without one).
+static uint32_t parse_id3v2(md_reader_t *r, track_info_t *track)
+{
+    uint8_t h[10];
+    md_seek(r, 0);
+    if (md_read(r, h, 10) != 10 || memcmp(h, "ID3", 3))
+    {
+        r->fail = false;
+        return 0;
+    }
+
+    uint8_t ver = h[3], flags = h[5];
+    uint32_t tag_end = 10 + syncsafe_to_uint(&h[6]);
+    uint32_t audio = tag_end + ((ver == 4 && (flags & 0x10)) ? 10 : 0); // footer
+    if (ver < 2 || ver > 4 || (ver == 2 && (flags & 0x40)))
+        return audio; // unknown version, or v2.2 compression nobody defined
+
+    // v2.2/2.3 unsynchronise the whole tag, frame sizes count the decoded bytes
+    bool tag_unsync = (flags & 0x80) && ver < 4;
+    r->unsync = tag_unsync;
+    r->unsync_end = tag_end;
+    r->last = 0;
+    if (ver > 2 && (flags & 0x40)) // extended header
+    {
+        uint8_t e[4];
+        md_read(r, e, 4);
+        uint32_t n = ver == 4 ? syncsafe_to_uint(e) : ((uint32_t)e[0] << 24 | e[1] << 16 | e[2] << 8 | e[3]) + 4;
+        md_skip(r, n > 4 ? n - 4 : 0);
+    }
+
+    uint32_t hdr_len = ver == 2 ? 6 : 10;
+    while (!r->fail && md_tell(r) + hdr_len <= tag_end)
+    {
+        uint8_t fh[10];
+        if (md_read(r, fh, hdr_len) != hdr_len || !id3_frame_id_ok(fh, ver == 2 ? 3 : 4))
+            break; // padding or garbage
+
+        uint32_t size;
+        uint8_t fmt = 0;
+        if (ver == 2)
+            size = (uint32_t)fh[3] << 16 | fh[4] << 8 | fh[5];
+        else if (ver == 3)
+            size = (uint32_t)fh[4] << 24 | (uint32_t)fh[5] << 16 | fh[6] << 8 | fh[7], fmt = fh[9];
+        else
+            size = id3v24_frame_size(r, &fh[4], tag_end), fmt = fh[9];
+
+        uint32_t start = md_tell(r);
+        uint32_t start_count = r->count;
+        uint32_t body = size;
+
+        // frame format flags: compressed or encrypted frames are skipped,
+        // grouping bytes and the v2.4 data length are stepped over
+        bool usable = true;
+        if (ver == 3)
+        {
+            usable = !(fmt & 0xC0);
+            if (fmt & 0x20)
+                md_skip(r, 1), body--;
+        }
+        else if (ver == 4)
+        {
+            usable = !(fmt & 0x0C);
+            if (fmt & 0x40)
+                md_skip(r, 1), body--;
+            if (fmt & 0x01)
+            {
+                uint8_t dl[4] = {0};
+                md_read(r, dl, 4);
+                body -= 4;
+                if (fmt & 0x02)
+                    body = syncsafe_to_uint(dl); // decoded length
+            }
+            r->unsync = (fmt & 0x02) || (flags & 0x80);
+            r->unsync_end = start + size;
+            r->last = 0;
+        }
+        if (body > size)
+            usable = false; // flags claim more than the frame holds
+
+        const char *id = (const char *)fh;
+        if (usable && (!memcmp(id, "TIT2", 4) || !memcmp(id, "TT2", 3)))
+            id3_text(r, body, track->title, sizeof(track->title));
+        else if (usable && (!memcmp(id, "TPE1", 4) || !memcmp(id, "TP1", 3)))
+            id3_text(r, body, track->artist, sizeof(track->artist));
+        else if (usable && (!memcmp(id, "TALB", 4) || !memcmp(id, "TAL", 3)))
+            id3_text(r, body, track->album, sizeof(track->album));
+        else if (usable && (!memcmp(id, "TPE2", 4) || (ver == 2 && !memcmp(id, "TP2", 3))))
+            id3_text(r, body, track->album_artist, sizeof(track->album_artist));
+        else if (usable && (!memcmp(id, "TCON", 4) || (ver == 2 && !memcmp(id, "TCO", 3))))
+        {
+            id3_text(r, body, track->genre, sizeof(track->genre));
+            genre_fix(track);
+        }
+        else if (usable && (!memcmp(id, "TRCK", 4) || (ver == 2 && !memcmp(id, "TRK", 3))))
+        {
+            char num[8] = "";
+            id3_text(r, body, num, sizeof(num));
+            track->track_no = track_number(num);
+        }
+        else if (usable && (!memcmp(id, "APIC", 4) || (ver == 2 && !memcmp(id, "PIC", 3))))
+            id3_picture(r, ver, body, track);
+
+        // next frame: on the card it's size bytes on, except through a whole-tag unsync
+        if (tag_unsync)
+        {
+            uint32_t used = r->count - start_count;
+            if (used < size)
+                md_skip(r, size - used);
+        }
+        else
+        {
+            r->unsync = false;
+            md_seek(r, start + size);
+        }
+    }
+    r->unsync = false;
+    r->fail = false;
+    return audio;
+}
+
+// ID3v1 at the very end: the audio stops before it, and its fixed 30 byte
+// fields stand in for anything ID3v2 didn't have
+static void parse_id3v1(md_reader_t *r, track_info_t *track)
+{
+    uint8_t v1[128];
+    uint32_t size = f_size(r->fil);
+    if (size < 128 + track->audio_start)
+        return;
+    md_seek(r, size - 128);
+    if (md_read(r, v1, 128) != 128 || memcmp(v1, "TAG", 3))
+    {
+        r->fail = false;
+        return;
+    }
+    track->audio_end = size - 128;
+
+    static const struct { uint8_t at; size_t field; } fields[] = {
+        {3, offsetof(track_info_t, title)},
+        {33, offsetof(track_info_t, artist)},
+        {63, offsetof(track_info_t, album)},
+    };
+    for (size_t i = 0; i < count_of(fields); i++)
+    {
+        char *dst = (char *)track + fields[i].field;
+        if (strcmp(dst, "(unknown)"))
+            continue;
+        char text[31];
+        size_t n = id3_decode(0, &v1[fields[i].at], 30, text, sizeof(text));
+        while (n && text[n - 1] == ' ')
+            text[--n] = '\0';
+        if (n)
+            strcpy(dst, text);
+    }
+    if (v1[125] == 0 && v1[126] && !track->track_no)
+        track->track_no = v1[126]; // ID3v1.1
+    if (!track->genre[0])
+        genre_number(track, v1[127]);
+}
+
+// First valid MPEG frame header at or after pos, scanned in the buffer
+static bool mpeg_first_frame(md_reader_t *r, uint32_t pos, uint8_t h[4], mp3_frame_t *f)
+{
+    uint32_t limit = pos + MD_SYNC_HUNT;
+    while (pos < limit)
+    {
+        md_seek(r, pos);
+        if (r->len - r->off < 4 && md_load(r, pos) < 4)
+            return false; // end of file
+        const uint8_t *b = r->buf;
+        uint32_t i = r->off;
+        for (; i + 4 <= r->len; i++)
+        {
+            if (b[i] != 0xFF || !mp3_parse_frame_header(&b[i], f))
+                continue;
+            memcpy(h, &b[i], 4);
+            r->off = i;
+            return true;
+        }
+        pos = r->base + i; // the last 3 bytes come round again at the front of the next block
+    }
+    return false;
+}
+
+static bool parse_mp3(md_reader_t *r, track_info_t *track)
+{
+    uint8_t h[4];
+    mp3_frame_t frame;
+
+    track->audio_start = parse_id3v2(r, track);
+    track->audio_end = f_size(r->fil);
+
+    if (mpeg_first_frame(r, track->audio_start, h, &frame))
+    {
+        track->audio_start = md_tell(r);
+        track->header = (uint32_t)h[0] << 24 | (uint32_t)h[1] << 16 | (uint32_t)h[2] << 8 | h[3];
+        track->mpegID = frame.version_bits == 3 ? 1 : 2; // MPEG 2.5 counts as 2
+        track->samplespeed = frame.samplespeed;
+        track->bitrate = frame.bitrate;
+        track->channels = (frame.channel_bits >> 1) & 1; // 0 = stereo, 1 = mono
+    }
+    r->fail = false;
+
+    parse_id3v1(r, track);
+    return true;
+}
+
+/* ---------------- FLAC ---------------- */
+
+// METADATA_BLOCK_PICTURE body, all big endian
+static void parse_flac_picture(md_reader_t *r, track_info_t *track)
+{
+    char mime[32];
+    uint32_t type = md_be32(r);
+    md_text(r, md_be32(r), mime, sizeof(mime));
+    md_skip(r, md_be32(r)); // description
+    md_skip(r, 16);         // width, height, depth, colours
+    uint32_t size = md_be32(r);
+    if (!r->fail)
+        take_art(r, track, type, mime, md_tell(r), size);
+}
+
+static bool parse_flac(md_reader_t *r, track_info_t *track, uint32_t start)
+{
+    uint64_t total_samples = 0;
+    bool last = false;
+
+    md_seek(r, start + 4); // past "fLaC"
+    while (!last && !r->fail)
+    {
+        uint8_t h[4];
+        if (md_read(r, h, 4) != 4)
+            break;
+        last = h[0] & 0x80;
+        uint32_t len = (uint32_t)h[1] << 16 | (uint32_t)h[2] << 8 | h[3];
+        uint32_t next = md_tell(r) + len;
+
+        switch (h[0] & 0x7F)
+        {
+        case 0: // STREAMINFO
+        {
+            uint8_t b[18];
+            if (len < 18 || md_read(r, b, 18) != 18)
+                return false;
+            track->samplespeed = (uint32_t)b[10] << 12 | (uint32_t)b[11] << 4 | b[12] >> 4;
+            track->channels = ((b[12] >> 1) & 0x07) + 1;
+            total_samples = (uint64_t)(b[13] & 0x0F) << 32 |
+                            ((uint32_t)b[14] << 24 | (uint32_t)b[15] << 16 | (uint32_t)b[16] << 8 | b[17]);
+            break;
+        }
+        case 4: // VORBIS_COMMENT
+            parse_vorbis_comments(r, track);
+            break;
+        case 6: // PICTURE
+            parse_flac_picture(r, track);
+            break;
+        }
+        r->fail = false; // a bad block only loses that block, the lengths keep us in step
+        md_seek(r, next);
+    }
+
+    if (track->samplespeed == 0 || md_tell(r) >= f_size(r->fil))
+        return false; // no STREAMINFO or no frames after the metadata
+    track->audio_start = md_tell(r); // first frame
+    track->audio_end = f_size(r->fil);
+    if (total_samples)
+        track->bitrate = avg_kbps(track->audio_end - track->audio_start,
+                                  total_samples * 1000 / track->samplespeed);
+    return true;
+}
+
+/* ---------------- Ogg Vorbis ---------------- */
+
+// Granule position of the last page: the stream length in samples
+static uint64_t ogg_last_granule(md_reader_t *r)
+{
+    uint32_t size = f_size(r->fil);
+    uint32_t pos = size > MD_OGG_TAIL ? size - MD_OGG_TAIL : 0;
+    uint64_t granule = 0;
+    uint32_t window = 0;
+
+    md_seek(r, pos);
+    for (; pos < size; pos++)
+    {
+        uint8_t c;
+        if (md_raw_read(r, &c, 1) != 1)
+            break;
+        window = window << 8 | c;
+        if (window != FOURCC('O', 'g', 'g', 'S'))
+            continue;
+        uint8_t h[10]; // version, type, granule
+        if (md_raw_read(r, h, 10) != 10)
+            break;
+        pos += 10;
+        uint64_t g = 0;
+        for (int i = 7; i >= 0; i--)
+            g = g << 8 | h[2 + i];
+        if (g != UINT64_MAX) // -1: no packet ends on this page
+            granule = g;
+        window = 0;
+    }
+    r->fail = false;
+    return granule;
+}
+
+static bool parse_ogg(md_reader_t *r, track_info_t *track)
+{
+    uint8_t id[30];
+    md_seek(r, 0);
+    r->ogg = true;
+    r->page_left = 0;
+
+    // identification header, alone on the first page. Opus, Speex or FLAC
+    // in Ogg aren't something the VS1053 plays.
+    if (md_read(r, id, 30) != 30 || id[0] != 1 || memcmp(&id[1], "vorbis", 6))
+        return false;
+    track->channels = id[11];
+    track->samplespeed = (uint32_t)id[15] << 24 | (uint32_t)id[14] << 16 | (uint32_t)id[13] << 8 | id[12];
+    uint32_t nominal = (uint32_t)id[23] << 24 | (uint32_t)id[22] << 16 | (uint32_t)id[21] << 8 | id[20];
+    md_skip(r, r->page_left);
+
+    // comment header, may run over several pages
+    uint8_t hdr[7];
+    if (md_read(r, hdr, 7) == 7 && hdr[0] == 3 && !memcmp(&hdr[1], "vorbis", 6))
+        parse_vorbis_comments(r, track);
+    r->ogg = false;
+    r->fail = false;
+
+    if (track->samplespeed == 0)
+        return false;
+    track->audio_start = 0; // the decoder needs the headers too
+    track->audio_end = f_size(r->fil);
+    uint64_t samples = ogg_last_granule(r);
+    track->bitrate = samples ? avg_kbps(track->audio_end, samples * 1000 / track->samplespeed)
+                             : nominal / 1000;
+    return true;
+}
+
+/* ---------------- MP4 / M4A ---------------- */
+
+typedef struct {
+    bool moov;          // seen a moov
+    bool mdat_first;    // mdat came before moov
+    uint32_t mdat_size;
+    uint32_t timescale;
+    uint64_t duration;  // in timescale units
+} mp4_scan_t;
+
+// One ilst item: its value sits in a child "data" atom
+static void parse_mp4_item(md_reader_t *r, track_info_t *track, uint32_t type, uint32_t end)
+{
+    uint32_t size = md_be32(r);
+    if (md_be32(r) != FOURCC('d', 'a', 't', 'a') || size < 16 || md_tell(r) - 8 + size > end)
+        return;
+    uint32_t kind = md_be32(r) & 0x00FFFFFF; // well-known type
+    md_skip(r, 4);                           // locale
+    uint32_t len = size - 16;
+
+    switch (type)
+    {
+    case FOURCC(0xA9, 'n', 'a', 'm'):
+        md_text(r, len, track->title, sizeof(track->title));
+        break;
+    case FOURCC(0xA9, 'A', 'R', 'T'):
+        md_text(r, len, track->artist, sizeof(track->artist));
+        break;
+    case FOURCC(0xA9, 'a', 'l', 'b'):
+        md_text(r, len, track->album, sizeof(track->album));
+        break;
+    case FOURCC('a', 'A', 'R', 'T'):
+        md_text(r, len, track->album_artist, sizeof(track->album_artist));
+        break;
+    case FOURCC(0xA9, 'g', 'e', 'n'):
+        md_text(r, len, track->genre, sizeof(track->genre));
+        break;
+    case FOURCC('g', 'n', 'r', 'e'): // ID3v1 number plus one
+        if (len >= 2 && !track->genre[0])
+            genre_number(track, (md_be32(r) >> 16) - 1);
+        break;
+    case FOURCC('t', 'r', 'k', 'n'): // 16 bits of padding, then track and total
+        if (len >= 4)
+            track->track_no = md_be32(r) & 0xFFFF;
+        break;
+    case FOURCC('c', 'o', 'v', 'r'):
+        take_art(r, track, 0x03, kind == 14 ? "image/png" : "image/jpeg", md_tell(r), len);
+        break;
+    }
+}
+
+// Walks the atoms in [pos, end)
+static void parse_mp4_atoms(md_reader_t *r, track_info_t *track, mp4_scan_t *st,
+                            uint32_t pos, uint32_t end, uint32_t parent, int depth)
+{
+    while (pos + 8 <= end && !r->fail)
+    {
+        md_seek(r, pos);
+        uint64_t size = md_be32(r);
+        uint32_t type = md_be32(r);
+        uint32_t hdr = 8;
+        if (size == 1)
+        {
+            size = (uint64_t)md_be32(r) << 32;
+            size |= md_be32(r);
+            hdr = 16;
+        }
+        else if (size == 0)
+        {
+            size = end - pos; // runs to the end of the file
+        }
+        if (size < hdr || size > end - pos)
+            size = end - pos; // damaged, treat it as the last atom here
+        uint32_t body = pos + hdr;
+        uint32_t next = pos + (uint32_t)size;
+
+        if (parent == FOURCC('i', 'l', 's', 't'))
+        {
+            parse_mp4_item(r, track, type, next);
+        }
+        else if (depth < MD_MP4_DEPTH)
+        {
+            switch (type)
+            {
+            case FOURCC('m', 'o', 'o', 'v'):
+                st->moov = true;
+                // fall through
+            case FOURCC('u', 'd', 't', 'a'):
+            case FOURCC('i', 'l', 's', 't'):
+            case FOURCC('t', 'r', 'a', 'k'):
+            case FOURCC('m', 'd', 'i', 'a'):
+            case FOURCC('m', 'i', 'n', 'f'):
+            case FOURCC('s', 't', 'b', 'l'):
+                parse_mp4_atoms(r, track, st, body, next, type, depth + 1);
+                break;
+            case FOURCC('m', 'e', 't', 'a'):
+                // ISO full box (version/flags first) or the QuickTime kind without
+                md_seek(r, body);
+                parse_mp4_atoms(r, track, st, md_be32(r) == 0 ? body + 4 : body, next, type, depth + 1);
+                break;
+            case FOURCC('s', 't', 's', 'd'):
+                parse_mp4_atoms(r, track, st, body + 8, next, type, depth + 1); // version/flags, entry count
+                break;
+            case FOURCC('m', 'p', '4', 'a'):
+            {
+                uint8_t b[28];
+                md_seek(r, body);
+                if (md_read(r, b, 28) == 28)
+                {
+                    track->channels = (uint16_t)b[16] << 8 | b[17];
+                    track->samplespeed = (uint16_t)b[24] << 8 | b[25]; // 16.16
+                }
+                break;
+            }
+            case FOURCC('m', 'v', 'h', 'd'):
+            {
+                md_seek(r, body);
+                bool v1 = (md_be32(r) >> 24) == 1;
+                md_skip(r, v1 ? 16 : 8); // creation, modification
+                st->timescale = md_be32(r);
+                st->duration = v1 ? (uint64_t)md_be32(r) << 32 : 0;
+                st->duration |= md_be32(r);
+                break;
+            }
+            case FOURCC('m', 'd', 'a', 't'):
+                if (!st->moov)
+                    st->mdat_first = true;
+                st->mdat_size = size - hdr;
+                break;
+            }
+        }
+        pos = next;
+    }
+}
+
+static bool parse_mp4(md_reader_t *r, track_info_t *track)
+{
+    mp4_scan_t st = {0};
+    parse_mp4_atoms(r, track, &st, 0, f_size(r->fil), 0, 0);
+    r->fail = false;
+
+    if (!st.moov)
+        return false;
+    if (st.mdat_first)
+    {
+        // the VS1053 needs moov before the audio, remux with faststart
+        printf("Skipping %s: mdat before moov\r\n", track->filename);
+        return false;
+    }
+    track->audio_start = 0; // the decoder walks the atoms itself
+    track->audio_end = f_size(r->fil);
+    if (st.timescale)
+        track->bitrate = avg_kbps(st.mdat_size, st.duration * 1000 / st.timescale);
+    return true;
+}
+
+/* ---------------- RIFF INFO / AIFF text ---------------- */
+
+// Text chunks next to the audio: LIST/INFO INAM, IART, IPRD, IGNR, ITRK in WAV,
+// NAME and AUTH in AIFF. Chunk sizes are even padded in both.
+static void parse_iff_text(md_reader_t *r, track_info_t *track, bool aiff)
+{
+    uint32_t size = f_size(r->fil);
+    uint32_t pos = 12;
+
+    while (pos + 8 <= size && !r->fail)
+    {
+        md_seek(r, pos);
+        uint32_t id = md_be32(r);
+        uint32_t len = aiff ? md_be32(r) : md_le32(r);
+        uint32_t next = pos + 8 + len + (len & 1);
+        if (next < pos)
+            break;
+
+        if (aiff && id == FOURCC('N', 'A', 'M', 'E'))
+            md_text(r, len, track->title, sizeof(track->title));
+        else if (aiff && id == FOURCC('A', 'U', 'T', 'H'))
+            md_text(r, len, track->artist, sizeof(track->artist));
+        else if (!aiff && id == FOURCC('L', 'I', 'S', 'T') && len >= 4 && md_be32(r) == FOURCC('I', 'N', 'F', 'O'))
+        {
+            uint32_t sub = pos + 12;
+            uint32_t end = pos + 8 + len;
+            while (sub + 8 <= end && !r->fail)
+            {
+                md_seek(r, sub);
+                uint32_t sid = md_be32(r);
+                uint32_t slen = md_le32(r);
+                if (sid == FOURCC('I', 'N', 'A', 'M'))
+                    md_text(r, slen, track->title, sizeof(track->title));
+                else if (sid == FOURCC('I', 'A', 'R', 'T'))
+                    md_text(r, slen, track->artist, sizeof(track->artist));
+                else if (sid == FOURCC('I', 'P', 'R', 'D'))
+                    md_text(r, slen, track->album, sizeof(track->album));
+                else if (sid == FOURCC('I', 'G', 'N', 'R'))
+                    md_text(r, slen, track->genre, sizeof(track->genre));
+                else if (sid == FOURCC('I', 'T', 'R', 'K'))
+                {
+                    char num[8];
+                    md_text(r, slen, num, sizeof(num));
+                    track->track_no = track_number(num);
+                }
+                sub += 8 + slen + (slen & 1);
+            }
+        }
+        pos = next;
+    }
+    r->fail = false;
+}
+
+/* ---------------- dispatch ---------------- */
+
+static uint8_t sniff(md_reader_t *r, const char *filename, uint32_t *start)
+{
+    uint8_t m[12] = {0};
+    *start = 0;
+    md_read(r, m, 12);
+    r->fail = false;
+
+    if (!memcmp(m, "ID3", 3))
+    {
+        // FLAC files sometimes carry an ID3v2 tag in front
+        uint32_t skip = 10 + syncsafe_to_uint(&m[6]) + ((m[5] & 0x10) ? 10 : 0);
+        uint8_t after[4] = {0};
+        md_seek(r, skip);
+        md_read(r, after, 4);
+        r->fail = false;
+        if (!memcmp(after, "fLaC", 4))
+        {
+            *start = skip;
+            return CONTAINER_FLAC;
+        }
+        return CONTAINER_MP3;
+    }
+    if (!memcmp(m, "fLaC", 4))
+        return CONTAINER_FLAC;
+    if (!memcmp(m, "OggS", 4))
+        return CONTAINER_OGG;
+    if (!memcmp(&m[4], "ftyp", 4))
+        return CONTAINER_MP4;
+    if (!memcmp(m, "RIFF", 4) && !memcmp(&m[8], "WAVE", 4))
+        return CONTAINER_WAV;
+    if (!memcmp(m, "FORM", 4) && (!memcmp(&m[8], "AIFF", 4) || !memcmp(&m[8], "AIFC", 4)))
+        return CONTAINER_AIFF;
+    if (m[0] == 0xFF && (m[1] & 0xE0) == 0xE0)
+        return CONTAINER_MP3;
+
+    // junk in front of the first frame: mpeg_first_frame() hunts for the sync
+    const char *ext = strrchr(filename, '.');
+    if (ext && !strcasecmp(ext, ".mp3"))
+        return CONTAINER_MP3;
+    return CONTAINER_UNKNOWN;
+}
+
+/**
+ * Fills track from whatever the file is. Returns false if it's nothing
+ * we can play (unknown container, a PCM format the DAC can't take, an
+ * MP4 the codec can't stream). Caller holds the SPI bus.
+ */
+bool get_metadata(const char *filename, track_info_t *track)
+{
+    FIL fil;
+    if (f_open(&fil, filename, FA_READ) != FR_OK)
+        return false;
+
+    md_reader_t *r = &reader;
+    md_open(r, &fil);
+    uint32_t start;
+    uint8_t container = sniff(r, filename, &start);
+    bool ok = false;
+
+    switch (container)
+    {
+    case CONTAINER_MP3:
+        md_defaults(filename, track);
+        ok = parse_mp3(r, track);
+        break;
+    case CONTAINER_WAV:
+    case CONTAINER_AIFF:
+        // format from the PCM parser, then whatever text chunks there are
+        ok = get_pcm_metadata(filename, track);
+        if (ok)
+            parse_iff_text(r, track, container == CONTAINER_AIFF);
+        break;
+    case CONTAINER_FLAC:
+        md_defaults(filename, track);
+        ok = parse_flac(r, track, start);
+        break;
+    case CONTAINER_OGG:
+        md_defaults(filename, track);
+        ok = parse_ogg(r, track);
+        break;
+    case CONTAINER_MP4:
+        md_defaults(filename, track);
+        ok = parse_mp4(r, track);
+        break;
+    }
+
+    f_close(&fil);
+    track->container = container;
+    return ok;
+}
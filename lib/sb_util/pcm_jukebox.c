@@ -0,0 +1,187 @@
+#include "global_vars.h"
+#include "sb_util.h"
+
+/* ##########################################################
+PCM JUKEBOX: WAV / AIFF OVER THE RP2350'S I2S
+The codec lets go of the DAC for the length of the track and the
+PIO transmitter plays the file bit for bit from the PCM ring. Same
+keys as jukebox() where they make sense; there's no tape warp or
+scrub without the codec, pause is a hard pause.
+########################################################## */
+
+#define PCM_SKIP_MS 2000      // FF/RW jump
+#define PCM_SKIP_INTERVAL_MS 100
+
+static pcm_stream_t pcm;
+
+int pcm_jukebox(vs1053_t *player, track_info_t *track, st7789_t *display)
+{
+    int exitType = 0;
+
+    paused = false;
+    warping = false;
+    playStatus = play_icon;
+    enableIcons = true;
+    album_art_ready = false;
+
+    if (pcm_stream_open(&pcm, track->filename) != FR_OK)
+    {
+        printf("Failed to open %s\r\n", track->filename);
+        return exitType;
+    }
+
+    const pcm_format_t *f = &pcm.fmt;
+    if (!i2s_out_route(player, I2S_ROUTE_RP2350, f->rate, f->slot_bits, f->bswap))
+    {
+        printf("DAC can't clock %lu Hz\r\n", (unsigned long)f->rate);
+        pcm_stream_close(&pcm);
+        return exitType;
+    }
+    for (int i = 0; i < I2S_OUT_NUM_BLOCKS; i++)
+        pcm_stream_fill(&pcm); // prime the ring, the DMA clocks silence until then
+
+    printf("PCM: %u Hz, %u bit, %u ch, %s\r\n", (unsigned)f->rate, f->bits, f->channels,
+           f->direct ? (f->bswap ? "direct, DMA byte swap" : "direct") : "widened in place");
+
+    dac_eq_init(f->rate);
+    selected_band = 0;
+    uint32_t duration = pcm_stream_duration_ms(&pcm);
+    absolute_time_t last_skip_time = get_absolute_time();
+    uint8_t vol_check = 10;
+    uint8_t old_volume = 0;
+
+    while (1)
+    {
+        // paused: nothing moves until input, so sleep between passes (see idle.c)
+        idle_set(paused);
+
+        // janky counter for volume sampling (every pass while paused, passes are slow then)
+        if (vol_check == 10 || paused)
+        {
+            uint16_t vol = (uint32_t)potVal * 0x60 / 4096;
+            ff_rew_status = empty_icon;
+            if (abs((int)vol - (int)old_volume) >= 2)
+            {
+                dac_set_volume(vol);
+                old_volume = vol;
+            }
+            vol_check = 0;
+        }
+        else
+        {
+            vol_check++;
+        }
+
+        int c = getchar_timeout_us(0); // nonblocking getchar
+        if (c == PICO_ERROR_TIMEOUT)
+        {
+            char btn_char = get_button_repeat(buttons_map_to_char_jukebox());
+            if (btn_char != 0)
+                c = (int)btn_char;
+        }
+
+        uint32_t now_ms = pcm_stream_elapsed_ms(&pcm);
+        float progress = duration ? (float)now_ms / (float)duration : 0.0f;
+        progress_bar = 240 * (progress > 1.0f ? 1.0f : progress);
+
+        absolute_time_t now = get_absolute_time();
+        bool can_skip = absolute_time_diff_us(last_skip_time, now) >= PCM_SKIP_INTERVAL_MS * 1000;
+
+        switch (c)
+        {
+        case 'e':
+            selected_band = (selected_band + 1) % 6;
+            printf("\nSelected Band: %d Hz\n", dac_eq_get_freq(selected_band));
+            break;
+        case '+':
+            dac_eq_adjust(selected_band, 0.5f, f->rate);
+            printf("Band %d Gain: %.1f dB\n", selected_band, dac_eq_get_gain(selected_band));
+            break;
+        case '-':
+            dac_eq_adjust(selected_band, -0.5f, f->rate);
+            printf("Band %d Gain: %.1f dB\n", selected_band, dac_eq_get_gain(selected_band));
+            break;
+        case 'n':
+        case 'N':
+            exitType = 1;
+            printf("\r\n Going to next song....\r\n");
+            goto out;
+        case 'o':
+        case 'O':
+            if (now_ms >= 5000)
+            {
+                pcm_stream_seek(&pcm, 0);
+                break;
+            }
+            exitType = 2;
+            printf("\r\n Going to previous song....\r\n");
+            goto out;
+        case 'p':
+        case 'P':
+            paused = !paused;
+            i2s_out_set_paused(paused); // the DMA keeps BCLK running on silence
+            playStatus = paused ? pause_icon : play_icon;
+            printf(paused ? "\r\nPaused.\r\n" : "\r\nResumed.\r\n");
+            break;
+        case 'f':
+        case 'F':
+            if (can_skip)
+            {
+                ff_rew_status = ff_icon;
+                uint32_t target = now_ms + PCM_SKIP_MS < duration ? now_ms + PCM_SKIP_MS : duration;
+                pcm_stream_seek(&pcm, target);
+                printf("\r\nFast-forwarded to %lu ms\r\n", (unsigned long)target);
+                last_skip_time = now;
+            }
+            break;
+        case 'r':
+        case 'R':
+            if (can_skip)
+            {
+                ff_rew_status = rew_icon;
+                uint32_t target = now_ms > PCM_SKIP_MS ? now_ms - PCM_SKIP_MS : 0;
+                pcm_stream_seek(&pcm, target);
+                printf("\r\nRewound to %lu ms\r\n", (unsigned long)target);
+                last_skip_time = now;
+            }
+            break;
+        case 'm':
+        case 'M':
+            enableIcons = !enableIcons;
+            break;
+        case 'i':
+        case 'I':
+            printf("\r\n\rNOW PLAYING:\r\n");
+            printf("  Title : %s\r\n", track->title);
+            printf("  Format : %u Hz, %u bit, %s (%s)\r\n", (unsigned)f->rate, f->bits,
+                   f->channels == 1 ? "Mono" : "Stereo", f->big_endian ? "big-endian" : "little-endian");
+            printf("  Position: %lu / %lu ms\r\n", (unsigned long)now_ms, (unsigned long)duration);
+            printf("  PCM ring: %lu/%u blocks queued, underruns %lu\r\n",
+                   (unsigned long)i2s_out_queued(), I2S_OUT_NUM_BLOCKS,
+                   (unsigned long)i2s_out_underruns());
+            break;
+        case 's':
+        case 'S':
+            exitType = 0;
+            printf("\r\nStopping....\r\n");
+            goto out;
+        }
+
+        pcm_stream_fill(&pcm);
+        if (!paused && pcm_stream_done(&pcm))
+        {
+            exitType = 1; // end of song
+            break;
+        }
+
+        bool ring_full = pcm.eof || i2s_out_claim() == NULL; // nothing left to read ahead
+        if (paused && ring_full && c == PICO_ERROR_TIMEOUT && !library_fill_step(track->id))
+            idle_wait_input(IDLE_WAIT_MS); // buttons, USB or the pot check wake us
+    }
+
+out:
+    idle_set(false);
+    pcm_stream_close(&pcm);
+    i2s_out_route(player, I2S_ROUTE_VS1053, 0, 0, false); // MP3s need the codec on the DAC again
+    return exitType;
+}
@@ -0,0 +1,133 @@
+#include "lib/sb_util/sb_util.h"
+
+/* ##########################################################
+PCM STREAM: WAV / AIFF FROM THE CARD INTO THE I2S RING
+Every f_read goes straight into a ring block the DMA plays from,
+there is no staging buffer. 16/32-bit stereo is played as read,
+narrower or mono data is widened inside the same block
+(pcm_expand). Reads end on sector boundaries where the frame size
+allows, so FatFs hands whole sectors to the card driver.
+########################################################## */
+
+static uint32_t pcm_file_read(void *ctx, uint32_t pos, void *buf, uint32_t len)
+{
+    FIL *fil = ctx;
+    UINT br = 0;
+    if (f_lseek(fil, pos) == FR_OK)
+        f_read(fil, buf, len, &br);
+    return br;
+}
+
+// Sample layout of an open WAV/AIFF file (caller holds the bus)
+bool pcm_read_format(FIL *fil, pcm_format_t *f)
+{
+    return pcm_parse(pcm_file_read, fil, f_size(fil), f);
+}
+
+FRESULT pcm_stream_open(pcm_stream_t *p, const char *filename)
+{
+    spi_bus_acquire(SPI_BUS_SD); // SD card shares SPI1 with the codec
+    FRESULT fr = f_open(&p->fil, filename, FA_READ);
+    if (fr == FR_OK)
+    {
+        sd_build_linkmap(&p->fil, p->clmt, &p->clmt_heap);
+        if (!pcm_read_format(&p->fil, &p->fmt))
+        {
+            f_close(&p->fil);
+            free(p->clmt_heap);
+            p->clmt_heap = NULL;
+            fr = FR_INVALID_OBJECT; // nothing the I2S path can play
+        }
+    }
+    spi_bus_release();
+    p->open = fr == FR_OK;
+    if (!p->open)
+        return fr;
+
+    p->end = p->fmt.data_start + p->fmt.data_len;
+    return pcm_stream_seek(p, 0);
+}
+
+void pcm_stream_close(pcm_stream_t *p)
+{
+    if (!p->open)
+        return;
+    f_close(&p->fil);
+    free(p->clmt_heap);
+    p->clmt_heap = NULL;
+    p->open = false;
+}
+
+// Drops whatever is queued and carries on ms into the track
+FRESULT pcm_stream_seek(pcm_stream_t *p, uint32_t ms)
+{
+    p->start_frame = pcm_frame_at_ms(&p->fmt, ms);
+    p->pos = p->fmt.data_start + p->start_frame * p->fmt.frame_bytes;
+    p->eof = p->pos >= p->end;
+    i2s_out_flush();
+
+    spi_bus_acquire(SPI_BUS_SD);
+    FRESULT fr = f_lseek(&p->fil, p->pos);
+    spi_bus_release();
+    return fr;
+}
+
+// Reads one ring block if one is free. Call often, it returns quickly when full.
+FRESULT pcm_stream_fill(pcm_stream_t *p)
+{
+    if (!p->open || p->eof)
+        return FR_OK;
+    uint8_t *block = i2s_out_claim();
+    if (block == NULL)
+        return FR_OK;
+
+    const pcm_format_t *f = &p->fmt;
+    uint32_t frames = I2S_OUT_BLOCK_SIZE / f->out_frame;
+    uint32_t left = (p->end - p->pos) / f->frame_bytes;
+    if (frames > left)
+        frames = left;
+
+    // end on a sector boundary if whole frames get there, every read after
+    // the first one is then whole sectors
+    uint32_t tail = (p->pos + frames * f->frame_bytes) % SD_SECTOR_SIZE;
+    if (tail % f->frame_bytes == 0 && tail < frames * f->frame_bytes)
+        frames -= tail / f->frame_bytes;
+
+    UINT want = frames * f->frame_bytes;
+    UINT br = 0;
+    uint8_t *dst = block + pcm_read_offset(f, frames);
+    spi_bus_acquire(SPI_BUS_SD);
+    FRESULT fr = f_read(&p->fil, dst, want, &br);
+    spi_bus_release();
+
+    p->pos += br;
+    frames = br / f->frame_bytes;
+    if (frames > 0)
+    {
+        pcm_expand(f, block, dst, frames);
+        i2s_out_commit(frames * f->out_frame);
+    }
+
+    if (fr != FR_OK || br < want || p->pos >= p->end)
+    {
+        p->eof = true;
+        i2s_out_finish(); // silence after this block is the end, not an underrun
+    }
+    return fr;
+}
+
+// Whole file read and played out
+bool pcm_stream_done(pcm_stream_t *p)
+{
+    return p->eof && i2s_out_idle();
+}
+
+uint32_t pcm_stream_elapsed_ms(pcm_stream_t *p)
+{
+    return pcm_ms_at_frame(&p->fmt, p->start_frame + i2s_out_played() / p->fmt.out_frame);
+}
+
+uint32_t pcm_stream_duration_ms(pcm_stream_t *p)
+{
+    return pcm_ms_at_frame(&p->fmt, p->fmt.data_len / p->fmt.frame_bytes);
+}
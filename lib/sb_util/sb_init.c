@@ -122,39 +122,18 @@ void sb_display_init(st7789_t *display)
     printf("CORE 1 LAUNCHED!\r\n");
 }
 
-int sb_scan_tracks(track_info_t *tracks, int max_tracks)
+int sb_scan_tracks(void)
 {
-    DIR dir;
-    FILINFO fno;
-    count = 0;
-
-    f_opendir(&dir, "0:/");
-
-    while (f_readdir(&dir, &fno) == FR_OK && fno.fname[0])
-    {
-        if (fno.fattrib & AM_DIR)
-            continue;
-
-        char *ext = strrchr(fno.fname, '.');
-        if (ext && !strcasecmp(ext, ".mp3") && count < MAX_TRACKS)
-        {
-            get_mp3_metadata(fno.fname, &tracks[count]);
-            count++;
-            // dprint("Read song %d", count);
-        }
-    }
-
-    f_closedir(&dir);
+    spi_bus_acquire(SPI_BUS_SD); // SD card shares SPI1 with the codec
+    library_scan();
+    spi_bus_release();
 
     if (count == 0)
     {
-        printf("No MP3 files found.\r\n");
+        printf("No playable files found.\r\n");
         while (1)
             ;
     }
-
-    qsort(tracks, count, sizeof(track_info_t), compare_filenames);
-
     return count;
 }
 
@@ -246,14 +225,25 @@ void sb_hw_init(vs1053_t *player, st7789_t *display)
     printf("VS1053 volume set to max!\r\n");
     dprint("VS1053 volume set to max!");
 
-    // Enable I2S output
-    vs1053_enable_i2s(player);
+    // Plugins register here: I2S output at boot, .plg arrays from VLSI too, e.g.
+    //   vs1053_plugin_register("flac", plugin, PLUGIN_SIZE, true);
+    // Boot ones load now, background ones from the play loop once audio runs.
+    vs1053_plugin_register("i2s", vs1053_i2s_patch, VS1053_I2S_PATCH_SIZE, false);
+    vs1053_plugins_load_boot(player);
     printf("VS1053 I2S enabled.\r\n");
     dprint("VS1053 I2S enabled.");
 
+    // From here on SDI data goes through the DREQ/DMA driven feeder
+    vs1053_feed_init(player);
+    printf("VS1053 SDI feeder started.\r\n");
+    vs1053_transport_init(player);
+
     // initialize DAC
     dac_init(i2c0);
     dac_interrupt_init();
+#if I2S_OUT_PINS_CONFIRMED
+    i2s_out_init(pio0); // idle until a WAV/AIFF takes the DAC over from the codec
+#endif
     printf("DAC intialized.\r\n");
     dprint("DAC intialized.");
 
@@ -263,6 +253,7 @@ void sb_hw_init(vs1053_t *player, st7789_t *display)
     // Initialize buttons with a 10ms scan rate
     buttons_init(10);
     printf("\r\nButtons intializedr\n");
+    idle_init(); // button changes and USB input wake the idle waits
 
     pot_init();
     printf("\r\npot intialized\r\n");
@@ -58,12 +58,17 @@ unsigned char jpeg_need_bytes_callback(
         to_read = ctx->bytes_left;
 
     UINT br;
-    if (f_read(ctx->fil, pBuf, to_read, &br) != FR_OK)
+    spi_bus_acquire(SPI_BUS_SD); // SD card shares SPI1 with the codec
+    FRESULT fr = f_read(ctx->fil, pBuf, to_read, &br);
+    spi_bus_release();
+    if (fr != FR_OK)
         return PJPG_STREAM_READ_ERROR;
 
     *pBytes_actually_read = br;
     ctx->bytes_left -= br;
 
+    jukebox_service(); // decoding takes long enough to run the codec dry
+
     return 0;
 }
 
@@ -74,22 +79,25 @@ void process_image(track_info_t *track, const char *filename, float output_size)
     uint8_t header[10];
     uint8_t frame_header[10];
 
+    spi_bus_acquire(SPI_BUS_SD);
     if (f_open(&fil, filename, FA_READ) != FR_OK)
     {
+        spi_bus_release();
         return;
     }
 
     if (f_read(&fil, header, 10, &br) != FR_OK || br != 10)
     {
-        goto out;
+        goto out_held;
     }
 
     if (memcmp(header, "ID3", 3) != 0)
     {
-        goto out;
+        goto out_held;
     }
 
     f_lseek(&fil, track->album_art_offset);
+    spi_bus_release();
     if (strcmp(track->mime_type, "image/jpeg") == 0)
     {
         pjpeg_image_info_t jpeg_info;
@@ -159,7 +167,10 @@ void process_image(track_info_t *track, const char *filename, float output_size)
         }
     }
 out:
+    spi_bus_acquire(SPI_BUS_SD);
+out_held:
     f_close(&fil);
+    spi_bus_release();
 }
 
 ////////////////////IMAGE////////////////////////////
@@ -11,14 +11,18 @@
 #include "lib/buttons/buttons.h"
 #include "lib/pot/pot.h"
 #include "lib/codec/vs1053.h"
+#include "lib/codec/vs1053_feed.h"
+#include "lib/codec/vs1053_transport.h"
+#include "lib/codec/vs1053_stats.h"
+#include "lib/codec/vs1053_plugin.h"
+#include "lib/spi_bus/spi_bus.h"
+#include "lib/i2s_out/i2s_out.h"
 
 /* ======== Filehelper =======*/
 uint32_t syncsafe_to_uint(const uint8_t *b);
-void read_text_frame(FIL *fil, uint32_t frame_size, char *out, size_t out_size);
 uint32_t find_audio_start(FIL *fil);
-void get_mp3_header(FIL *fil, track_info_t *track);
-void get_mp3_metadata(const char *filename, track_info_t *track);
-int compare_filenames(const void *a, const void *b);
+bool mp3_parse_frame_header(const uint8_t *h, mp3_frame_t *f);
+bool get_pcm_metadata(const char *filename, track_info_t *track);
 
 /* ======== Init ==============*/
 void sb_hw_init(vs1053_t *player, st7789_t *display);
@@ -27,12 +31,101 @@ void sb_hw_init(vs1053_t *player, st7789_t *display);
 void sb_audio_init(vs1053_t *player);
 
 /* ========= MP3 / Metadata ========= */
-int  sb_scan_tracks(track_info_t *tracks, int max_tracks);
+bool get_metadata(const char *filename, track_info_t *track);
+const char *container_name(uint8_t container);
+int  sb_scan_tracks(void);
 void sb_print_track(track_info_t *t);
 
+/* ========= Library ========= */
+#define LIBRARY_DIR "0:/.stereoboy"
+#define LIBRARY_TRACKS LIBRARY_DIR "/tracks.dat"
+#define LIBRARY_STRINGS LIBRARY_DIR "/strings.dat"
+#define LIBRARY_TRACKS_TMP LIBRARY_DIR "/tracks.tmp"
+#define LIBRARY_STRINGS_TMP LIBRARY_DIR "/strings.tmp"
+#define LIBRARY_SORT_A LIBRARY_DIR "/sort_a.tmp"
+#define LIBRARY_SORT_B LIBRARY_DIR "/sort_b.tmp"
+#define LIBRARY_DIRS LIBRARY_DIR "/dirs.dat"
+#define LIBRARY_BY_ARTIST_IDX LIBRARY_DIR "/artist.idx"
+#define LIBRARY_BY_ALBUM_IDX LIBRARY_DIR "/album.idx"
+#define LIBRARY_BY_GENRE_IDX LIBRARY_DIR "/genre.idx"
+#define LIBRARY_VERSION 9 // bump whenever track_rec_t or what the parsers store changes
+
+uint32_t library_crc32(uint32_t crc, const void *data, size_t len);
+uint32_t library_stamp(const FILINFO *fno);
+int  library_scan(void);
+void library_invalidate(void);
+void library_get(int id, track_info_t *t);
+bool library_fill_step(int prefer);
+bool library_resolve(int id);
+bool library_ready(int id);
+int  library_pending(void);
+void library_window(int center);
+const library_row_t *library_row(int id);
+const char *library_title(int id);
+void library_print_stats(void);
+void library_cache_stats(library_cache_stats_t *s);
+int  library_index_groups(library_index_t ix);
+int  library_index_find(library_index_t ix, const char *prefix, int *end);
+int  library_index_jump(library_index_t ix, char letter);
+int  library_index_group(library_index_t ix, int g, char *name, size_t n, int *tracks);
+int  library_index_track(library_index_t ix, int pos);
+void library_index_print(library_index_t ix, const char *prefix);
+
+/* ========= SD read-ahead ========= */
+FRESULT sd_stream_open(sd_stream_t *s, const char *filename);
+void sd_stream_close(sd_stream_t *s);
+FRESULT sd_stream_seek(sd_stream_t *s, uint32_t pos);
+FRESULT sd_stream_fill(sd_stream_t *s);
+size_t sd_stream_pump(sd_stream_t *s);
+uint32_t sd_stream_level(sd_stream_t *s);
+uint32_t sd_stream_tell(sd_stream_t *s);
+bool sd_stream_done(sd_stream_t *s);
+void sd_stream_set_end(sd_stream_t *s, uint32_t end);
+UINT sd_stream_read_at(sd_stream_t *s, uint32_t pos, void *buf, UINT len);
+void sd_build_linkmap(FIL *fil, DWORD *clmt, DWORD **heap);
+
+/* ========= Gapless ========= */
+bool gapless_open(sd_stream_t *s, seek_index_t *idx, track_info_t *track);
+bool gapless_fits(const track_info_t *track, const track_info_t *next);
+bool gapless_prefetch(sd_stream_t *s, seek_index_t *idx, track_info_t *next, sd_stream_t *playing);
+size_t gapless_splice(sd_stream_t *done, sd_stream_t *next);
+
+/* ========= PCM stream (I2S path) ========= */
+bool pcm_read_format(FIL *fil, pcm_format_t *f);
+FRESULT pcm_stream_open(pcm_stream_t *p, const char *filename);
+void pcm_stream_close(pcm_stream_t *p);
+FRESULT pcm_stream_seek(pcm_stream_t *p, uint32_t ms);
+FRESULT pcm_stream_fill(pcm_stream_t *p);
+bool pcm_stream_done(pcm_stream_t *p);
+uint32_t pcm_stream_elapsed_ms(pcm_stream_t *p);
+uint32_t pcm_stream_duration_ms(pcm_stream_t *p);
+
+/* ========= Idle ========= */
+#define IDLE_FRAME_MS 100 // core1 redraw period while idle (menu marquee steps at this rate too)
+#define IDLE_WAIT_MS 50   // longest a paused jukebox loop sleeps between passes
+
+void idle_init(void);
+void idle_set(bool on);
+bool idle_active(void);
+void idle_poke(void);
+bool idle_wait_input(uint32_t ms);
+void idle_pace(absolute_time_t *next, uint32_t period_ms);
+
+/* ========= Seek index ========= */
+void seek_index_init(seek_index_t *idx, FIL *fil, track_info_t *track);
+void seek_index_scan(seek_index_t *idx, const uint8_t *data, uint32_t len, uint32_t pos);
+uint32_t seek_index_offset(seek_index_t *idx, uint32_t ms);
+uint32_t seek_index_time(seek_index_t *idx, uint32_t offset);
+uint32_t seek_index_duration(seek_index_t *idx);
+uint32_t seek_index_align(seek_index_t *idx, sd_stream_t *s, uint32_t pos);
+
 /* ========= Playback ========= */
 // int sb_play_track(vs1053_t *player, track_info_t *track, st7789_t *display);
 int jukebox(vs1053_t *player, track_info_t *track, st7789_t *display);
+int pcm_jukebox(vs1053_t *player, track_info_t *track, st7789_t *display);
+void seek_to_ms(uint32_t ms);
+void jukebox_service(void);
+uint32_t elapsed_ms(void);
 
 
 /* ====== Core 1 Entry  ======*/
@@ -41,7 +134,6 @@ void dprint(char * str, ...);
 void core1_entry();
 
 void update_scope_core1();
-static void process_audio_batch();
 void addIcons(uint16_t* frame_buffer, bool enabled);
 
 /* ========= Display ========= */
@@ -57,7 +149,6 @@ void addIcons(uint16_t* frame_buffer, bool enabled);
 /* ========= sb_util.c ========== */
 
 void process_image(track_info_t *track, const char *filename, float output_size);
-static void process_audio_batch();
 
 void set_visualizer(int num);
 void clear_framebuffer();
@@ -0,0 +1,227 @@
+#include "lib/sb_util/sb_util.h"
+
+/* ##########################################################
+SD STREAM: READ-AHEAD BETWEEN FATFS AND THE SDI FEEDER
+A ring of sector aligned blocks. Each refill is one multi-sector
+f_read straight into a block (FatFs skips its sector window for
+whole, aligned sectors), and sd_stream_pump() drains the blocks into
+the codec feed ring independently of when the card answers.
+########################################################## */
+
+static inline uint32_t stream_slot(uint32_t n)
+{
+    return n % SD_STREAM_NUM_BLOCKS;
+}
+
+static void stream_reset(sd_stream_t *s, uint32_t pos)
+{
+    s->head = 0;
+    s->tail = 0;
+    s->rd_off = 0;
+    s->fill_pos = pos;
+    s->play_pos = pos;
+    s->eof = pos >= s->end;
+    s->primed = false;
+}
+
+// Seeks late in a long file and the refills after them lean on the link map
+// (scripting/library_indexer/tests/clmt_bench.c has the numbers), so a
+// FatFs configuration without it doesn't build
+#if !FF_USE_FASTSEEK
+#error "sd_stream needs FF_USE_FASTSEEK 1 in ffconf.h"
+#endif
+
+// Build the cluster link map so every f_lseek (and cluster step in f_read)
+// is a table lookup instead of a walk down the FAT chain from the start.
+// clmt holds SD_STREAM_CLMT_LEN entries, *heap gets a bigger table if the
+// file needs one (free it on close).
+void sd_build_linkmap(FIL *fil, DWORD *clmt, DWORD **heap)
+{
+    *heap = NULL;
+    fil->cltbl = clmt;
+    clmt[0] = SD_STREAM_CLMT_LEN;
+    FRESULT fr = f_lseek(fil, CREATE_LINKMAP);
+
+    if (fr == FR_NOT_ENOUGH_CORE)
+    {
+        // clmt[0] now holds the size this file needs
+        DWORD need = clmt[0];
+        *heap = malloc(need * sizeof(DWORD));
+        if (*heap != NULL)
+        {
+            fil->cltbl = *heap;
+            (*heap)[0] = need;
+            fr = f_lseek(fil, CREATE_LINKMAP);
+        }
+    }
+
+    if (fr != FR_OK)
+    {
+        printf("No link map for this file (%d), seeking the slow way\r\n", fr);
+        fil->cltbl = NULL;
+        free(*heap);
+        *heap = NULL;
+    }
+}
+
+FRESULT sd_stream_open(sd_stream_t *s, const char *filename)
+{
+    spi_bus_acquire(SPI_BUS_SD); // SD card shares SPI1 with the codec
+    FRESULT fr = f_open(&s->fil, filename, FA_READ);
+    if (fr == FR_OK)
+        sd_build_linkmap(&s->fil, s->clmt, &s->clmt_heap);
+    spi_bus_release();
+    if (fr != FR_OK)
+    {
+        s->open = false;
+        return fr;
+    }
+
+    s->open = true;
+    s->end = f_size(&s->fil);
+    s->low_water = SD_STREAM_NUM_BLOCKS * SD_STREAM_BLOCK_SIZE;
+    s->underruns = 0;
+    s->starved = false;
+    s->index = NULL;
+    stream_reset(s, 0);
+    return FR_OK;
+}
+
+void sd_stream_close(sd_stream_t *s)
+{
+    if (!s->open)
+        return;
+    f_close(&s->fil);
+    free(s->clmt_heap);
+    s->clmt_heap = NULL;
+    s->open = false;
+}
+
+// Drops everything buffered and continues reading at pos
+FRESULT sd_stream_seek(sd_stream_t *s, uint32_t pos)
+{
+    if (pos > s->end)
+        pos = s->end;
+
+    spi_bus_acquire(SPI_BUS_SD);
+    FRESULT fr = f_lseek(&s->fil, pos);
+    spi_bus_release();
+
+    stream_reset(s, pos);
+    return fr;
+}
+
+// Moves the end of the readable range (A-B loops stream up to B, then seek back)
+void sd_stream_set_end(sd_stream_t *s, uint32_t end)
+{
+    uint32_t size = f_size(&s->fil);
+    s->end = end < size ? end : size;
+    s->eof = s->fill_pos >= s->end;
+}
+
+// Random read that leaves the streaming position alone, returns bytes read
+UINT sd_stream_read_at(sd_stream_t *s, uint32_t pos, void *buf, UINT len)
+{
+    UINT br = 0;
+    spi_bus_acquire(SPI_BUS_SD);
+    if (f_lseek(&s->fil, pos) == FR_OK)
+        f_read(&s->fil, buf, len, &br);
+    f_lseek(&s->fil, s->fill_pos); // next refill carries on where it was
+    spi_bus_release();
+    return br;
+}
+
+// Reads one block if a slot is free. Call often, it returns quickly when full.
+FRESULT sd_stream_fill(sd_stream_t *s)
+{
+    if (!s->open || s->eof || s->head - s->tail >= SD_STREAM_NUM_BLOCKS)
+        return FR_OK;
+
+    // first read after open/seek brings the file pointer back onto a sector
+    // boundary, every read after that is whole sectors
+    UINT want = SD_STREAM_BLOCK_SIZE - (s->fill_pos % SD_SECTOR_SIZE);
+    if (want > s->end - s->fill_pos)
+        want = s->end - s->fill_pos;
+
+    uint32_t slot = stream_slot(s->head);
+    UINT br = 0;
+    spi_bus_acquire(SPI_BUS_SD);
+    uint32_t t0 = time_us_32();
+    FRESULT fr = f_read(&s->fil, s->blocks[slot], want, &br);
+    vs1053_stats_read(time_us_32() - t0);
+    spi_bus_release();
+    if (fr != FR_OK)
+    {
+        s->eof = true;
+        return fr;
+    }
+
+    s->len[slot] = br;
+    s->pos[slot] = s->fill_pos;
+    if (s->index != NULL && br > 0)
+        seek_index_scan(s->index, s->blocks[slot], br, s->fill_pos);
+    s->fill_pos += br;
+    if (br > 0)
+        s->head++;
+    if (s->head - s->tail == SD_STREAM_NUM_BLOCKS)
+        s->primed = true;
+    if (br < want || s->fill_pos >= s->end)
+        s->eof = true;
+
+    return FR_OK;
+}
+
+// Moves buffered data into the SDI feed ring, returns the number of bytes moved
+size_t sd_stream_pump(sd_stream_t *s)
+{
+    size_t moved = 0;
+
+    // low-water mark only counts once the ring has been full after an open/seek
+    uint32_t level = sd_stream_level(s);
+    if (s->primed && !s->eof && level < s->low_water)
+        s->low_water = level;
+
+    while (s->head != s->tail)
+    {
+        uint32_t slot = stream_slot(s->tail);
+        uint32_t n = s->len[slot] - s->rd_off;
+        size_t took = vs1053_feed_submit(&s->blocks[slot][s->rd_off], n);
+
+        moved += took;
+        s->rd_off += took;
+        s->play_pos += took;
+        if (s->rd_off < s->len[slot])
+            break; // feed ring is full
+
+        s->tail++;
+        s->rd_off = 0;
+    }
+
+    // codec ran dry while the file still has data: the card fell behind
+    bool dry = !s->eof && s->head == s->tail && vs1053_feed_level() == 0;
+    if (dry && !s->starved)
+        s->underruns++;
+    s->starved = dry;
+
+    return moved;
+}
+
+uint32_t sd_stream_level(sd_stream_t *s)
+{
+    uint32_t level = 0;
+    for (uint32_t n = s->tail; n != s->head; n++)
+        level += s->len[stream_slot(n)];
+    return level - s->rd_off;
+}
+
+// File offset of the next byte that will go to the codec
+uint32_t sd_stream_tell(sd_stream_t *s)
+{
+    return s->play_pos;
+}
+
+// True once the whole file has been handed to the feed ring
+bool sd_stream_done(sd_stream_t *s)
+{
+    return s->eof && s->head == s->tail;
+}
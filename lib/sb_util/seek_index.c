@@ -0,0 +1,427 @@
+#include "lib/sb_util/sb_util.h"
+
+/* ##########################################################
+SEEK INDEX: TIME <-> FILE OFFSET FOR MP3 STREAMS
+Uses the Xing/Info TOC or the VBRI table when the encoder wrote one.
+Otherwise a sparse table of (frame, offset) points is built from the
+blocks the read-ahead pulls in, one point every `stride` frames.
+When the table fills up every other point is dropped and the stride
+doubles, so memory stays fixed for any track length.
+Lookups are binary searches, positions past the scanned part are
+estimated from the average frame size seen so far.
+########################################################## */
+
+static uint32_t be32(const uint8_t *b)
+{
+    return ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) | ((uint32_t)b[2] << 8) | b[3];
+}
+
+static uint16_t be16(const uint8_t *b)
+{
+    return (b[0] << 8) | b[1];
+}
+
+static uint32_t frames_to_ms(seek_index_t *idx, uint32_t frames)
+{
+    return (uint64_t)frames * idx->samples * 1000 / idx->samplespeed;
+}
+
+static uint32_t ms_to_frames(seek_index_t *idx, uint32_t ms)
+{
+    return (uint64_t)ms * idx->samplespeed / ((uint32_t)idx->samples * 1000);
+}
+
+static void add_point(seek_index_t *idx, uint32_t frame, uint32_t offset)
+{
+    if (idx->num_points == SEEK_INDEX_MAX_POINTS)
+    {
+        // table full: keep every other point and halve the resolution
+        for (int i = 0; i < SEEK_INDEX_MAX_POINTS / 2; i++)
+            idx->points[i] = idx->points[2 * i];
+        idx->num_points = SEEK_INDEX_MAX_POINTS / 2;
+        idx->stride *= 2;
+        if (frame % idx->stride != 0)
+            return;
+    }
+    idx->points[idx->num_points].frame = frame;
+    idx->points[idx->num_points].offset = offset;
+    idx->num_points++;
+}
+
+// Index of the last point at or before frame (num_points must be > 0)
+static int point_for_frame(seek_index_t *idx, uint32_t frame)
+{
+    int lo = 0, hi = idx->num_points - 1;
+    while (lo < hi)
+    {
+        int mid = (lo + hi + 1) / 2;
+        if (idx->points[mid].frame <= frame)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+// Index of the last point at or before offset (num_points must be > 0)
+static int point_for_offset(seek_index_t *idx, uint32_t offset)
+{
+    int lo = 0, hi = idx->num_points - 1;
+    while (lo < hi)
+    {
+        int mid = (lo + hi + 1) / 2;
+        if (idx->points[mid].offset <= offset)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+// Average frame size in bytes, from the best information we have
+static float avg_frame_bytes(seek_index_t *idx)
+{
+    if (idx->total_frames)
+        return (float)(idx->audio_end - idx->first_frame) / idx->total_frames;
+    if (idx->scan_frame > idx->stride)
+        return (float)(idx->scan_pos - idx->first_frame) / idx->scan_frame;
+    return (float)idx->samples * idx->bitrate * 125 / idx->samplespeed;
+}
+
+static bool covered_frame(seek_index_t *idx, uint32_t frame)
+{
+    return idx->num_points && (idx->complete || frame < idx->scan_frame);
+}
+
+static bool covered_offset(seek_index_t *idx, uint32_t offset)
+{
+    return idx->num_points && (idx->complete || offset < idx->scan_pos);
+}
+
+// The known frame boundary after point i: the next point, or where the table ends
+static seek_point_t next_point(seek_index_t *idx, int i)
+{
+    if (i + 1 < idx->num_points)
+        return idx->points[i + 1];
+    if (idx->scan_frame)
+        return (seek_point_t){idx->scan_frame, idx->scan_pos};
+    return (seek_point_t){idx->total_frames, idx->audio_end}; // VBRI table, nothing scanned
+}
+
+static void parse_vbri(seek_index_t *idx, FIL *fil, const uint8_t *vbri)
+{
+    UINT br;
+    uint32_t frames = be32(&vbri[14]);
+    uint16_t entries = be16(&vbri[18]);
+    uint16_t scale = be16(&vbri[20]);
+    uint16_t entry_size = be16(&vbri[22]);
+    uint16_t frames_per_entry = be16(&vbri[24]);
+
+    idx->total_bytes = be32(&vbri[10]);
+    idx->total_frames = frames;
+    if (entries == 0 || entry_size == 0 || entry_size > 4 || frames_per_entry == 0)
+        return;
+
+    // VBRI entries are segment sizes, turn them into absolute frame offsets
+    idx->stride = frames_per_entry;
+    uint32_t offset = idx->first_frame;
+    uint8_t buf[64];
+    uint16_t have = 0, used = 0;
+
+    add_point(idx, 0, offset);
+    for (uint16_t i = 0; i < entries; i++)
+    {
+        if (used + entry_size > have)
+        {
+            memmove(buf, &buf[used], have - used);
+            have -= used;
+            used = 0;
+            if (f_read(fil, &buf[have], sizeof(buf) - have, &br) != FR_OK)
+                return;
+            have += br;
+            if (have < entry_size)
+                return;
+        }
+
+        uint32_t size = 0;
+        for (int b = 0; b < entry_size; b++)
+            size = (size << 8) | buf[used + b];
+        used += entry_size;
+
+        offset += size * scale;
+        if (offset >= idx->audio_end)
+            break;
+        add_point(idx, (uint32_t)(i + 1) * frames_per_entry, offset);
+    }
+    idx->complete = true;
+}
+
+/**
+ * Reads the first frame of the track and sets up the index. Looks for a
+ * Xing/Info or VBRI header in it; if there is one the frame itself holds
+ * no audio.
+ */
+void seek_index_init(seek_index_t *idx, FIL *fil, track_info_t *track)
+{
+    UINT br;
+    uint8_t buf[64];
+    mp3_frame_t frame;
+
+    memset(idx, 0, sizeof(*idx));
+    idx->base = track->audio_start;
+    idx->first_frame = track->audio_start;
+    idx->audio_end = track->audio_end;
+    idx->bitrate = track->bitrate;
+    idx->stride = SEEK_INDEX_STRIDE;
+    idx->scan_pos = track->audio_start;
+
+    if (f_lseek(fil, track->audio_start) != FR_OK ||
+        f_read(fil, buf, sizeof(buf), &br) != FR_OK || br < 40 ||
+        !mp3_parse_frame_header(buf, &frame))
+        return; // samplespeed stays 0, everything falls back to bitrate estimates
+
+    idx->samplespeed = frame.samplespeed;
+    idx->samples = frame.samples;
+    idx->layer_bits = frame.layer_bits;
+
+    // Xing/Info sits right after the side info
+    bool mono = frame.channel_bits == 3;
+    uint32_t xing_off = 4 + (frame.version_bits == 3 ? (mono ? 17 : 32) : (mono ? 9 : 17));
+
+    if (xing_off + 8 <= br &&
+        (!memcmp(&buf[xing_off], "Xing", 4) || !memcmp(&buf[xing_off], "Info", 4)))
+    {
+        uint32_t flags = be32(&buf[xing_off + 4]);
+        uint32_t p = xing_off + 8;
+        uint8_t field[100];
+
+        // fields follow in flag order, read them straight from the file
+        f_lseek(fil, track->audio_start + p);
+        if ((flags & 0x1) && f_read(fil, field, 4, &br) == FR_OK && br == 4)
+            idx->total_frames = be32(field);
+        if ((flags & 0x2) && f_read(fil, field, 4, &br) == FR_OK && br == 4)
+            idx->total_bytes = be32(field);
+        if ((flags & 0x4) && f_read(fil, idx->toc, 100, &br) == FR_OK && br == 100)
+            idx->has_toc = idx->total_frames != 0;
+
+        if (idx->total_bytes == 0)
+            idx->total_bytes = track->audio_end - track->audio_start;
+        idx->first_frame = track->audio_start + frame.frame_len;
+    }
+    else if (!memcmp(&buf[4 + 32], "VBRI", 4))
+    {
+        idx->first_frame = track->audio_start + frame.frame_len;
+        f_lseek(fil, track->audio_start + 4 + 32 + 26); // table follows the 26-byte header
+        parse_vbri(idx, fil, &buf[4 + 32]);
+    }
+
+    idx->scan_pos = idx->first_frame;
+}
+
+/**
+ * Walks the frame headers in a block of file data starting at file offset
+ * pos. Blocks have to arrive in file order to extend the table, anything
+ * that doesn't line up with where the scan stopped is ignored.
+ */
+void seek_index_scan(seek_index_t *idx, const uint8_t *data, uint32_t len, uint32_t pos)
+{
+    if (idx->complete || idx->samplespeed == 0)
+        return;
+
+    while (1)
+    {
+        if (idx->scan_pos >= idx->audio_end)
+        {
+            idx->complete = true;
+            return;
+        }
+
+        uint32_t need = idx->scan_pos + idx->hdr_have; // next header byte we want
+        if (need < pos || need >= pos + len)
+            return; // not in this block (gap after a seek, or need the next one)
+
+        uint32_t rel = need - pos;
+        while (idx->hdr_have < 4 && rel < len)
+            idx->hdr[idx->hdr_have++] = data[rel++];
+        if (idx->hdr_have < 4)
+            return; // header straddles into the next block
+
+        mp3_frame_t f;
+        if (!mp3_parse_frame_header(idx->hdr, &f) ||
+            f.samplespeed != idx->samplespeed || f.layer_bits != idx->layer_bits)
+        {
+            // lost sync, slide forward one byte
+            memmove(idx->hdr, &idx->hdr[1], 3);
+            idx->hdr_have = 3;
+            idx->scan_pos++;
+            continue;
+        }
+
+        if (idx->scan_frame % idx->stride == 0)
+            add_point(idx, idx->scan_frame, idx->scan_pos);
+        idx->scan_frame++;
+        idx->scan_pos += f.frame_len;
+        idx->hdr_have = 0;
+    }
+}
+
+/**
+ * Start of the frame that contains file offset pos. Walks frame headers
+ * from the nearest table point; if that's too far back (pos was never
+ * scanned) it finds sync in the last kilobyte before pos instead.
+ */
+uint32_t seek_index_align(seek_index_t *idx, sd_stream_t *s, uint32_t pos)
+{
+    if (idx->samplespeed == 0)
+        return pos; // no frame layout to go by
+    if (pos <= idx->first_frame)
+        return idx->first_frame;
+
+    uint32_t p = idx->first_frame;
+    if (idx->num_points)
+        p = idx->points[point_for_offset(idx, pos)].offset;
+    if (p > pos)
+        p = idx->first_frame;
+
+    mp3_frame_t f;
+    if (pos - p > SEEK_ALIGN_WALK_MAX)
+    {
+        uint8_t buf[1024];
+        uint32_t from = pos - sizeof(buf);
+        UINT n = sd_stream_read_at(s, from, buf, sizeof(buf));
+        p = pos;
+        for (UINT i = 0; i + 4 <= n; i++)
+        {
+            // a header only counts if the next frame's header follows it
+            if (!mp3_parse_frame_header(&buf[i], &f) || f.samplespeed != idx->samplespeed)
+                continue;
+            UINT next = i + f.frame_len;
+            mp3_frame_t g;
+            if (next + 4 <= n && !mp3_parse_frame_header(&buf[next], &g))
+                continue;
+            p = from + i;
+            break;
+        }
+        if (p == pos)
+            return pos;
+    }
+
+    uint8_t h[4];
+    while (1)
+    {
+        if (sd_stream_read_at(s, p, h, 4) != 4 || !mp3_parse_frame_header(h, &f))
+            return p; // lost sync, settle for the last good frame
+        if (p + f.frame_len > pos)
+            return p;
+        p += f.frame_len;
+    }
+}
+
+uint32_t seek_index_duration(seek_index_t *idx)
+{
+    if (idx->samplespeed == 0)
+        return idx->bitrate ? (uint64_t)(idx->audio_end - idx->base) * 8 / idx->bitrate : 0;
+    if (idx->total_frames)
+        return frames_to_ms(idx, idx->total_frames);
+    if (idx->complete && idx->num_points)
+        return frames_to_ms(idx, idx->scan_frame ? idx->scan_frame
+                                                 : idx->points[idx->num_points - 1].frame + idx->stride);
+    return frames_to_ms(idx, (idx->audio_end - idx->first_frame) / avg_frame_bytes(idx));
+}
+
+// File offset to start feeding from to play from ms
+uint32_t seek_index_offset(seek_index_t *idx, uint32_t ms)
+{
+    if (idx->samplespeed == 0)
+    {
+        uint32_t off = idx->base + (uint64_t)ms * idx->bitrate / 8;
+        return off < idx->audio_end ? off : idx->audio_end;
+    }
+
+    uint32_t frame = ms_to_frames(idx, ms);
+    if (idx->total_frames && frame >= idx->total_frames)
+        return idx->audio_end;
+
+    // scanned or table from the file: interpolate between the points around
+    // the frame, returning the point itself would snap short seeks back to it
+    if (covered_frame(idx, frame))
+    {
+        int i = point_for_frame(idx, frame);
+        seek_point_t p = idx->points[i];
+        seek_point_t n = next_point(idx, i);
+        uint32_t off = p.offset;
+        if (n.frame > p.frame && n.offset > p.offset)
+            off += (uint64_t)(frame - p.frame) * (n.offset - p.offset) / (n.frame - p.frame);
+        return off < idx->audio_end ? off : idx->audio_end;
+    }
+
+    uint32_t off;
+    if (idx->has_toc)
+    {
+        float pct = (float)frame * 100.0f / idx->total_frames;
+        int i = (int)pct;
+        if (i > 99)
+            i = 99;
+        float a = idx->toc[i];
+        float b = (i < 99) ? idx->toc[i + 1] : 256.0f;
+        off = idx->base + (uint32_t)((a + (b - a) * (pct - i)) * idx->total_bytes / 256.0f);
+    }
+    else
+    {
+        // extrapolate from the furthest point we know
+        seek_point_t last = {0, idx->first_frame};
+        if (idx->num_points)
+            last = idx->points[idx->num_points - 1];
+        off = last.offset + (uint32_t)((frame - last.frame) * avg_frame_bytes(idx));
+    }
+    return off < idx->audio_end ? off : idx->audio_end;
+}
+
+// Play time in ms at a file offset
+uint32_t seek_index_time(seek_index_t *idx, uint32_t offset)
+{
+    if (idx->samplespeed == 0)
+        return (idx->bitrate && offset > idx->base) ? (uint64_t)(offset - idx->base) * 8 / idx->bitrate : 0;
+    if (offset <= idx->first_frame)
+        return 0;
+
+    if (covered_offset(idx, offset))
+    {
+        int i = point_for_offset(idx, offset);
+        seek_point_t p = idx->points[i];
+        // interpolate frames between this point and the next known frame boundary
+        seek_point_t n = next_point(idx, i);
+        uint32_t frame = p.frame;
+        if (n.frame > p.frame && n.offset > p.offset)
+            frame += (uint64_t)(offset - p.offset) * (n.frame - p.frame) / (n.offset - p.offset);
+        return frames_to_ms(idx, frame);
+    }
+
+    if (idx->has_toc)
+    {
+        // binary search the TOC for the byte position, then interpolate the percentage
+        float q = (float)(offset - idx->base) * 256.0f / idx->total_bytes;
+        int lo = 0, hi = 99;
+        while (lo < hi)
+        {
+            int mid = (lo + hi + 1) / 2;
+            if (idx->toc[mid] <= q)
+                lo = mid;
+            else
+                hi = mid - 1;
+        }
+        float a = idx->toc[lo];
+        float b = (lo < 99) ? idx->toc[lo + 1] : 256.0f;
+        float pct = lo + ((b > a) ? (q - a) / (b - a) : 0.0f);
+        if (pct > 100.0f)
+            pct = 100.0f;
+        return frames_to_ms(idx, (uint32_t)(pct * idx->total_frames / 100.0f));
+    }
+
+    seek_point_t last = {0, idx->first_frame};
+    if (idx->num_points)
+        last = idx->points[idx->num_points - 1];
+    if (offset <= last.offset)
+        return frames_to_ms(idx, last.frame);
+    return frames_to_ms(idx, last.frame + (uint32_t)((offset - last.offset) / avg_frame_bytes(idx)));
+}
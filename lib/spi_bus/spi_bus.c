@@ -0,0 +1,177 @@
+#include "spi_bus.h"
+#include "hardware/sync.h"
+#include <stdio.h>
+
+/* ##########################################################
+SPI1 BUS ARBITER
+The SD card and both VS1053 interfaces share SPI1 but want different
+clocks. Every device gets a profile (the CR0/CPSR values spi_set_baudrate
+worked out for it) and the registers are only rewritten when the bus
+changes hands to a device with a different profile.
+Ownership is per context (core + exception number) behind a hardware
+spinlock, so one context can nest acquires. DMA transfers own the bus themselves
+until their completion interrupt releases it; the SDI feeder tries for
+the bus from its interrupts and simply backs off.
+########################################################## */
+
+typedef struct {
+    uint32_t cr0;
+    uint32_t cpsr;
+    uint baud; // what the divider actually gives
+} spi_bus_profile_t;
+
+static struct {
+    spi_inst_t *spi;
+    spin_lock_t *lock;
+    spi_bus_profile_t profile[SPI_BUS_NUM_DEVICES];
+    int applied;                     // profile in the registers, -1 for none
+    int owner;                       // context holding the bus, -1 when free
+    uint8_t depth;                   // nested acquires by the owner
+    spi_bus_dev_t stack[SPI_BUS_MAX_DEPTH];
+    void (*on_release)(void);        // runs whenever the bus becomes free
+    uint32_t switches;               // profile changes, for tuning
+} bus = {.applied = -1, .owner = -1};
+
+#define CTX_DMA (-2) // owned by a DMA transfer in flight, never nests
+
+// Core and IPSR exception number (0 in thread mode, 9 bits), so a handler
+// that preempts another on the same core is a context of its own and can't
+// nest into a bus the preempted one holds
+static int current_context(void)
+{
+    return (int)(get_core_num() << 9 | __get_current_exception());
+}
+
+// Must hold bus.lock
+static void apply_profile(spi_bus_dev_t dev)
+{
+    if (bus.applied == (int)dev)
+        return;
+
+    spi_hw_t *hw = spi_get_hw(bus.spi);
+    spi_bus_profile_t *p = &bus.profile[dev];
+    hw->cr1 &= ~SPI_SSPCR1_SSE_BITS; // divider and format only change while disabled
+    hw->cpsr = p->cpsr;
+    hw->cr0 = p->cr0;
+    hw->cr1 |= SPI_SSPCR1_SSE_BITS;
+    bus.applied = dev;
+    bus.switches++;
+}
+
+// Runs the SDK divider search once and keeps the result
+static void store_profile(spi_bus_dev_t dev, uint baud)
+{
+    spi_hw_t *hw = spi_get_hw(bus.spi);
+    bus.profile[dev].baud = spi_set_baudrate(bus.spi, baud);
+    bus.profile[dev].cr0 = hw->cr0;
+    bus.profile[dev].cpsr = hw->cpsr;
+    bus.applied = dev;
+}
+
+// Takes over SPI1 after the SD card is mounted. The VS1053 profiles start
+// slow, raise them with spi_bus_set_baudrate() once SCI_CLOCKF is set.
+void spi_bus_init(spi_inst_t *spi)
+{
+    spi_init(spi, SPI_BUS_VS1053_SLOW_HZ);
+    spi_set_format(spi, 8, SPI_CPOL_0, SPI_CPHA_0, SPI_MSB_FIRST);
+
+    bus.spi = spi;
+    bus.lock = spin_lock_init(spin_lock_claim_unused(true));
+    bus.owner = -1;
+    bus.depth = 0;
+
+    store_profile(SPI_BUS_SD, SPI_BUS_SD_HZ);
+    store_profile(SPI_BUS_SCI, SPI_BUS_VS1053_SLOW_HZ);
+    store_profile(SPI_BUS_SDI, SPI_BUS_VS1053_SLOW_HZ);
+
+    printf("SPI1: SD %u Hz, SCI %u Hz, SDI %u Hz\r\n", bus.profile[SPI_BUS_SD].baud,
+           bus.profile[SPI_BUS_SCI].baud, bus.profile[SPI_BUS_SDI].baud);
+}
+
+// Recomputes a device's profile, returns the baud rate it actually got
+uint spi_bus_set_baudrate(spi_bus_dev_t dev, uint baud)
+{
+    spi_bus_acquire(dev);
+    uint32_t save = spin_lock_blocking(bus.lock);
+    store_profile(dev, baud);
+    spin_unlock(bus.lock, save);
+    spi_bus_release();
+    return bus.profile[dev].baud;
+}
+
+static bool try_acquire_as(spi_bus_dev_t dev, int ctx)
+{
+    if (bus.spi == NULL)
+        return true; // before init (boot time SD access), nothing to share with yet
+
+    uint32_t save = spin_lock_blocking(bus.lock);
+    bool ok = bus.depth == 0 || (bus.owner == ctx && ctx != CTX_DMA);
+    if (ok)
+    {
+        if (bus.depth == SPI_BUS_MAX_DEPTH)
+            panic("spi_bus: acquires nested too deep");
+        bus.owner = ctx;
+        bus.stack[bus.depth++] = dev;
+        apply_profile(dev);
+    }
+    spin_unlock(bus.lock, save);
+    return ok;
+}
+
+// Takes the bus for dev if it's free or already ours. Safe from IRQs.
+bool spi_bus_try_acquire(spi_bus_dev_t dev)
+{
+    return try_acquire_as(dev, current_context());
+}
+
+// For a transfer that finishes in an interrupt: the bus belongs to the
+// transfer, not the caller, until spi_bus_release() from the completion IRQ.
+// Never nests into whatever the calling context already holds.
+bool spi_bus_try_acquire_dma(spi_bus_dev_t dev)
+{
+    return try_acquire_as(dev, CTX_DMA);
+}
+
+// Spins until the bus is ours. Not from IRQs, and not with interrupts off:
+// the feeder gives the bus back from its DMA interrupt.
+void spi_bus_acquire(spi_bus_dev_t dev)
+{
+    while (!spi_bus_try_acquire(dev))
+        tight_loop_contents();
+}
+
+void spi_bus_release(void)
+{
+    if (bus.spi == NULL)
+        return;
+
+    bool freed = false;
+    uint32_t save = spin_lock_blocking(bus.lock);
+    if (bus.depth > 0)
+    {
+        bus.depth--;
+        if (bus.depth > 0)
+            apply_profile(bus.stack[bus.depth - 1]); // back to the outer device
+        else
+        {
+            bus.owner = -1;
+            freed = true;
+        }
+    }
+    spin_unlock(bus.lock, save);
+
+    if (freed && bus.on_release != NULL)
+        bus.on_release();
+}
+
+// cb runs (in the releasing context) every time the bus becomes free,
+// the SDI feeder uses it to pick up DREQ edges it had to skip
+void spi_bus_set_release_callback(void (*cb)(void))
+{
+    bus.on_release = cb;
+}
+
+uint32_t spi_bus_switches(void)
+{
+    return bus.switches;
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include "pico/stdlib.h"
+#include "hardware/spi.h"
+
+// Devices sharing SPI1. Each keeps its own cached baud/format profile.
+typedef enum {
+    SPI_BUS_SD,  // SD card (FatFs driver)
+    SPI_BUS_SCI, // VS1053 control registers (xCS)
+    SPI_BUS_SDI, // VS1053 audio data (xDCS)
+    SPI_BUS_NUM_DEVICES
+} spi_bus_dev_t;
+
+#define SPI_BUS_SD_HZ (125 * 1000 * 1000 / 4) // keep in step with baud_rate in src/hw_config.c
+
+// VS1053 limits: SCI reads CLKI/7, SCI writes and SDI CLKI/4.
+// CLKI is 12.288 MHz out of reset and 55.3 MHz after SCI_CLOCKF = 0xB000.
+#define SPI_BUS_VS1053_SLOW_HZ (1 * 1000 * 1000)
+#define SPI_BUS_SCI_FAST_HZ (7 * 1000 * 1000)
+#define SPI_BUS_SDI_FAST_HZ (13 * 1000 * 1000)
+
+// How many acquires one context can nest (e.g. an SCI access inside an SD one)
+#define SPI_BUS_MAX_DEPTH 4
+
+void spi_bus_init(spi_inst_t *spi);
+uint spi_bus_set_baudrate(spi_bus_dev_t dev, uint baud);
+void spi_bus_acquire(spi_bus_dev_t dev);
+bool spi_bus_try_acquire(spi_bus_dev_t dev);
+bool spi_bus_try_acquire_dma(spi_bus_dev_t dev);
+void spi_bus_release(void);
+void spi_bus_set_release_callback(void (*cb)(void));
+uint32_t spi_bus_switches(void);
@@ -0,0 +1,415 @@
+#define _GNU_SOURCE
+#define DIR FF_DIR // FatFs and POSIX both have one
+#include "ff.h"
+#undef DIR
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/msdos_fs.h>
+#endif
+
+/* ##########################################################
+FATFS OVER A MOUNTED CARD
+"0:/dir/file" is looked up under the mount point. Directories are
+read in the order the system hands them out, which on a vfat mount
+is the order of the entries on the card, the order FatFs reads them
+in on the device. Times go back into FAT's local date and time with
+TZ, so run with the TZ the card was mounted with. On vfat the hidden
+and system bits come from FAT_IOCTL_GET_ATTRIBUTES, elsewhere there
+are none.
+########################################################## */
+
+static char mount_root[4096] = ".";
+static DWORD mount_serial;
+static uint32_t reads, writes;
+
+void ff_posix_mount(const char *root, DWORD serial)
+{
+    snprintf(mount_root, sizeof(mount_root), "%s", root);
+    mount_serial = serial;
+}
+
+uint32_t ff_posix_reads(void)
+{
+    return reads;
+}
+
+uint32_t ff_posix_writes(void)
+{
+    return writes;
+}
+
+static FRESULT host_path(const TCHAR *path, char *out, size_t n)
+{
+    if (!strncmp(path, "0:", 2))
+        path += 2;
+    while (*path == '/')
+        path++;
+    if (snprintf(out, n, "%s/%s", mount_root, path) >= (int)n)
+        return FR_INVALID_NAME;
+    return FR_OK;
+}
+
+static FRESULT from_errno(int e)
+{
+    switch (e)
+    {
+    case ENOENT:
+        return FR_NO_FILE;
+    case ENOTDIR:
+        return FR_NO_PATH;
+    case EEXIST:
+    case ENOTEMPTY:
+        return FR_EXIST;
+    case EACCES:
+    case EPERM:
+        return FR_DENIED;
+    case EROFS:
+        return FR_WRITE_PROTECTED;
+    case ENAMETOOLONG:
+        return FR_INVALID_NAME;
+    default:
+        return FR_DISK_ERR;
+    }
+}
+
+/* ##########################################################
+FAT MODEL
+The bytes come from the host file, but every file also gets a
+cluster chain so seeks cost what they would on the card: FatFs
+follows the chain one FAT entry at a time (from the cluster it is
+at, or from the first one when going back) and reads a FAT sector
+each time an entry isn't in the sector it has in its window. With
+a link map (cltbl) it looks the cluster up in the table instead.
+FAT32, 128 entries a sector. Files are contiguous unless
+ff_posix_fat() asks for fragments, which then sit a few FAT
+sectors apart so every one starts in a sector of its own.
+########################################################## */
+
+#define FAT_ENTRIES 128 // per 512 byte sector
+#define FAT_GAP (4 * FAT_ENTRIES)
+#define NO_CLUST ((DWORD)-1)
+
+static DWORD fat_csize = 32768;
+static DWORD fat_run;
+static DWORD fat_win = NO_CLUST; // FAT sector in the window
+static uint32_t fat_reads;
+
+void ff_posix_fat(DWORD csize, DWORD run)
+{
+    fat_csize = csize;
+    fat_run = run;
+    fat_win = NO_CLUST;
+}
+
+uint32_t ff_posix_fat_reads(void)
+{
+    return fat_reads;
+}
+
+// The same file gets the same clusters every time it's opened
+static DWORD fat_base(const char *path)
+{
+    DWORD h = 2166136261u;
+    while (*path)
+        h = (h ^ (BYTE)*path++) * 16777619u;
+    return 2 + (h % 4096) * FAT_ENTRIES;
+}
+
+static void fat_chain(FIL *fp, const char *path)
+{
+    fp->nclust = (fp->objsize + fat_csize - 1) / fat_csize;
+    fp->chain = malloc((fp->nclust ? fp->nclust : 1) * sizeof(DWORD));
+    fp->ci = NO_CLUST;
+    DWORD c = fat_base(path);
+    for (DWORD i = 0; i < fp->nclust; i++)
+    {
+        if (i && fat_run && i % fat_run == 0)
+            c += FAT_GAP;
+        fp->chain[i] = c++;
+    }
+}
+
+// get_fat() on cluster c
+static void fat_entry(DWORD c)
+{
+    if (c / FAT_ENTRIES != fat_win)
+    {
+        fat_win = c / FAT_ENTRIES;
+        fat_reads++;
+    }
+}
+
+// Brings fp->ci to chain index i the way FatFs gets there
+static void fat_walk(FIL *fp, DWORD i)
+{
+    if (!fp->chain || !fp->nclust)
+        return;
+    if (i >= fp->nclust)
+        i = fp->nclust - 1;
+    if (fp->cltbl)
+    {
+        fp->ci = i;
+        return;
+    }
+    if (fp->ci == NO_CLUST || i < fp->ci)
+        fp->ci = 0; // the first cluster is in the directory entry
+    for (; fp->ci < i; fp->ci++)
+        fat_entry(fp->chain[fp->ci]);
+}
+
+// One whole walk down the chain; the table is its size, then a (length,
+// first cluster) pair per fragment and a 0. Too small a table gets
+// FR_NOT_ENOUGH_CORE with the size it needs in cltbl[0], as in FatFs.
+static FRESULT fat_linkmap(FIL *fp)
+{
+    DWORD *tbl = fp->cltbl, len = tbl[0], need = 2;
+    for (DWORD i = 0; i < fp->nclust;)
+    {
+        DWORD start = i;
+        do
+            fat_entry(fp->chain[i++]);
+        while (i < fp->nclust && fp->chain[i] == fp->chain[i - 1] + 1);
+        need += 2;
+        if (need <= len)
+        {
+            tbl[need - 3] = i - start;
+            tbl[need - 2] = fp->chain[start];
+        }
+    }
+    if (need > len)
+    {
+        tbl[0] = need;
+        return FR_NOT_ENOUGH_CORE;
+    }
+    tbl[0] = need;
+    tbl[need - 1] = 0;
+    return FR_OK;
+}
+
+FRESULT f_open(FIL *fp, const TCHAR *path, BYTE mode)
+{
+    char p[4096];
+    FRESULT fr = host_path(path, p, sizeof(p));
+    memset(fp, 0, sizeof(*fp));
+    if (fr != FR_OK)
+        return fr;
+
+    FILE *f;
+    if (mode & FA_CREATE_ALWAYS)
+        f = fopen(p, "w+b");
+    else if (mode & FA_WRITE)
+    {
+        f = fopen(p, "r+b");
+        if (!f && errno == ENOENT && (mode & FA_OPEN_ALWAYS))
+            f = fopen(p, "w+b");
+    }
+    else
+        f = fopen(p, "rb");
+    if (!f)
+        return from_errno(errno);
+
+    struct stat st;
+    if (fstat(fileno(f), &st) || S_ISDIR(st.st_mode))
+    {
+        fclose(f);
+        return FR_NO_FILE;
+    }
+    fp->fp = f;
+    fp->objsize = st.st_size;
+    fat_chain(fp, p);
+    fat_win = NO_CLUST; // the directory went through the window
+    return FR_OK;
+}
+
+FRESULT f_close(FIL *fp)
+{
+    if (!fp->fp)
+        return FR_INVALID_OBJECT;
+    int r = fclose(fp->fp);
+    fp->fp = NULL;
+    free(fp->chain);
+    fp->chain = NULL;
+    return r ? FR_DISK_ERR : FR_OK;
+}
+
+FRESULT f_read(FIL *fp, void *buff, UINT btr, UINT *br)
+{
+    *br = 0;
+    if (!fp->fp)
+        return FR_INVALID_OBJECT;
+    reads++;
+    if (fp->fptr >= fp->objsize)
+        return FR_OK;
+    if (btr > fp->objsize - fp->fptr)
+        btr = fp->objsize - fp->fptr;
+    if (fseek(fp->fp, fp->fptr, SEEK_SET))
+        return FR_DISK_ERR;
+    *br = fread(buff, 1, btr, fp->fp);
+    if (*br)
+        fat_walk(fp, (fp->fptr + *br - 1) / fat_csize);
+    fp->fptr += *br;
+    return *br == btr ? FR_OK : FR_DISK_ERR;
+}
+
+FRESULT f_write(FIL *fp, const void *buff, UINT btw, UINT *bw)
+{
+    *bw = 0;
+    if (!fp->fp)
+        return FR_INVALID_OBJECT;
+    writes++;
+    if (fseek(fp->fp, fp->fptr, SEEK_SET))
+        return FR_DISK_ERR;
+    *bw = fwrite(buff, 1, btw, fp->fp);
+    fp->fptr += *bw;
+    if (fp->fptr > fp->objsize)
+        fp->objsize = fp->fptr;
+    return *bw == btw ? FR_OK : FR_DISK_ERR;
+}
+
+// Past the end is fine, writing there grows the file as it does on FatFs
+FRESULT f_lseek(FIL *fp, FSIZE_t ofs)
+{
+    if (!fp->fp)
+        return FR_INVALID_OBJECT;
+    if (ofs == CREATE_LINKMAP)
+        return fp->cltbl ? fat_linkmap(fp) : FR_INVALID_PARAMETER;
+    if (ofs)
+        fat_walk(fp, (ofs - 1) / fat_csize);
+    else
+        fp->ci = NO_CLUST;
+    fp->fptr = ofs;
+    return FR_OK;
+}
+
+FRESULT f_sync(FIL *fp)
+{
+    if (!fp->fp)
+        return FR_INVALID_OBJECT;
+    return fflush(fp->fp) || fsync(fileno(fp->fp)) ? FR_DISK_ERR : FR_OK;
+}
+
+FRESULT f_opendir(FF_DIR *dp, const TCHAR *path)
+{
+    char p[4096];
+    FRESULT fr = host_path(path, p, sizeof(p));
+    if (fr != FR_OK)
+        return fr;
+    dp->dp = opendir(p);
+    return dp->dp ? FR_OK : FR_NO_PATH;
+}
+
+FRESULT f_closedir(FF_DIR *dp)
+{
+    if (dp->dp)
+        closedir(dp->dp);
+    dp->dp = NULL;
+    return FR_OK;
+}
+
+// FAT keeps local time in 2 second steps, from 1980 on
+static void fat_time(time_t t, FILINFO *fno)
+{
+    struct tm tm;
+    localtime_r(&t, &tm);
+    if (tm.tm_year < 80)
+    {
+        fno->fdate = 1 << 5 | 1; // 1980-01-01
+        fno->ftime = 0;
+        return;
+    }
+    if (tm.tm_year > 80 + 127)
+        tm.tm_year = 80 + 127;
+    fno->fdate = (tm.tm_year - 80) << 9 | (tm.tm_mon + 1) << 5 | tm.tm_mday;
+    fno->ftime = tm.tm_hour << 11 | tm.tm_min << 5 | tm.tm_sec / 2;
+}
+
+static BYTE fat_attrib(int dirfd, const char *name, const struct stat *st)
+{
+    BYTE a = S_ISDIR(st->st_mode) ? AM_DIR : AM_ARC;
+#ifdef FAT_IOCTL_GET_ATTRIBUTES
+    int fd = openat(dirfd, name, O_RDONLY);
+    if (fd >= 0)
+    {
+        uint32_t attr;
+        if (ioctl(fd, FAT_IOCTL_GET_ATTRIBUTES, &attr) == 0)
+            a = attr & (AM_RDO | AM_HID | AM_SYS | AM_DIR | AM_ARC);
+        close(fd);
+    }
+#endif
+    return a;
+}
+
+// Next entry, fname[0] == 0 at the end. No "." or "..", FatFs leaves those out too.
+FRESULT f_readdir(FF_DIR *dp, FILINFO *fno)
+{
+    memset(fno, 0, sizeof(*fno));
+    if (!dp->dp)
+        return FR_INVALID_OBJECT;
+
+    struct dirent *e;
+    struct stat st;
+    int fd = dirfd(dp->dp);
+    do
+    {
+        errno = 0;
+        if (!(e = readdir(dp->dp)))
+            return errno ? FR_DISK_ERR : FR_OK;
+    } while (!strcmp(e->d_name, ".") || !strcmp(e->d_name, "..") || strlen(e->d_name) > FF_MAX_LFN ||
+             fstatat(fd, e->d_name, &st, 0));
+
+    strcpy(fno->fname, e->d_name);
+    fno->fsize = S_ISDIR(st.st_mode) ? 0 : st.st_size;
+    fno->fattrib = fat_attrib(fd, e->d_name, &st);
+    fat_time(st.st_mtime, fno);
+    return FR_OK;
+}
+
+FRESULT f_mkdir(const TCHAR *path)
+{
+    char p[4096];
+    FRESULT fr = host_path(path, p, sizeof(p));
+    if (fr == FR_OK && mkdir(p, 0777))
+        fr = from_errno(errno);
+    return fr;
+}
+
+FRESULT f_unlink(const TCHAR *path)
+{
+    char p[4096];
+    FRESULT fr = host_path(path, p, sizeof(p));
+    if (fr == FR_OK && remove(p))
+        fr = from_errno(errno);
+    return fr;
+}
+
+// FatFs won't rename onto an existing file, neither does this
+FRESULT f_rename(const TCHAR *path_old, const TCHAR *path_new)
+{
+    char a[4096], b[4096];
+    FRESULT fr = host_path(path_old, a, sizeof(a));
+    if (fr == FR_OK)
+        fr = host_path(path_new, b, sizeof(b));
+    if (fr != FR_OK)
+        return fr;
+    if (!access(b, F_OK))
+        return FR_EXIST;
+    return rename(a, b) ? from_errno(errno) : FR_OK;
+}
+
+FRESULT f_getlabel(const TCHAR *path, TCHAR *label, DWORD *vsn)
+{
+    if (label)
+        label[0] = '\0';
+    if (vsn)
+        *vsn = mount_serial;
+    return FR_OK;
+}
@@ -0,0 +1,112 @@
+#pragma once
+#include "pico_host.h"
+
+// The part of the FatFs API the library and the parsers use, served by
+// ff_posix.c from a mounted copy of the card. Same names, types and result
+// codes as FatFs R0.15, so the firmware sources build unchanged.
+
+typedef unsigned int UINT;
+typedef unsigned char BYTE;
+typedef uint16_t WORD;
+typedef uint32_t DWORD;
+typedef char TCHAR;
+typedef DWORD FSIZE_t;
+
+#define FF_USE_LFN 3
+#define FF_MAX_LFN 255
+#define FF_USE_FASTSEEK 1
+#define FF_USE_LABEL 1
+
+typedef struct {
+    void *fp;        // FILE *
+    FSIZE_t fptr;
+    FSIZE_t objsize;
+    DWORD *cltbl;    // link map, set it and f_lseek(fp, CREATE_LINKMAP)
+    DWORD *chain;    // host only: the file's clusters in the FAT model
+    DWORD nclust;
+    DWORD ci;        // host only: index in chain FatFs is at (fp->clust)
+} FIL;
+
+typedef struct {
+    void *dp;        // POSIX DIR *
+} DIR;
+
+typedef struct {
+    FSIZE_t fsize;
+    WORD fdate;
+    WORD ftime;
+    BYTE fattrib;
+    TCHAR fname[FF_MAX_LFN + 1];
+} FILINFO;
+
+typedef enum {
+    FR_OK = 0,
+    FR_DISK_ERR,
+    FR_INT_ERR,
+    FR_NOT_READY,
+    FR_NO_FILE,
+    FR_NO_PATH,
+    FR_INVALID_NAME,
+    FR_DENIED,
+    FR_EXIST,
+    FR_INVALID_OBJECT,
+    FR_WRITE_PROTECTED,
+    FR_INVALID_DRIVE,
+    FR_NOT_ENABLED,
+    FR_NO_FILESYSTEM,
+    FR_MKFS_ABORTED,
+    FR_TIMEOUT,
+    FR_LOCKED,
+    FR_NOT_ENOUGH_CORE,
+    FR_TOO_MANY_OPEN_FILES,
+    FR_INVALID_PARAMETER
+} FRESULT;
+
+#define FA_READ 0x01
+#define FA_WRITE 0x02
+#define FA_OPEN_EXISTING 0x00
+#define FA_CREATE_NEW 0x04
+#define FA_CREATE_ALWAYS 0x08
+#define FA_OPEN_ALWAYS 0x10
+
+#define AM_RDO 0x01
+#define AM_HID 0x02
+#define AM_SYS 0x04
+#define AM_DIR 0x10
+#define AM_ARC 0x20
+
+FRESULT f_open(FIL *fp, const TCHAR *path, BYTE mode);
+FRESULT f_close(FIL *fp);
+FRESULT f_read(FIL *fp, void *buff, UINT btr, UINT *br);
+FRESULT f_write(FIL *fp, const void *buff, UINT btw, UINT *bw);
+FRESULT f_lseek(FIL *fp, FSIZE_t ofs);
+FRESULT f_sync(FIL *fp);
+FRESULT f_opendir(DIR *dp, const TCHAR *path);
+FRESULT f_closedir(DIR *dp);
+FRESULT f_readdir(DIR *dp, FILINFO *fno);
+FRESULT f_mkdir(const TCHAR *path);
+FRESULT f_unlink(const TCHAR *path);
+FRESULT f_rename(const TCHAR *path_old, const TCHAR *path_new);
+FRESULT f_getlabel(const TCHAR *path, TCHAR *label, DWORD *vsn);
+
+#define CREATE_LINKMAP ((FSIZE_t)0 - 1)
+
+#define f_tell(fp) ((fp)->fptr)
+#define f_size(fp) ((fp)->objsize)
+#define f_eof(fp) ((int)((fp)->fptr == (fp)->objsize))
+#define f_rewind(fp) f_lseek((fp), 0)
+
+// Host only: the directory the card is mounted on, and its volume serial
+// number for f_getlabel() (0 if unknown)
+void ff_posix_mount(const char *root, DWORD serial);
+
+// Host only: f_read and f_write calls so far, what the benchmarks count
+uint32_t ff_posix_reads(void);
+uint32_t ff_posix_writes(void);
+
+// Host only: the FAT model behind the fast seek tests. Files opened after
+// this have clusters of csize bytes laid out in fragments of run clusters
+// (0: in one piece); ff_posix_fat_reads() counts the FAT sectors FatFs
+// would have read to follow the chains since.
+void ff_posix_fat(DWORD csize, DWORD run);
+uint32_t ff_posix_fat_reads(void);
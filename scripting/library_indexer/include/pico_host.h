@@ -0,0 +1,120 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Just enough of the Pico SDK for lib/sb_util/sb_util.h, the parsers and the
+// SPI1 feed path to build on the host. Everything that touches hardware is a
+// stand-in from pico_host.c; none of it is reached while indexing, the tests
+// drive it through the host_* hooks at the bottom.
+
+typedef unsigned int uint;
+typedef uint64_t absolute_time_t;
+
+typedef struct { int unused; } i2c_inst_t;
+typedef struct { int unused; } spi_inst_t;
+typedef struct {
+    uint32_t cr0, cr1, dr, sr, cpsr, imsc, ris, mis, icr, dmacr;
+} spi_hw_t;
+typedef volatile uint32_t spin_lock_t;
+typedef void (*irq_handler_t)(void);
+typedef struct pio_hw pio_hw_t;
+typedef pio_hw_t *PIO;
+typedef struct { int unused; } mutex_t;
+typedef struct { int unused; } semaphore_t;
+struct repeating_timer;
+
+enum { GPIO_IN = 0, GPIO_OUT = 1 };
+enum { GPIO_IRQ_LEVEL_LOW = 1, GPIO_IRQ_LEVEL_HIGH = 2, GPIO_IRQ_EDGE_FALL = 4, GPIO_IRQ_EDGE_RISE = 8 };
+enum { SPI_CPOL_0 = 0, SPI_CPOL_1 = 1 };
+enum { SPI_CPHA_0 = 0, SPI_CPHA_1 = 1 };
+enum { SPI_LSB_FIRST = 0, SPI_MSB_FIRST = 1 };
+enum dma_channel_transfer_size { DMA_SIZE_8 = 0, DMA_SIZE_16 = 1, DMA_SIZE_32 = 2 };
+
+// RP2350 interrupt numbers
+#define DMA_IRQ_0 10
+#define DMA_IRQ_1 11
+#define IO_IRQ_BANK0 21
+#define HOST_NUM_IRQS 52
+#define HOST_NUM_GPIOS 48
+#define HOST_NUM_DMA 16
+#define PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY 0x80
+
+#define SPI_SSPCR1_SSE_BITS 0x00000002
+#define SPI_SSPICR_RORIC_BITS 0x00000001
+
+typedef struct {
+    uint32_t ctrl;
+} dma_channel_config;
+
+extern i2c_inst_t i2c0_inst;
+#define i2c0 (&i2c0_inst)
+#define i2c_default i2c0
+extern spi_inst_t spi1_inst;
+#define spi1 (&spi1_inst)
+
+#define count_of(a) (sizeof(a) / sizeof((a)[0]))
+
+absolute_time_t get_absolute_time(void);
+int64_t absolute_time_diff_us(absolute_time_t from, absolute_time_t to);
+uint64_t time_us_64(void);
+uint32_t time_us_32(void);
+void sleep_ms(uint32_t ms);
+void __dmb(void);
+void tight_loop_contents(void);
+void panic(const char *fmt, ...);
+uint get_core_num(void);
+uint __get_current_exception(void);
+
+uint32_t save_and_disable_interrupts(void);
+void restore_interrupts(uint32_t status);
+uint spin_lock_claim_unused(bool required);
+spin_lock_t *spin_lock_init(uint lock_num);
+uint32_t spin_lock_blocking(spin_lock_t *lock);
+void spin_unlock(spin_lock_t *lock, uint32_t saved_irq);
+void irq_add_shared_handler(uint num, irq_handler_t handler, uint8_t order_priority);
+void irq_set_enabled(uint num, bool enabled);
+
+void gpio_init(uint gpio);
+void gpio_set_dir(uint gpio, bool out);
+void gpio_put(uint gpio, bool value);
+bool gpio_get(uint gpio);
+void gpio_add_raw_irq_handler(uint gpio, irq_handler_t handler);
+void gpio_set_irq_enabled(uint gpio, uint32_t events, bool enabled);
+uint32_t gpio_get_irq_event_mask(uint gpio);
+void gpio_acknowledge_irq(uint gpio, uint32_t events);
+int i2c_write_blocking(i2c_inst_t *i2c, uint8_t addr, const uint8_t *src, size_t len, bool nostop);
+int i2c_read_blocking(i2c_inst_t *i2c, uint8_t addr, uint8_t *dst, size_t len, bool nostop);
+
+uint spi_init(spi_inst_t *spi, uint baudrate);
+uint spi_set_baudrate(spi_inst_t *spi, uint baudrate);
+void spi_set_format(spi_inst_t *spi, uint data_bits, int cpol, int cpha, int order);
+spi_hw_t *spi_get_hw(spi_inst_t *spi);
+uint spi_get_dreq(spi_inst_t *spi, bool is_tx);
+bool spi_is_busy(spi_inst_t *spi);
+bool spi_is_readable(spi_inst_t *spi);
+int spi_write_blocking(spi_inst_t *spi, const uint8_t *src, size_t len);
+
+int dma_claim_unused_channel(bool required);
+dma_channel_config dma_channel_get_default_config(uint channel);
+void channel_config_set_transfer_data_size(dma_channel_config *c, enum dma_channel_transfer_size size);
+void channel_config_set_read_increment(dma_channel_config *c, bool incr);
+void channel_config_set_write_increment(dma_channel_config *c, bool incr);
+void channel_config_set_dreq(dma_channel_config *c, uint dreq);
+void dma_channel_configure(uint channel, const dma_channel_config *config, volatile void *write_addr,
+                           const volatile void *read_addr, uint transfer_count, bool trigger);
+void dma_channel_transfer_from_buffer_now(uint channel, const volatile void *read_addr, uint32_t transfer_count);
+void dma_irqn_set_channel_enabled(uint irq_index, uint channel, bool enabled);
+bool dma_irqn_get_channel_status(uint irq_index, uint channel);
+void dma_irqn_acknowledge_channel(uint irq_index, uint channel);
+
+// Test side of the stand-ins: the hardware only moves when a test says so.
+// Raising an interrupt runs its handlers right away, in handler context.
+extern void (*host_idle_hook)(void);           // every tight_loop_contents(), i.e. busy waits
+extern void (*host_spi_write_hook)(const uint8_t *src, size_t len);
+void host_reset(void);
+bool host_irqs_enabled(void);
+void host_irq_raise(uint num);
+void host_gpio_edge(uint gpio, bool level);    // drives an input, rising/falling edges raise its IRQ
+const uint8_t *host_dma_pending(uint channel, uint32_t *count); // NULL when the channel is idle
+void host_dma_finish(uint channel);            // transfer done, raises its DMA IRQ
@@ -0,0 +1,111 @@
+#include "lib/sb_util/sb_util.h"
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/* ##########################################################
+LIBRARY INDEXER: THE CARD'S LIBRARY, BUILT ON A PC
+Runs lib/sb_util/library.c and the tag parsers over a card mounted
+on the host and leaves the .stereoboy files the player would have
+after a cold start: tracks.dat and strings.dat with every tag parsed
+(album art located), the artist, album and genre indices and the
+directory snapshot. The player then finds the card unchanged and
+goes straight to the menu with nothing left to parse.
+
+It's built from the same tree as the firmware, so the files carry
+its LIBRARY_VERSION. A player with another format ignores them and
+indexes the card itself. Old library files are removed first and
+the clock stands still (pico_host.c), so the same card gives the
+same bytes every time.
+
+usage: library_indexer [-s XXXX-XXXX] /media/user/CARD
+  -s  volume serial number, as blkid -s UUID -o value /dev/sdX1 has
+      it. Without it the player takes its own directory snapshot on
+      the first boot, the table stays as it is.
+File times are compared in FAT's local time, run it with the TZ the
+card was mounted with (tz=UTC mounts want TZ=UTC).
+
+build: cmake -S scripting/library_indexer -B build && cmake --build build
+########################################################## */
+
+static const char *const library_files[] = {
+    LIBRARY_TRACKS,        LIBRARY_STRINGS,      LIBRARY_DIRS,        LIBRARY_BY_ARTIST_IDX,
+    LIBRARY_BY_ALBUM_IDX,  LIBRARY_BY_GENRE_IDX, LIBRARY_TRACKS_TMP,  LIBRARY_STRINGS_TMP,
+    LIBRARY_SORT_A,        LIBRARY_SORT_B,
+};
+
+// "1A2B-3C4D" as blkid prints it, or plain hex
+static bool parse_serial(const char *s, DWORD *vsn)
+{
+    unsigned hi, lo;
+    char *end;
+    if (sscanf(s, "%4x-%4x", &hi, &lo) == 2 && strlen(s) == 9)
+    {
+        *vsn = hi << 16 | lo;
+        return true;
+    }
+    unsigned long v = strtoul(s, &end, 16);
+    if (!*s || *end || v > 0xFFFFFFFFul)
+        return false;
+    *vsn = v;
+    return true;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-s XXXX-XXXX] CARD_MOUNT_POINT\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    DWORD serial = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:")) != -1)
+    {
+        if (opt != 's' || !parse_serial(optarg, &serial))
+        {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (optind != argc - 1)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+    struct stat st;
+    if (stat(argv[optind], &st) || !S_ISDIR(st.st_mode))
+    {
+        fprintf(stderr, "%s is not a directory\n", argv[optind]);
+        return 1;
+    }
+    ff_posix_mount(argv[optind], serial);
+    printf("Library format %d, volume serial %04lX-%04lX\n", LIBRARY_VERSION, (unsigned long)serial >> 16,
+           (unsigned long)serial & 0xFFFF);
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (size_t i = 0; i < count_of(library_files); i++)
+        f_unlink(library_files[i]); // from nothing, or the result depends on what was there
+
+    int n = library_scan();
+    for (int steps = 1; library_fill_step(0); steps++)
+        if (steps % 1000 == 0 && isatty(STDERR_FILENO))
+            fprintf(stderr, "%d to parse\r", library_pending());
+
+    FIL fil;
+    if (f_open(&fil, LIBRARY_TRACKS, FA_READ) != FR_OK)
+    {
+        fprintf(stderr, "No library written to %s\n", argv[optind]);
+        return 1;
+    }
+    f_close(&fil);
+    if (library_pending())
+    {
+        fprintf(stderr, "%d tracks left unparsed\n", library_pending());
+        return 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    printf("%d tracks indexed in %.1f s\n", n, (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9);
+    return 0;
+}
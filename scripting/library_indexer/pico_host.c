@@ -0,0 +1,350 @@
+#include "lib/sb_util/sb_util.h"
+#include <stdarg.h>
+
+/* ##########################################################
+PICO STAND-INS FOR THE HOST
+The clock stands still, so nothing timing dependent (cold_ms in the
+table header) makes two runs over the same card differ. The DAC's
+I2C goes nowhere, the SD card is ff_posix.c's business.
+GPIO, interrupts, SPI1 and DMA keep just enough state for the tests
+to play the hardware's part: a busy wait calls host_idle_hook, DMA
+transfers sit until host_dma_finish() and input edges come from
+host_gpio_edge(). The SPI1 arbiter itself is the real spi_bus.c.
+########################################################## */
+
+int count; // the firmware's track count, library_scan() keeps it
+i2c_inst_t i2c0_inst;
+spi_inst_t spi1_inst;
+
+void (*host_idle_hook)(void);
+void (*host_spi_write_hook)(const uint8_t *src, size_t len);
+
+static struct {
+    bool irqs_off;
+    uint exception; // vector number of the running handler, 0 in thread mode
+    irq_handler_t irq[HOST_NUM_IRQS];
+    bool gpio[HOST_NUM_GPIOS];
+    uint32_t gpio_events[HOST_NUM_GPIOS];
+    irq_handler_t gpio_irq[HOST_NUM_GPIOS];
+    spin_lock_t locks[32];
+    spi_hw_t spi;
+    int dma_claimed;
+    struct {
+        const uint8_t *src;
+        uint32_t count;
+        bool done;
+        int8_t irq_index; // -1 when no DMA IRQ wants it
+    } dma[HOST_NUM_DMA];
+} host;
+
+absolute_time_t get_absolute_time(void)
+{
+    return 0;
+}
+
+int64_t absolute_time_diff_us(absolute_time_t from, absolute_time_t to)
+{
+    return (int64_t)(to - from);
+}
+
+uint64_t time_us_64(void)
+{
+    return 0;
+}
+
+uint32_t time_us_32(void)
+{
+    return 0;
+}
+
+void sleep_ms(uint32_t ms)
+{
+}
+
+void __dmb(void)
+{
+}
+
+void tight_loop_contents(void)
+{
+    if (host_idle_hook)
+        host_idle_hook();
+}
+
+void panic(const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+    abort();
+}
+
+uint get_core_num(void)
+{
+    return 0;
+}
+
+uint __get_current_exception(void)
+{
+    return host.exception;
+}
+
+/* ---------------- interrupts ---------------- */
+
+uint32_t save_and_disable_interrupts(void)
+{
+    uint32_t was_off = host.irqs_off;
+    host.irqs_off = true;
+    return was_off;
+}
+
+void restore_interrupts(uint32_t status)
+{
+    host.irqs_off = status;
+}
+
+uint spin_lock_claim_unused(bool required)
+{
+    return 0;
+}
+
+spin_lock_t *spin_lock_init(uint lock_num)
+{
+    host.locks[lock_num] = 0;
+    return &host.locks[lock_num];
+}
+
+// One core, so the lock is only the interrupt mask
+uint32_t spin_lock_blocking(spin_lock_t *lock)
+{
+    return save_and_disable_interrupts();
+}
+
+void spin_unlock(spin_lock_t *lock, uint32_t saved_irq)
+{
+    restore_interrupts(saved_irq);
+}
+
+void irq_add_shared_handler(uint num, irq_handler_t handler, uint8_t order_priority)
+{
+    host.irq[num] = handler; // one handler per line is all the tests need
+}
+
+void irq_set_enabled(uint num, bool enabled)
+{
+}
+
+// Power-on state for the next test: handlers, pins and DMA channels all free
+void host_reset(void)
+{
+    memset(&host, 0, sizeof(host));
+}
+
+bool host_irqs_enabled(void)
+{
+    return !host.irqs_off;
+}
+
+// No nesting and nothing pends: everything runs at one priority, and a
+// test has to wait for interrupts to be on before it moves the hardware
+static void run_handler(uint num, irq_handler_t handler)
+{
+    if (host.irqs_off)
+        panic("irq %u raised with interrupts off", num);
+    host.exception = 16 + num;
+    host.irqs_off = true;
+    handler();
+    host.irqs_off = false;
+    host.exception = 0;
+}
+
+void host_irq_raise(uint num)
+{
+    if (host.irq[num])
+        run_handler(num, host.irq[num]);
+}
+
+/* ---------------- GPIO ---------------- */
+
+void gpio_init(uint gpio)
+{
+    host.gpio[gpio] = false;
+}
+
+void gpio_set_dir(uint gpio, bool out)
+{
+}
+
+void gpio_put(uint gpio, bool value)
+{
+    host.gpio[gpio] = value;
+}
+
+bool gpio_get(uint gpio)
+{
+    return host.gpio[gpio];
+}
+
+void gpio_add_raw_irq_handler(uint gpio, irq_handler_t handler)
+{
+    host.gpio_irq[gpio] = handler;
+}
+
+void gpio_set_irq_enabled(uint gpio, uint32_t events, bool enabled)
+{
+}
+
+uint32_t gpio_get_irq_event_mask(uint gpio)
+{
+    return host.gpio_events[gpio];
+}
+
+void gpio_acknowledge_irq(uint gpio, uint32_t events)
+{
+    host.gpio_events[gpio] &= ~events;
+}
+
+// The bank IRQ only calls the raw handler of the pin that changed
+void host_gpio_edge(uint gpio, bool level)
+{
+    if (host.gpio[gpio] == level)
+        return;
+    host.gpio[gpio] = level;
+    host.gpio_events[gpio] |= level ? GPIO_IRQ_EDGE_RISE : GPIO_IRQ_EDGE_FALL;
+    if (host.gpio_irq[gpio])
+        run_handler(IO_IRQ_BANK0, host.gpio_irq[gpio]);
+}
+
+int i2c_write_blocking(i2c_inst_t *i2c, uint8_t addr, const uint8_t *src, size_t len, bool nostop)
+{
+    return -1;
+}
+
+int i2c_read_blocking(i2c_inst_t *i2c, uint8_t addr, uint8_t *dst, size_t len, bool nostop)
+{
+    return -1;
+}
+
+/* ---------------- SPI ---------------- */
+
+uint spi_init(spi_inst_t *spi, uint baudrate)
+{
+    host.spi.cr1 |= SPI_SSPCR1_SSE_BITS;
+    return spi_set_baudrate(spi, baudrate);
+}
+
+// cpsr/cr0 just have to tell the profiles apart
+uint spi_set_baudrate(spi_inst_t *spi, uint baudrate)
+{
+    host.spi.cpsr = 2;
+    host.spi.cr0 = baudrate;
+    return baudrate;
+}
+
+void spi_set_format(spi_inst_t *spi, uint data_bits, int cpol, int cpha, int order)
+{
+}
+
+spi_hw_t *spi_get_hw(spi_inst_t *spi)
+{
+    return &host.spi;
+}
+
+uint spi_get_dreq(spi_inst_t *spi, bool is_tx)
+{
+    return 0;
+}
+
+bool spi_is_busy(spi_inst_t *spi)
+{
+    return false;
+}
+
+bool spi_is_readable(spi_inst_t *spi)
+{
+    return false;
+}
+
+int spi_write_blocking(spi_inst_t *spi, const uint8_t *src, size_t len)
+{
+    if (host_spi_write_hook)
+        host_spi_write_hook(src, len);
+    return (int)len;
+}
+
+/* ---------------- DMA ---------------- */
+
+int dma_claim_unused_channel(bool required)
+{
+    int ch = host.dma_claimed++;
+    host.dma[ch].irq_index = -1;
+    return ch;
+}
+
+dma_channel_config dma_channel_get_default_config(uint channel)
+{
+    return (dma_channel_config){0};
+}
+
+void channel_config_set_transfer_data_size(dma_channel_config *c, enum dma_channel_transfer_size size)
+{
+}
+
+void channel_config_set_read_increment(dma_channel_config *c, bool incr)
+{
+}
+
+void channel_config_set_write_increment(dma_channel_config *c, bool incr)
+{
+}
+
+void channel_config_set_dreq(dma_channel_config *c, uint dreq)
+{
+}
+
+void dma_channel_configure(uint channel, const dma_channel_config *config, volatile void *write_addr,
+                           const volatile void *read_addr, uint transfer_count, bool trigger)
+{
+    if (trigger)
+        dma_channel_transfer_from_buffer_now(channel, read_addr, transfer_count);
+}
+
+void dma_channel_transfer_from_buffer_now(uint channel, const volatile void *read_addr, uint32_t transfer_count)
+{
+    if (host.dma[channel].src)
+        panic("dma %u: triggered while busy", channel);
+    host.dma[channel].src = (const uint8_t *)read_addr;
+    host.dma[channel].count = transfer_count;
+}
+
+void dma_irqn_set_channel_enabled(uint irq_index, uint channel, bool enabled)
+{
+    host.dma[channel].irq_index = enabled ? (int8_t)irq_index : -1;
+}
+
+bool dma_irqn_get_channel_status(uint irq_index, uint channel)
+{
+    return host.dma[channel].done && host.dma[channel].irq_index == (int8_t)irq_index;
+}
+
+void dma_irqn_acknowledge_channel(uint irq_index, uint channel)
+{
+    host.dma[channel].done = false;
+}
+
+const uint8_t *host_dma_pending(uint channel, uint32_t *count)
+{
+    *count = host.dma[channel].count;
+    return host.dma[channel].src;
+}
+
+void host_dma_finish(uint channel)
+{
+    host.dma[channel].src = NULL;
+    host.dma[channel].count = 0;
+    host.dma[channel].done = true;
+    if (host.dma[channel].irq_index >= 0)
+        host_irq_raise(DMA_IRQ_0 + host.dma[channel].irq_index);
+}
@@ -0,0 +1,109 @@
+#include "synth_card.h"
+#include <time.h>
+
+/* ##########################################################
+BOOT BENCH: COLD START AGAINST WARM START
+lib/sb_util/library.c on synthetic cards (synth_card.c) of a few
+sizes, booted twice the way sb_init() and the menu's idle loop do
+it. The cold boot finds no table, so library_scan() lists every
+file and the fill steps parse each one. The warm boot finds the
+table and an unchanged card, so it only walks the directories.
+
+Checked: the cold scan leaves every track pending and the fill
+parses them all. The warm scan finds the same tracks with the same
+tags, leaves nothing pending, writes nothing, and reads only the
+headers, the directory snapshot and the first menu rows, the same
+few whatever the card holds. What's left of a warm boot is the
+directory walk. Reported per card: host time, f_read and f_write
+calls for each boot, and how much faster warm is. Card calls are what the device
+would make; host time only compares runs on one machine.
+
+build: cmake -S scripting/library_indexer -B build && cmake --build build
+run:   ctest --test-dir build, or build/boot_bench [artists...] for the numbers
+########################################################## */
+
+#define FAIL synth_fail
+#define WARM_READS 16 // the headers, dirs.dat, and a page and a few string sectors for the first menu rows
+
+typedef struct {
+    double ms;
+    uint32_t reads, writes;
+} boot_t;
+
+static double now_ms(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+static void begin(boot_t *b)
+{
+    b->ms = now_ms();
+    b->reads = ff_posix_reads();
+    b->writes = ff_posix_writes();
+}
+
+static void end(boot_t *b)
+{
+    b->ms = now_ms() - b->ms;
+    b->reads = ff_posix_reads() - b->reads;
+    b->writes = ff_posix_writes() - b->writes;
+}
+
+static void bench(int artists)
+{
+    int n;
+    char *root = synth_temp_card(artists, &n);
+
+    boot_t cold, warm;
+    begin(&cold);
+    if (library_scan() != n || library_pending() != n)
+        FAIL("cold scan found %d of %d tracks, %d pending", count, n, library_pending());
+    while (library_pending())
+        library_fill_step(0);
+    end(&cold);
+
+    track_info_t *before = malloc(n * sizeof(track_info_t));
+    for (int id = 0; id < n; id++)
+        library_get(id, &before[id]);
+
+    begin(&warm);
+    if (library_scan() != n || library_pending())
+        FAIL("warm scan found %d of %d tracks, %d pending", count, n, library_pending());
+    end(&warm);
+
+    if (warm.writes)
+        FAIL("%d tracks: the warm boot wrote %lu times", n, (unsigned long)warm.writes);
+    if (warm.reads > WARM_READS)
+        FAIL("%d tracks: the warm boot read %lu times, wanted at most %d", n, (unsigned long)warm.reads, WARM_READS);
+    for (int id = 0; id < n; id++)
+    {
+        track_info_t t;
+        library_get(id, &t);
+        if (strcmp(t.filename, before[id].filename) || strcmp(t.title, before[id].title) ||
+            strcmp(t.artist, before[id].artist) || t.audio_start != before[id].audio_start)
+            FAIL("%d tracks: track %d is '%s', was '%s'", n, id, t.title, before[id].title);
+    }
+
+    printf("%6d tracks: cold %7.1f ms %7lu reads %7lu writes, warm %6.1f ms %2lu reads %lu writes, %5.1fx\n", n,
+           cold.ms, (unsigned long)cold.reads, (unsigned long)cold.writes, warm.ms, (unsigned long)warm.reads,
+           (unsigned long)warm.writes, cold.ms / warm.ms);
+
+    free(before);
+    synth_remove(root);
+    free(root);
+}
+
+int main(int argc, char **argv)
+{
+    static const int sizes[] = {10, 50, 250}; // 200, 1000 and 5000 tracks
+    if (argc > 1)
+        for (int i = 1; i < argc; i++)
+            bench(atoi(argv[i]));
+    else
+        for (size_t i = 0; i < count_of(sizes); i++)
+            bench(sizes[i]);
+    printf("boot: all passed\n");
+    return 0;
+}
@@ -0,0 +1,215 @@
+#include "synth_card.h"
+#include <time.h>
+
+/* ##########################################################
+BROWSE BENCH: THE ARTIST, ALBUM AND GENRE INDICES OVER 10K TRACKS
+lib/sb_util/library.c on a synthetic 10k-track card (synth_card.c)
+through ff_posix.c, from a cold start: the scan, the tag fill, the
+strings.dat check and the three index builds the idle fill steps do
+after it, then prefix lookups and letter jumps on each index.
+
+Checked against the tags themselves: every playable track is in
+each index once, groups come in key order with no two equal (case-
+insensitive), every track sits in the group its tags name and in
+sub-key order inside it, and each lookup returns exactly the groups
+starting with the prefix. Reported: build time and card calls per
+index, and reads and host time per lookup. Card calls are the
+f_read/f_write the device would make; host time only compares runs
+on one machine.
+
+build: cmake -S scripting/library_indexer -B build && cmake --build build
+run:   ctest --test-dir build, or build/browse_bench for the numbers
+########################################################## */
+
+#define FAIL synth_fail
+#define ARTISTS 500 // 10k tracks
+
+static const char *const prefixes[] = {"a", "ac", "AC/", "zulu", "\xC3\x9C", "(", "various", "x", "album d", "rock", ""};
+
+static const char *const names[LIBRARY_INDEX_NUM] = {"artist", "album", "genre"};
+static char **keys[LIBRARY_INDEX_NUM]; // group keys as the tags give them
+static int groups[LIBRARY_INDEX_NUM];
+
+static double now_ms(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+static int log2_ceil(int n)
+{
+    int k = 0;
+    while ((1 << k) < n)
+        k++;
+    return k;
+}
+
+// Group key of track t in index ix, and what orders it inside the group
+static void track_key(library_index_t ix, const track_info_t *t, char *key, char *sub, size_t n)
+{
+    if (ix == LIBRARY_BY_ARTIST)
+    {
+        snprintf(key, n, "%s", t->artist);
+        snprintf(sub, n, "%s\x01%05u", t->album, t->track_no);
+    }
+    else if (ix == LIBRARY_BY_ALBUM)
+    {
+        snprintf(key, n, "%s\x02%s", t->album_artist[0] ? t->album_artist : t->artist, t->album);
+        snprintf(sub, n, "%05u", t->track_no);
+    }
+    else
+    {
+        snprintf(key, n, "%s", t->genre);
+        snprintf(sub, n, "%s\x01%s\x01%05u", t->artist, t->album, t->track_no);
+    }
+}
+
+static void check_index(library_index_t ix, int n)
+{
+    int g_n = library_index_groups(ix);
+    if (g_n <= 0)
+        FAIL("%s index not built", names[ix]);
+    groups[ix] = g_n;
+    keys[ix] = calloc(g_n, sizeof(char *));
+    uint8_t *seen = calloc(n, 1);
+    int pos = 0;
+    char name[300], key[600], sub[600], prev_sub[600];
+
+    for (int g = 0; g < g_n; g++)
+    {
+        int tracks;
+        int first = library_index_group(ix, g, name, sizeof(name), &tracks);
+        if (first != pos || tracks <= 0)
+            FAIL("%s group %d: entries from %d (%d), wanted from %d", names[ix], g, first, tracks, pos);
+        prev_sub[0] = '\0';
+        for (int i = 0; i < tracks; i++, pos++)
+        {
+            int id = library_index_track(ix, pos);
+            if (id < 0 || id >= n || seen[id]++)
+                FAIL("%s entry %d: track %d twice or out of range", names[ix], pos, id);
+            track_info_t t;
+            library_get(id, &t);
+            track_key(ix, &t, key, sub, sizeof(key));
+            if (i == 0)
+            {
+                keys[ix][g] = strdup(key);
+                if (g && synth_fold_cmp(keys[ix][g - 1], key) >= 0)
+                    FAIL("%s groups '%s' and '%s' out of order", names[ix], keys[ix][g - 1], key);
+            }
+            else if (synth_fold_cmp(keys[ix][g], key))
+                FAIL("%s group '%s' has track %d of '%s'", names[ix], keys[ix][g], id, key);
+            if (synth_fold_cmp(prev_sub, sub) > 0)
+                FAIL("%s group '%s': track %d out of order", names[ix], keys[ix][g], id);
+            strcpy(prev_sub, sub);
+        }
+    }
+    if (pos != n)
+        FAIL("%s index has %d of %d tracks", names[ix], pos, n);
+    free(seen);
+}
+
+static bool has_prefix(const char *key, const char *prefix)
+{
+    char k[600];
+    snprintf(k, sizeof(k), "%.*s", (int)strlen(prefix), key);
+    return !synth_fold_cmp(k, prefix);
+}
+
+static void bench_lookups(library_index_t ix)
+{
+    uint32_t reads = 0, max = 0;
+    double ms = 0;
+    int bound = 4 * log2_ceil(groups[ix] + 1) + 8; // two binary searches reading a group and its name a step
+
+    for (size_t i = 0; i < count_of(prefixes); i++)
+    {
+        uint32_t r0 = ff_posix_reads();
+        double t0 = now_ms();
+        int end, lo = library_index_find(ix, prefixes[i], &end);
+        ms += now_ms() - t0;
+        uint32_t r = ff_posix_reads() - r0;
+        reads += r;
+        max = r > max ? r : max;
+        if ((int)r > bound)
+            FAIL("%s '%s': %lu reads, more than %d", names[ix], prefixes[i], (unsigned long)r, bound);
+
+        for (int g = 0; g < groups[ix]; g++)
+            if (has_prefix(keys[ix][g], prefixes[i]) != (g >= lo && g < end))
+                FAIL("%s '%s' gave [%d, %d), group %d '%s' says otherwise", names[ix], prefixes[i], lo, end, g,
+                     keys[ix][g]);
+    }
+
+    uint32_t jump_reads = ff_posix_reads();
+    for (char c = 'a'; c <= 'z'; c++)
+    {
+        int g = library_index_jump(ix, c), want = 0;
+        while (want < groups[ix] && synth_fold_cmp(keys[ix][want], (char[]){c, 0}) < 0)
+            want++;
+        if (g != want)
+            FAIL("%s jump to '%c' gave group %d, wanted %d", names[ix], c, g, want);
+    }
+    jump_reads = ff_posix_reads() - jump_reads;
+
+    printf("%-6s %5d names: lookup %4.1f reads (max %lu), %6.1f us; letter jump %4.1f reads\n", names[ix],
+           groups[ix], (double)reads / count_of(prefixes), (unsigned long)max, ms * 1e3 / count_of(prefixes),
+           jump_reads / 26.0);
+}
+
+int main(void)
+{
+    int n;
+    double t0 = now_ms();
+    char *root = synth_temp_card(ARTISTS, &n);
+    printf("card: %d tracks written in %.0f ms\n", n, now_ms() - t0);
+
+    t0 = now_ms();
+    if (library_scan() != n)
+        FAIL("scan found %d of %d tracks", library_scan(), n);
+    printf("scan: %.0f ms, %lu reads, %lu writes\n", now_ms() - t0, (unsigned long)ff_posix_reads(),
+           (unsigned long)ff_posix_writes());
+
+    uint32_t r0 = ff_posix_reads(), w0 = ff_posix_writes();
+    t0 = now_ms();
+    while (library_pending())
+        library_fill_step(0);
+    printf("fill: %.0f ms, %lu reads, %lu writes\n", now_ms() - t0, (unsigned long)(ff_posix_reads() - r0),
+           (unsigned long)(ff_posix_writes() - w0));
+
+    // the idle steps after that read strings.dat back against its CRC, then build one index each
+    int checks = 0;
+    r0 = ff_posix_reads();
+    t0 = now_ms();
+    for (int ix = 0; ix < LIBRARY_INDEX_NUM;)
+    {
+        uint32_t r1 = ff_posix_reads(), w1 = ff_posix_writes();
+        double t1 = now_ms();
+        if (!library_fill_step(0))
+            FAIL("fill steps done before the %s index", names[ix]);
+        uint32_t r = ff_posix_reads() - r1, w = ff_posix_writes() - w1;
+        double ms = now_ms() - t1;
+        if (library_index_groups(ix) <= 0)
+        {
+            if (ix)
+                FAIL("a step between the %s and %s indices", names[ix - 1], names[ix]);
+            checks++;
+            continue;
+        }
+        if (ix == 0)
+            printf("strings check: %d steps, %.0f ms, %lu reads\n", checks, t1 - t0, (unsigned long)(r1 - r0));
+        printf("%s index: %.0f ms, %lu reads, %lu writes\n", names[ix], ms, (unsigned long)r, (unsigned long)w);
+        ix++;
+    }
+    if (library_fill_step(0))
+        FAIL("fill steps still busy after the indices");
+
+    for (int ix = 0; ix < LIBRARY_INDEX_NUM; ix++)
+        check_index(ix, n);
+    for (int ix = 0; ix < LIBRARY_INDEX_NUM; ix++)
+        bench_lookups(ix);
+
+    synth_remove(root);
+    free(root);
+    printf("browse: all passed\n");
+    return 0;
+}
@@ -0,0 +1,130 @@
+#include "lib/sb_util/sb_util.h"
+#include <stdarg.h>
+#include <unistd.h>
+
+/* ##########################################################
+CLMT BENCH: SEEKS ON A FRAGMENTED CARD, WITH AND WITHOUT THE LINK MAP
+One 6 MB track opened through the real sd_stream.c (which builds
+the link map with sd_build_linkmap) on the FAT model in ff_posix.c,
+laid out in one piece and in fragments of 8 and 1 clusters. The
+same pseudo-random seeks the jukebox makes (seek, refill a block)
+run once with the link map and once with it dropped, counting the
+FAT sectors FatFs has to read to find the cluster.
+
+Checked: with the map no seek reads the FAT; a file too fragmented
+for the SD_STREAM_CLMT_LEN inline table gets a heap table and still
+seeks without the FAT; the bytes read after each seek are the ones
+at that offset. Reported: FAT reads to build the map, FAT reads per
+seek both ways, and what that is in card time at SECTOR_US a read.
+
+build: cmake -S scripting/library_indexer -B build && cmake --build build
+run:   ctest --test-dir build, or build/clmt_bench for the numbers
+########################################################## */
+
+#define CLUSTER 32768    // what SD cards ship formatted with
+#define FILE_SIZE (6u << 20)
+#define SEEKS 200
+#define SECTOR_US 300    // one 512 byte single block read on SPI, command included
+
+static sd_stream_t stream;
+
+static void fail(const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    printf("clmt: FAIL: ");
+    vprintf(fmt, ap);
+    printf("\n");
+    va_end(ap);
+    exit(1);
+}
+
+static uint8_t file_byte(uint32_t off)
+{
+    return (uint8_t)(off * 7 + (off >> 11));
+}
+
+static uint32_t rng = 1;
+static uint32_t rnd(uint32_t n)
+{
+    rng = rng * 1664525u + 1013904223u;
+    return (rng >> 8) % n;
+}
+
+// The seeks, fast-forward and rewind style; returns the FAT reads they took
+static uint32_t seeks(sd_stream_t *s)
+{
+    rng = 1;
+    uint32_t before = ff_posix_fat_reads();
+    for (int i = 0; i < SEEKS; i++)
+    {
+        uint32_t pos = rnd(FILE_SIZE - SD_STREAM_BLOCK_SIZE);
+        sd_stream_seek(s, pos);
+        sd_stream_fill(s);
+        uint32_t slot = s->tail % SD_STREAM_NUM_BLOCKS;
+        if (s->pos[slot] != pos || !s->len[slot])
+            fail("seek to %lu read at %lu", (unsigned long)pos, (unsigned long)s->pos[slot]);
+        for (uint32_t j = 0; j < s->len[slot]; j++)
+            if (s->blocks[slot][j] != file_byte(pos + j))
+                fail("wrong byte at %lu after a seek to %lu", (unsigned long)(pos + j), (unsigned long)pos);
+    }
+    return ff_posix_fat_reads() - before;
+}
+
+static void bench(const char *name, DWORD run)
+{
+    ff_posix_fat(CLUSTER, run);
+
+    uint32_t before = ff_posix_fat_reads();
+    if (sd_stream_open(&stream, "track.mp3") != FR_OK)
+        fail("%s: can't open", name);
+    uint32_t build = ff_posix_fat_reads() - before;
+    if (!stream.fil.cltbl)
+        fail("%s: no link map", name);
+    DWORD entries = stream.fil.cltbl[0];
+    bool heap = stream.clmt_heap != NULL;
+    if (heap != (entries > SD_STREAM_CLMT_LEN))
+        fail("%s: %lu entry table %s the heap", name, (unsigned long)entries, heap ? "on" : "not on");
+    uint32_t with = seeks(&stream);
+    sd_stream_close(&stream);
+    if (with)
+        fail("%s: %lu FAT reads seeking with the link map", name, (unsigned long)with);
+
+    sd_stream_open(&stream, "track.mp3");
+    stream.fil.cltbl = NULL; // as a FatFs without FF_USE_FASTSEEK
+    uint32_t without = seeks(&stream);
+    sd_stream_close(&stream);
+
+    uint32_t frags = (entries - 2) / 2;
+    printf("%-11s %4lu fragments, map %3lu entries (%s), built with %3lu FAT reads; per seek "
+           "%5.1f FAT reads (%5.2f ms) without it, 0 with it\n",
+           name, (unsigned long)frags, (unsigned long)entries, heap ? "heap" : "inline", (unsigned long)build,
+           (double)without / SEEKS, (double)without / SEEKS * SECTOR_US / 1000);
+    if (run && without <= SEEKS)
+        fail("%s: only %lu FAT reads for %d seeks without the map", name, (unsigned long)without, SEEKS);
+}
+
+int main(void)
+{
+    char dir[] = "/tmp/clmt_benchXXXXXX";
+    if (!mkdtemp(dir))
+        fail("no temp dir");
+    char path[512];
+    snprintf(path, sizeof(path), "%s/track.mp3", dir);
+    FILE *f = fopen(path, "wb");
+    if (!f)
+        fail("can't write %s", path);
+    for (uint32_t off = 0; off < FILE_SIZE; off++)
+        fputc(file_byte(off), f);
+    fclose(f);
+    ff_posix_mount(dir, 0);
+
+    bench("contiguous", 0);
+    bench("8 clusters", 8);
+    bench("1 cluster", 1);
+
+    unlink(path);
+    rmdir(dir);
+    printf("clmt: all passed\n");
+    return 0;
+}
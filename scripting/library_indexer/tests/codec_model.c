@@ -0,0 +1,146 @@
+#include "codec_model.h"
+#include <stdarg.h>
+
+/* ##########################################################
+CODEC MODEL: THE VS1053'S SDI SIDE FOR THE HOST TESTS
+lib/codec/vs1053_feed.c and the real SPI1 arbiter run over the
+pico_host.c stand-ins and this plays the codec: a 2 KB SDI FIFO
+that drains codec.drain bytes a tick, DREQ high while 32 bytes
+fit, and a DMA burst that lands one tick after feed_kick()
+started it. Busy waits in the feeder move the same clock, so
+flush, drain and pause see the hardware finish underneath them.
+
+Every landed burst is checked against codec.byte_at(), every SCI
+write against the newest post; codec_check_no_stall() catches a
+feeder that sits still with work to do.
+########################################################## */
+
+codec_model_t codec;
+vs1053_t codec_pins = {.spi = spi1, .cs = 32, .dcs = 33, .dreq = 29, .rst = 27};
+static const char *scenario;
+
+void codec_fail(const char *fmt, ...)
+{
+    va_list ap;
+    printf("FAIL %s tick %lu: ", scenario, (unsigned long)codec.tick);
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    printf("\n");
+    exit(1);
+}
+
+bool codec_feed_idle(void)
+{
+    uint32_t n;
+    return host_dma_pending(FEED_CHAN, &n) == NULL;
+}
+
+static void on_spi_write(const uint8_t *src, size_t len)
+{
+    if (len != 4 || src[0] != 0x02)
+        codec_fail("SCI write of %zu bytes, opcode %02x", len, src[0]);
+    if (gpio_get(codec_pins.cs) || !gpio_get(codec_pins.dcs))
+        codec_fail("SCI write without xCS low / xDCS high");
+    if (!gpio_get(codec_pins.dreq))
+        codec_fail("SCI write with DREQ low");
+    if (codec.sd_held)
+        codec_fail("SCI write while the SD card has the bus");
+    if (!codec.sci_pending || (src[2] << 8 | src[3]) != codec.sci_want)
+        codec_fail("SCI write %02x%02x, %s %04x", src[2], src[3],
+                   codec.sci_pending ? "the newest post is" : "nothing posted since", codec.sci_want);
+    memcpy(codec.sci_last, src, 4);
+    codec.sci_pending = false;
+    codec.sci_seen++;
+}
+
+static void set_dreq(void)
+{
+    host_gpio_edge(codec_pins.dreq, CODEC_FIFO - codec.fifo >= VS1053_SDI_BURST);
+}
+
+// One tick of codec time: land the running burst, play some, move DREQ
+void codec_step(void)
+{
+    codec.tick++;
+
+    uint32_t n;
+    const uint8_t *src = host_dma_pending(FEED_CHAN, &n);
+    if (src)
+    {
+        if (gpio_get(codec_pins.dcs) || !gpio_get(codec_pins.cs))
+            codec_fail("SDI burst without xDCS low / xCS high");
+        if (codec.sd_held)
+            codec_fail("SDI burst while the SD card has the bus");
+        if (n == 0 || n > VS1053_SDI_BURST)
+            codec_fail("burst of %lu bytes", (unsigned long)n);
+        if (n > CODEC_FIFO - codec.fifo)
+            codec_fail("burst of %lu overflows the codec FIFO (%lu free)", (unsigned long)n,
+                       (unsigned long)(CODEC_FIFO - codec.fifo));
+        for (uint32_t i = 0; i < n; i++)
+            if (src[i] != codec.byte_at(codec.expect + i))
+                codec_fail("byte %lu is %02x, wanted %02x", (unsigned long)(codec.expect + i), src[i],
+                           codec.byte_at(codec.expect + i));
+        codec.expect += n;
+        codec.got += n;
+        codec.fifo += n;
+        codec.bursts++;
+        if (n > codec.max_burst)
+            codec.max_burst = n;
+        set_dreq(); // before the IRQ looks
+        host_dma_finish(FEED_CHAN);
+    }
+
+    if (codec.fifo == 0 && !codec.paused)
+    {
+        if (vs1053_feed_level())
+            codec.dry_ticks++;
+        if (codec.got && codec.got < codec.total)
+            codec.gap_ticks++;
+    }
+    codec.fifo -= codec.fifo < codec.drain ? codec.fifo : codec.drain;
+    set_dreq();
+}
+
+// Busy waits inside the feeder (flush, drain, pause) let the codec run
+static void idle_hook(void)
+{
+    if (host_irqs_enabled())
+        codec_step();
+}
+
+// No lost kicks: with something to send and nothing in the way a burst is
+// running, and a posted register write has gone out
+void codec_check_no_stall(void)
+{
+    if (codec.sci_pending && gpio_get(codec_pins.dreq) && !codec.sd_held && codec_feed_idle())
+        codec_fail("posted SCI write still waiting with DREQ high and the bus free");
+    if (vs1053_feed_level() && gpio_get(codec_pins.dreq) && !codec.sd_held && !codec.paused && codec_feed_idle())
+        codec_fail("stalled: %lu bytes queued, DREQ high, bus free, no burst", (unsigned long)vs1053_feed_level());
+}
+
+void codec_post_sci(uint16_t value)
+{
+    codec.sci_pending = true;
+    codec.sci_want = value;
+    vs1053_feed_post_sci(0x05, value); // SCI_AUDATA, as the transport engine posts it
+}
+
+// Powers the board up again with an empty codec and the feeder running
+void codec_start(const char *name, uint32_t drain, uint8_t (*byte_at)(uint32_t pos))
+{
+    scenario = name;
+    memset(&codec, 0, sizeof(codec));
+    codec.drain = drain;
+    codec.byte_at = byte_at;
+    vs1053_stats_clear();
+
+    host_reset();
+    host_idle_hook = idle_hook;
+    host_spi_write_hook = on_spi_write;
+    gpio_put(codec_pins.cs, 1);
+    gpio_put(codec_pins.dcs, 1);
+    gpio_put(codec_pins.dreq, 1); // empty FIFO after reset
+    spi_bus_init(spi1);
+    vs1053_feed_init(&codec_pins);
+}
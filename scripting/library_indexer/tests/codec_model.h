@@ -0,0 +1,40 @@
+#pragma once
+#include "lib/sb_util/sb_util.h"
+
+// Simulated VS1053 for the host tests of the feed path, see codec_model.c
+
+// A tick is about one 32-byte burst at SPI_BUS_SDI_FAST_HZ (~25 us); the
+// codec plays a few bytes in that time even at 320 kbps
+#define CODEC_FIFO 2048   // VS1053 SDI FIFO
+#define CODEC_TICK_US 25
+#define FEED_CHAN 0       // the feeder claims the first DMA channel after host_reset()
+
+typedef struct {
+    uint32_t tick;
+    uint32_t fifo;       // bytes waiting in the codec
+    uint32_t drain;      // bytes the codec plays per tick
+    uint32_t expect;     // stream position of the next byte the codec should get
+    uint32_t got;        // bytes the codec got
+    uint32_t total;      // stream length if known, 0 if not
+    uint32_t bursts;
+    uint32_t max_burst;
+    uint32_t dry_ticks;  // FIFO empty while the feed ring had data
+    uint32_t gap_ticks;  // FIFO empty between the first byte and the last (needs total)
+    bool sd_held;        // the test holds SPI1 for the SD card
+    bool paused;
+    bool sci_pending;    // posted and not out yet
+    uint16_t sci_want;   // newest post
+    uint32_t sci_seen;
+    uint8_t sci_last[4];
+    uint8_t (*byte_at)(uint32_t pos); // what the stream carries at pos
+} codec_model_t;
+
+extern codec_model_t codec;
+extern vs1053_t codec_pins;
+
+void codec_fail(const char *fmt, ...);
+void codec_start(const char *name, uint32_t drain, uint8_t (*byte_at)(uint32_t pos));
+void codec_step(void);
+bool codec_feed_idle(void);
+void codec_check_no_stall(void);
+void codec_post_sci(uint16_t value);
@@ -0,0 +1,140 @@
+#include "synth_card.h"
+
+/* ##########################################################
+DAMAGE TEST: THE TRACK TABLE'S CRCS
+lib/sb_util/library.c on a synthetic card (synth_card.c), with
+bytes flipped in tracks.dat and strings.dat behind its back and
+a reboot (library_scan() on the same card) after each:
+- a record: it fails when its page is read, reads as empty and
+  unplayable, and the next fill step rebuilds. Only its file comes
+  back pending, the rest keep their tags.
+- a string: the idle fill steps read strings.dat back against the
+  header's CRC, and the rebuild after a mismatch starts from
+  nothing, every file pending.
+- nothing flipped: the fill steps read strings.dat back and write
+  nothing.
+
+Checked: after each rebuild and fill every track has the tags it
+had before the damage.
+
+build: cmake -S scripting/library_indexer -B build && cmake --build build
+run:   ctest --test-dir build, or build/damage_test
+########################################################## */
+
+#define FAIL synth_fail
+#define ARTISTS 20 // 400 tracks
+#define DAMAGED_ID 100
+
+static char **titles;
+static uint32_t *starts;
+
+static void flip(const char *root, const char *file, long pos)
+{
+    char path[1200];
+    snprintf(path, sizeof(path), "%s/%s", root, file + strlen("0:/"));
+    FILE *f = fopen(path, "r+b");
+    if (!f || fseek(f, pos, SEEK_SET))
+        FAIL("can't open %s", path);
+    int c = fgetc(f);
+    fseek(f, pos, SEEK_SET);
+    fputc(c ^ 0x20, f);
+    fclose(f);
+}
+
+static long file_size(const char *root, const char *file)
+{
+    char path[1200];
+    snprintf(path, sizeof(path), "%s/%s", root, file + strlen("0:/"));
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        FAIL("can't open %s", path);
+    fseek(f, 0, SEEK_END);
+    long n = ftell(f);
+    fclose(f);
+    return n;
+}
+
+// Fill steps until there's nothing left, how many it took
+static int drain(void)
+{
+    int steps = 0;
+    while (library_fill_step(0))
+        if (++steps > 100000)
+            FAIL("fill steps never finish");
+    return steps;
+}
+
+static void check_tags(int n, const char *when)
+{
+    if (count != n || library_pending())
+        FAIL("%s: %d tracks, %d pending", when, count, library_pending());
+    for (int id = 0; id < n; id++)
+    {
+        track_info_t t;
+        library_get(id, &t);
+        if (strcmp(t.title, titles[id]) || t.audio_start != starts[id])
+            FAIL("%s: track %d is '%s' at %lu, was '%s' at %lu", when, id, t.title, (unsigned long)t.audio_start,
+                 titles[id], (unsigned long)starts[id]);
+    }
+}
+
+int main(void)
+{
+    int n;
+    char *root = synth_temp_card(ARTISTS, &n);
+    if (library_scan() != n)
+        FAIL("scan found %d of %d tracks", count, n);
+    drain();
+    titles = calloc(n, sizeof(char *));
+    starts = calloc(n, sizeof(uint32_t));
+    for (int id = 0; id < n; id++)
+    {
+        track_info_t t;
+        library_get(id, &t);
+        titles[id] = strdup(t.title);
+        starts[id] = t.audio_start;
+    }
+
+    // a clean reboot: strings.dat is read back, nothing is rebuilt or written
+    library_scan();
+    uint32_t r0 = ff_posix_reads(), w0 = ff_posix_writes();
+    int steps = drain();
+    printf("clean: %d fill steps, %lu reads, %lu writes\n", steps, (unsigned long)(ff_posix_reads() - r0),
+           (unsigned long)(ff_posix_writes() - w0));
+    if (ff_posix_writes() != w0)
+        FAIL("a clean table was written to");
+    check_tags(n, "clean");
+
+    // a record
+    flip(root, LIBRARY_TRACKS, SD_SECTOR_SIZE + DAMAGED_ID * sizeof(track_rec_t) + offsetof(track_rec_t, audio_start));
+    library_scan();
+    track_info_t t;
+    library_get(DAMAGED_ID, &t);
+    if (t.filename[0] || library_resolve(DAMAGED_ID))
+        FAIL("damaged record reads as '%s'", t.filename);
+    library_fill_step(0);
+    printf("record: %d of %d pending after the rebuild\n", library_pending(), n);
+    if (library_pending() != 1)
+        FAIL("%d pending after one damaged record", library_pending());
+    drain();
+    check_tags(n, "record");
+
+    // a string
+    flip(root, LIBRARY_STRINGS, file_size(root, LIBRARY_STRINGS) / 2);
+    library_scan();
+    while (library_pending() < n)
+        if (!library_fill_step(0))
+            FAIL("damaged strings.dat not noticed");
+    printf("strings: %d of %d pending after the rebuild\n", library_pending(), n);
+    drain();
+    check_tags(n, "strings");
+
+    for (int id = 0; id < n; id++)
+        free(titles[id]);
+    free(titles);
+    free(starts);
+    synth_remove(root);
+    free(root);
+    printf("damage: all passed\n");
+    return 0;
+}
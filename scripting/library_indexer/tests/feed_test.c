@@ -0,0 +1,257 @@
+#include "codec_model.h"
+
+/* ##########################################################
+FEED TEST: THE SDI FEEDER AGAINST A SIMULATED VS1053
+lib/codec/vs1053_feed.c and the real SPI1 arbiter against
+codec_model.c. Every tick checks what the feeder is there for:
+- bytes reach the codec in order, none lost or repeated
+- a burst is never more than 32 bytes, never starts with DREQ low
+  or xCS low, never while the SD card has the bus, and never runs
+  off the end of the ring
+- nothing waits: data queued, DREQ high, bus free and not paused
+  means a burst is in flight (no lost kick after a DREQ edge or a
+  bus release)
+- posted SCI writes go out once, with xCS low and DREQ high, and a
+  newer post replaces one that hadn't gone yet
+
+build: cmake -S scripting/library_indexer -B build && cmake --build build
+run:   ctest --test-dir build, or build/feed_test for the numbers
+########################################################## */
+
+#define FAIL codec_fail
+
+static const char *scenario;
+static uint32_t sent; // stream bytes submitted so far
+
+static uint8_t pattern(uint32_t i)
+{
+    return (uint8_t)(i ^ (i >> 8) ^ (i >> 16) * 3);
+}
+
+static void submit(uint32_t max)
+{
+    uint8_t buf[512];
+    if (max > sizeof(buf))
+        max = sizeof(buf);
+    for (uint32_t i = 0; i < max; i++)
+        buf[i] = pattern(sent + i);
+    sent += vs1053_feed_submit(buf, max);
+}
+
+static void start(const char *name, uint32_t drain)
+{
+    scenario = name;
+    sent = 0;
+    codec_start(name, drain, pattern);
+}
+
+#define ANY_UNDERRUNS UINT32_MAX
+
+static void finish(uint32_t underruns)
+{
+    // codec plays out whatever's left, the feeder has to see it through
+    vs1053_feed_drain();
+    if (vs1053_feed_level() || !codec_feed_idle())
+        FAIL("drain returned with %lu bytes queued", (unsigned long)vs1053_feed_level());
+    if (codec.expect != sent)
+        FAIL("codec got %lu of %lu bytes", (unsigned long)codec.expect, (unsigned long)sent);
+
+    vs1053_stats_t s;
+    vs1053_stats_get(&s);
+    if (underruns != ANY_UNDERRUNS && s.underruns != underruns)
+        FAIL("%lu underruns counted, wanted %lu", (unsigned long)s.underruns, (unsigned long)underruns);
+    if (s.sci_writes != codec.sci_seen)
+        FAIL("%lu SCI writes counted, %lu reached the codec", (unsigned long)s.sci_writes,
+             (unsigned long)codec.sci_seen);
+    if (s.bytes_fed != codec.got)
+        FAIL("bytes_fed %lu, codec got %lu", (unsigned long)s.bytes_fed, (unsigned long)codec.got);
+
+    printf("%-10s %7lu bytes in %6lu bursts (max %2lu), %5lu ticks, %lu SCI, %lu underruns, dry %lu ticks\n",
+           scenario, (unsigned long)sent, (unsigned long)codec.bursts, (unsigned long)codec.max_burst,
+           (unsigned long)codec.tick, (unsigned long)codec.sci_seen, (unsigned long)s.underruns, (unsigned long)codec.dry_ticks);
+}
+
+static uint32_t rng = 1;
+static uint32_t rnd(uint32_t n)
+{
+    rng = rng * 1664525u + 1013904223u;
+    return (rng >> 8) % n;
+}
+
+// Producer well ahead of the codec, nothing else on the bus
+static void test_steady(void)
+{
+    start("steady", 4);
+    while (sent < 256 * 1024)
+    {
+        submit(vs1053_feed_space());
+        codec_step();
+        codec_check_no_stall();
+    }
+    if (codec.dry_ticks)
+        FAIL("codec ran dry for %lu ticks", (unsigned long)codec.dry_ticks);
+    finish(0);
+}
+
+// SD reads take the bus for up to 200 ticks (a 4 KB block) at a time, and
+// refills come in odd sizes so bursts have to stop at the end of the ring
+static void test_contended(void)
+{
+    start("contended", 4);
+    uint32_t hold = 0;
+    while (sent < 256 * 1024)
+    {
+        if (!codec.sd_held && rnd(64) == 0)
+        {
+            spi_bus_acquire(SPI_BUS_SD); // waits out a running burst
+            codec.sd_held = true;
+            hold = 1 + rnd(200);
+        }
+        if (codec.sd_held && --hold == 0)
+        {
+            codec.sd_held = false;
+            spi_bus_release(); // the feeder picks up the DREQ edges it missed
+        }
+        uint32_t want = 1 + rnd(512);
+        if (vs1053_feed_space() >= want)
+            submit(want);
+        codec_step();
+        codec_check_no_stall();
+    }
+    if (codec.sd_held)
+    {
+        codec.sd_held = false;
+        spi_bus_release();
+    }
+    if (codec.dry_ticks)
+        FAIL("codec ran dry for %lu ticks", (unsigned long)codec.dry_ticks);
+    finish(0);
+}
+
+// The producer barely keeps up, so bursts come short and the tail wanders
+// off the 32-byte grid: bursts have to stop at the end of the ring
+static void test_trickle(void)
+{
+    start("trickle", 4);
+    while (sent < 64 * 1024)
+    {
+        submit(1 + rnd(8));
+        codec_step();
+        codec_check_no_stall();
+    }
+    finish(ANY_UNDERRUNS); // the ring runs dry all the time, that's the point
+}
+
+// Posted register writes in the middle of the stream, some while the bus
+// is taken, two back to back where only the newer may go out
+static void test_sci(void)
+{
+    start("sci", 4);
+    uint32_t posts = 0, replaced = 0;
+    while (sent < 64 * 1024)
+    {
+        if (rnd(16) == 0)
+        {
+            replaced += codec.sci_pending;
+            codec_post_sci(0xAC44 + posts++);
+        }
+        if (rnd(64) == 0)
+        {
+            spi_bus_acquire(SPI_BUS_SD);
+            codec.sd_held = true;
+            uint32_t seen = codec.sci_seen;
+            replaced += codec.sci_pending + 1;
+            codec_post_sci(0x1111);
+            codec_post_sci(0x2222);
+            posts += 2;
+            codec.sd_held = false;
+            spi_bus_release(); // the newer post goes out now, or on the next DREQ edge
+            if (gpio_get(codec_pins.dreq) && (codec.sci_seen != seen + 1 || codec.sci_last[2] != 0x22))
+                FAIL("pending post not replaced by the newer one (%lu writes, last %02x%02x)",
+                     (unsigned long)(codec.sci_seen - seen), codec.sci_last[2], codec.sci_last[3]);
+        }
+        submit(vs1053_feed_space());
+        codec_step();
+        codec_check_no_stall();
+    }
+    if (codec.sci_seen != posts - replaced)
+        FAIL("%lu SCI writes for %lu posts (%lu replaced)", (unsigned long)codec.sci_seen, (unsigned long)posts,
+             (unsigned long)replaced);
+    finish(0);
+}
+
+// The producer stops long enough for the codec to empty the ring twice:
+// one underrun per gap, and none for the stream running out at the end
+static void test_starve(void)
+{
+    start("starve", 8);
+    for (int gap = 0; gap < 2; gap++)
+    {
+        uint32_t until = sent + 64 * 1024;
+        while (sent < until)
+        {
+            submit(vs1053_feed_space() < 256 ? vs1053_feed_space() : 256);
+            codec_step();
+            codec_check_no_stall();
+        }
+        for (int i = 0; i < 2000; i++) // ring and codec FIFO hold ~770 ticks
+        {
+            codec_step();
+            codec_check_no_stall();
+        }
+    }
+    finish(2);
+}
+
+// Pause holds the ring, resume carries on from the same byte; flush drops
+// the ring and the codec gets what's submitted after it
+static void test_pause_flush(void)
+{
+    start("pause", 4);
+    for (int round = 0; round < 8; round++)
+    {
+        for (int i = 0; i < 300; i++)
+        {
+            submit(vs1053_feed_space());
+            codec_step();
+            codec_check_no_stall();
+        }
+
+        codec.paused = true;
+        vs1053_feed_set_paused(true); // returns once the burst in flight landed
+        if (!codec_feed_idle())
+            FAIL("burst still running after pause");
+        uint32_t level = vs1053_feed_level(), got = codec.expect;
+        for (int i = 0; i < 100; i++)
+            codec_step();
+        if (codec.expect != got || vs1053_feed_level() != level)
+            FAIL("fed %lu bytes while paused", (unsigned long)(codec.expect - got));
+        codec.paused = false;
+        vs1053_feed_set_paused(false);
+        codec_check_no_stall();
+
+        for (int i = 0; i < 50; i++)
+        {
+            submit(vs1053_feed_space());
+            codec_step();
+        }
+        vs1053_feed_flush(); // waits out the running burst
+        if (vs1053_feed_level())
+            FAIL("%lu bytes left after flush", (unsigned long)vs1053_feed_level());
+        codec.expect = sent; // what was queued is gone, the next byte comes after it
+        codec_check_no_stall();
+    }
+    finish(0);
+}
+
+int main(void)
+{
+    test_steady();
+    test_contended();
+    test_trickle();
+    test_sci();
+    test_starve();
+    test_pause_flush();
+    printf("feed: all passed\n");
+    return 0;
+}
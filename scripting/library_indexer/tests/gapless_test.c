@@ -0,0 +1,225 @@
+#include "codec_model.h"
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* ##########################################################
+GAPLESS TEST: THE SPLICE GAP IN A FIFO MODEL
+Two MP3s on a host directory (ff_posix.c) play through the real
+sd_stream.c read-ahead and SDI feeder into codec_model.c, with
+gapless.c's steps in the order jukebox() takes them: the next track
+is opened into the other slot GAPLESS_PREFETCH_MS before the end and
+its blocks filled while this one keeps pumping; when this one is
+done the other slot is pumped straight into the feed. jukebox() then
+returns 3 and main() comes back in through jukebox() before anything
+pumps again; that re-entry is modelled as a stretch of main-loop
+time with no pumping.
+
+Checked: the codec gets track A's audio and then track B's, byte
+for byte (no ID3 tag, nothing dropped or repeated between them),
+and its FIFO never empties from A's first byte to B's last while
+the re-entry fits in what was queued at the splice. A next track at
+another rate isn't spliced. Reported: the bytes queued at the
+splice and how long a re-entry they cover.
+
+What it can't see is the decoder itself: a VS1053 that finishes A's
+last frame late still plays a gap the FIFO model doesn't know of.
+
+build: cmake -S scripting/library_indexer -B build && cmake --build build
+run:   ctest --test-dir build, or build/gapless_test for the numbers
+########################################################## */
+
+#define FAIL codec_fail
+
+#define GAPLESS_PREFETCH_MS 3000 // as jukebox.c has it
+#define BYTES_PER_MS 40          // 320 kbps, the codec drains one byte a tick
+#define MAIN_PASS_TICKS 40       // one jukebox() loop pass every ms
+#define TRACK_MS 8000
+
+typedef struct {
+    const char *name;
+    uint32_t tag;   // ID3v2 tag size, header included
+    uint32_t audio; // bytes after it
+    uint8_t seed;
+} test_track_t;
+
+static test_track_t tracks[2] = {
+    {"a.mp3", 1034, TRACK_MS * BYTES_PER_MS + 123, 11},
+    {"b.mp3", 4107, TRACK_MS * BYTES_PER_MS + 77, 29},
+};
+
+static sd_stream_t streams[2];
+static seek_index_t seek_idxs[2];
+
+// File contents, tag bytes included so a leaked tag shows up
+static uint8_t file_byte(const test_track_t *t, uint32_t off)
+{
+    return (uint8_t)(off * 13 + (off >> 9) + t->seed);
+}
+
+// A's audio, then B's
+static uint8_t stream_byte(uint32_t pos)
+{
+    if (pos < tracks[0].audio)
+        return file_byte(&tracks[0], tracks[0].tag + pos);
+    return file_byte(&tracks[1], tracks[1].tag + pos - tracks[0].audio);
+}
+
+static void write_track(const char *dir, const test_track_t *t)
+{
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", dir, t->name);
+    FILE *f = fopen(path, "wb");
+    if (!f)
+        FAIL("can't write %s", path);
+    for (uint32_t off = 0; off < t->tag + t->audio; off++)
+    {
+        uint8_t b = file_byte(t, off);
+        if (off < 10)
+        {
+            // ID3v2.3 header, syncsafe size of what follows it
+            uint32_t size = t->tag - 10;
+            const uint8_t hdr[10] = {'I', 'D', '3', 3, 0, 0, (size >> 21) & 0x7F, (size >> 14) & 0x7F,
+                                     (size >> 7) & 0x7F, size & 0x7F};
+            b = hdr[off];
+        }
+        fputc(b, f);
+    }
+    fclose(f);
+}
+
+// A's and B's library entries, MP3s at one rate so they splice
+static track_info_t infos[2];
+
+// jukebox.c's open_track(), checking it lands on the first audio byte
+static void open_track(int slot, const test_track_t *t)
+{
+    track_info_t *info = &infos[t - tracks];
+    if (!gapless_open(&streams[slot], &seek_idxs[slot], info))
+        FAIL("can't open %s", t->name);
+    if (sd_stream_tell(&streams[slot]) != t->tag)
+        FAIL("%s: audio at %lu, the tag ends at %lu", t->name, (unsigned long)sd_stream_tell(&streams[slot]),
+             (unsigned long)t->tag);
+}
+
+static void run_ticks(uint32_t n)
+{
+    for (uint32_t i = 0; i < n; i++)
+    {
+        codec_step();
+        codec_check_no_stall();
+    }
+}
+
+// Both tracks through the model, spliced, with a re-entry of reentry_ms.
+// Returns the bytes queued (feed ring + codec FIFO) at the splice.
+static uint32_t play(uint32_t reentry_ms, uint32_t *gap_ms)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "splice+%lums", (unsigned long)reentry_ms);
+    codec_start(name, CODEC_TICK_US * BYTES_PER_MS / 1000, stream_byte);
+    codec.total = tracks[0].audio + tracks[1].audio;
+
+    int active = 0;
+    sd_stream_t *stream = &streams[active];
+    open_track(active, &tracks[0]);
+    bool prefetched = false;
+
+    // track A, prefetching B near the end
+    while (!sd_stream_done(stream))
+    {
+        sd_stream_fill(stream);
+        sd_stream_pump(stream);
+        uint32_t left_ms = (stream->end - sd_stream_tell(stream) + vs1053_feed_level()) / BYTES_PER_MS;
+        if (!prefetched && (stream->eof || left_ms <= GAPLESS_PREFETCH_MS))
+        {
+            // jukebox.c's prefetch_next()
+            if (!gapless_fits(&infos[0], &infos[1]))
+                FAIL("A and B don't fit together");
+            if (!gapless_prefetch(&streams[active ^ 1], &seek_idxs[active ^ 1], &infos[1], stream))
+                FAIL("can't prefetch %s", tracks[1].name);
+            if (sd_stream_tell(&streams[active ^ 1]) != tracks[1].tag)
+                FAIL("%s prefetched from %lu", tracks[1].name, (unsigned long)sd_stream_tell(&streams[active ^ 1]));
+            prefetched = true;
+        }
+        run_ticks(MAIN_PASS_TICKS);
+    }
+    if (!prefetched)
+        FAIL("never prefetched");
+
+    // splice: no cancel, no reset, no drain
+    uint32_t queued = gapless_splice(stream, &streams[active ^ 1]) + codec.fifo;
+    active ^= 1;
+    stream = &streams[active];
+
+    // jukebox() returns 3, main() comes back in
+    run_ticks(reentry_ms * MAIN_PASS_TICKS);
+
+    // track B
+    while (!sd_stream_done(stream))
+    {
+        sd_stream_fill(stream);
+        sd_stream_pump(stream);
+        run_ticks(MAIN_PASS_TICKS);
+    }
+    sd_stream_close(stream);
+    vs1053_feed_drain();
+    while (codec.fifo)
+        codec_step();
+
+    if (codec.expect != codec.total)
+        FAIL("codec got %lu of %lu bytes", (unsigned long)codec.expect, (unsigned long)codec.total);
+    *gap_ms = codec.gap_ticks * CODEC_TICK_US / 1000;
+    return queued;
+}
+
+int main(void)
+{
+    char dir[] = "/tmp/gapless_testXXXXXX";
+    if (!mkdtemp(dir))
+        FAIL("no temp dir");
+    for (int i = 0; i < 2; i++)
+    {
+        write_track(dir, &tracks[i]);
+        snprintf(infos[i].filename, sizeof(infos[i].filename), "%s", tracks[i].name);
+        infos[i].format = TRACK_CODEC;
+        infos[i].container = CONTAINER_MP3;
+        infos[i].samplespeed = 44100;
+        infos[i].bitrate = BYTES_PER_MS * 8;
+        infos[i].audio_end = tracks[i].tag + tracks[i].audio;
+    }
+    track_info_t other = infos[1];
+    other.samplespeed = 48000;
+    if (gapless_fits(&infos[0], &other))
+        FAIL("a rate change spliced");
+    ff_posix_mount(dir, 0);
+
+    // the splice itself, and a re-entry the queue easily covers
+    uint32_t gap_ms, queued = 0;
+    for (uint32_t reentry = 0; reentry <= 50; reentry += 25)
+    {
+        queued = play(reentry, &gap_ms);
+        if (codec.gap_ticks)
+            FAIL("codec ran dry for %lu ticks (%lu ms) across the splice", (unsigned long)codec.gap_ticks,
+                 (unsigned long)gap_ms);
+    }
+    uint32_t covers = queued / BYTES_PER_MS;
+    printf("splice: %lu bytes queued, covers a %lu ms re-entry at %u kbps\n", (unsigned long)queued,
+           (unsigned long)covers, BYTES_PER_MS * 8);
+
+    // past what's queued the codec has to go dry, and only by the overshoot
+    uint32_t over = 100;
+    play(covers + over, &gap_ms);
+    if (gap_ms + 2 < over || gap_ms > over + 2)
+        FAIL("re-entry %lu ms past the queue left a %lu ms gap", (unsigned long)over, (unsigned long)gap_ms);
+    printf("re-entry of %lu ms: %lu ms gap\n", (unsigned long)(covers + over), (unsigned long)gap_ms);
+
+    for (int i = 0; i < 2; i++)
+    {
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%s", dir, tracks[i].name);
+        unlink(path);
+    }
+    rmdir(dir);
+    printf("gapless: all passed\n");
+    return 0;
+}
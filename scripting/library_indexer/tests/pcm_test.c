@@ -0,0 +1,563 @@
+#include "lib/sb_util/sb_util.h"
+#include <stdarg.h>
+#include <unistd.h>
+
+/* ##########################################################
+PCM TEST: THE I2S RING AND THE WAV/AIFF SOURCE
+The parts of the I2S path that don't touch the hardware, as the
+transmitter drives them:
+- pcm_ring.h with a producer claiming and committing blocks and two
+  chained DMA channels taking and releasing them, in random order,
+  with seeks dropping what's queued and the counters wrapping.
+- pcm_source.c over WAV and AIFF/AIFC headers in memory: every
+  layout it plays, the chunk orders and paddings it has to walk,
+  truncated files, and the formats it has to turn down.
+- lib/sb_util/pcm_stream.c reading files on a host directory
+  (ff_posix.c) into the ring, with a stand-in for the i2s_out.c
+  calls it makes, played out by a consumer that reads the slots the
+  way the DMA would (byte swapped when the format says so).
+
+Checked: no block is handed out twice or overwritten before it
+played, blocks play in commit order, every sample comes out left
+justified in its slot on the right side, the first read after a
+seek lands on the right frame, and 16-bit stereo WAV is read in
+whole sectors after the first read (and the first after a seek).
+
+build: cmake -S scripting/library_indexer -B build && cmake --build build
+run:   ctest --test-dir build, or build/pcm_test
+########################################################## */
+
+#define RING_N I2S_OUT_NUM_BLOCKS
+
+static void fail(const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    printf("pcm: FAIL: ");
+    vprintf(fmt, ap);
+    printf("\n");
+    va_end(ap);
+    exit(1);
+}
+
+static uint32_t rng = 1;
+static uint32_t rnd(uint32_t n)
+{
+    rng = rng * 1664525u + 1013904223u;
+    return (rng >> 8) % n;
+}
+
+/* ---------------- the ring ---------------- */
+
+enum { SLOT_FREE, SLOT_QUEUED, SLOT_PLAYING };
+
+// steps random producer and DMA events with the counters starting at start
+static void ring_run(uint32_t start, uint32_t steps)
+{
+    pcm_ring_t r;
+    r.head = r.assigned = r.done = start;
+    uint8_t state[RING_N] = {0};
+    uint32_t seq[RING_N];         // what the producer wrote into each slot
+    int chan[2] = {-1, -1};       // slot each DMA channel plays, -1 for silence
+    uint32_t next = 0, want = 0;  // next sequence number written and expected out
+    int ch = 0;                   // chained, so they finish in turn
+
+    for (uint32_t i = 0; i < steps || !pcm_ring_empty(&r) || chan[0] >= 0 || chan[1] >= 0; i++)
+    {
+        uint32_t op = i < steps ? rnd(16) : 8; // past steps only the DMA runs
+        if (op < 7)
+        {
+            bool full = r.head - r.done == RING_N;
+            int s = pcm_ring_claim(&r, RING_N);
+            if ((s < 0) != full)
+                fail("ring: claim gave %d with %lu of %d slots in use", s, (unsigned long)(r.head - r.done), RING_N);
+            if (s < 0)
+                continue;
+            if (state[s] != SLOT_FREE)
+                fail("ring: claim handed out slot %d while it was %s", s, state[s] == SLOT_QUEUED ? "queued" : "playing");
+            seq[s] = next++;
+            state[s] = SLOT_QUEUED;
+            pcm_ring_commit(&r);
+        }
+        else if (op < 15)
+        {
+            // i2s_out_dma_irq(): the finished channel gives its block back and takes the next one
+            if (chan[ch] >= 0)
+            {
+                state[chan[ch]] = SLOT_FREE;
+                pcm_ring_release(&r);
+            }
+            uint32_t queued = pcm_ring_queued(&r);
+            int s = pcm_ring_take(&r, RING_N);
+            if ((s < 0) != (queued == 0))
+                fail("ring: take gave %d with %lu queued", s, (unsigned long)queued);
+            if (s >= 0)
+            {
+                if (state[s] != SLOT_QUEUED)
+                    fail("ring: take gave slot %d, nothing was queued in it", s);
+                if (seq[s] != want)
+                    fail("ring: block %lu played where %lu should have", (unsigned long)seq[s], (unsigned long)want);
+                want++;
+                state[s] = SLOT_PLAYING;
+            }
+            chan[ch] = s;
+            ch ^= 1;
+        }
+        else
+        {
+            // seek: whatever the DMA hasn't picked up goes
+            pcm_ring_drop(&r);
+            for (int s = 0; s < RING_N; s++)
+                if (state[s] == SLOT_QUEUED)
+                    state[s] = SLOT_FREE;
+            if (pcm_ring_queued(&r))
+                fail("ring: %lu blocks still queued after a drop", (unsigned long)pcm_ring_queued(&r));
+            want = next;
+        }
+
+        bool busy = false;
+        for (int s = 0; s < RING_N; s++)
+            busy |= state[s] != SLOT_FREE;
+        if (pcm_ring_empty(&r) == busy)
+            fail("ring: empty says %d with blocks %s", pcm_ring_empty(&r), busy ? "in use" : "all free");
+    }
+    if (want != next)
+        fail("ring: %lu of %lu blocks came out", (unsigned long)want, (unsigned long)next);
+}
+
+static void test_ring(void)
+{
+    // the counters run free, slot = counter % RING_N has to stay in step across 2^32
+    if (RING_N & (RING_N - 1))
+        fail("ring: I2S_OUT_NUM_BLOCKS (%d) has to be a power of two", RING_N);
+    ring_run(0, 200000);
+    ring_run(0xFFFFFFFFu - 5000, 20000);
+    ring_run(0xFFFFFFFFu - 3, 200);
+    printf("ring: claim/commit/take/release/drop in order, across the counter wrap\n");
+}
+
+/* ---------------- building files ---------------- */
+
+typedef struct {
+    uint8_t *b;
+    size_t n, cap;
+} buf_t;
+
+static void put(buf_t *b, const void *data, size_t n)
+{
+    if (b->n + n > b->cap)
+    {
+        b->cap = (b->n + n) * 2;
+        b->b = realloc(b->b, b->cap);
+    }
+    memcpy(&b->b[b->n], data, n);
+    b->n += n;
+}
+
+static void put_str(buf_t *b, const char *s)
+{
+    put(b, s, strlen(s));
+}
+
+static void put_int(buf_t *b, uint32_t v, int bytes, bool be)
+{
+    for (int i = 0; i < bytes; i++)
+    {
+        int shift = be ? (bytes - 1 - i) * 8 : i * 8;
+        put(b, &(uint8_t){v >> shift}, 1);
+    }
+}
+
+typedef struct {
+    const char *name;
+    const char *form;        // "WAVE", "AIFF" or "AIFC"
+    const char *aifc;        // AIFC compression type
+    uint16_t tag;            // WAV format tag, 0xFFFE for WAVE_FORMAT_EXTENSIBLE
+    uint16_t channels;
+    uint16_t bits;           // valid bits
+    uint8_t container;       // bytes per sample
+    uint32_t rate;
+    uint32_t frames;
+    bool junk_first;         // LIST (WAV) or ANNO (AIFF) with an odd length before the format chunk
+    bool data_first;         // the sample chunk before the format chunk
+    uint32_t ssnd_offset;
+    uint32_t cut;            // bytes missing off the end
+    // wanted
+    bool ok;
+    uint8_t slot_bits;
+    bool direct, bswap;
+} pcm_case_t;
+
+static const pcm_case_t cases[] = {
+    {"16-bit stereo WAV", "WAVE", NULL, 1, 2, 16, 2, 44100, 3000, false, false, 0, 0, true, 16, true, false},
+    {"LIST before fmt", "WAVE", NULL, 1, 2, 16, 2, 48000, 700, true, false, 0, 0, true, 16, true, false},
+    {"8-bit mono WAV", "WAVE", NULL, 1, 1, 8, 1, 22050, 1500, false, false, 0, 0, true, 16, false, false},
+    {"16-bit mono WAV", "WAVE", NULL, 1, 1, 16, 2, 32000, 900, false, false, 0, 0, true, 16, false, false},
+    {"24-bit stereo WAV", "WAVE", NULL, 1, 2, 24, 3, 48000, 1000, false, false, 0, 0, true, 32, false, false},
+    {"32-bit stereo WAV", "WAVE", NULL, 1, 2, 32, 4, 44100, 800, false, false, 0, 0, true, 32, true, false},
+    {"extensible 20 in 24", "WAVE", NULL, 0xFFFE, 2, 20, 3, 48000, 600, false, false, 0, 0, true, 32, false, false},
+    {"truncated WAV", "WAVE", NULL, 1, 2, 16, 2, 44100, 1000, false, false, 0, 1001, true, 16, true, false},
+    {"float WAV", "WAVE", NULL, 3, 2, 32, 4, 44100, 100, false, false, 0, 0, false, 0, false, false},
+    {"5.1 WAV", "WAVE", NULL, 1, 6, 16, 2, 48000, 100, false, false, 0, 0, false, 0, false, false},
+    {"data before fmt", "WAVE", NULL, 1, 2, 16, 2, 44100, 100, false, true, 0, 0, false, 0, false, false},
+    {"16-bit stereo AIFF", "AIFF", NULL, 0, 2, 16, 2, 44100, 2000, false, false, 0, 0, true, 16, true, true},
+    {"ANNO, SSND first", "AIFF", NULL, 0, 2, 16, 2, 48000, 500, true, true, 8, 0, true, 16, true, true},
+    {"24-bit mono AIFF", "AIFF", NULL, 0, 1, 24, 3, 44100, 700, false, false, 0, 0, true, 32, false, false},
+    {"12-bit AIFF", "AIFF", NULL, 0, 2, 12, 2, 8000, 300, false, false, 0, 0, true, 16, true, true},
+    {"AIFC sowt", "AIFC", "sowt", 0, 2, 16, 2, 44100, 900, false, false, 0, 0, true, 16, true, false},
+    {"AIFC NONE", "AIFC", "NONE", 0, 2, 16, 2, 44100, 400, false, false, 0, 0, true, 16, true, true},
+    {"AIFC ima4", "AIFC", "ima4", 0, 2, 16, 2, 44100, 100, false, false, 0, 0, false, 0, false, false},
+};
+
+// Sample ch of frame n, a signed value of c->bits bits
+static int32_t sample(const pcm_case_t *c, uint32_t n, int ch)
+{
+    uint32_t x = (n + 1) * 2654435761u ^ (ch + 1) * 40503u * (n >> 3);
+    return (int32_t)x >> (32 - c->bits);
+}
+
+// What the DAC should get for it: left justified in a 32-bit slot
+static uint32_t slot_value(const pcm_case_t *c, uint32_t n, int ch)
+{
+    return (uint32_t)sample(c, n, ch) << (32 - c->bits);
+}
+
+static void put_samples(buf_t *b, const pcm_case_t *c, bool be)
+{
+    for (uint32_t n = 0; n < c->frames; n++)
+        for (int ch = 0; ch < c->channels; ch++)
+        {
+            uint32_t v = (uint32_t)sample(c, n, ch) << (c->container * 8 - c->bits);
+            if (c->container == 1 && !be)
+                v ^= 0x80; // 8-bit WAV is unsigned
+            put_int(b, v, c->container, be);
+        }
+}
+
+static void put_ext80(buf_t *b, uint32_t rate)
+{
+    int exp = 31;
+    while (!(rate & 0x80000000u))
+        rate <<= 1, exp--;
+    put_int(b, 16383 + exp, 2, true);
+    put_int(b, rate, 4, true);
+    put_int(b, 0, 4, true);
+}
+
+// The whole file, *data_start set to where the samples begin
+static void build(buf_t *b, const pcm_case_t *c, uint32_t *data_start)
+{
+    bool wav = !strcmp(c->form, "WAVE");
+    uint32_t data_len = c->frames * c->channels * c->container;
+    b->n = 0;
+    put_str(b, wav ? "RIFF" : "FORM");
+    put_int(b, 0, 4, !wav); // filled in below
+    put_str(b, c->form);
+
+    for (int pass = 0; pass < 3; pass++)
+    {
+        int what = pass == 0 ? 0 : (pass == 1) != c->data_first ? 1 : 2; // junk, format, data
+        if (what == 0 && c->junk_first)
+        {
+            put_str(b, wav ? "LIST" : "ANNO");
+            put_int(b, 5, 4, !wav);
+            put(b, "odd!!\0", 6); // 5 bytes and a pad byte
+        }
+        else if (what == 1 && wav)
+        {
+            bool ext = c->tag == 0xFFFE;
+            put_str(b, "fmt ");
+            put_int(b, ext ? 40 : 16, 4, false);
+            put_int(b, c->tag, 2, false);
+            put_int(b, c->channels, 2, false);
+            put_int(b, c->rate, 4, false);
+            put_int(b, c->rate * c->channels * c->container, 4, false);
+            put_int(b, c->channels * c->container, 2, false);
+            put_int(b, ext ? c->container * 8 : c->bits, 2, false);
+            if (ext)
+            {
+                put_int(b, 22, 2, false);
+                put_int(b, c->bits, 2, false); // valid bits
+                put_int(b, 3, 4, false);       // channel mask
+                put_int(b, 1, 2, false);       // subformat PCM, then the rest of the GUID
+                put(b, (const uint8_t[]){0, 0, 0, 0, 0x10, 0, 0x80, 0, 0, 0xAA, 0, 0x38, 0x9B, 0x71}, 14);
+            }
+        }
+        else if (what == 1)
+        {
+            bool aifc = c->aifc != NULL;
+            put_str(b, "COMM");
+            put_int(b, aifc ? 24 : 18, 4, true);
+            put_int(b, c->channels, 2, true);
+            put_int(b, c->frames, 4, true);
+            put_int(b, c->bits, 2, true);
+            put_ext80(b, c->rate);
+            if (aifc)
+            {
+                put_str(b, c->aifc);
+                put_int(b, 0, 2, true); // empty pascal string, padded
+            }
+        }
+        else if (what == 2 && wav)
+        {
+            put_str(b, "data");
+            put_int(b, data_len, 4, false);
+            *data_start = b->n;
+            put_samples(b, c, false);
+        }
+        else if (what == 2)
+        {
+            put_str(b, "SSND");
+            put_int(b, 8 + c->ssnd_offset + data_len, 4, true);
+            put_int(b, c->ssnd_offset, 4, true);
+            put_int(b, 0, 4, true); // block size
+            for (uint32_t i = 0; i < c->ssnd_offset; i++)
+                put(b, "\xEE", 1);
+            *data_start = b->n;
+            put_samples(b, c, !(c->aifc && !strcmp(c->aifc, "sowt")));
+        }
+    }
+
+    uint32_t form_len = b->n - 8;
+    for (int i = 0; i < 4; i++)
+        b->b[4 + i] = wav ? form_len >> (8 * i) : form_len >> (24 - 8 * i);
+    b->n -= c->cut;
+}
+
+static uint32_t mem_read(void *ctx, uint32_t pos, void *buf, uint32_t len)
+{
+    buf_t *b = ctx;
+    if (pos >= b->n)
+        return 0;
+    if (len > b->n - pos)
+        len = b->n - pos;
+    memcpy(buf, b->b + pos, len);
+    return len;
+}
+
+// Slot of a stereo frame in the ring as the DMA sends it, left justified to 32 bits
+static uint32_t ring_slot(const pcm_format_t *f, const uint8_t *frame, int side)
+{
+    if (f->slot_bits == 16)
+    {
+        const uint8_t *p = frame + 2 * side;
+        uint32_t v = f->bswap ? p[0] << 8 | p[1] : p[1] << 8 | p[0];
+        return v << 16;
+    }
+    const uint8_t *p = frame + 4 * side;
+    return f->bswap ? (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3]
+                    : (uint32_t)p[3] << 24 | p[2] << 16 | p[1] << 8 | p[0];
+}
+
+static void check_frame(const pcm_case_t *c, const pcm_format_t *f, const uint8_t *frame, uint32_t n)
+{
+    for (int side = 0; side < 2; side++)
+    {
+        uint32_t want = slot_value(c, n, c->channels > 1 ? side : 0); // mono on both sides
+        if (f->slot_bits == 16)
+            want &= 0xFFFF0000u;
+        uint32_t got = ring_slot(f, frame, side);
+        if (got != want)
+            fail("%s: frame %lu %s is %08lx, wanted %08lx", c->name, (unsigned long)n, side ? "right" : "left",
+                 (unsigned long)got, (unsigned long)want);
+    }
+}
+
+/* ---------------- pcm_source.c ---------------- */
+
+static void test_parse(const pcm_case_t *c)
+{
+    buf_t file = {0};
+    uint32_t data_start;
+    build(&file, c, &data_start);
+
+    pcm_format_t f;
+    bool ok = pcm_parse(mem_read, &file, file.n, &f);
+    if (ok != c->ok)
+        fail("%s: parse says %s", c->name, ok ? "playable" : "not playable");
+    if (!ok)
+    {
+        free(file.b);
+        return;
+    }
+
+    uint32_t frame_bytes = c->channels * c->container;
+    uint32_t frames = c->frames;
+    if (data_start + frames * frame_bytes > file.n)
+        frames = (file.n - data_start) / frame_bytes;
+    if (f.data_start != data_start || f.data_len != frames * frame_bytes || f.rate != c->rate ||
+        f.channels != c->channels || f.bits != c->bits || f.container != c->container)
+        fail("%s: data at %lu+%lu, %lu Hz, %u ch, %u in %u bits; wanted %lu+%lu, %lu Hz, %u ch, %u in %u",
+             c->name, (unsigned long)f.data_start, (unsigned long)f.data_len, (unsigned long)f.rate, f.channels,
+             f.bits, f.container * 8, (unsigned long)data_start, (unsigned long)(frames * frame_bytes),
+             (unsigned long)c->rate, c->channels, c->bits, c->container * 8);
+    if (f.slot_bits != c->slot_bits || f.direct != c->direct || f.bswap != c->bswap)
+        fail("%s: %u-bit slots direct %d bswap %d, wanted %u-bit direct %d bswap %d", c->name, f.slot_bits,
+             f.direct, f.bswap, c->slot_bits, c->direct, c->bswap);
+
+    // a block's worth read where pcm_stream.c reads it, widened in place
+    static uint8_t block[I2S_OUT_BLOCK_SIZE];
+    uint32_t per_block = I2S_OUT_BLOCK_SIZE / f.out_frame;
+    for (uint32_t at = 0; at < frames; at += per_block)
+    {
+        uint32_t n = frames - at < per_block ? frames - at : per_block;
+        uint8_t *dst = block + pcm_read_offset(&f, n);
+        if (mem_read(&file, f.data_start + at * frame_bytes, dst, n * frame_bytes) != n * frame_bytes)
+            fail("%s: short read", c->name);
+        pcm_expand(&f, block, dst, n);
+        for (uint32_t i = 0; i < n; i++)
+            check_frame(c, &f, block + i * f.out_frame, at + i);
+    }
+
+    uint32_t ms = frames * 1000ull / c->rate / 2;
+    if (pcm_frame_at_ms(&f, ms) != (uint64_t)ms * c->rate / 1000 || pcm_ms_at_frame(&f, pcm_frame_at_ms(&f, ms)) > ms ||
+        pcm_frame_at_ms(&f, 10000000) != frames)
+        fail("%s: %lu ms is frame %lu", c->name, (unsigned long)ms, (unsigned long)pcm_frame_at_ms(&f, ms));
+    free(file.b);
+}
+
+/* ---------------- pcm_stream.c into the ring ---------------- */
+
+// i2s_out.c's side of the ring, without the PIO and DMA behind it
+static pcm_ring_t ring;
+static uint8_t blocks[RING_N][I2S_OUT_BLOCK_SIZE];
+static uint32_t lens[RING_N];
+static uint32_t played;
+
+uint8_t *i2s_out_claim(void)
+{
+    int slot = pcm_ring_claim(&ring, RING_N);
+    return slot < 0 ? NULL : blocks[slot];
+}
+
+void i2s_out_commit(uint32_t len)
+{
+    lens[ring.head % RING_N] = len;
+    pcm_ring_commit(&ring);
+}
+
+void i2s_out_flush(void)
+{
+    pcm_ring_drop(&ring);
+    played = 0;
+}
+
+void i2s_out_finish(void)
+{
+}
+
+bool i2s_out_idle(void)
+{
+    return pcm_ring_empty(&ring);
+}
+
+uint32_t i2s_out_played(void)
+{
+    return played;
+}
+
+// The DMA side: plays one block if one is queued, checking what's in it
+static bool play_block(const pcm_case_t *c, const pcm_format_t *f, uint32_t *frame)
+{
+    int slot = pcm_ring_take(&ring, RING_N);
+    if (slot < 0)
+        return false;
+    if (lens[slot] % f->out_frame || lens[slot] > I2S_OUT_BLOCK_SIZE)
+        fail("%s: block of %lu bytes", c->name, (unsigned long)lens[slot]);
+    for (uint32_t i = 0; i < lens[slot] / f->out_frame; i++)
+        check_frame(c, f, blocks[slot] + i * f->out_frame, (*frame)++);
+    played += lens[slot];
+    pcm_ring_release(&ring);
+    return true;
+}
+
+static void test_stream(const char *dir, const pcm_case_t *c)
+{
+    buf_t file = {0};
+    uint32_t data_start;
+    build(&file, c, &data_start);
+    char path[600];
+    snprintf(path, sizeof(path), "%s/t.pcm", dir);
+    FILE *out = fopen(path, "wb");
+    if (!out || fwrite(file.b, 1, file.n, out) != file.n)
+        fail("can't write %s", path);
+    fclose(out);
+    free(file.b);
+
+    static pcm_stream_t p;
+    pcm_ring_reset(&ring);
+    played = 0;
+    FRESULT fr = pcm_stream_open(&p, "t.pcm");
+    if ((fr == FR_OK) != c->ok)
+        fail("%s: open gave %d", c->name, fr);
+    if (fr != FR_OK)
+        return;
+
+    const pcm_format_t *f = &p.fmt;
+    uint32_t frame = 0, frames = f->data_len / f->frame_bytes, reads = 0, unaligned = 0;
+    bool seeked = false, first = true; // first read since the open or the seek
+    while (!pcm_stream_done(&p))
+    {
+        uint32_t pos = p.pos;
+        pcm_stream_fill(&p);
+        if (p.pos != pos)
+        {
+            reads++;
+            if (!first && pos % SD_SECTOR_SIZE)
+                unaligned++;
+            first = false;
+        }
+        if (rnd(3) == 0)
+            play_block(c, f, &frame);
+
+        // halfway, seek back a second (or to the start) and check it comes out from there
+        if (!seeked && frame >= frames / 2)
+        {
+            uint32_t ms = pcm_ms_at_frame(f, frame);
+            ms = ms > 1000 ? ms - 1000 : 0;
+            pcm_stream_seek(&p, ms);
+            frame = pcm_frame_at_ms(f, ms);
+            if (pcm_stream_elapsed_ms(&p) != pcm_ms_at_frame(f, frame))
+                fail("%s: %lu ms in after the seek to %lu", c->name, (unsigned long)pcm_stream_elapsed_ms(&p),
+                     (unsigned long)ms);
+            seeked = true;
+            first = true;
+        }
+    }
+    pcm_stream_close(&p);
+
+    if (frame != frames)
+        fail("%s: %lu of %lu frames played", c->name, (unsigned long)frame, (unsigned long)frames);
+    if (pcm_stream_elapsed_ms(&p) != pcm_ms_at_frame(f, frames))
+        fail("%s: ends %lu ms in, not %lu", c->name, (unsigned long)pcm_stream_elapsed_ms(&p),
+             (unsigned long)pcm_ms_at_frame(f, frames));
+    // the header leaves 16-bit stereo WAV sector aligned, every read after the first is whole sectors
+    if (!strcmp(c->form, "WAVE") && f->direct && f->slot_bits == 16 && f->data_start % 4 == 0 && unaligned)
+        fail("%s: %lu of %lu reads off a sector boundary", c->name, (unsigned long)unaligned, (unsigned long)reads);
+    printf("%-20s %6lu Hz %u ch %2u in %2u bits -> %u-bit slots%s%s: %lu reads\n", c->name, (unsigned long)f->rate,
+           f->channels, f->bits, f->container * 8, f->slot_bits, f->direct ? ", direct" : "",
+           f->bswap ? ", DMA swaps" : "", (unsigned long)reads);
+}
+
+int main(void)
+{
+    test_ring();
+
+    for (size_t i = 0; i < count_of(cases); i++)
+        test_parse(&cases[i]);
+    printf("parse: %u headers\n", (unsigned)count_of(cases));
+
+    char dir[] = "/tmp/pcm_testXXXXXX";
+    if (!mkdtemp(dir))
+        fail("no temp dir");
+    ff_posix_mount(dir, 0);
+    for (size_t i = 0; i < count_of(cases); i++)
+        test_stream(dir, &cases[i]);
+
+    char path[600];
+    snprintf(path, sizeof(path), "%s/t.pcm", dir);
+    unlink(path);
+    rmdir(dir);
+    printf("pcm: all passed\n");
+    return 0;
+}
@@ -0,0 +1,211 @@
+#include "synth_card.h"
+#include <time.h>
+#include <utime.h>
+
+/* ##########################################################
+RESCAN TEST: A FEW CHANGED DIRECTORIES ON A BIG CARD
+lib/sb_util/library.c on synthetic cards (synth_card.c) of two
+sizes. Each card is scanned and filled, then files in two album
+directories are changed behind its back: some touched (new
+timestamp), some copied in under new names, some deleted. The
+next library_scan() is the boot after that.
+
+Checked: the rescan takes the incremental path and parses only the
+touched and added files, every other track keeps its tags without
+being parsed again, the deleted files are gone from the table and
+the added ones are in it, in path order. The same changes on a card
+ten times the size cost about the same: the same files parsed, and
+the f_read/f_write calls of scan and fill only grow by the table
+copy, one page read and one page write per LIBRARY_PAGE_RECS
+records (ids are positions in path order, so the records after an
+added or removed file all move). The changed directories are the
+only ones listed, and the strings of records in between aren't
+read. Reported: files parsed, card calls and host time, per size.
+
+build: cmake -S scripting/library_indexer -B build && cmake --build build
+run:   ctest --test-dir build, or build/rescan_test
+########################################################## */
+
+#define FAIL synth_fail
+#define TOUCHED 2 // files per changed directory
+#define ADDED 3
+#define REMOVED 1
+
+typedef struct {
+    int tracks, parsed;
+    uint32_t reads, writes;
+    double ms;
+} rescan_t;
+
+static double now_ms(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+static int compare_names(const void *a, const void *b)
+{
+    return strcmp(a, b);
+}
+
+// Entries of the card directory dir ("" for the root) through FatFs, sorted,
+// up to max. files picks the .mp3s, otherwise the directories. Returns how many.
+static int list_dir(const char *dir, bool files, char names[][256], int max)
+{
+    char path[300];
+    DIR d;
+    FILINFO fno;
+    snprintf(path, sizeof(path), "0:/%s", dir);
+    if (f_opendir(&d, path) != FR_OK)
+        FAIL("can't list %s", path);
+    int n = 0;
+    while (n < max && f_readdir(&d, &fno) == FR_OK && fno.fname[0])
+        if (fno.fname[0] != '.' && !(fno.fattrib & AM_DIR) == files)
+            snprintf(names[n++], 256, "%s", fno.fname);
+    f_closedir(&d);
+    qsort(names, n, 256, compare_names);
+    return n;
+}
+
+static void copy_file(const char *from, const char *to)
+{
+    char buf[4096];
+    FILE *in = fopen(from, "rb"), *out = fopen(to, "wb");
+    if (!in || !out)
+        FAIL("can't copy %s to %s", from, to);
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0)
+        fwrite(buf, 1, n, out);
+    fclose(in);
+    fclose(out);
+}
+
+// The first album of the k-th artist directory, relative to the root
+static void album_dir(int k, char *out, size_t n)
+{
+    char artists[4][256], albums[SYNTH_ALBUMS][256];
+    if (list_dir("", false, artists, 4) <= k || list_dir(artists[k], false, albums, SYNTH_ALBUMS) < 1)
+        FAIL("card too small");
+    snprintf(out, n, "%s/%s", artists[k], albums[0]);
+}
+
+// Path order as ids come in: case-insensitive, a directory's files before
+// "dir name with more"
+static int path_cmp(const char *a, const char *b)
+{
+    char x[512], y[512];
+    snprintf(x, sizeof(x), "%s", a);
+    snprintf(y, sizeof(y), "%s", b);
+    for (char *c = x; *c; c++)
+        *c = *c == '/' ? '\x01' : *c;
+    for (char *c = y; *c; c++)
+        *c = *c == '/' ? '\x01' : *c;
+    return synth_fold_cmp(x, y);
+}
+
+// Whether the library has a track at root-relative path
+static bool has_track(const char *path)
+{
+    for (int id = 0; id < count; id++)
+    {
+        track_info_t t;
+        library_get(id, &t);
+        if (!strcmp(t.filename, path))
+            return true;
+    }
+    return false;
+}
+
+static rescan_t run(int artists)
+{
+    int n;
+    char *root = synth_temp_card(artists, &n);
+    if (library_scan() != n)
+        FAIL("scan found %d of %d tracks", count, n);
+    while (library_fill_step(0))
+        ;
+
+    // two album directories apart in path order
+    char dirs[2][600], names[SYNTH_TRACKS][256], path[2000], from[2000];
+    char added[2][ADDED][1000], removed[2][REMOVED][1000];
+    album_dir(0, dirs[0], sizeof(dirs[0]));
+    album_dir(3, dirs[1], sizeof(dirs[1]));
+    struct utimbuf later = {.actime = time(NULL) + 3600, .modtime = time(NULL) + 3600};
+    for (int d = 0; d < 2; d++)
+    {
+        if (list_dir(dirs[d], true, names, SYNTH_TRACKS) != SYNTH_TRACKS)
+            FAIL("%s isn't a synthetic album", dirs[d]);
+        for (int i = 0; i < TOUCHED; i++)
+        {
+            snprintf(path, sizeof(path), "%s/%s/%s", root, dirs[d], names[i]);
+            if (utime(path, &later))
+                FAIL("can't touch %s", path);
+        }
+        for (int i = 0; i < ADDED; i++)
+        {
+            snprintf(added[d][i], sizeof(added[d][i]), "%s/%02d added.mp3", dirs[d], 90 + i);
+            snprintf(from, sizeof(from), "%s/%s/%s", root, dirs[d], names[0]);
+            snprintf(path, sizeof(path), "%s/%s", root, added[d][i]);
+            copy_file(from, path);
+        }
+        for (int i = 0; i < REMOVED; i++)
+        {
+            snprintf(removed[d][i], sizeof(removed[d][i]), "%s/%s", dirs[d], names[SYNTH_TRACKS - 1 - i]);
+            snprintf(path, sizeof(path), "%s/%s", root, removed[d][i]);
+            if (remove(path))
+                FAIL("can't remove %s", path);
+        }
+    }
+    int want = n + 2 * (ADDED - REMOVED), parse = 2 * (TOUCHED + ADDED);
+
+    rescan_t r = {.tracks = n};
+    uint32_t r0 = ff_posix_reads(), w0 = ff_posix_writes();
+    double t0 = now_ms();
+    if (library_scan() != want)
+        FAIL("rescan found %d tracks, wanted %d", count, want);
+    r.parsed = library_pending();
+    while (library_pending())
+        library_fill_step(0);
+    r.ms = now_ms() - t0;
+    r.reads = ff_posix_reads() - r0;
+    r.writes = ff_posix_writes() - w0;
+
+    if (r.parsed != parse)
+        FAIL("%d tracks: the rescan parses %d files, wanted the %d touched or added", n, r.parsed, parse);
+    for (int d = 0; d < 2; d++)
+    {
+        for (int i = 0; i < ADDED; i++)
+            if (!has_track(added[d][i]))
+                FAIL("%s added but not in the library", added[d][i]);
+        for (int i = 0; i < REMOVED; i++)
+            if (has_track(removed[d][i]))
+                FAIL("%s removed but still in the library", removed[d][i]);
+    }
+    track_info_t prev, t;
+    library_get(0, &prev);
+    for (int id = 1; id < count; id++, prev = t)
+    {
+        library_get(id, &t);
+        if (path_cmp(prev.filename, t.filename) > 0)
+            FAIL("tracks %d and %d out of order: %s, %s", id - 1, id, prev.filename, t.filename);
+    }
+
+    printf("%6d tracks: rescan parsed %d files, %lu reads, %lu writes, %.1f ms\n", n, r.parsed,
+           (unsigned long)r.reads, (unsigned long)r.writes, r.ms);
+    synth_remove(root);
+    free(root);
+    return r;
+}
+
+int main(void)
+{
+    rescan_t small = run(25), big = run(250); // 500 and 5000 tracks
+    uint32_t copy = (big.tracks - small.tracks) / LIBRARY_PAGE_RECS + 32;
+    if (big.parsed != small.parsed || big.reads > small.reads + copy || big.writes > small.writes + copy)
+        FAIL("rescanning the same changes on a card %d times the size cost %lu/%lu calls, against %lu/%lu",
+             big.tracks / small.tracks, (unsigned long)big.reads, (unsigned long)big.writes,
+             (unsigned long)small.reads, (unsigned long)small.writes);
+    printf("rescan: all passed\n");
+    return 0;
+}
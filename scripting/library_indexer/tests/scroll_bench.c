@@ -0,0 +1,140 @@
+#include "synth_card.h"
+
+/* ##########################################################
+SCROLL BENCH: THE TRACK TABLE'S PAGE CACHE UNDER THE MENU
+lib/sb_util/library.c on a synthetic card (synth_card.c), driven
+the way main()'s menu loop drives it: every button press moves the
+highlight and calls library_window(), and core1 draws the ten rows
+around it with library_row(). The first run scrolls while the tags
+are still being filled, library_fill_step() between presses as the
+loop does when no button is held; the rest run on a full table:
+down and up by one past the wrap, by ten, and random jumps.
+
+Checked: every row core1 would draw is loaded after the press, with
+its track's title once the tags are in. Reported: page and string
+sector cache hit rates and f_read calls per press, only counting
+what library_window() did. The cache is LIBRARY_PAGES pages of
+LIBRARY_PAGE_RECS records whatever the card holds, so a small card
+(ctest scroll_small) should hit every time once warm and a 10k
+card should miss about once a page crossing.
+
+build: cmake -S scripting/library_indexer -B build && cmake --build build
+run:   ctest --test-dir build, or build/scroll_bench [artists] for the numbers
+########################################################## */
+
+#define FAIL synth_fail
+#define MENU_ROWS 10 // as core1_entry.c draws the list
+
+static int choice;
+
+typedef struct {
+    library_cache_stats_t cache; // library_window()'s share only
+    uint32_t reads;
+    uint32_t presses;
+} scroll_t;
+
+// What the menu shows around the highlight: rows from choice - 5, no wrap
+static void check_rows(bool tags)
+{
+    int start = choice < 6 ? 0 : choice - 5;
+    for (int id = start; id < start + MENU_ROWS && id < count; id++)
+    {
+        const library_row_t *row = library_row(id);
+        if (!row)
+            FAIL("row %d not loaded at %d", id, choice);
+        if (!tags)
+            continue;
+        track_info_t t;
+        library_get(id, &t);
+        if (strncmp(row->title, t.title, sizeof(row->title) - 1))
+            FAIL("row %d says '%s', track says '%s'", id, row->title, t.title);
+    }
+}
+
+static void press(scroll_t *s, int next, bool tags)
+{
+    library_cache_stats_t a, b;
+    library_cache_stats(&a);
+    uint32_t r0 = ff_posix_reads();
+    choice = next;
+    library_window(choice);
+    s->reads += ff_posix_reads() - r0;
+    library_cache_stats(&b);
+    s->cache.page_hits += b.page_hits - a.page_hits;
+    s->cache.page_misses += b.page_misses - a.page_misses;
+    s->cache.line_hits += b.line_hits - a.line_hits;
+    s->cache.line_misses += b.line_misses - a.line_misses;
+    s->presses++;
+    check_rows(tags);
+}
+
+static uint32_t percent(uint32_t hits, uint32_t misses)
+{
+    return hits + misses ? hits * 100 / (hits + misses) : 100;
+}
+
+static void report(const char *name, const scroll_t *s)
+{
+    printf("%-8s %5lu presses: pages %3lu%% hit (%lu misses), strings %3lu%% hit, %.2f reads a press\n", name,
+           (unsigned long)s->presses, (unsigned long)percent(s->cache.page_hits, s->cache.page_misses),
+           (unsigned long)s->cache.page_misses, (unsigned long)percent(s->cache.line_hits, s->cache.line_misses),
+           (double)s->reads / s->presses);
+}
+
+static uint32_t rng = 1;
+static int rnd(int n)
+{
+    rng = rng * 1664525u + 1013904223u;
+    return (rng >> 8) % n;
+}
+
+int main(int argc, char **argv)
+{
+    int artists = argc > 1 ? atoi(argv[1]) : 500;
+    int n;
+    char *root = synth_temp_card(artists, &n);
+    if (library_scan() != n)
+        FAIL("scan found %d of %d tracks", count, n);
+    printf("card: %d tracks, cache %d pages of %d records\n", n, LIBRARY_PAGES, LIBRARY_PAGE_RECS);
+
+    // tags still coming in, filled around the highlight between presses
+    scroll_t cold = {0};
+    library_window(choice);
+    for (int i = 0; i < 300; i++)
+    {
+        press(&cold, (choice + 1) % count, false);
+        library_fill_step(choice);
+    }
+    report("cold", &cold);
+    while (library_fill_step(choice))
+        ;
+
+    scroll_t down = {0}, up = {0}, page = {0}, jump = {0};
+    for (int i = 0; i < 2000; i++)
+        press(&down, (choice + 1) % count, true);
+    for (int i = 0; i < 2000 + count / 2; i++) // past 0 and round to the end
+        press(&up, (choice - 1 + count) % count, true);
+    for (int i = 0; i < 1000; i++)
+        press(&page, i < 500 ? (choice + 10) % count : (choice - 10 + count) % count, true);
+    for (int i = 0; i < 500; i++)
+        press(&jump, rnd(count), true);
+    report("down", &down);
+    report("up", &up);
+    report("page", &page);
+    report("jump", &jump);
+
+    // one new row a press either side, so at most one miss every page's worth of presses
+    uint32_t worst = down.presses / LIBRARY_PAGE_RECS + 2;
+    if (down.cache.page_misses > worst || up.cache.page_misses > up.presses / LIBRARY_PAGE_RECS + 2)
+        FAIL("%lu/%lu page misses scrolling by one, wanted at most about %lu", (unsigned long)down.cache.page_misses,
+             (unsigned long)up.cache.page_misses, (unsigned long)worst);
+    if (count <= LIBRARY_PAGES * LIBRARY_PAGE_RECS &&
+        down.cache.page_misses + up.cache.page_misses + page.cache.page_misses + jump.cache.page_misses)
+        FAIL("%d tracks fit the cache, but it missed", count);
+
+    library_print_stats();
+    synth_remove(root);
+    free(root);
+    printf("scroll: all passed\n");
+    return 0;
+}
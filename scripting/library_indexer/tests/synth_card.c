@@ -0,0 +1,180 @@
+#define _XOPEN_SOURCE 700
+#include "synth_card.h"
+#include <errno.h>
+#include <ftw.h>
+#include <stdarg.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* ##########################################################
+SYNTH CARD: A LIBRARY OF TAGGED MP3S FOR THE BENCHMARKS
+artist/album/NN song.mp3, SYNTH_ALBUMS albums of SYNTH_TRACKS
+tracks per artist. Each file is an ID3v2.3 tag and one silent
+MPEG-1 Layer III frame, so 10k tracks take about 6 MB. The tags
+carry what the browse indices trip over: the same artist in two
+cases ("AC/DC", "ac/dc"), UTF-8 past ASCII, a '/' in a name,
+untagged artists, "Various Artists" album artists, and genres
+as "(17)", "(8)Bebop", bare numbers and two spellings of one.
+Files go in backwards within an album so the listing order and
+the track order disagree. Same seed, same card.
+########################################################## */
+
+static const char *const words[] = {
+    "Alpha", "Bravo",  "Charlie", "Delta",   "Echo",    "Foxtrot", "Golf",   "Hotel",  "India",  "Juliet",  "Kilo",
+    "Lima",  "Mike",   "November", "Oscar",  "Papa",    "Quebec",  "Romeo",  "Sierra", "Tango",  "Uniform", "Victor",
+    "Whiskey", "Xray", "Yankee",  "Zulu",    "ABBA",    "AC/DC",   "ac/dc",  "\xC3\x9Cmlaut", "99 Red", "(Paren)",
+};
+
+static const char *const genres[] = {
+    "Rock", "Jazz", "(17)", "(8)Bebop", "Electronic", "electronic", "Hip-Hop", "Classical", "13", "Metal", "Folk",
+    "Ambient", "",
+};
+
+static uint32_t rng;
+static const char *pick(const char *const *list, size_t n)
+{
+    rng = rng * 1664525u + 1013904223u;
+    return list[(rng >> 8) % n];
+}
+
+void synth_fail(const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    printf("FAIL: ");
+    vprintf(fmt, ap);
+    printf("\n");
+    va_end(ap);
+    exit(1);
+}
+
+// ID3v2.3 text frame, ISO-8859-1 flag (the parser takes the bytes as they are)
+static size_t id3_frame(uint8_t *out, const char *id, const char *text)
+{
+    size_t len = strlen(text) + 1;
+    memcpy(out, id, 4);
+    out[4] = len >> 24;
+    out[5] = len >> 16;
+    out[6] = len >> 8;
+    out[7] = len;
+    out[8] = out[9] = 0;
+    out[10] = 0;
+    memcpy(&out[11], text, len - 1);
+    return 10 + len;
+}
+
+static void write_track(const char *path, const char *title, const char *artist, const char *album_artist,
+                        const char *album, const char *genre, int track_no)
+{
+    uint8_t tag[2048];
+    char trck[16];
+    size_t n = 10;
+    n += id3_frame(&tag[n], "TIT2", title);
+    if (*artist)
+        n += id3_frame(&tag[n], "TPE1", artist);
+    if (*album_artist)
+        n += id3_frame(&tag[n], "TPE2", album_artist);
+    n += id3_frame(&tag[n], "TALB", album);
+    if (*genre)
+        n += id3_frame(&tag[n], "TCON", genre);
+    snprintf(trck, sizeof(trck), "%d/%d", track_no, SYNTH_TRACKS);
+    n += id3_frame(&tag[n], "TRCK", trck);
+
+    uint32_t size = n - 10;
+    const uint8_t hdr[10] = {'I', 'D', '3', 3, 0, 0, (size >> 21) & 0x7F, (size >> 14) & 0x7F, (size >> 7) & 0x7F,
+                             size & 0x7F};
+    memcpy(tag, hdr, sizeof(hdr));
+
+    // 128 kbps 44.1 kHz joint stereo, 417 bytes
+    uint8_t frame[417] = {0xFF, 0xFB, 0x90, 0x64};
+
+    FILE *f = fopen(path, "wb");
+    if (!f || fwrite(tag, 1, n, f) != n || fwrite(frame, 1, sizeof(frame), f) != sizeof(frame))
+        synth_fail("can't write %s", path);
+    fclose(f);
+}
+
+// A tag as a directory name, '/' can't be in one
+static void dir_name(char *out, size_t n, const char *tag)
+{
+    snprintf(out, n, "%s", tag);
+    for (char *c = out; *c; c++)
+        if (*c == '/')
+            *c = '_';
+}
+
+// Writes artists * SYNTH_ALBUMS * SYNTH_TRACKS tracks under root, returns how many
+int synth_card(const char *root, int artists)
+{
+    char dir[1024], path[1200], artist[128], album[128], title[128], name[128], sub[128];
+    int n = 0;
+    rng = 7;
+    for (int a = 0; a < artists; a++)
+    {
+        const char *w1 = pick(words, count_of(words)), *w2 = pick(words, count_of(words));
+        if (a % 3)
+            snprintf(artist, sizeof(artist), "%s %s %d", w1, w2, a);
+        else
+            snprintf(artist, sizeof(artist), "%s %s", w1, w2);
+        if (a % 50 == 0)
+            artist[0] = '\0';
+
+        if (*artist)
+            dir_name(name, sizeof(name), artist);
+        else
+            snprintf(name, sizeof(name), "Unknown %d", a);
+        snprintf(dir, sizeof(dir), "%s/%s", root, name);
+        mkdir(dir, 0777);
+
+        for (int al = 0; al < SYNTH_ALBUMS; al++)
+        {
+            snprintf(album, sizeof(album), "Album %s %d", pick(words, count_of(words)), al);
+            const char *album_artist = a % 40 == 1 ? "Various Artists" : "";
+            const char *genre = pick(genres, count_of(genres));
+            dir_name(sub, sizeof(sub), album);
+            snprintf(dir, sizeof(dir), "%s/%s/%s", root, name, sub);
+            if (mkdir(dir, 0777) && errno != EEXIST)
+                synth_fail("can't make %s", dir);
+            for (int t = SYNTH_TRACKS; t >= 1; t--, n++)
+            {
+                snprintf(title, sizeof(title), "Song %s %d", pick(words, count_of(words)), n);
+                snprintf(path, sizeof(path), "%s/%02d song %d.mp3", dir, SYNTH_TRACKS + 1 - t, n);
+                write_track(path, title, artist, album_artist, album, genre, t);
+            }
+        }
+    }
+    return n;
+}
+
+static int remove_one(const char *path, const struct stat *st, int type, struct FTW *ftw)
+{
+    return remove(path);
+}
+
+void synth_remove(const char *root)
+{
+    nftw(root, remove_one, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+// A fresh card in a temporary directory, mounted for ff_posix.c. Free the name.
+char *synth_temp_card(int artists, int *tracks)
+{
+    char *root = strdup("/tmp/synth_cardXXXXXX");
+    if (!mkdtemp(root))
+        synth_fail("no temp dir");
+    *tracks = synth_card(root, artists);
+    ff_posix_mount(root, 0x5EB0C0DE);
+    return root;
+}
+
+// Index key order: case-insensitive in ASCII, bytes past it as they are
+int synth_fold_cmp(const char *a, const char *b)
+{
+    for (;; a++, b++)
+    {
+        int ca = *a >= 'A' && *a <= 'Z' ? *a + 'a' - 'A' : (uint8_t)*a;
+        int cb = *b >= 'A' && *b <= 'Z' ? *b + 'a' - 'A' : (uint8_t)*b;
+        if (ca != cb || !ca)
+            return ca - cb;
+    }
+}
@@ -0,0 +1,13 @@
+#pragma once
+#include "lib/sb_util/sb_util.h"
+
+// Synthetic card for the library benchmarks, see synth_card.c
+
+#define SYNTH_ALBUMS 4 // per artist
+#define SYNTH_TRACKS 5 // per album
+
+void synth_fail(const char *fmt, ...);
+int synth_card(const char *root, int artists);
+void synth_remove(const char *root);
+char *synth_temp_card(int artists, int *tracks);
+int synth_fold_cmp(const char *a, const char *b);
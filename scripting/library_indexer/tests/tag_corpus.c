@@ -0,0 +1,593 @@
+#include "lib/sb_util/sb_util.h"
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+
+/* ##########################################################
+TAG CORPUS: THE METADATA PARSERS OVER EVERY CONTAINER
+Writes a small corpus to a temporary directory, one file per case
+the parsers in lib/sb_util/metadata.c take a different path for:
+ID3v2.3 in UTF-16 and ISO-8859-1 with an APIC, ID3v2.4 in UTF-8
+with syncsafe frame sizes, ID3v1.1 alone, FLAC behind an ID3 tag
+with a PICTURE block, Ogg Vorbis with the comment header split over
+two pages, MP4 with moov before a large mdat and after it (which
+the VS1053 can't stream), WAV with LIST/INFO, and files that are
+nothing at all. Then runs
+get_metadata() over it through ff_posix.c.
+
+Checked: the container each file is taken for, whether it's
+playable, and every tag, track number, sample rate, audio start
+and album art location against what was written. Reported: parse
+time and card reads per file by container, over PASSES passes;
+files the player skips are parsed once, only to check them.
+
+WAV/AIFF come out unplayable while I2S_OUT_PINS_CONFIRMED is 0,
+their text chunks are only read for playable files.
+
+build: cmake -S scripting/library_indexer -B build && cmake --build build
+run:   ctest --test-dir build, or build/tag_corpus for the numbers
+########################################################## */
+
+#define PASSES 200
+
+typedef struct {
+    uint8_t *b;
+    size_t n, cap;
+} buf_t;
+
+typedef struct {
+    const char *name;
+    uint8_t container;
+    bool ok;
+    const char *title, *artist, *album, *album_artist, *genre;
+    uint16_t track_no;
+    uint16_t samplespeed;
+    uint32_t audio_start;
+    uint32_t art_offset, art_size;
+    buf_t file;
+    double us;                 // parse time, all passes
+    uint32_t reads;
+    uint32_t runs;
+} corpus_t;
+
+static void fail(const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    printf("tags: FAIL: ");
+    vprintf(fmt, ap);
+    printf("\n");
+    va_end(ap);
+    exit(1);
+}
+
+/* ---------------- building files ---------------- */
+
+static void put(buf_t *b, const void *data, size_t n)
+{
+    if (b->n + n > b->cap)
+    {
+        b->cap = (b->n + n) * 2;
+        b->b = realloc(b->b, b->cap);
+    }
+    memcpy(&b->b[b->n], data, n);
+    b->n += n;
+}
+
+static void put_str(buf_t *b, const char *s)
+{
+    put(b, s, strlen(s));
+}
+
+static void put_fill(buf_t *b, uint8_t v, size_t n)
+{
+    while (n--)
+        put(b, &v, 1);
+}
+
+static void put_be(buf_t *b, uint32_t v, int bytes)
+{
+    while (bytes--)
+    {
+        uint8_t c = v >> (bytes * 8);
+        put(b, &c, 1);
+    }
+}
+
+static void put_le(buf_t *b, uint32_t v, int bytes)
+{
+    for (int i = 0; i < bytes; i++, v >>= 8)
+        put(b, &(uint8_t){v}, 1);
+}
+
+static void set_be(buf_t *b, size_t at, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+        b->b[at + i] = v >> (24 - 8 * i);
+}
+
+static void set_syncsafe(buf_t *b, size_t at, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+        b->b[at + i] = (v >> (21 - 7 * i)) & 0x7F;
+}
+
+static void put_art(corpus_t *c, size_t n)
+{
+    c->art_offset = c->file.n;
+    c->art_size = n;
+    put(&c->file, (const uint8_t[]){0xFF, 0xD8, 0xFF, 0xE0}, 4);
+    for (size_t i = 4; i < n; i++)
+        put(&c->file, &(uint8_t){(uint8_t)(i * 7)}, 1);
+}
+
+// Silent MPEG-1 Layer III frames, 128 kbps 44.1 kHz, 417 bytes each
+static void put_mpeg(buf_t *b, int frames)
+{
+    for (int i = 0; i < frames; i++)
+    {
+        put(b, (const uint8_t[]){0xFF, 0xFB, 0x90, 0x64}, 4);
+        put_fill(b, 0, 413);
+    }
+}
+
+// ID3v2 frame header, the size filled in by id3_end()
+static size_t id3_frame(buf_t *b, const char *id, int ver)
+{
+    put_str(b, id);
+    size_t at = b->n;
+    put_be(b, 0, 4);
+    put_be(b, 0, 2);
+    return at | (size_t)ver << 28;
+}
+
+static void id3_end(buf_t *b, size_t frame)
+{
+    size_t at = frame & 0x0FFFFFFF;
+    uint32_t size = b->n - at - 6;
+    if (frame >> 28 == 4)
+        set_syncsafe(b, at, size);
+    else
+        set_be(b, at, size);
+}
+
+static void id3_text(buf_t *b, int ver, const char *id, uint8_t enc, const void *text, size_t n)
+{
+    size_t f = id3_frame(b, id, ver);
+    put(b, &enc, 1);
+    put(b, text, n);
+    id3_end(b, f);
+}
+
+static void mp3_v23(corpus_t *c)
+{
+    buf_t *b = &c->file;
+    put(b, (const uint8_t[]){'I', 'D', '3', 3, 0, 0, 0, 0, 0, 0}, 10);
+    // UTF-16 with a BOM: "Caf" U+00E9
+    id3_text(b, 3, "TIT2", 1, (const uint8_t[]){0xFF, 0xFE, 'C', 0, 'a', 0, 'f', 0, 0xE9, 0}, 10);
+    id3_text(b, 3, "TPE1", 0, "Bj\xF6rk", 5); // ISO-8859-1
+    id3_text(b, 3, "TPE2", 0, "Various Artists", 15);
+    id3_text(b, 3, "TALB", 0, "Post", 4);
+    id3_text(b, 3, "TCON", 0, "(8)", 3);
+    id3_text(b, 3, "TRCK", 0, "7/12", 4);
+    size_t f = id3_frame(b, "APIC", 3);
+    put(b, "\0image/jpeg\0\x03\0", 14);
+    put_art(c, 3000);
+    id3_end(b, f);
+    put_fill(b, 0, 512); // padding
+    set_syncsafe(b, 6, b->n - 10);
+    c->audio_start = b->n;
+    put_mpeg(b, 40);
+}
+
+static void mp3_v24(corpus_t *c)
+{
+    buf_t *b = &c->file;
+    put(b, (const uint8_t[]){'I', 'D', '3', 4, 0, 0, 0, 0, 0, 0}, 10);
+    // a long comment first, the frames after it are only found if its size reads as syncsafe
+    size_t f = id3_frame(b, "COMM", 4);
+    put(b, "\3eng\0", 5);
+    put_fill(b, 'x', 300);
+    id3_end(b, f);
+    id3_text(b, 4, "TIT2", 3, "\xC3\x9C" "ber", 5);
+    id3_text(b, 4, "TPE1", 3, "Kraftwerk", 9);
+    id3_text(b, 4, "TALB", 3, "Computerwelt", 12);
+    id3_text(b, 4, "TCON", 3, "Electronic", 10);
+    id3_text(b, 4, "TRCK", 3, "3", 1);
+    set_syncsafe(b, 6, b->n - 10);
+    c->audio_start = b->n;
+    put_mpeg(b, 40);
+}
+
+static void mp3_v1(corpus_t *c)
+{
+    buf_t *b = &c->file;
+    c->audio_start = 0;
+    put_mpeg(b, 40);
+    uint8_t v1[128] = "TAG";
+    memcpy(&v1[3], "Old Song", 8);
+    memcpy(&v1[33], "Old Artist", 10);
+    memcpy(&v1[63], "Old Album", 9);
+    v1[125] = 0;
+    v1[126] = 5; // ID3v1.1 track
+    v1[127] = 17; // Rock
+    put(b, v1, sizeof(v1));
+}
+
+// METADATA_BLOCK header
+static size_t flac_block(buf_t *b, uint8_t type)
+{
+    put(b, &type, 1);
+    put_be(b, 0, 3);
+    return b->n;
+}
+
+static void flac_end(buf_t *b, size_t at)
+{
+    uint32_t len = b->n - at;
+    b->b[at - 3] = len >> 16;
+    b->b[at - 2] = len >> 8;
+    b->b[at - 1] = len;
+}
+
+static void vorbis_comments(buf_t *b, const char *const *tags, int n)
+{
+    put_le(b, 11, 4);
+    put_str(b, "test vendor");
+    put_le(b, n, 4);
+    for (int i = 0; i < n; i++)
+    {
+        put_le(b, strlen(tags[i]), 4);
+        put_str(b, tags[i]);
+    }
+}
+
+static void flac(corpus_t *c)
+{
+    buf_t *b = &c->file;
+    put(b, (const uint8_t[]){'I', 'D', '3', 4, 0, 0, 0, 0, 1, 0}, 10); // 128 bytes of nothing
+    put_fill(b, 0, 128);
+    put_str(b, "fLaC");
+
+    size_t at = flac_block(b, 0); // STREAMINFO, 44.1 kHz stereo 16 bit, 10 s
+    put_be(b, 4096, 2);
+    put_be(b, 4096, 2);
+    put_fill(b, 0, 6);
+    uint64_t x = (uint64_t)44100 << 44 | (uint64_t)1 << 41 | (uint64_t)15 << 36 | 441000;
+    put_be(b, x >> 32, 4);
+    put_be(b, (uint32_t)x, 4);
+    put_fill(b, 0, 16);
+    flac_end(b, at);
+
+    static const char *const tags[] = {"TITLE=Flac Song", "ARTIST=Flac Artist", "ALBUMARTIST=Flac AA",
+                                       "GENRE=Jazz",      "TRACKNUMBER=7/12",   "album=Flac Album"};
+    at = flac_block(b, 4);
+    vorbis_comments(b, tags, count_of(tags));
+    flac_end(b, at);
+
+    at = flac_block(b, 6);
+    put_be(b, 3, 4);
+    put_be(b, 10, 4);
+    put_str(b, "image/jpeg");
+    put_be(b, 4, 4);
+    put_str(b, "desc");
+    put_fill(b, 0, 16);
+    put_be(b, 5000, 4);
+    put_art(c, 5000);
+    flac_end(b, at);
+
+    at = flac_block(b, 0x80 | 1); // last: PADDING
+    put_fill(b, 0, 100);
+    flac_end(b, at);
+
+    c->audio_start = b->n;
+    put(b, (const uint8_t[]){0xFF, 0xF8}, 2);
+    put_fill(b, 0x11, 100000);
+}
+
+// Ogg page carrying segs (lacing values given), granule position gp
+static void ogg_page(buf_t *b, uint32_t seq, bool cont, uint64_t gp, const uint8_t *lacing, int nseg,
+                     const void *body, size_t n)
+{
+    put_str(b, "OggS");
+    put(b, (const uint8_t[]){0, cont ? 1 : 0}, 2);
+    put_le(b, (uint32_t)gp, 4);
+    put_le(b, gp >> 32, 4);
+    put_le(b, 1, 4);
+    put_le(b, seq, 4);
+    put_le(b, 0, 4); // CRC, not checked
+    put(b, &(uint8_t){nseg}, 1);
+    put(b, lacing, nseg);
+    put(b, body, n);
+}
+
+static int lace(size_t n, uint8_t *out)
+{
+    int k = 0;
+    for (; n >= 255; n -= 255)
+        out[k++] = 255;
+    out[k++] = n;
+    return k;
+}
+
+static void ogg(corpus_t *c)
+{
+    buf_t *b = &c->file, id = {0}, comm = {0};
+    uint8_t lacing[255];
+
+    put(&id, "\1vorbis", 7);
+    put_le(&id, 0, 4);
+    put(&id, &(uint8_t){2}, 1);
+    put_le(&id, 48000, 4);
+    put_le(&id, 0, 4);
+    put_le(&id, 160000, 4);
+    put_le(&id, 0, 4);
+    put(&id, (const uint8_t[]){0xB8, 1}, 2);
+    ogg_page(b, 0, false, 0, lacing, lace(id.n, lacing), id.b, id.n);
+
+    // the comment packet runs over into a second page
+    static const char *const tags[] = {"TITLE=Ogg Song", "ARTIST=Ogg Artist", "COMMENT=", "ALBUM=Ogg Album",
+                                       "TRACKNUMBER=2"};
+    char comment[3009] = "COMMENT=";
+    memset(&comment[8], 'x', 3000);
+    const char *t[count_of(tags)];
+    memcpy(t, tags, sizeof(t));
+    t[2] = comment;
+    put(&comm, "\3vorbis", 7);
+    vorbis_comments(&comm, t, count_of(t));
+    put(&comm, "\1", 1);
+    memset(lacing, 255, 4);
+    ogg_page(b, 1, false, 0, lacing, 4, comm.b, 4 * 255);
+    ogg_page(b, 2, true, 0, lacing, lace(comm.n - 4 * 255, lacing), &comm.b[4 * 255], comm.n - 4 * 255);
+
+    put_fill(b, 0x55, 300000); // the codec wants the headers too, audio_start stays 0
+    uint8_t last[100] = {0};
+    ogg_page(b, 3, false, 48000 * 20, lacing, lace(sizeof(last), lacing), last, sizeof(last));
+    free(id.b);
+    free(comm.b);
+}
+
+static size_t atom(buf_t *b, const char *type)
+{
+    size_t at = b->n;
+    put_be(b, 0, 4);
+    put(b, type, 4);
+    return at;
+}
+
+static void atom_end(buf_t *b, size_t at)
+{
+    set_be(b, at, b->n - at);
+}
+
+static void ilst_item(corpus_t *c, const char *type, uint32_t kind, const void *data, size_t n)
+{
+    buf_t *b = &c->file;
+    size_t item = atom(b, type), d = atom(b, "data");
+    put_be(b, kind, 4);
+    put_be(b, 0, 4);
+    if (data)
+        put(b, data, n);
+    else
+        put_art(c, n);
+    atom_end(b, d);
+    atom_end(b, item);
+}
+
+static void mp4_moov(corpus_t *c)
+{
+    buf_t *b = &c->file;
+    size_t moov = atom(b, "moov");
+    size_t a = atom(b, "mvhd");
+    put_fill(b, 0, 12);
+    put_be(b, 1000, 4);
+    put_be(b, 30000, 4);
+    put_fill(b, 0, 80);
+    atom_end(b, a);
+
+    size_t trak = atom(b, "trak"), mdia = atom(b, "mdia"), minf = atom(b, "minf"), stbl = atom(b, "stbl");
+    size_t stsd = atom(b, "stsd");
+    put_be(b, 0, 4);
+    put_be(b, 1, 4);
+    size_t mp4a = atom(b, "mp4a");
+    put_fill(b, 0, 6);
+    put_be(b, 1, 2);
+    put_fill(b, 0, 8);
+    put_be(b, 2, 2);
+    put_be(b, 16, 2);
+    put_fill(b, 0, 4);
+    put_be(b, 44100 << 16, 4);
+    size_t esds = atom(b, "esds");
+    put_fill(b, 0, 20);
+    atom_end(b, esds);
+    atom_end(b, mp4a);
+    atom_end(b, stsd);
+    atom_end(b, stbl);
+    atom_end(b, minf);
+    atom_end(b, mdia);
+    atom_end(b, trak);
+
+    size_t udta = atom(b, "udta"), meta = atom(b, "meta");
+    put_be(b, 0, 4);
+    a = atom(b, "hdlr");
+    put_fill(b, 0, 25);
+    atom_end(b, a);
+    size_t ilst = atom(b, "ilst");
+    ilst_item(c, "\xA9nam", 1, "M4A Song", 8);
+    ilst_item(c, "\xA9" "ART", 1, "M4A Artist", 10);
+    ilst_item(c, "\xA9" "alb", 1, "M4A Album", 9);
+    ilst_item(c, "aART", 1, "M4A AA", 6);
+    ilst_item(c, "gnre", 0, "\0\x12", 2); // ID3v1 genre 17 + 1: Rock
+    ilst_item(c, "trkn", 0, "\0\0\0\x09\0\x0c\0\0", 8);
+    ilst_item(c, "covr", 13, NULL, 20000);
+    atom_end(b, ilst);
+    atom_end(b, meta);
+    atom_end(b, udta);
+    atom_end(b, moov);
+}
+
+static void mp4(corpus_t *c, bool moov_first)
+{
+    buf_t *b = &c->file;
+    size_t a = atom(b, "ftyp");
+    put(b, "M4A \0\0\0\0", 8);
+    atom_end(b, a);
+    if (moov_first)
+        mp4_moov(c);
+    a = atom(b, "mdat"); // the decoder walks the atoms itself, audio_start stays 0
+    put_fill(b, 0x22, 1000000);
+    atom_end(b, a);
+    if (!moov_first)
+        mp4_moov(c);
+}
+
+static void m4a_front(corpus_t *c)
+{
+    mp4(c, true);
+}
+
+static void m4a_back(corpus_t *c)
+{
+    mp4(c, false);
+}
+
+static void wav(corpus_t *c)
+{
+    buf_t *b = &c->file;
+    put_str(b, "RIFF");
+    put_le(b, 0, 4);
+    put_str(b, "WAVEfmt ");
+    put_le(b, 16, 4);
+    put_le(b, 1, 2);
+    put_le(b, 2, 2);
+    put_le(b, 44100, 4);
+    put_le(b, 44100 * 4, 4);
+    put_le(b, 4, 2);
+    put_le(b, 16, 2);
+    put_str(b, "data");
+    put_le(b, 40000, 4);
+    put_fill(b, 0, 40000);
+    put_str(b, "LIST");
+    put_le(b, 4 + 8 + 10 + 8 + 4, 4);
+    put_str(b, "INFOINAM");
+    put_le(b, 9, 4);
+    put(b, "Wav Song\0\0", 10);
+    put_str(b, "IART");
+    put_le(b, 4, 4);
+    put(b, "Art\0", 4);
+    uint32_t size = b->n - 8;
+    memcpy(&b->b[4], &size, 4);
+}
+
+static void junk(corpus_t *c)
+{
+    put_fill(&c->file, 0, 100);
+}
+
+static corpus_t corpus[] = {
+    {"v23.mp3", CONTAINER_MP3, true, "Caf\xC3\xA9", "Bj\xC3\xB6rk", "Post", "Various Artists", "Jazz", 7, 44100},
+    {"v24.mp3", CONTAINER_MP3, true, "\xC3\x9C" "ber", "Kraftwerk", "Computerwelt", "", "Electronic", 3, 44100},
+    {"v1.mp3", CONTAINER_MP3, true, "Old Song", "Old Artist", "Old Album", "", "Rock", 5, 44100},
+    {"a.flac", CONTAINER_FLAC, true, "Flac Song", "Flac Artist", "Flac Album", "Flac AA", "Jazz", 7, 44100},
+    {"a.ogg", CONTAINER_OGG, true, "Ogg Song", "Ogg Artist", "Ogg Album", "", "", 2, 48000},
+    {"front.m4a", CONTAINER_MP4, true, "M4A Song", "M4A Artist", "M4A Album", "M4A AA", "Rock", 9, 44100},
+    {"back.m4a", CONTAINER_MP4, false},
+    {"a.wav", CONTAINER_WAV, false},
+    {"junk.mp3", CONTAINER_MP3, true},
+    {"junk.bin", CONTAINER_UNKNOWN, false},
+};
+
+static void (*const builders[])(corpus_t *) = {mp3_v23, mp3_v24, mp3_v1, flac, ogg, m4a_front, m4a_back, wav, junk,
+                                                junk};
+
+/* ---------------- checking ---------------- */
+
+static void check_str(const corpus_t *c, const char *what, const char *got, const char *want)
+{
+    if (want && strcmp(got, want))
+        fail("%s: %s '%s', wanted '%s'", c->name, what, got, want);
+}
+
+static void check(corpus_t *c, bool ok, const track_info_t *t)
+{
+    if (t->container != c->container || ok != c->ok)
+        fail("%s: container %d %s, wanted %d %s", c->name, t->container, ok ? "playable" : "unplayable",
+             c->container, c->ok ? "playable" : "unplayable");
+    if (!ok)
+        return;
+    check_str(c, "title", t->title, c->title);
+    check_str(c, "artist", t->artist, c->artist);
+    check_str(c, "album", t->album, c->album);
+    check_str(c, "album artist", t->album_artist, c->album_artist);
+    check_str(c, "genre", t->genre, c->genre);
+    if (c->title && (t->track_no != c->track_no || t->samplespeed != c->samplespeed))
+        fail("%s: track %u at %u Hz, wanted %u at %u Hz", c->name, t->track_no, t->samplespeed, c->track_no,
+             c->samplespeed);
+    if (c->title && t->audio_start != c->audio_start)
+        fail("%s: audio at %lu, wanted %lu", c->name, (unsigned long)t->audio_start, (unsigned long)c->audio_start);
+    if (t->album_art_offset != c->art_offset || t->album_art_size != c->art_size)
+        fail("%s: art %lu+%lu, wanted %lu+%lu", c->name, (unsigned long)t->album_art_offset,
+             (unsigned long)t->album_art_size, (unsigned long)c->art_offset, (unsigned long)c->art_size);
+    if (c->art_size && strcmp(t->mime_type, "image/jpeg"))
+        fail("%s: art type '%s'", c->name, t->mime_type);
+}
+
+int main(void)
+{
+    char dir[] = "/tmp/tag_corpusXXXXXX", path[512];
+    if (!mkdtemp(dir))
+        fail("no temp dir");
+    size_t bytes = 0;
+    for (size_t i = 0; i < count_of(corpus); i++)
+    {
+        builders[i](&corpus[i]);
+        snprintf(path, sizeof(path), "%s/%s", dir, corpus[i].name);
+        FILE *f = fopen(path, "wb");
+        if (!f || fwrite(corpus[i].file.b, 1, corpus[i].file.n, f) != corpus[i].file.n)
+            fail("can't write %s", path);
+        fclose(f);
+        bytes += corpus[i].file.n;
+    }
+    ff_posix_mount(dir, 0);
+
+    struct timespec t0, t1;
+    for (int pass = 0; pass < PASSES; pass++)
+    {
+        for (size_t i = 0; i < count_of(corpus); i++)
+        {
+            corpus_t *c = &corpus[i];
+            if (pass && !c->ok)
+                continue;
+            track_info_t t;
+            memset(&t, 0, sizeof(t));
+            uint32_t r0 = ff_posix_reads();
+            clock_gettime(CLOCK_MONOTONIC, &t0);
+            bool ok = get_metadata(c->name, &t);
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            c->us += (t1.tv_sec - t0.tv_sec) * 1e6 + (t1.tv_nsec - t0.tv_nsec) / 1e3;
+            c->reads += ff_posix_reads() - r0;
+            c->runs++;
+            if (pass == 0)
+                check(c, ok, &t);
+        }
+    }
+
+    double total = 0;
+    uint32_t files = 0;
+    for (size_t i = 0; i < count_of(corpus); i++)
+    {
+        corpus_t *c = &corpus[i];
+        printf("%-10s %8lu bytes: %6.1f us, %4.1f reads a file\n", c->name, (unsigned long)c->file.n, c->us / c->runs,
+               (double)c->reads / c->runs);
+        total += c->us;
+        files += c->runs;
+        snprintf(path, sizeof(path), "%s/%s", dir, c->name);
+        unlink(path);
+        free(c->file.b);
+    }
+    rmdir(dir);
+    printf("%zu files (%zu KB), %lu parses: %.0f files/s\n", count_of(corpus), bytes / 1024, (unsigned long)files,
+           files / (total / 1e6));
+    printf("tags: all passed\n");
+    return 0;
+}
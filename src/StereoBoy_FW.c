@@ -44,7 +44,7 @@ struct st7789_t display = {
 #define LCD_WIDTH  240
 #define LCD_HEIGHT 240
 
-track_info_t tracks[MAX_TRACKS];
+static track_info_t now_playing; // library_get() copy of the selected track
 int song_choice = 0;
 int count;
 float x_brightness = 0.5;
@@ -84,10 +84,11 @@ int main()
 
     dprint("Starting Track Scan");
     // pause_core1();
-    sb_scan_tracks(tracks, MAX_TRACKS); //Implicitly sets count now
+    sb_scan_tracks(); //Implicitly sets count now
     // resume_core1();
     int exitCode = 0;
     int prev_choice = 0;
+    int skipped = 0; // unplayable tracks passed over in a row
     bool selected = 0;
     // --- Print menu ---
     dprint("Debug print test %d", 1); //Trigger Core 2 Print
@@ -105,6 +106,8 @@ int main()
             clear_framebuffer();
             printf("\r\nSong %d/%d: ", song_choice+1, count);
             prev_choice = song_choice;
+            library_window(song_choice);
+            idle_set(true); // core1 only redraws the list on a change or a marquee step
             while (selected == false) {
                 uint8_t maped_btn = buttons_map_menu_navigation();
                 uint8_t btn = get_button_repeat(maped_btn);
@@ -117,12 +120,36 @@ int main()
                 if (prev_choice != song_choice){
                     printf("\r\nSong %d/%d: ", song_choice+1, count);
                     prev_choice = song_choice;
+                    library_window(song_choice); // the rows core1 is about to draw
+                    idle_poke(); // redraw now, not at the next marquee step
                 }
                 
-                sleep_ms(10);
+                if ((uint8_t)~buttons_get_raw_state())
+                    sleep_ms(10); // held: keep polling for auto-repeat
+                else if (library_fill_step(song_choice)) {
+                    idle_poke(); // tags for the rows on screen first, then the browse indices
+                }
+                else
+                    idle_wait_input(IDLE_FRAME_MS);
+            }
+            idle_set(false);
+            library_print_stats();
+        }
+        bool playable = library_resolve(song_choice);
+        library_get(song_choice, &now_playing);
+        if (!playable) {
+            printf("\r\nCan't play %s\r\n", now_playing.filename);
+            // picked from the menu: stay there. Next/prev: keep going, but not round and round
+            if (exitCode != 0 && ++skipped < count)
+                song_choice = (exitCode == 2) ? (song_choice - 1 + count) % count : (song_choice + 1) % count;
+            else {
+                exitCode = 0;
+                skipped = 0;
             }
+            continue;
         }
-        track_info_t *track = &tracks[song_choice];
+        skipped = 0;
+        track_info_t *track = &now_playing;
 
         printf("\r\n\rNOW PLAYING:\r\n");
         printf("  Title : %s\r\n", track->title);
@@ -138,19 +165,14 @@ int main()
         set_visualizer(1);
         exitCode = jukebox(&player, track, &display);
 
-        if (exitCode == 1){
-            if (song_choice + 1 > count)
-                song_choice = 1;
-            else
-                song_choice += 1;
+        // 3 = jukebox already spliced the next track into the codec feed
+        if (exitCode == 1 || exitCode == 3){
+            song_choice = (song_choice + 1) % count; // same order the gapless prefetch uses
             printf("\r\n Next song!\r\n");
             dprint("Next song!");
         }
         if (exitCode == 2){
-            if (song_choice - 1 < 1)
-                song_choice = count;
-            else
-                song_choice -= 1;
+            song_choice = (song_choice - 1 + count) % count;
             dprint("Prev Song!");
             printf("\r\nPrev Song!\r\n");
         }